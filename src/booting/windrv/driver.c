@@ -146,6 +146,28 @@ NTSTATUS NoirDispatchIoControl(IN PDEVICE_OBJECT DeviceObject,IN PIRP Irp)
 			*(PBOOLEAN)OutputBuffer=NoirIsVirtualizationEnabled();
 			break;
 		}
+		case IOCTL_QueryExitHist:
+		{
+			ULONG ProcessorNumber=*(PULONG)InputBuffer;
+			PVOID Buffer=(PVOID)((ULONG_PTR)OutputBuffer+8);
+			*(PULONG32)OutputBuffer=NoirQueryExitHistogram(ProcessorNumber,Buffer,OutputSize-8);
+			st=STATUS_SUCCESS;
+			break;
+		}
+		case IOCTL_ResetExitHist:
+		{
+			*(PULONG32)OutputBuffer=NoirResetExitHistograms();
+			st=STATUS_SUCCESS;
+			break;
+		}
+		case IOCTL_QueryExitTrace:
+		{
+			ULONG ProcessorNumber=*(PULONG)InputBuffer;
+			PVOID Buffer=(PVOID)((ULONG_PTR)OutputBuffer+8);
+			*(PULONG32)OutputBuffer=NoirQueryExitTrace(ProcessorNumber,Buffer,OutputSize-8);
+			st=STATUS_SUCCESS;
+			break;
+		}
 		case IOCTL_CvmCreateVm:
 		{
 			PCVM_HANDLE VmHandle=(PCVM_HANDLE)((ULONG_PTR)OutputBuffer+sizeof(CVM_HANDLE));
@@ -168,6 +190,36 @@ NTSTATUS NoirDispatchIoControl(IN PDEVICE_OBJECT DeviceObject,IN PIRP Irp)
 			st=STATUS_SUCCESS;
 			break;
 		}
+		case IOCTL_CvmQueryVmStats:
+		{
+			CVM_HANDLE VmHandle=*(PCVM_HANDLE)InputBuffer;
+			PVOID Buffer=(PVOID)((ULONG_PTR)OutputBuffer+8);
+			*(PULONG32)OutputBuffer=NoirQueryVirtualMachineStatistics(VmHandle,Buffer,OutputSize-8);
+			st=STATUS_SUCCESS;
+			break;
+		}
+		case IOCTL_CvmRunScheduler:
+		{
+			st=STATUS_SUCCESS;
+			if(OutputSize<noir_cvm_exit_context_size)
+			{
+				if(OutputSize<sizeof(ULONG64))
+					st=STATUS_INSUFFICIENT_RESOURCES;
+				else
+				{
+					*(PULONG32)OutputBuffer=NOIR_INSUFFICIENT_RESOURCES;
+					*(PULONG32)((ULONG_PTR)OutputBuffer+4)=noir_cvm_exit_context_size;
+				}
+			}
+			else
+			{
+				CVM_HANDLE VmHandle=*(PCVM_HANDLE)InputBuffer;
+				PULONG32 VpIndex=(PULONG32)((ULONG_PTR)OutputBuffer+4);
+				PVOID ExitContext=(PVOID)((ULONG_PTR)OutputBuffer+sizeof(ULONG64));
+				*(PULONG32)OutputBuffer=NoirRunVirtualMachineScheduler(VmHandle,VpIndex,ExitContext);
+			}
+			break;
+		}
 		case IOCTL_CvmQueryHvStatus:
 		{
 			break;
@@ -253,6 +305,54 @@ NTSTATUS NoirDispatchIoControl(IN PDEVICE_OBJECT DeviceObject,IN PIRP Irp)
 			st=STATUS_SUCCESS;
 			break;
 		}
+		case IOCTL_CvmQueryVcpuStats:
+		{
+			CVM_HANDLE VmHandle=*(PCVM_HANDLE)InputBuffer;
+			ULONG32 VpIndex=*(PULONG32)((ULONG_PTR)InputBuffer+sizeof(CVM_HANDLE));
+			PVOID Buffer=(PVOID)((ULONG_PTR)OutputBuffer+8);
+			*(PULONG32)OutputBuffer=NoirQueryVirtualProcessorStatistics(VmHandle,VpIndex,Buffer,OutputSize-8);
+			st=STATUS_SUCCESS;
+			break;
+		}
+		case IOCTL_CvmFetchExitContext:
+		{
+			st=STATUS_SUCCESS;
+			if(OutputSize<noir_cvm_exit_context_size)
+			{
+				if(OutputSize<sizeof(ULONG64))
+					st=STATUS_INSUFFICIENT_RESOURCES;
+				else
+				{
+					*(PULONG32)OutputBuffer=NOIR_INSUFFICIENT_RESOURCES;
+					*(PULONG32)((ULONG_PTR)OutputBuffer+4)=noir_cvm_exit_context_size;
+				}
+			}
+			else
+			{
+				CVM_HANDLE VmHandle=*(PCVM_HANDLE)InputBuffer;
+				ULONG32 VpIndex=*(PULONG32)((ULONG_PTR)InputBuffer+sizeof(CVM_HANDLE));
+				PVOID ExitContext=(PVOID)((ULONG_PTR)OutputBuffer+sizeof(ULONG64));
+				*(PULONG32)OutputBuffer=NoirFetchVirtualProcessorExitContext(VmHandle,VpIndex,ExitContext);
+			}
+			break;
+		}
+		case IOCTL_CvmScheduleVcpu:
+		{
+			CVM_HANDLE VmHandle=*(PCVM_HANDLE)InputBuffer;
+			ULONG32 VpIndex=*(PULONG32)((ULONG_PTR)InputBuffer+sizeof(CVM_HANDLE));
+			*(PULONG32)OutputBuffer=NoirScheduleVirtualProcessor(VmHandle,VpIndex);
+			st=STATUS_SUCCESS;
+			break;
+		}
+		case IOCTL_CvmQueueEvent:
+		{
+			CVM_HANDLE VmHandle=*(PCVM_HANDLE)InputBuffer;
+			ULONG32 VpIndex=*(PULONG32)((ULONG_PTR)InputBuffer+sizeof(CVM_HANDLE));
+			ULONG64 InjectedEvent=*(PULONG64)((ULONG_PTR)InputBuffer+16);
+			*(PULONG32)OutputBuffer=NoirQueueEventInjection(VmHandle,VpIndex,InjectedEvent);
+			st=STATUS_SUCCESS;
+			break;
+		}
 		default:
 		{
 			break;
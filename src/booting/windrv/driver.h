@@ -30,6 +30,8 @@
 #define NOIR_BUFFER_TOO_SMALL			0xC0000007
 #define NOIR_VCPU_NOT_EXIST				0xC0000008
 #define NOIR_USER_PAGE_VIOLATION		0xC0000009
+#define NOIR_VCPU_ALREADY_SCHEDULED		0xC000000A
+#define NOIR_NO_READY_VCPU				0xC000000B
 
 typedef ULONG32 NOIR_STATUS;
 
@@ -48,11 +50,16 @@ typedef ULONG32 NOIR_STATUS;
 #define IOCTL_OsVer			CTL_CODE_GEN(0x813)
 #define IOCTL_VirtCap		CTL_CODE_GEN(0x814)
 #define IOCTL_VirtEn		CTL_CODE_GEN(0x815)
+#define IOCTL_QueryExitHist	CTL_CODE_GEN(0x816)
+#define IOCTL_ResetExitHist	CTL_CODE_GEN(0x817)
+#define IOCTL_QueryExitTrace	CTL_CODE_GEN(0x818)
 
 // Following definitions are intended for CVM use.
 #define IOCTL_CvmCreateVm		CTL_CODE_GEN(0x880)
 #define IOCTL_CvmDeleteVm		CTL_CODE_GEN(0x881)
 #define IOCTL_CvmSetMapping		CTL_CODE_GEN(0x882)
+#define IOCTL_CvmQueryVmStats	CTL_CODE_GEN(0x883)
+#define IOCTL_CvmRunScheduler	CTL_CODE_GEN(0x884)
 #define IOCTL_CvmQueryHvStatus	CTL_CODE_GEN(0x88F)
 #define IOCTL_CvmCreateVcpu		CTL_CODE_GEN(0x890)
 #define IOCTL_CvmDeleteVcpu		CTL_CODE_GEN(0x891)
@@ -62,6 +69,10 @@ typedef ULONG32 NOIR_STATUS;
 #define IOCTL_CvmRescindVcpu	CTL_CODE_GEN(0x895)
 #define IOCTL_CvmInjectEvent	CTL_CODE_GEN(0x896)
 #define IOCTL_CvmSetVcpuOptions	CTL_CODE_GEN(0x897)
+#define IOCTL_CvmQueryVcpuStats	CTL_CODE_GEN(0x898)
+#define IOCTL_CvmFetchExitContext	CTL_CODE_GEN(0x899)
+#define IOCTL_CvmScheduleVcpu	CTL_CODE_GEN(0x89A)
+#define IOCTL_CvmQueueEvent		CTL_CODE_GEN(0x89B)
 
 // Layered Hypervisor Functions
 typedef ULONG64 CVM_HANDLE;
@@ -125,9 +136,15 @@ NOIR_STATUS NoirSetMapping(IN CVM_HANDLE VirtualMachine,IN PNOIR_ADDRESS_MAPPING
 NOIR_STATUS NoirViewVirtualProcessorRegisters(IN CVM_HANDLE VirtualMachine,IN ULONG32 VpIndex,IN NOIR_CVM_REGISTER_TYPE RegisterType,OUT PVOID Buffer,IN ULONG32 BufferSize);
 NOIR_STATUS NoirEditVirtualProcessorRegisters(IN CVM_HANDLE VirtualMachine,IN ULONG32 VpIndex,IN NOIR_CVM_REGISTER_TYPE RegisterType,IN PVOID Buffer,IN ULONG32 BufferSize);
 NOIR_STATUS NoirSetEventInjection(IN CVM_HANDLE VirtualMachine,IN ULONG32 VpIndex,IN ULONG64 InjectedEvent);
+NOIR_STATUS NoirQueueEventInjection(IN CVM_HANDLE VirtualMachine,IN ULONG32 VpIndex,IN ULONG64 InjectedEvent);
 NOIR_STATUS NoirSetVirtualProcessorOptions(IN CVM_HANDLE VirtualMachine,IN ULONG32 VpIndex,IN ULONG32 OptionType,IN ULONG32 Options);
 NOIR_STATUS NoirRunVirtualProcessor(IN CVM_HANDLE VirtualMachine,IN ULONG32 VpIndex,OUT PVOID ExitContext);
 NOIR_STATUS NoirRescindVirtualProcessor(IN CVM_HANDLE VirtualMachine,IN ULONG32 VpIndex);
+NOIR_STATUS NoirFetchVirtualProcessorExitContext(IN CVM_HANDLE VirtualMachine,IN ULONG32 VpIndex,OUT PVOID ExitContext);
+NOIR_STATUS NoirQueryVirtualProcessorStatistics(IN CVM_HANDLE VirtualMachine,IN ULONG32 VpIndex,OUT PVOID Buffer,IN ULONG32 BufferSize);
+NOIR_STATUS NoirQueryVirtualMachineStatistics(IN CVM_HANDLE VirtualMachine,OUT PVOID Buffer,IN ULONG32 BufferSize);
+NOIR_STATUS NoirScheduleVirtualProcessor(IN CVM_HANDLE VirtualMachine,IN ULONG32 VpIndex);
+NOIR_STATUS NoirRunVirtualMachineScheduler(IN CVM_HANDLE VirtualMachine,OUT PULONG32 VpIndex,OUT PVOID ExitContext);
 
 void NoirInitializeDisassembler();
 NTSTATUS NoirReportWindowsVersion();
@@ -145,6 +162,9 @@ void NoirTeardownHypervisor();
 ULONG NoirVisorVersion();
 ULONG NoirQueryVirtualizationSupportability();
 BOOLEAN NoirIsVirtualizationEnabled();
+ULONG NoirQueryExitHistogram(IN ULONG ProcessorNumber,OUT PVOID Buffer,IN ULONG BufferSize);
+ULONG NoirResetExitHistograms();
+ULONG NoirQueryExitTrace(IN ULONG ProcessorNumber,OUT PVOID Buffer,IN ULONG BufferSize);
 void NoirLocatePsLoadedModule(IN PDRIVER_OBJECT DriverObject);
 BOOLEAN NoirInitializeCodeIntegrity(IN PVOID ImageBase);
 void NoirFinalizeCodeIntegrity();
@@ -50,9 +50,165 @@ ZyanU8 NoirDisasmCode64(char* Mnemonic,ZyanUSize MnemonicLength,ZyanU8* Code,Zya
 	return ZyIns.length;
 }
 
+// Table-driven Instruction Length Decoder
+// Zero is returned if the encoding is rare or invalid. The caller should consult Zydis in this case.
+ZyanU8 static NoirGetInstructionLengthFast(ZyanU8* Code,ZyanUSize CodeLength,ZyanU8 Bits)
+{
+	const ZyanUSize Limit=CodeLength==0 || CodeLength>15?15:CodeLength;
+	ZyanBool OpSizePrefix=ZYAN_FALSE,AddrSizePrefix=ZYAN_FALSE,RepPrefix=ZYAN_FALSE,RexW=ZYAN_FALSE,Vex=ZYAN_FALSE;
+	ZyanU8 Opcode,Flags=0,Map=0,OperandSize,AddressSize;
+	ZyanUSize i=0;
+	// Scan Legacy Prefixes and REX Prefix.
+	for(;i<Limit;i++)
+	{
+		const ZyanU8 Prefix=Code[i];
+		if(Prefix==0x66)
+			OpSizePrefix=ZYAN_TRUE;
+		else if(Prefix==0x67)
+			AddrSizePrefix=ZYAN_TRUE;
+		else if(Prefix==0xF2 || Prefix==0xF3)
+			RepPrefix=ZYAN_TRUE;
+		else if(Prefix==0x26 || Prefix==0x2E || Prefix==0x36 || Prefix==0x3E || Prefix==0x64 || Prefix==0x65 || Prefix==0xF0)
+			;
+		else if(Bits==64 && (Prefix&0xF0)==0x40)
+		{
+			RexW=(Prefix&8)!=0;
+			continue;
+		}
+		else
+			break;
+		// REX Prefix is ignored if it is followed by a legacy prefix.
+		RexW=ZYAN_FALSE;
+	}
+	if(i>=Limit)return 0;
+	if(Bits==16)
+	{
+		OperandSize=OpSizePrefix?32:16;
+		AddressSize=AddrSizePrefix?32:16;
+	}
+	else
+	{
+		OperandSize=OpSizePrefix?16:32;
+		if(Bits==32)
+			AddressSize=AddrSizePrefix?16:32;
+		else
+			AddressSize=AddrSizePrefix?32:64;
+	}
+	if(RexW)OperandSize=64;
+	// Locate the opcode map.
+	Opcode=Code[i++];
+	if(Opcode==0x0F)
+	{
+		if(i>=Limit)return 0;
+		Opcode=Code[i++];
+		Map=1;
+		if(Opcode==0x38 || Opcode==0x3A)
+		{
+			if(i>=Limit)return 0;
+			Map=Opcode==0x38?2:3;
+			Opcode=Code[i++];
+		}
+	}
+	else if(Opcode==0xC4 || Opcode==0xC5 || Opcode==0x62)
+	{
+		if(Bits==16 || i>=Limit)return 0;
+		// In 32-bit mode, these are LES/LDS/BOUND instructions unless ModR/M.mod is 3.
+		if(Bits==64 || (Code[i]&0xC0)==0xC0)
+		{
+			if(Opcode==0xC5)
+				Map=1;
+			else if(Opcode==0xC4)
+				Map=Code[i]&0x1F;
+			else
+				Map=Code[i]&0x7;
+			i+=Opcode==0xC5?1:Opcode==0xC4?2:3;
+			if(Map<1 || Map>3 || i>=Limit)return 0;
+			Opcode=Code[i++];
+			Vex=ZYAN_TRUE;
+		}
+	}
+	else if(Opcode==0x8F)
+	{
+		// XOP Prefix is specified by a non-zero ModR/M.reg field.
+		if(i>=Limit || (Code[i]&0x38))return 0;
+	}
+	switch(Map)
+	{
+		case 0:
+		{
+			if(Bits==64 && (NoirLdeInvalid64[Opcode>>5]&(1<<(Opcode&0x1F))))return 0;
+			Flags=NoirLdeOneByteMap[Opcode];
+			break;
+		}
+		case 1:
+		{
+			// EXTRQ/INSERTQ instructions have two immediates.
+			if(Opcode==0x78 && !Vex && (OpSizePrefix || RepPrefix))return 0;
+			Flags=NoirLdeTwoByteMap[Opcode];
+			break;
+		}
+		case 2:
+		{
+			Flags=noir_lde_modrm;
+			break;
+		}
+		case 3:
+		{
+			Flags=noir_lde_modrm|noir_lde_imm8;
+			break;
+		}
+	}
+	if(Flags & noir_lde_special)return 0;
+	// Vendors disagree on the size of relative branches with operand-size override in 64-bit mode.
+	if(Bits==64 && OpSizePrefix && !RexW)
+		if((Map==0 && (Opcode==0xE8 || Opcode==0xE9)) || (Map==1 && (Opcode&0xF0)==0x80))
+			return 0;
+	if(Flags & noir_lde_modrm)
+	{
+		ZyanU8 ModRM,Mod,Rm;
+		if(i>=Limit)return 0;
+		ModRM=Code[i++];
+		Mod=ModRM>>6;
+		Rm=ModRM&7;
+		if((Flags & noir_lde_group3) && (ModRM&0x38)>=0x10)Flags&=~(noir_lde_imm8|noir_lde_immz);
+		if(Mod!=3)
+		{
+			if(AddressSize==16)
+			{
+				if(Mod==1)
+					i+=1;
+				else if(Mod==2 || Rm==6)
+					i+=2;
+			}
+			else
+			{
+				if(Rm==4)
+				{
+					if(i>=Limit)return 0;
+					// SIB.base=5 without displacement specifies a 32-bit displacement without base.
+					if(Mod==0 && (Code[i]&7)==5)i+=4;
+					i++;
+				}
+				if(Mod==1)
+					i+=1;
+				else if(Mod==2 || (Mod==0 && Rm==5))
+					i+=4;
+			}
+		}
+	}
+	if(Flags & noir_lde_imm8)i+=1;
+	if(Flags & noir_lde_imm16)i+=2;
+	if(Flags & noir_lde_immz)i+=OperandSize==16?2:4;
+	if(Flags & noir_lde_immv)i+=OperandSize>>3;
+	if(Flags & noir_lde_moffs)i+=AddressSize>>3;
+	return i>Limit?0:(ZyanU8)i;
+}
+
 ZyanU8 NoirGetInstructionLength16(ZyanU8* Code,ZyanUSize CodeLength)
 {
 	ZydisDecodedInstruction ZyIns;
+	const ZyanU8 Length=NoirGetInstructionLengthFast(Code,CodeLength,16);
+	if(Length)return Length;
 	ZydisDecoderDecodeBuffer(&ZyDec16,Code,CodeLength==0?15:CodeLength,&ZyIns);
 	return ZyIns.length;
 }
@@ -60,6 +216,8 @@ ZyanU8 NoirGetInstructionLength16(ZyanU8* Code,ZyanUSize CodeLength)
 ZyanU8 NoirGetInstructionLength32(ZyanU8* Code,ZyanUSize CodeLength)
 {
 	ZydisDecodedInstruction ZyIns;
+	const ZyanU8 Length=NoirGetInstructionLengthFast(Code,CodeLength,32);
+	if(Length)return Length;
 	ZydisDecoderDecodeBuffer(&ZyDec32,Code,CodeLength==0?15:CodeLength,&ZyIns);
 	return ZyIns.length;
 }
@@ -67,6 +225,8 @@ ZyanU8 NoirGetInstructionLength32(ZyanU8* Code,ZyanUSize CodeLength)
 ZyanU8 NoirGetInstructionLength64(ZyanU8* Code,ZyanUSize CodeLength)
 {
 	ZydisDecodedInstruction ZyIns;
+	const ZyanU8 Length=NoirGetInstructionLengthFast(Code,CodeLength,64);
+	if(Length)return Length;
 	ZydisDecoderDecodeBuffer(&ZyDec64,Code,CodeLength==0?15:CodeLength,&ZyIns);
 	return ZyIns.length;
 }
@@ -86,24 +246,65 @@ void noir_decode_instruction64(ZyanU8* Code,ZyanUSize CodeLength,ZydisDecodedIns
 	ZydisDecoderDecodeBuffer(&ZyDec64,Code,CodeLength==0?15:CodeLength,DecodeResult);
 }
 
+// Translate a Zydis register into the index of general-purpose register.
+// Returns 0xFF if the register is not a general-purpose register.
+ZyanU8 static NoirGetGprIndex(ZydisRegister Register,ZyanU8* Size,ZyanBool* HighByte)
+{
+	*HighByte=ZYAN_FALSE;
+	if(Register>=ZYDIS_REGISTER_AL && Register<=ZYDIS_REGISTER_R15B)
+	{
+		// Order of 8-bit registers in Zydis: al,cl,dl,bl,ah,ch,dh,bh,spl,bpl,sil,dil,r8b-r15b
+		const ZyanU8 Index=(ZyanU8)(Register-ZYDIS_REGISTER_AL);
+		*Size=1;
+		if(Index<4)return Index;
+		if(Index<8)*HighByte=ZYAN_TRUE;
+		return (ZyanU8)(Index-4);
+	}
+	if(Register>=ZYDIS_REGISTER_AX && Register<=ZYDIS_REGISTER_R15W)
+	{
+		*Size=2;
+		return (ZyanU8)(Register-ZYDIS_REGISTER_AX);
+	}
+	if(Register>=ZYDIS_REGISTER_EAX && Register<=ZYDIS_REGISTER_R15D)
+	{
+		*Size=4;
+		return (ZyanU8)(Register-ZYDIS_REGISTER_EAX);
+	}
+	if(Register>=ZYDIS_REGISTER_RAX && Register<=ZYDIS_REGISTER_R15)
+	{
+		*Size=8;
+		return (ZyanU8)(Register-ZYDIS_REGISTER_RAX);
+	}
+	return 0xFF;
+}
+
 void noir_decode_basic_operand(ZydisDecodedInstruction* DecodeResult,NoirBasicOperand *BasicOperand)
 {
+	unsigned long OperandSize=0;
 	BasicOperand->Complex.Value=0;
 	BasicOperand->Immediate.Unsigned=0;
+	// Operand Size: 0=8-bit, 1=16-bit, 2=32-bit, 3=64-bit
+	_BitScanForward(&OperandSize,DecodeResult->operand_width>>3);
 	for(ZyanU8 i=0;i<DecodeResult->operand_count;i++)
 	{
 		// Only explicit operands are considered.
 		if(DecodeResult->operands[i].visibility==ZYDIS_OPERAND_VISIBILITY_EXPLICIT)
 		{
-			BasicOperand->Complex.OperandSize=DecodeResult->operand_width>>4;
+			BasicOperand->Complex.OperandSize=OperandSize;
 			BasicOperand->Complex.AddressSize=DecodeResult->address_width>>5;
 			switch(DecodeResult->operands[i].type)
 			{
 				case ZYDIS_OPERAND_TYPE_REGISTER:
 				{
-					ZydisRegister Subtraction[4]={ZYDIS_REGISTER_AL,ZYDIS_REGISTER_AX,ZYDIS_REGISTER_EAX,ZYDIS_REGISTER_RAX};
-					// FIXME: Cannot correctly decode 8-bit registers in light of the mess of ah,spl,r8b etc.
-					ZydisRegister Value=DecodeResult->operands[i].reg.value-Subtraction[BasicOperand->Complex.OperandSize];
+					ZyanU8 Size;
+					ZyanBool HighByte;
+					ZyanU8 Value=NoirGetGprIndex(DecodeResult->operands[i].reg.value,&Size,&HighByte);
+					// Follow the hardware encoding of 8-bit registers: indices 4-7 without REX are ah,ch,dh,bh.
+					if(HighByte)
+					{
+						BasicOperand->Complex.HighByteRegs=1;
+						Value+=4;
+					}
 					BasicOperand->Complex.RegValid++;
 					switch(BasicOperand->Complex.RegValid)
 					{
@@ -119,18 +320,30 @@ void noir_decode_basic_operand(ZydisDecodedInstruction* DecodeResult,NoirBasicOp
 				case ZYDIS_OPERAND_TYPE_MEMORY:
 				{
 					unsigned long Scale=0;
-					ZydisRegister Subtraction[3]={ZYDIS_REGISTER_AX,ZYDIS_REGISTER_EAX,ZYDIS_REGISTER_RAX};
+					ZyanU8 Size;
+					ZyanBool HighByte;
 					BasicOperand->Complex.MemValid=1;
 					if(DecodeResult->operands[i].mem.disp.has_displacement)
 						BasicOperand->Complex.Displacement=DecodeResult->operands[i].mem.disp.value;
 					BasicOperand->Complex.Segment=DecodeResult->operands[i].mem.segment-ZYDIS_REGISTER_ES;
-					BasicOperand->Complex.Index=DecodeResult->operands[i].mem.index-Subtraction[BasicOperand->Complex.OperandSize];
-					BasicOperand->Complex.Base=DecodeResult->operands[i].mem.base-Subtraction[BasicOperand->Complex.OperandSize];
-					_BitScanForward(&Scale,DecodeResult->operands[i].mem.scale);
-					BasicOperand->Complex.Scale=Scale;
+					// Register indices of address are independent from operand size.
 					if(DecodeResult->operands[i].mem.index!=ZYDIS_REGISTER_NONE && DecodeResult->operands[i].mem.scale)
+					{
+						BasicOperand->Complex.Index=NoirGetGprIndex(DecodeResult->operands[i].mem.index,&Size,&HighByte);
+						_BitScanForward(&Scale,DecodeResult->operands[i].mem.scale);
+						BasicOperand->Complex.Scale=Scale;
 						BasicOperand->Complex.SiValid=1;
-					BasicOperand->Complex.BaseValid=DecodeResult->operands[i].mem.base!=ZYDIS_REGISTER_NONE;
+					}
+					// RIP-relative addressing cannot be described by basic operand.
+					if(DecodeResult->operands[i].mem.base!=ZYDIS_REGISTER_NONE)
+					{
+						const ZyanU8 Base=NoirGetGprIndex(DecodeResult->operands[i].mem.base,&Size,&HighByte);
+						if(Base!=0xFF)
+						{
+							BasicOperand->Complex.Base=Base;
+							BasicOperand->Complex.BaseValid=1;
+						}
+					}
 					break;
 				}
 				case ZYDIS_OPERAND_TYPE_IMMEDIATE:
@@ -150,4 +363,325 @@ void noir_decode_basic_operand(ZydisDecodedInstruction* DecodeResult,NoirBasicOp
 			}
 		}
 	}
+}
+
+// Instruction Emulator
+// This emulator is intended for MMIO and protected-page accesses by device drivers.
+ZyanU64 static NoirEmuSizeMask(ZyanU8 Size)
+{
+	return Size>=8?~(ZyanU64)0:((ZyanU64)1<<(Size<<3))-1;
+}
+
+ZyanU64 static NoirEmuSignExtend(ZyanU64 Value,ZyanU8 Size)
+{
+	const ZyanU8 Shift=(ZyanU8)(64-(Size<<3));
+	return (ZyanU64)(((ZyanI64)(Value<<Shift))>>Shift);
+}
+
+ZyanUPointer noir_emu_read_gpr(ZyanUPointer* Gpr,ZyanU8 Index,ZyanU8 Size,ZyanU32 HighByte)
+{
+	if(HighByte)return (Gpr[Index]>>8)&0xFF;
+	return (ZyanUPointer)(Gpr[Index]&NoirEmuSizeMask(Size));
+}
+
+void noir_emu_write_gpr(ZyanUPointer* Gpr,ZyanU8 Index,ZyanU8 Size,ZyanU32 HighByte,ZyanUPointer Value)
+{
+	if(HighByte)
+		((ZyanU8*)&Gpr[Index])[1]=(ZyanU8)Value;
+	else
+	{
+		switch(Size)
+		{
+			case 1:
+				*(ZyanU8*)&Gpr[Index]=(ZyanU8)Value;
+				break;
+			case 2:
+				*(ZyanU16*)&Gpr[Index]=(ZyanU16)Value;
+				break;
+			case 4:
+				// Writing to 32-bit registers zero-extends the whole register.
+				Gpr[Index]=(ZyanU32)Value;
+				break;
+			default:
+				Gpr[Index]=Value;
+				break;
+		}
+	}
+}
+
+ZyanUPointer static NoirEmuApplySegment(NoirEmuContext* Context,ZyanU8 Segment,ZyanU64 Offset)
+{
+	// Segment bases other than FS and GS are ignored in 64-bit mode.
+	if(Context->Bits!=64 || Segment>=4)Offset+=Context->SegmentBase[Segment];
+	if(Context->Bits!=64)Offset&=0xFFFFFFFF;
+	return (ZyanUPointer)Offset;
+}
+
+ZyanU32 static NoirEmuGetLinearAddress(NoirEmuContext* Context,ZydisDecodedInstruction* Instruction,ZydisDecodedOperand* Operand,ZyanUPointer* Address)
+{
+	ZyanU64 Offset=(ZyanU64)Operand->mem.disp.value;
+	ZyanU8 Index,Size;
+	ZyanBool HighByte;
+	if(Operand->mem.base==ZYDIS_REGISTER_RIP || Operand->mem.base==ZYDIS_REGISTER_EIP)
+		Offset+=Context->Rip+Instruction->length;
+	else if(Operand->mem.base!=ZYDIS_REGISTER_NONE)
+	{
+		Index=NoirGetGprIndex(Operand->mem.base,&Size,&HighByte);
+		if(Index==0xFF)return noir_emu_status_unsupported;
+		Offset+=Context->Gpr[Index];
+	}
+	if(Operand->mem.index!=ZYDIS_REGISTER_NONE)
+	{
+		Index=NoirGetGprIndex(Operand->mem.index,&Size,&HighByte);
+		if(Index==0xFF)return noir_emu_status_unsupported;
+		Offset+=(ZyanU64)Context->Gpr[Index]*Operand->mem.scale;
+	}
+	Offset&=NoirEmuSizeMask(Instruction->address_width>>3);
+	*Address=NoirEmuApplySegment(Context,(ZyanU8)(Operand->mem.segment-ZYDIS_REGISTER_ES),Offset);
+	return noir_emu_status_success;
+}
+
+// Memory operands are read only if Read is set. Reading MMIO may have side effects.
+ZyanU32 static NoirEmuLoadOperand(NoirEmuContext* Context,ZydisDecodedInstruction* Instruction,ZydisDecodedOperand* Operand,NoirEmuOperand* Result,ZyanBool Read)
+{
+	ZyanU32 Status=noir_emu_status_success;
+	Result->Type=Operand->type;
+	Result->Size=(ZyanU8)(Operand->size>>3);
+	Result->Value=0;
+	switch(Operand->type)
+	{
+		case ZYDIS_OPERAND_TYPE_REGISTER:
+		{
+			ZyanU8 Size;
+			Result->Index=NoirGetGprIndex(Operand->reg.value,&Size,&Result->HighByte);
+			if(Result->Index==0xFF)return noir_emu_status_unsupported;
+			Result->Value=noir_emu_read_gpr(Context->Gpr,Result->Index,Result->Size,Result->HighByte);
+			break;
+		}
+		case ZYDIS_OPERAND_TYPE_MEMORY:
+		{
+			Status=NoirEmuGetLinearAddress(Context,Instruction,Operand,&Result->Address);
+			if(Status==noir_emu_status_success && Read)
+				if(!Context->MemoryAccessor(Context->AccessorContext,Result->Address,&Result->Value,Result->Size,ZYAN_FALSE))
+					Status=noir_emu_status_memory_fault;
+			break;
+		}
+		case ZYDIS_OPERAND_TYPE_IMMEDIATE:
+		{
+			// Immediates are sign-extended to the operand size.
+			Result->Size=(ZyanU8)(Instruction->operand_width>>3);
+			Result->Value=Operand->imm.value.u&NoirEmuSizeMask(Result->Size);
+			break;
+		}
+		default:
+		{
+			Status=noir_emu_status_unsupported;
+			break;
+		}
+	}
+	return Status;
+}
+
+ZyanU32 static NoirEmuStoreOperand(NoirEmuContext* Context,NoirEmuOperand* Operand,ZyanU64 Value)
+{
+	if(Operand->Type==ZYDIS_OPERAND_TYPE_REGISTER)
+		noir_emu_write_gpr(Context->Gpr,Operand->Index,Operand->Size,Operand->HighByte,(ZyanUPointer)Value);
+	else if(!Context->MemoryAccessor(Context->AccessorContext,Operand->Address,&Value,Operand->Size,ZYAN_TRUE))
+		return noir_emu_status_memory_fault;
+	return noir_emu_status_success;
+}
+
+// Compute PF, ZF and SF from the result.
+ZyanUPointer static NoirEmuResultFlags(ZyanU64 Result,ZyanU8 Size)
+{
+	ZyanU8 Parity=(ZyanU8)Result;
+	ZyanUPointer Flags=0;
+	Parity^=Parity>>4;
+	Parity^=Parity>>2;
+	Parity^=Parity>>1;
+	if(!(Parity&1))Flags|=noir_emu_rflags_pf;
+	if(!(Result&NoirEmuSizeMask(Size)))Flags|=noir_emu_rflags_zf;
+	if((Result>>((Size<<3)-1))&1)Flags|=noir_emu_rflags_sf;
+	return Flags;
+}
+
+// Compute arithmetic flags of Left-Right, which is what CMP instruction does.
+ZyanUPointer static NoirEmuSubtractionFlags(ZyanU64 Left,ZyanU64 Right,ZyanU8 Size)
+{
+	const ZyanU64 Result=(Left-Right)&NoirEmuSizeMask(Size);
+	ZyanUPointer Flags=NoirEmuResultFlags(Result,Size);
+	if(Left<Right)Flags|=noir_emu_rflags_cf;
+	if((Left^Right^Result)&0x10)Flags|=noir_emu_rflags_af;
+	if((((Left^Right)&(Left^Result))>>((Size<<3)-1))&1)Flags|=noir_emu_rflags_of;
+	return Flags;
+}
+
+ZyanU32 static NoirEmuBinaryInstruction(NoirEmuContext* Context,ZydisDecodedInstruction* Instruction)
+{
+	const ZydisMnemonic Mnemonic=Instruction->mnemonic;
+	const ZyanBool ReadDestination=Mnemonic!=ZYDIS_MNEMONIC_MOV && Mnemonic!=ZYDIS_MNEMONIC_MOVZX && Mnemonic!=ZYDIS_MNEMONIC_MOVSX && Mnemonic!=ZYDIS_MNEMONIC_MOVSXD;
+	NoirEmuOperand Dst,Src;
+	ZyanU32 Status;
+	if(Instruction->operands[0].visibility!=ZYDIS_OPERAND_VISIBILITY_EXPLICIT || Instruction->operands[1].visibility!=ZYDIS_OPERAND_VISIBILITY_EXPLICIT)
+		return noir_emu_status_unsupported;
+	Status=NoirEmuLoadOperand(Context,Instruction,&Instruction->operands[1],&Src,ZYAN_TRUE);
+	if(Status!=noir_emu_status_success)return Status;
+	Status=NoirEmuLoadOperand(Context,Instruction,&Instruction->operands[0],&Dst,ReadDestination);
+	if(Status!=noir_emu_status_success)return Status;
+	switch(Mnemonic)
+	{
+		case ZYDIS_MNEMONIC_MOV:
+		case ZYDIS_MNEMONIC_MOVZX:
+		{
+			Status=NoirEmuStoreOperand(Context,&Dst,Src.Value);
+			break;
+		}
+		case ZYDIS_MNEMONIC_MOVSX:
+		case ZYDIS_MNEMONIC_MOVSXD:
+		{
+			Status=NoirEmuStoreOperand(Context,&Dst,NoirEmuSignExtend(Src.Value,Src.Size));
+			break;
+		}
+		case ZYDIS_MNEMONIC_AND:
+		case ZYDIS_MNEMONIC_OR:
+		{
+			const ZyanU64 Result=Mnemonic==ZYDIS_MNEMONIC_AND?Dst.Value&Src.Value:Dst.Value|Src.Value;
+			Status=NoirEmuStoreOperand(Context,&Dst,Result);
+			// CF and OF are cleared. AF is undefined, so clear it as well.
+			if(Status==noir_emu_status_success)
+				Context->Rflags=(Context->Rflags&~noir_emu_rflags_arith)|NoirEmuResultFlags(Result,Dst.Size);
+			break;
+		}
+		case ZYDIS_MNEMONIC_XCHG:
+		{
+			// Memory operand is written first so that a failure leaves registers intact.
+			if(Src.Type==ZYDIS_OPERAND_TYPE_MEMORY)
+			{
+				Status=NoirEmuStoreOperand(Context,&Src,Dst.Value);
+				if(Status==noir_emu_status_success)Status=NoirEmuStoreOperand(Context,&Dst,Src.Value);
+			}
+			else
+			{
+				Status=NoirEmuStoreOperand(Context,&Dst,Src.Value);
+				if(Status==noir_emu_status_success)Status=NoirEmuStoreOperand(Context,&Src,Dst.Value);
+			}
+			break;
+		}
+		case ZYDIS_MNEMONIC_CMPXCHG:
+		{
+			const ZyanU64 Accumulator=noir_emu_read_gpr(Context->Gpr,0,Dst.Size,ZYAN_FALSE);
+			const ZyanUPointer Flags=NoirEmuSubtractionFlags(Accumulator,Dst.Value,Dst.Size);
+			if(Accumulator==Dst.Value)
+				Status=NoirEmuStoreOperand(Context,&Dst,Src.Value);
+			else
+			{
+				// The destination is always written back. The accumulator receives the destination.
+				Status=NoirEmuStoreOperand(Context,&Dst,Dst.Value);
+				if(Status==noir_emu_status_success)noir_emu_write_gpr(Context->Gpr,0,Dst.Size,ZYAN_FALSE,(ZyanUPointer)Dst.Value);
+			}
+			if(Status==noir_emu_status_success)Context->Rflags=(Context->Rflags&~noir_emu_rflags_arith)|Flags;
+			break;
+		}
+		default:
+		{
+			Status=noir_emu_status_unsupported;
+			break;
+		}
+	}
+	return Status;
+}
+
+// STOS and MOVS instructions, with or without REP prefix.
+ZyanU32 static NoirEmuStringInstruction(NoirEmuContext* Context,ZydisDecodedInstruction* Instruction,ZyanBool Movs)
+{
+	const ZyanU8 Size=(ZyanU8)(Instruction->operand_width>>3);
+	const ZyanU8 AddressSize=(ZyanU8)(Instruction->address_width>>3);
+	const ZyanU64 AddressMask=NoirEmuSizeMask(AddressSize);
+	const ZyanBool Rep=(Instruction->attributes & ZYDIS_ATTRIB_HAS_REP)!=0;
+	const ZyanU64 Delta=(Context->Rflags & noir_emu_rflags_df)?0-(ZyanU64)Size:(ZyanU64)Size;
+	ZyanU32 Iterations=0;
+	// Source of MOVS is DS:rSI unless the segment is overridden.
+	ZyanU8 SourceSegment=3;
+	for(ZyanU8 i=0;i<Instruction->operand_count;i++)
+	{
+		ZydisDecodedOperand* Operand=&Instruction->operands[i];
+		if(Operand->type==ZYDIS_OPERAND_TYPE_MEMORY && (Operand->mem.base==ZYDIS_REGISTER_SI || Operand->mem.base==ZYDIS_REGISTER_ESI || Operand->mem.base==ZYDIS_REGISTER_RSI))
+			SourceSegment=(ZyanU8)(Operand->mem.segment-ZYDIS_REGISTER_ES);
+	}
+	// Registers are updated on each iteration so that a faulting REP instruction can be restarted.
+	while(!Rep || (Context->Gpr[1]&AddressMask))
+	{
+		const ZyanUPointer Destination=NoirEmuApplySegment(Context,0,Context->Gpr[7]&AddressMask);
+		ZyanU64 Value=0;
+		if(Movs)
+		{
+			const ZyanUPointer Source=NoirEmuApplySegment(Context,SourceSegment,Context->Gpr[6]&AddressMask);
+			if(!Context->MemoryAccessor(Context->AccessorContext,Source,&Value,Size,ZYAN_FALSE))return noir_emu_status_memory_fault;
+		}
+		else
+			Value=noir_emu_read_gpr(Context->Gpr,0,Size,ZYAN_FALSE);
+		if(!Context->MemoryAccessor(Context->AccessorContext,Destination,&Value,Size,ZYAN_TRUE))return noir_emu_status_memory_fault;
+		noir_emu_write_gpr(Context->Gpr,7,AddressSize,ZYAN_FALSE,(ZyanUPointer)(Context->Gpr[7]+Delta));
+		if(Movs)noir_emu_write_gpr(Context->Gpr,6,AddressSize,ZYAN_FALSE,(ZyanUPointer)(Context->Gpr[6]+Delta));
+		if(!Rep)break;
+		noir_emu_write_gpr(Context->Gpr,1,AddressSize,ZYAN_FALSE,(ZyanUPointer)(Context->Gpr[1]-1));
+		// The remaining iterations are left to the restarted instruction.
+		if(++Iterations==noir_emu_rep_iteration_limit && (Context->Gpr[1]&AddressMask))return noir_emu_status_rep_partial;
+	}
+	return noir_emu_status_success;
+}
+
+// Emulate the instruction. RIP is advanced only if the emulation succeeds.
+// The caller must synchronize RSP into the GPR state, as it is saved in VMCB/VMCS.
+ZyanU32 noir_emulate_instruction(NoirEmuContext* Context,ZyanU8* Code,ZyanUSize CodeLength)
+{
+	ZydisDecoder* Decoder=Context->Bits==64?&ZyDec64:Context->Bits==32?&ZyDec32:&ZyDec16;
+	ZydisDecodedInstruction Instruction;
+	ZyanU32 Status;
+	if(ZYAN_FAILED(ZydisDecoderDecodeBuffer(Decoder,Code,CodeLength==0?15:CodeLength,&Instruction)))
+		return noir_emu_status_unsupported;
+	Context->Length=Instruction.length;
+	switch(Instruction.mnemonic)
+	{
+		case ZYDIS_MNEMONIC_STOSB:
+		case ZYDIS_MNEMONIC_STOSW:
+		case ZYDIS_MNEMONIC_STOSD:
+		case ZYDIS_MNEMONIC_STOSQ:
+		{
+			Status=NoirEmuStringInstruction(Context,&Instruction,ZYAN_FALSE);
+			break;
+		}
+		case ZYDIS_MNEMONIC_MOVSB:
+		case ZYDIS_MNEMONIC_MOVSW:
+		case ZYDIS_MNEMONIC_MOVSD:
+		case ZYDIS_MNEMONIC_MOVSQ:
+		{
+			// MOVSD is also an SSE2 instruction, which has explicit operands.
+			if(Instruction.operands[0].visibility==ZYDIS_OPERAND_VISIBILITY_EXPLICIT)
+				Status=noir_emu_status_unsupported;
+			else
+				Status=NoirEmuStringInstruction(Context,&Instruction,ZYAN_TRUE);
+			break;
+		}
+		case ZYDIS_MNEMONIC_MOV:
+		case ZYDIS_MNEMONIC_MOVZX:
+		case ZYDIS_MNEMONIC_MOVSX:
+		case ZYDIS_MNEMONIC_MOVSXD:
+		case ZYDIS_MNEMONIC_AND:
+		case ZYDIS_MNEMONIC_OR:
+		case ZYDIS_MNEMONIC_XCHG:
+		case ZYDIS_MNEMONIC_CMPXCHG:
+		{
+			Status=NoirEmuBinaryInstruction(Context,&Instruction);
+			break;
+		}
+		default:
+		{
+			Status=noir_emu_status_unsupported;
+			break;
+		}
+	}
+	if(Status==noir_emu_status_success)
+		Context->Rip=(ZyanUPointer)((Context->Rip+Instruction.length)&NoirEmuSizeMask(Context->Bits>>3));
+	return Status;
 }
\ No newline at end of file
@@ -29,7 +29,7 @@ typedef struct NoirBasicOperand_
 			ZyanU64 Reg2:4;				// Bits	52-55
 			ZyanU64 OperandSize:2;		// Bits	56-57
 			ZyanU64 BaseValid:1;		// Bit	58
-			ZyanU64 Reserved:1;			// Bit	59
+			ZyanU64 HighByteRegs:1;		// Bit	59
 			ZyanU64 MemValid:1;			// Bit	60
 			ZyanU64 RegValid:2;			// Bits	61-62
 			ZyanU64 ImmValid:1;			// Bit	63
@@ -43,6 +43,106 @@ typedef struct NoirBasicOperand_
 	}Immediate;
 }NoirBasicOperand;
 
+// Status Codes of Instruction Emulator
+#define noir_emu_status_success			0
+#define noir_emu_status_unsupported		1	// The instruction is not supported by the emulator.
+#define noir_emu_status_memory_fault	2	// The memory accessor failed. Instruction pointer is not advanced.
+#define noir_emu_status_rep_partial		3	// The REP instruction is not completed in this call. Instruction pointer is not advanced.
+
+// A REP instruction is restarted after this many iterations so that the guest is not stalled by a huge count.
+#define noir_emu_rep_iteration_limit	256
+
+// Boolean type in NoirVisor is 32-bit wide.
+typedef ZyanU32 (*NoirEmuMemoryAccessor)(void* Context,ZyanUPointer Address,void* Buffer,ZyanU32 Size,ZyanU32 Write);
+
+typedef struct NoirEmuContext_
+{
+	ZyanUPointer* Gpr;
+	ZyanUPointer SegmentBase[6];
+	NoirEmuMemoryAccessor MemoryAccessor;
+	void* AccessorContext;
+	ZyanUPointer Rip;
+	ZyanUPointer Rflags;
+	ZyanU8 Bits;
+	ZyanU8 Length;
+	ZyanU8 Reserved[6];
+}NoirEmuContext;
+
+typedef struct NoirEmuOperand_
+{
+	ZyanU64 Value;
+	ZyanUPointer Address;		// Linear address of memory operand.
+	ZydisOperandType Type;
+	ZyanU8 Size;				// Size of operand in bytes.
+	ZyanU8 Index;				// Index of general-purpose register.
+	ZyanBool HighByte;			// The register is one of ah,ch,dh,bh.
+}NoirEmuOperand;
+
+// Arithmetic flags in RFLAGS: CF, PF, AF, ZF, SF and OF.
+#define noir_emu_rflags_cf		0x001
+#define noir_emu_rflags_pf		0x004
+#define noir_emu_rflags_af		0x010
+#define noir_emu_rflags_zf		0x040
+#define noir_emu_rflags_sf		0x080
+#define noir_emu_rflags_df		0x400
+#define noir_emu_rflags_of		0x800
+#define noir_emu_rflags_arith	0x8D5
+
+// Attributes of opcodes for the Instruction Length Decoder
+#define noir_lde_modrm		0x01	// ModR/M byte follows the opcode.
+#define noir_lde_imm8		0x02	// 8-bit immediate.
+#define noir_lde_imm16		0x04	// 16-bit immediate.
+#define noir_lde_immz		0x08	// 16-bit or 32-bit immediate, depending on operand size.
+#define noir_lde_immv		0x10	// 16-bit, 32-bit or 64-bit immediate, depending on operand size.
+#define noir_lde_moffs		0x20	// Memory offset sized by address size.
+#define noir_lde_group3		0x40	// Immediate exists only if ModR/M.reg is 0 or 1. (TEST instruction)
+#define noir_lde_special	0x80	// Prefixes, escapes and rare encodings. Leave them to Zydis.
+
+// One-byte opcode map.
+const ZyanU8 NoirLdeOneByteMap[256]=
+{
+	0x01,0x01,0x01,0x01,0x02,0x08,0x00,0x00,0x01,0x01,0x01,0x01,0x02,0x08,0x00,0x80,	// 0x00-0x0F
+	0x01,0x01,0x01,0x01,0x02,0x08,0x00,0x00,0x01,0x01,0x01,0x01,0x02,0x08,0x00,0x00,	// 0x10-0x1F
+	0x01,0x01,0x01,0x01,0x02,0x08,0x80,0x00,0x01,0x01,0x01,0x01,0x02,0x08,0x80,0x00,	// 0x20-0x2F
+	0x01,0x01,0x01,0x01,0x02,0x08,0x80,0x00,0x01,0x01,0x01,0x01,0x02,0x08,0x80,0x00,	// 0x30-0x3F
+	0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,	// 0x40-0x4F
+	0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,	// 0x50-0x5F
+	0x00,0x00,0x01,0x01,0x80,0x80,0x80,0x80,0x08,0x09,0x02,0x03,0x00,0x00,0x00,0x00,	// 0x60-0x6F
+	0x02,0x02,0x02,0x02,0x02,0x02,0x02,0x02,0x02,0x02,0x02,0x02,0x02,0x02,0x02,0x02,	// 0x70-0x7F
+	0x03,0x09,0x03,0x03,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,	// 0x80-0x8F
+	0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x0C,0x00,0x00,0x00,0x00,0x00,	// 0x90-0x9F
+	0x20,0x20,0x20,0x20,0x00,0x00,0x00,0x00,0x02,0x08,0x00,0x00,0x00,0x00,0x00,0x00,	// 0xA0-0xAF
+	0x02,0x02,0x02,0x02,0x02,0x02,0x02,0x02,0x10,0x10,0x10,0x10,0x10,0x10,0x10,0x10,	// 0xB0-0xBF
+	0x03,0x03,0x04,0x00,0x01,0x01,0x03,0x09,0x06,0x00,0x04,0x00,0x00,0x02,0x00,0x00,	// 0xC0-0xCF
+	0x01,0x01,0x01,0x01,0x02,0x02,0x00,0x00,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,	// 0xD0-0xDF
+	0x02,0x02,0x02,0x02,0x02,0x02,0x02,0x02,0x08,0x08,0x0C,0x02,0x00,0x00,0x00,0x00,	// 0xE0-0xEF
+	0x80,0x00,0x80,0x80,0x00,0x00,0x43,0x49,0x00,0x00,0x00,0x00,0x00,0x00,0x01,0x01	// 0xF0-0xFF
+};
+
+// Two-byte opcode map. (0F xx)
+const ZyanU8 NoirLdeTwoByteMap[256]=
+{
+	0x01,0x01,0x01,0x01,0x80,0x00,0x00,0x00,0x00,0x00,0x80,0x00,0x80,0x01,0x00,0x80,	// 0x00-0x0F
+	0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,	// 0x10-0x1F
+	0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,	// 0x20-0x2F
+	0x00,0x00,0x00,0x00,0x00,0x00,0x80,0x00,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,	// 0x30-0x3F
+	0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,	// 0x40-0x4F
+	0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,	// 0x50-0x5F
+	0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,	// 0x60-0x6F
+	0x03,0x03,0x03,0x03,0x01,0x01,0x01,0x00,0x01,0x01,0x80,0x80,0x01,0x01,0x01,0x01,	// 0x70-0x7F
+	0x08,0x08,0x08,0x08,0x08,0x08,0x08,0x08,0x08,0x08,0x08,0x08,0x08,0x08,0x08,0x08,	// 0x80-0x8F
+	0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,	// 0x90-0x9F
+	0x00,0x00,0x00,0x01,0x03,0x01,0x80,0x80,0x00,0x00,0x00,0x01,0x03,0x01,0x01,0x01,	// 0xA0-0xAF
+	0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x80,0x01,0x03,0x01,0x01,0x01,0x01,0x01,	// 0xB0-0xBF
+	0x01,0x01,0x03,0x01,0x03,0x03,0x03,0x01,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,	// 0xC0-0xCF
+	0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,	// 0xD0-0xDF
+	0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,	// 0xE0-0xEF
+	0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01	// 0xF0-0xFF
+};
+
+// Bitmap of one-byte opcodes that are invalid in 64-bit mode.
+const ZyanU32 NoirLdeInvalid64[8]={0xC0C040C0,0x80808080,0x00000000,0x00000003,0x04000004,0x00000000,0x00704000,0x00000400};
+
 ZydisDecoder ZyDec16;
 ZydisDecoder ZyDec32;
 ZydisDecoder ZyDec64;
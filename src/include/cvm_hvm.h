@@ -23,6 +23,15 @@
 // Defining vCPU priority on scheduler.
 #define noir_cvm_vcpu_priority_user				0
 #define noir_cvm_vcpu_priority_kernel			8
+#define noir_cvm_vcpu_priority_levels			16
+
+// Default time slice of vCPU scheduled by NoirVisor, in TSC ticks.
+#define noir_cvm_default_time_slice				0x400000
+
+// Defining vCPU states on scheduler.
+#define noir_cvm_vcpu_state_idle				0	// The vCPU is not scheduled.
+#define noir_cvm_vcpu_state_ready				1	// The vCPU is in a run queue.
+#define noir_cvm_vcpu_state_running				2	// The vCPU is being run by a scheduler thread.
 
 // CPUID Leaves for NoirVisor Customizable VM.
 #define ncvm_cpuid_leaf_range_and_vendor_string			0x40000000
@@ -52,6 +61,11 @@ typedef enum _noir_cvm_intercept_code
 	cv_scheduler_pause=0x80000001
 }noir_cvm_intercept_code,*noir_cvm_intercept_code_p;
 
+// Per-intercept tables are indexed by intercept code.
+// Scheduler-relevant intercept codes are placed right after the regular codes.
+#define noir_cvm_intercept_index_limit		17
+#define noir_cvm_intercept_index(c)			(((c)&0x80000000)?(cv_interrupt_window+1+((c)&0x7fffffff)):(c))
+
 typedef enum _noir_cvm_register_type
 {
 	noir_cvm_general_purpose_register,
@@ -80,7 +94,10 @@ typedef enum _noir_cvm_vcpu_option_type
 {
 	noir_cvm_guest_vcpu_options,
 	noir_cvm_exception_bitmap,
-	noir_cvm_vcpu_priority
+	noir_cvm_vcpu_priority,
+	noir_cvm_exit_context_sections,
+	noir_cvm_vcpu_affinity_policy,
+	noir_cvm_vcpu_time_slice
 }noir_cvm_vcpu_option_type,*noir_cvm_vcpu_option_type_p;
 
 typedef union _noir_cvm_invalid_state_context
@@ -181,9 +198,19 @@ typedef struct _noir_cvm_cpuid_context
 	}leaf;
 }noir_cvm_cpuid_context,*noir_cvm_cpuid_context_p;
 
+// Optional sections of the exit context.
+#define noir_cvm_exit_section_vcpu_state		0
+#define noir_cvm_exit_section_code_segment		1
+#define noir_cvm_exit_section_rip_rflags		2
+#define noir_cvm_exit_section_all				0x7
+
+// The exit context is composed of the mandatory header and optional sections.
+// Optional sections are saved only if they are requested for the intercept code.
 typedef struct _noir_cvm_exit_context
 {
+	// Mandatory header...
 	noir_cvm_intercept_code intercept_code;
+	u32 sections;		// Valid optional sections.
 	union
 	{
 		noir_cvm_invalid_state_context invalid_state;
@@ -195,9 +222,7 @@ typedef struct _noir_cvm_exit_context
 		noir_cvm_memory_access_context memory_access;
 		noir_cvm_cpuid_context cpuid;
 	};
-	segment_register cs;
-	u64 rip;
-	u64 rflags;
+	// Optional sections...
 	struct
 	{
 		u32 cpl:2;
@@ -207,8 +232,23 @@ typedef struct _noir_cvm_exit_context
 		u32 instruction_length:4;
 		u32 reserved:23;
 	}vcpu_state;
+	segment_register cs;
+	u64 rip;
+	u64 rflags;
 }noir_cvm_exit_context,*noir_cvm_exit_context_p;
 
+// Option data to specify the optional sections to be saved for an intercept code.
+typedef union _noir_cvm_exit_section_option
+{
+	struct
+	{
+		u32 index:16;		// Use the noir_cvm_intercept_index macro.
+		u32 sections:8;
+		u32 reserved:8;
+	};
+	u32 value;
+}noir_cvm_exit_section_option,*noir_cvm_exit_section_option_p;
+
 typedef struct _noir_seg_state
 {
 	segment_register cs;
@@ -322,6 +362,60 @@ typedef struct _noir_cvm_event_injection
 	u32 error_code;
 }noir_cvm_event_injection,*noir_cvm_event_injection_p;
 
+// Maximum number of events pending in the queue of a vCPU.
+#define noir_cvm_event_queue_size			32
+
+// Pending events are sorted by ascending priority. The event to be injected next is the last one.
+// The queue is drained by the hypervisor on VM-Entry according to the interruptibility of the guest.
+typedef struct _noir_cvm_event_queue
+{
+	noir_cvm_event_injection events[noir_cvm_event_queue_size];
+	u32 count;
+	u32 lock;		// Bit 0 is the spin lock. The hypervisor only tries to acquire it.
+}noir_cvm_event_queue,*noir_cvm_event_queue_p;
+
+typedef struct _noir_cvm_exit_statistics
+{
+	u64 count;
+	u64 tsc;		// TSC ticks elapsed from VM-Exit to the next VM-Entry of the vCPU.
+}noir_cvm_exit_statistics,*noir_cvm_exit_statistics_p;
+
+typedef struct _noir_cvm_vcpu_statistics
+{
+	noir_cvm_exit_statistics exits[noir_cvm_intercept_index_limit];
+	u64 total_exits;		// Exits handled by NoirVisor without going to user hypervisor are included.
+	u64 injected_events;
+	struct
+	{
+		u64 guest;
+		u64 hypervisor;
+		u64 user;
+	}tsc;
+	struct
+	{
+		u64 migrations;		// Entries that invalidated the VMCB cache due to a processor change.
+		u64 pinned_runs;	// Runs that the thread was pinned to the processor owning the VMCB.
+		u64 rehomes;		// Times that soft-pinning gave up and let the vCPU migrate.
+	}affinity;
+}noir_cvm_vcpu_statistics,*noir_cvm_vcpu_statistics_p;
+
+// Affinity policies of vCPU scheduling.
+#define noir_cvm_affinity_free		0		// Let the vCPU run on any processor.
+#define noir_cvm_affinity_soft		1		// Prefer the processor owning the VMCB/VMCS.
+#define noir_cvm_affinity_hard		2		// Always run on the specified processor.
+
+typedef union _noir_cvm_vcpu_affinity
+{
+	struct
+	{
+		u32 processor:16;		// Target processor for hard pinning.
+		u32 policy:2;
+		u32 migration_cost:8;	// Soft pinning: consecutive runs away from home before migrating.
+		u32 reserved:6;
+	};
+	u32 value;
+}noir_cvm_vcpu_affinity,*noir_cvm_vcpu_affinity_p;
+
 typedef struct _noir_cvm_virtual_cpu
 {
 	noir_gpr_state gpr;
@@ -334,11 +428,24 @@ typedef struct _noir_cvm_virtual_cpu
 	u64 rflags;
 	u64 rip;
 	noir_cvm_event_injection injected_event;
+	noir_cvm_event_queue event_queue;
 	noir_cvm_exit_context exit_context;
 	noir_cvm_vcpu_options vcpu_options;
 	noir_cvm_vcpu_state_cache state_cache;
 	u32 exception_bitmap;
 	u32 scheduling_priority;
+	noir_cvm_vcpu_statistics statistics;
+	u8 exit_sections[noir_cvm_intercept_index_limit];
+	noir_cvm_vcpu_affinity affinity;
+	// Scheduler-related fields are protected by the lock of the run queue.
+	struct
+	{
+		list_entry ready_list;
+		u64 time_slice;		// TSC ticks the vCPU may run before being rotated.
+		u32 queue;			// Index of the run queue. All ones if not queued.
+		u32 level;			// Priority level the vCPU is queued at.
+		u32 state;
+	}scheduler;
 }noir_cvm_virtual_cpu,*noir_cvm_virtual_cpu_p;
 
 typedef union _noir_cvm_mapping_attributes
@@ -364,11 +471,22 @@ typedef struct _noir_cvm_address_mapping
 	noir_cvm_mapping_attributes attributes;
 }noir_cvm_address_mapping,*noir_cvm_address_mapping_p;
 
+// Each processor has its own run queue so that scheduler threads rarely contend.
+typedef struct _noir_cvm_run_queue
+{
+	list_entry head[noir_cvm_vcpu_priority_levels];
+	noir_reslock lock;
+	u32 ready_levels;	// Bitmap of priority levels with ready vCPUs.
+	u32 count;
+}noir_cvm_run_queue,*noir_cvm_run_queue_p;
+
 typedef struct _noir_cvm_virtual_machine
 {
 	list_entry active_vm_list;
 	u32 pid;
 	noir_reslock vcpu_list_lock;
+	noir_cvm_run_queue_p run_queue;
+	u32 run_queues;
 }noir_cvm_virtual_machine,*noir_cvm_virtual_machine_p;
 
 #if defined(_central_hvm)
@@ -378,6 +496,8 @@ noir_status nvc_svmc_create_vcpu(noir_cvm_virtual_cpu_p* virtual_cpu,noir_cvm_vi
 void nvc_svmc_release_vcpu(noir_cvm_virtual_cpu_p vcpu);
 noir_status nvc_svmc_run_vcpu(noir_cvm_virtual_cpu_p vcpu);
 noir_status nvc_svmc_rescind_vcpu(noir_cvm_virtual_cpu_p vcpu);
+noir_status nvc_svmc_schedule_vcpu(noir_cvm_virtual_cpu_p vcpu);
+noir_status nvc_svmc_run_scheduler(noir_cvm_virtual_machine_p vm,noir_cvm_virtual_cpu_p *vcpu,u32 *vcpu_id);
 noir_cvm_virtual_cpu_p nvc_svmc_reference_vcpu(noir_cvm_virtual_machine_p vm,u32 vcpu_id);
 noir_status nvc_svmc_set_mapping(noir_cvm_virtual_machine_p vm,noir_cvm_address_mapping_p mapping_info);
 u32 nvc_svmc_get_vm_asid(noir_cvm_virtual_machine_p vm);
@@ -26,8 +26,62 @@
 
 #define noir_mshv_npiep_prevent_all			0xF
 
+// The hypercall page loads this signature into eax before executing
+// vmcall/vmmcall so that Hv#1 hypercalls can be told from NoirVisor's.
+#define noir_mshv_hypercall_signature		0x31237648		// "Hv#1"
+
+// TLB flushes requested by Hv#1 hypercalls
+#define noir_mshv_tlb_flush_non_global		0x1
+#define noir_mshv_tlb_flush_all				0x2
+
+#define noir_mshv_sint_count				16
+#define noir_mshv_stimer_count				4
+
+typedef struct _noir_mshv_stimer
+{
+	u64 config;
+	u64 count;
+	u64 deadline;		// Reference time of the next expiration.
+	u64 expiration;		// Reference time of the expiration pending for delivery.
+	bool pending;		// The expiration message is not yet delivered.
+}noir_mshv_stimer,*noir_mshv_stimer_p;
+
+typedef struct _noir_mshv_synic
+{
+	u64 scontrol;
+	u64 siefp;
+	u64 simp;
+	u64 sint[noir_mshv_sint_count];
+	void* siefp_page;
+	void* simp_page;
+	// Vectors asserted by SynIC but not yet injected.
+	u32 pending_vectors[8];
+	// Bitmap of enabled synthetic timers.
+	u32 armed_timers;
+}noir_mshv_synic,*noir_mshv_synic_p;
+
+typedef struct _noir_mshv_vapic
+{
+	u64 vp_assist;
+	void* vp_assist_page;
+	// Vectors injected by NoirVisor and not yet completed by the guest.
+	u32 in_service[8];
+	// The guest was told that EOI is not required for the synthetic interrupt in service.
+	bool eoi_avoided;
+}noir_mshv_vapic,*noir_mshv_vapic_p;
+
 typedef struct _noir_mshv_vcpu
 {
 	void* root_vcpu;
 	u64 npiep_config;
+	noir_mshv_synic synic;
+	noir_mshv_stimer stimer[noir_mshv_stimer_count];
+	noir_mshv_vapic vapic;
+	// TLB flushes requested by any vCPU are applied at the next VM-Entry.
+	u32v tlb_flush_pending;
+	// Flushes requested while this vCPU waits for other vCPUs. They are applied after the wait.
+	u32 tlb_flush_deferred;
+	// Set if an NMI is sent to force this vCPU to exit.
+	u32v kick_pending;
+	u32 apic_id;
 }noir_mshv_vcpu,*noir_mshv_vcpu_p;
\ No newline at end of file
@@ -61,6 +61,7 @@
 #define noir_cvm_run_vcpu					0x10001
 #define noir_cvm_dump_vcpu_vmcb				0x10002
 #define noir_cvm_set_vcpu_options			0x10003
+#define noir_cvm_fetch_exit_context			0x10004
 
 struct _noir_cvm_virtual_machine;
 
@@ -126,10 +127,15 @@ typedef struct _noir_hypervisor
 			u64 disable_patchguard:1;
 			u64 nested_virtualization:1;
 			u64 kva_shadow_presence:1;
-			u64 reserved:59;
+			u64 exit_profiling:1;
+			u64 exit_tracing:1;
+			u64 reserved:56;
 		};
 		u64 value;
 	}options;		// Enable certain features.
+	noir_exit_histogram_p exit_histograms;		// Per-processor histograms of exit latencies.
+	noir_exit_trace_ring_p exit_traces;			// Per-processor rings of captured exits.
+	noir_numa_alloc_report numa_report;			// Placement of per-processor structures.
 	struct
 	{
 		large_integer support_mask;
@@ -149,6 +155,18 @@ typedef struct _noir_hypervisor
 	u64 reserved[0x10];	// Reserve 128 bytes for Relative HVM.
 }noir_hypervisor,*noir_hypervisor_p;
 
+#define noir_vcpu_setup_no_failure		0xFFFFFFFF
+
+// vCPUs are prepared in parallel. Their failures are collected here.
+typedef struct _noir_vcpu_setup_context
+{
+	noir_hypervisor_p hvm;
+	u32v failures;				// Number of vCPUs that failed.
+	u32v failed_processor;		// The processor that failed first.
+	u32 status;					// Status of the first failure.
+	u32 reserved;
+}noir_vcpu_setup_context,*noir_vcpu_setup_context_p;
+
 #if !defined(_central_hvm) && !defined(_code_integrity)
 typedef struct _noir_hook_page
 {
@@ -192,15 +210,34 @@ extern ulong_ptr orig_system_call;
 #endif
 #if defined(_mshv_core)
 void nvc_svm_reconfigure_npiep_interceptions(void* vcpu);
+void nvc_vt_reconfigure_npiep_interceptions(void* vcpu);
 #elif defined(_vt_core)
+void nvc_vt_reconfigure_npiep_interceptions(noir_vt_vcpu_p vcpu);
 #elif defined(_svm_core)
 void nvc_svm_reconfigure_npiep_interceptions(noir_svm_vcpu_p vcpu);
 #endif
+noir_mshv_vcpu_p nvc_svm_get_mshv_vcpu(u32 vp_index);
+noir_mshv_vcpu_p nvc_vt_get_mshv_vcpu(u32 vp_index);
 // Functions from MSHV Core.
 u32 fastcall nvc_mshv_build_cpuid_handlers();
 void fastcall nvc_mshv_teardown_cpuid_handlers();
 u64 fastcall nvc_mshv_rdmsr_handler(noir_mshv_vcpu_p vcpu,u32 index);
-void fastcall nvc_mshv_wrmsr_handler(noir_mshv_vcpu_p vcpu,u32 index,u64 val);
+bool fastcall nvc_mshv_wrmsr_handler(noir_mshv_vcpu_p vcpu,u32 index,u64 val);
+void fastcall nvc_mshv_calibrate_reference_time();
+void fastcall nvc_mshv_initialize_apic_access();
+void fastcall nvc_mshv_finalize_apic_access();
+void fastcall nvc_mshv_initialize_vcpu_kicker();
+void fastcall nvc_mshv_finalize_vcpu_kicker();
+void fastcall nvc_mshv_initialize_synic(noir_mshv_vcpu_p vcpu);
+void fastcall nvc_mshv_capture_apic_id(noir_mshv_vcpu_p vcpu);
+bool fastcall nvc_mshv_poll_synthetic_timers(noir_mshv_vcpu_p vcpu);
+u64 fastcall nvc_mshv_get_synthetic_timer_countdown(noir_mshv_vcpu_p vcpu);
+u8 fastcall nvc_mshv_acknowledge_synthetic_interrupt(noir_mshv_vcpu_p vcpu);
+bool fastcall nvc_mshv_hypercall_handler(noir_mshv_vcpu_p vcpu,noir_gpr_state_p gpr_state);
+
+// Functions from Central HVM.
+void nvc_initialize_vcpu_setup_context(noir_vcpu_setup_context_p setup,noir_hypervisor_p hvm);
+void nvc_record_vcpu_setup_failure(noir_vcpu_setup_context_p setup,u32 processor_id,u32 status);
 
 // Miscellaneous
 u64 noir_query_enabled_features_in_system();
@@ -274,4 +311,28 @@ extern noir_mshv_msr_handler*	hvm_msr_handlers;
 #if defined(_mshv_msr)
 u64v noir_mshv_guest_os_id=0;
 u64v noir_mshv_hypercall_ctrl=0;
+u64v noir_mshv_reference_tsc_ctrl=0;
+#endif
+#if defined(_mshv_synic)
+u64 noir_mshv_tsc_frequency=0;
+u64 noir_mshv_reference_tsc_scale=0;
+u64 noir_mshv_reference_tsc_offset=0;
+bool noir_mshv_invariant_tsc=false;
+bool noir_mshv_stimer_wakeup=false;		// Set by the selected core if it can exit at the deadline of synthetic timers.
+#else
+extern u64 noir_mshv_tsc_frequency;
+extern u64 noir_mshv_reference_tsc_scale;
+extern u64 noir_mshv_reference_tsc_offset;
+extern bool noir_mshv_invariant_tsc;
+extern bool noir_mshv_stimer_wakeup;
+#endif
+#if defined(_mshv_apic)
+void* noir_mshv_xapic_page=null;
+#else
+extern void* noir_mshv_xapic_page;
+#endif
+#if defined(_mshv_hypercall)
+void* noir_mshv_kick_nmi_handle=null;
+#else
+extern void* noir_mshv_kick_nmi_handle;
 #endif
\ No newline at end of file
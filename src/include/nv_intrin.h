@@ -108,6 +108,11 @@ void noir_xsetbv(u32 xcr_id,u64 val);
 #define noir_rdtsc		__rdtsc
 #define noir_rdtscp		__rdtscp
 
+// High 64 bits of 128-bit product
+#if defined(_amd64)
+#define noir_umulh		__umulh
+#endif
+
 // Memory Barrier instructions.
 #define noir_load_fence		_mm_lfence
 #define noir_store_fence	_mm_sfence
@@ -194,6 +199,17 @@ void inline noir_cpuid(u32 ia,u32 ic,u32* a,u32* b,u32* c,u32* d)
 	if(d)*d=info[3];
 }
 
+#if !defined(_amd64)
+// There is no 128-bit multiplication intrinsic in 32-bit mode.
+u64 inline noir_umulh(u64 a,u64 b)
+{
+	u64 al=(u32)a,ah=a>>32,bl=(u32)b,bh=b>>32;
+	u64 ll=al*bl,lh=al*bh,hl=ah*bl,hh=ah*bh;
+	u64 mid=(ll>>32)+(u32)lh+(u32)hl;
+	return hh+(lh>>32)+(hl>>32)+(mid>>32);
+}
+#endif
+
 u8 inline noir_set_bitmap(void* bitmap,u32 bit_position)
 {
 	u32* bmp=(u32*)bitmap;
@@ -277,6 +277,143 @@ typedef struct _noir_cpuid_general_info
 	u32 edx;
 }noir_cpuid_general_info,*noir_cpuid_general_info_p;
 
+typedef void (fastcall *noir_cpuid_handler)
+(
+ u32 leaf,
+ u32 subleaf,
+ noir_cpuid_general_info_p info
+);
+
+// Number of leaves cached per leaf class (standard and extended).
+#define noir_cpuid_cache_leaf_limit		0x20
+// Number of subleaves cached in total.
+#define noir_cpuid_cache_subleaf_limit	0x40
+
+#define noir_cpuid_cache_native			0	// The leaf is not cached. Execute the handler instead.
+#define noir_cpuid_cache_plain			1	// The leaf is cached regardless of subleaf.
+#define noir_cpuid_cache_indexed		2	// The leaf is cached per subleaf.
+
+typedef struct _noir_cpuid_cache_leaf
+{
+	u8 type;
+	u8 first;		// Position of subleaf 0 in the subleaf table.
+	u8 count;		// Number of subleaves cached in the subleaf table.
+	u8 reserved;
+}noir_cpuid_cache_leaf,*noir_cpuid_cache_leaf_p;
+
+// Results of CPUID are precomputed with the masks of hypervisor applied.
+// Index 0 is for standard leaves. Index 1 is for extended leaves.
+typedef struct _noir_cpuid_cache
+{
+	noir_cpuid_general_info info[2][noir_cpuid_cache_leaf_limit];
+	noir_cpuid_cache_leaf leaf[2][noir_cpuid_cache_leaf_limit];
+	u32 leaves[2];
+	u32 subleaves;
+	noir_cpuid_general_info subleaf[noir_cpuid_cache_subleaf_limit];
+}noir_cpuid_cache,*noir_cpuid_cache_p;
+
+// Number of log-scale buckets in the exit-latency histogram.
+#define noir_exit_histogram_buckets		32
+// Number of exit codes that can be profiled.
+#define noir_exit_histogram_slots		0xC0
+// Specify this processor number to query the histogram merged from all processors.
+#define noir_exit_histogram_all_processors	0xFFFFFFFF
+
+// Bucket n counts the exits whose latency is in range [2^n,2^(n+1)) ticks of TSC.
+// Exits that took less than two ticks are counted in bucket 0.
+typedef struct _noir_exit_histogram_slot
+{
+	u64 count;
+	u64 total;		// Sum of latencies in ticks of TSC.
+	u64 maximum;
+	u64 bucket[noir_exit_histogram_buckets];
+}noir_exit_histogram_slot,*noir_exit_histogram_slot_p;
+
+// The histogram is only written by the processor that it serves.
+// Resetting is requested by other processors and is performed by the serving processor on its next exit.
+typedef struct _noir_exit_histogram
+{
+	noir_exit_histogram_slot slot[noir_exit_histogram_slots];
+	u32 reset_pending;
+	u32 reserved;
+}noir_exit_histogram,*noir_exit_histogram_p;
+
+// Number of records in the exit trace ring of each processor. Must be power of 2.
+#define noir_exit_trace_ring_size		0x100
+
+// A record captures an exit with the state before and after it is handled, so that it can be replayed offline.
+// Format of exit code and exit information:
+// SVM: Exit code, EXITINFO1 and EXITINFO2.
+// VMX: Basic exit reason, exit qualification and guest linear address.
+typedef struct _noir_exit_trace_record
+{
+	u64 sequence;		// Zero if the record is being written or is never written.
+	u64 timestamp;
+	i64 exit_code;
+	u64 exit_info[2];
+	u64 rip[2];			// Guest RIP before and after handling.
+	u64 event;			// The event to be injected by the handler.
+	noir_gpr_state gpr[2];	// Guest GPRs before and after handling.
+}noir_exit_trace_record,*noir_exit_trace_record_p;
+
+// The ring is only written by the processor that it serves.
+typedef struct _noir_exit_trace_ring
+{
+	u64 head;
+	u64 reserved;
+	noir_exit_trace_record records[noir_exit_trace_ring_size];
+}noir_exit_trace_ring,*noir_exit_trace_ring_p;
+
+// Use this node number if the allocation has no preference of NUMA node.
+#define noir_numa_any_node				0xFFFFFFFF
+
+// Outcomes of NUMA-aware allocations.
+typedef struct _noir_numa_alloc_report
+{
+	u32 requested;		// Allocated with the node requested. The system may still place it off the node.
+	u32 fallback;		// The system refused the request. Allocated from any node.
+	u32 failed;
+	u32 reserved;
+}noir_numa_alloc_report,*noir_numa_alloc_report_p;
+
+// Number of pages allocated to a page pool in one refill. Smaller chunks are tried if contiguous memory is fragmented.
+#define noir_page_pool_chunk_pages		16
+
+typedef struct _noir_page_pool_chunk
+{
+	struct _noir_page_pool_chunk *next;
+	void* virt;
+	u64 phys;
+	u32 pages;
+	u32 reserved;
+}noir_page_pool_chunk,*noir_page_pool_chunk_p;
+
+// A free page is zeroed except for this header, which is cleared as the page is allocated.
+typedef struct _noir_page_pool_entry
+{
+	struct _noir_page_pool_entry *next;
+	u64 phys;
+}noir_page_pool_entry,*noir_page_pool_entry_p;
+
+// The pool supplies page-sized, page-aligned and physically contiguous pages (e.g.: paging structures).
+// The pool is not locked. It must only be operated by its owner.
+typedef struct _noir_page_pool
+{
+	noir_page_pool_chunk_p chunks;
+	noir_page_pool_entry_p free_list;
+	noir_numa_alloc_report_p report;	// Optional. Outcomes of refills are counted here.
+	u32 free_pages;
+	u32 total_pages;
+	u32 node;							// Chunks are preferably allocated from this node.
+	u32 reserved;
+}noir_page_pool,*noir_page_pool_p;
+
+// Previous affinity of the thread. The content is defined by the XPF. (e.g: GROUP_AFFINITY in Windows)
+typedef struct _noir_thread_affinity
+{
+	u64 value[2];
+}noir_thread_affinity,*noir_thread_affinity_p;
+
 typedef struct _noir_disasm_request
 {
 	// Input
@@ -307,7 +444,7 @@ typedef struct _noir_basic_operand
 			u64 reg2:4;				// Bits	52-55
 			u64 operand_size:2;		// Bits	56-57
 			u64 base_valid:1;		// Bit	58
-			u64 reserved:1;			// Bit	59
+			u64 high_byte_regs:1;	// Bit	59
 			u64 mem_valid:1;		// Bit	60
 			u64 reg_valid:2;		// Bits	61-62
 			u64 imm_valid:1;		// Bit	63
@@ -321,6 +458,31 @@ typedef struct _noir_basic_operand
 	}immediate;
 }noir_basic_operand,*noir_basic_operand_p;
 
+// Status Codes of Instruction Emulator
+#define noir_emu_status_success			0
+#define noir_emu_status_unsupported		1	// The instruction is not supported by the emulator.
+#define noir_emu_status_memory_fault	2	// The memory accessor failed. Instruction pointer is not advanced.
+#define noir_emu_status_rep_partial		3	// The REP instruction is not completed in this call. Instruction pointer is not advanced.
+
+// The accessor reads or writes guest memory at the linear address.
+typedef bool (*noir_emu_memory_accessor)(void* context,ulong_ptr address,void* buffer,u32 size,bool write);
+
+typedef struct _noir_emu_context
+{
+	// Input
+	noir_gpr_state_p gpr;			// RSP must be synchronized by the caller.
+	ulong_ptr segment_base[6];		// ES,CS,SS,DS,FS,GS
+	noir_emu_memory_accessor memory_accessor;
+	void* accessor_context;
+	// Input and Output
+	ulong_ptr rip;
+	ulong_ptr rflags;
+	u8 bits;
+	// Output
+	u8 length;
+	u8 reserved[6];
+}noir_emu_context,*noir_emu_context_p;
+
 typedef union _noir_addr64_translator_l4
 {
 	struct
@@ -385,6 +547,9 @@ u16 noir_get_segment_attributes(ulong_ptr gdt_base,u16 selector);
 void noir_generic_call(noir_broadcast_worker worker,void* context);
 u32 noir_get_processor_count();
 u32 noir_get_current_processor();
+u32 noir_get_processor_node(u32 processor_id);
+void noir_set_thread_affinity(u32 processor_id,noir_thread_affinity_p previous_affinity);
+void noir_revert_thread_affinity(noir_thread_affinity_p previous_affinity);
 u32 noir_get_instruction_length(void* code,bool long_mode);
 u32 noir_get_instruction_length_ex(void* code,u8 bits);
 u32 noir_disasm_instruction(void* code,char* mnemonic,size_t mnemonic_length,u8 bits,u64 virtual_address);
@@ -392,6 +557,9 @@ void noir_decode_instruction16(u8* code,size_t code_length,void* decode_result);
 void noir_decode_instruction32(u8* code,size_t code_length,void* decode_result);
 void noir_decode_instruction64(u8* code,size_t code_length,void* decode_result);
 void noir_decode_basic_operand(void* decode_result,noir_basic_operand_p basic_operand);
+ulong_ptr noir_emu_read_gpr(noir_gpr_state_p gpr,u8 index,u8 size,bool high_byte);
+void noir_emu_write_gpr(noir_gpr_state_p gpr,u8 index,u8 size,bool high_byte,ulong_ptr value);
+u32 noir_emulate_instruction(noir_emu_context_p context,u8* code,size_t code_length);
 
 // Doubly-Linked List Facility
 void noir_initialize_list_entry(list_entry_p entry);
@@ -403,6 +571,30 @@ void noir_remove_list_entry(list_entry_p entry);
 u32 noir_find_clear_bit(void* bitmap,u32 limit);
 u32 noir_find_set_bit(void* bitmap,u32 limit);
 
+// CPUID Cache Facility
+void noir_build_cpuid_cache(noir_cpuid_cache_p cache,noir_cpuid_handler handler);
+bool noir_query_cpuid_cache(noir_cpuid_cache_p cache,u32 leaf,u32 subleaf,ulong_ptr cr4,noir_cpuid_general_info_p info);
+
+// Exit Histogram Facility
+void noir_record_exit_latency(noir_exit_histogram_p histogram,u32 slot,u64 ticks);
+void noir_reset_exit_histogram(noir_exit_histogram_p histogram);
+void noir_merge_exit_histogram(noir_exit_histogram_p target,noir_exit_histogram_p source);
+
+// Exit Trace Facility
+noir_exit_trace_record_p noir_begin_exit_trace(noir_exit_trace_ring_p ring,i64 exit_code,u64 exit_info1,u64 exit_info2,u64 rip,noir_gpr_state_p gpr_state);
+void noir_end_exit_trace(noir_exit_trace_ring_p ring,noir_exit_trace_record_p record,u64 rip,u64 event,noir_gpr_state_p gpr_state);
+
+// Page Pool Facility
+void noir_initialize_page_pool(noir_page_pool_p pool,u32 node,noir_numa_alloc_report_p report);
+bool noir_reserve_pool_pages(noir_page_pool_p pool,u32 count);
+void* noir_alloc_pool_page(noir_page_pool_p pool,u64p phys);
+void noir_free_pool_page(noir_page_pool_p pool,void* virtual_address);
+void noir_finalize_page_pool(noir_page_pool_p pool);
+
+// NUMA Placement Facility
+void* noir_alloc_node_contd_memory(size_t length,u32 node,noir_numa_alloc_report_p report);
+void* noir_alloc_node_2mb_page(u32 node,noir_numa_alloc_report_p report);
+
 // Processor Extension Register Context Instructions
 // Use when switching from/to customizable VMs.
 void noir_fxsave(noir_fx_state_p state);
@@ -421,6 +613,8 @@ void* noir_alloc_contd_memory(size_t length);
 void* noir_alloc_nonpg_memory(size_t length);
 void* noir_alloc_paged_memory(size_t length);
 void* noir_alloc_2mb_page();
+void* noir_alloc_contd_memory_on_node(size_t length,u32 node);
+void* noir_alloc_2mb_page_on_node(u32 node);
 void noir_free_contd_memory(void* virtual_address);
 void noir_free_nonpg_memory(void* virtual_address);
 void noir_free_paged_memory(void* virtual_address);
@@ -429,6 +623,7 @@ u64 noir_get_user_physical_address(void* virtual_address);
 u64 noir_get_physical_address(void* virtual_address);
 u64 noir_get_current_process_cr3();
 void* noir_map_physical_memory(u64 physical_address,size_t length);
+void* noir_map_uncached_memory(u64 physical_address,size_t length);
 void noir_unmap_physical_memory(void* virtual_address,size_t length);
 void* noir_find_virt_by_phys(u64 physical_address);
 bool noir_query_page_attributes(void* virtual_address,bool *valid,bool *locked,bool *large_page);
@@ -438,7 +633,7 @@ void noir_copy_memory(void* dest,void* src,u32 cch);
 void cdecl nv_dprintf(const char* format,...);
 void cdecl nv_tracef(const char* format,...);
 void cdecl nv_panicf(const char* format,...);
-void cdecl nv_async_dprintf(const char* format,...);
+void cdecl nv_async_tracef(u32 argc,const char* format,...);
 void cdecl nvci_tracef(const char* format,...);
 void cdecl nvci_panicf(const char* format,...);
 
@@ -459,5 +654,25 @@ void noir_acquire_reslock_shared_ex(noir_reslock lock);
 void noir_acquire_reslock_exclusive(noir_reslock lock);
 void noir_release_reslock(noir_reslock lock);
 
+// Parallel Passive Call Facility
+// A worker thread of a parallel passive call.
+typedef struct _noir_passive_call_thread
+{
+	noir_broadcast_worker worker;
+	void* context;
+	noir_thread thread;
+	u32 processor_id;
+	u32 reserved;
+}noir_passive_call_thread,*noir_passive_call_thread_p;
+
+void noir_generic_passive_call(noir_broadcast_worker worker,void* context);
+
+// NMI Facility
+// The callback is invoked in the NMI handler of the system. It returns whether the NMI is claimed.
+typedef u8 (*noir_nmi_callback)(void* context,u8 handled);
+void* noir_register_nmi_callback(noir_nmi_callback callback,void* context);
+void noir_unregister_nmi_callback(void* handle);
+
 // Miscellaneous
-void noir_qsort(void* base,u32 num,u32 width,noir_sorting_comparator comparator);
\ No newline at end of file
+void noir_qsort(void* base,u32 num,u32 width,noir_sorting_comparator comparator);
+u64 noir_query_performance_counter(u64* frequency);
\ No newline at end of file
@@ -158,6 +158,24 @@ typedef u32 noir_status;
 
 #define noir_user_page_violation		0xC0000009
 
+/*
+  Status Indicator: noir_vcpu_already_scheduled
+  If an attempt to schedule a vCPU that is
+  already queued or running in the scheduler,
+  then this value is supposed to be returned.
+*/
+
+#define noir_vcpu_already_scheduled		0xC000000A
+
+/*
+  Status Indicator: noir_no_ready_vcpu
+  If the scheduler finds no ready vCPU to run
+  in any of the run queues of the VM,
+  then this value is supposed to be returned.
+*/
+
+#define noir_no_ready_vcpu				0xC000000B
+
 /*
   Status Indicator: noir_not_intel
   If a procedure is specific for Intel Processor,
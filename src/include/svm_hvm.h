@@ -23,6 +23,7 @@
 #define noir_svm_run_custom_vcpu			0x10001
 #define noir_svm_dump_vcpu_vmcb				0x10002
 #define noir_svm_set_vcpu_options			0x10003
+#define noir_svm_fetch_exit_context			0x10004
 
 // Definition of Enabled features
 #define noir_svm_vmcb_caching				1		// Bit 0
@@ -35,7 +36,14 @@
 #define noir_svm_kva_shadow_present			128		// Bit 7
 
 // Number of nested VMCBs to be cached.
+// Define this macro in build options to cache more VMCBs for L1 hypervisors running many L2 vCPUs.
+#if !defined(noir_svm_cached_nested_vmcb)
 #define noir_svm_cached_nested_vmcb			32
+#endif
+
+// Cached nested VMCBs are indexed by a hash on the VMCB physical address.
+#define noir_svm_nested_vmcb_hash_bits		8
+#define noir_svm_nested_vmcb_hash_buckets	(1<<noir_svm_nested_vmcb_hash_bits)
 
 // When synchronizing nested VMCB for nested VM-Exits,
 // most fields in VMCB requires synchronization.
@@ -85,10 +93,15 @@ typedef struct _noir_svm_virtual_msr
 
 typedef struct _noir_svm_nested_vcpu_node
 {
+	struct _noir_svm_nested_vcpu_node* hash_next;
+	struct _noir_svm_nested_vcpu_node* lru_prev;
+	struct _noir_svm_nested_vcpu_node* lru_next;
 	memory_descriptor vmcb_t;
 	memory_descriptor vmcb_c;
 	u64 last_tsc;
 	u64 entry_counter;
+	// VMCB state groups not yet synchronized to L2T VMCB, in layout of VMCB clean bits.
+	u32 dirty_groups;
 }noir_svm_nested_vcpu_node,*noir_svm_nested_vcpu_node_p;
 
 typedef struct _noir_svm_nested_vcpu
@@ -96,6 +109,13 @@ typedef struct _noir_svm_nested_vcpu
 	u64 hsave_gpa;
 	void* hsave_hva;
 	noir_svm_nested_vcpu_node nested_vmcb[noir_svm_cached_nested_vmcb];
+	noir_svm_nested_vcpu_node_p vmcb_hash[noir_svm_nested_vmcb_hash_buckets];
+	// The most-recently-used VMCB is at head. The victim of replacement is at tail.
+	struct
+	{
+		noir_svm_nested_vcpu_node_p head;
+		noir_svm_nested_vcpu_node_p tail;
+	}vmcb_lru;
 	struct
 	{
 		u64 svme:1;
@@ -127,6 +147,9 @@ typedef struct _noir_svm_vcpu
 	noir_svm_virtual_msr virtual_msr;
 	noir_svm_nested_vcpu nested_hvm;
 	noir_cvm_virtual_cpu cvm_state;
+	noir_cpuid_cache cpuid_cache;
+	noir_exit_histogram_p exit_histogram;
+	noir_exit_trace_ring_p exit_trace;
 	u32 cpuid_fms;
 	u16 enabled_feature;
 	u8 status;
@@ -161,6 +184,7 @@ typedef struct _noir_svm_custom_npt_manager
 		struct _noir_npt_pte_descriptor *head;
 		struct _noir_npt_pte_descriptor *tail;
 	}pte;
+	noir_page_pool pool;	// Paging structures are allocated from this pool.
 }noir_svm_custom_npt_manager,*noir_svm_custom_npt_manager_p;
 
 // Some bits are host-owned. Therefore, Guest's bit must be saved accordingly.
@@ -188,13 +212,23 @@ typedef struct _noir_svm_custom_vcpu
 		struct
 		{
 			u64 prev_virq:1;	// Required for interrupt-window interception.
-			u64 reserved:62;
+			u64 event_window:1;	// Interrupt window is requested for the event queue.
+			u64 reserved:61;
 			u64 rescission:1;
 		};
 		u64 value;
 	}special_state;
 	u64 lasted_tsc;
-	u32 proc_id;
+	// Timestamps for profiling the vCPU.
+	struct
+	{
+		u64 entry;		// TSC of last entry to the guest.
+		u64 exit;		// TSC of last exit to the user hypervisor.
+		u32 index;		// Statistics index of last exit to the user hypervisor.
+	}timestamp;
+	u32 proc_id;		// Processor owning the cached VMCB state. All ones if none.
+	u32 vcpu_id;
+	u32 away_runs;		// Consecutive runs away from the owning processor.
 }noir_svm_custom_vcpu,*noir_svm_custom_vcpu_p;
 
 typedef struct _noir_svm_custom_vm
@@ -234,19 +268,25 @@ void nvc_svm_host_nmi_handler(void);
 void nvc_svm_host_ready_nmi(void);
 void fastcall nvc_svm_reserved_cpuid_handler(u32* info);
 void nvc_svm_set_mshv_handler(bool option);
+void nvc_svm_build_cpuid_cache(noir_svm_vcpu_p vcpu);
 bool nvc_svm_build_cpuid_handler();
 void nvc_svm_teardown_cpuid_handler();
 bool nvc_svm_build_exit_handler();
 void nvc_svm_teardown_exit_handler();
 void nvc_svm_initialize_cvm_vmcb(noir_svm_custom_vcpu_p vmcb);
 void nvc_svm_dump_guest_vcpu_state(noir_svm_custom_vcpu_p vcpu);
+void nvc_svm_save_exit_context(noir_svm_custom_vcpu_p vcpu,u32 sections);
+void nvc_svm_drain_event_queue(noir_svm_custom_vcpu_p cvcpu);
+void nvc_svm_cancel_event_window(noir_svm_custom_vcpu_p cvcpu);
 void nvc_svm_set_guest_vcpu_options(noir_svm_custom_vcpu_p vcpu);
 void nvc_svm_switch_to_guest_vcpu(noir_gpr_state_p gpr_state,noir_svm_vcpu_p vcpu,noir_svm_custom_vcpu_p cvcpu);
 void nvc_svm_switch_to_host_vcpu(noir_gpr_state_p gpr_state,noir_svm_vcpu_p vcpu);
 void nvc_svm_emulate_init_signal(noir_gpr_state_p gpr_state,void* vmcb,u32 cpuid_fms);
 void nvc_svmn_synchronize_to_l2t_vmcb(noir_svm_nested_vcpu_node_p nvcpu);
 void nvc_svmn_synchronize_to_l2c_vmcb(noir_svm_nested_vcpu_node_p nvcpu);
-void nvc_svmn_insert_nested_vmcb(noir_svm_vcpu_p vcpu,memory_descriptor_p vmcb);
+void nvc_svmn_initialize_nested_vmcb_cache(noir_svm_vcpu_p vcpu);
+noir_svm_nested_vcpu_node_p nvc_svmn_search_nested_vmcb(noir_svm_vcpu_p vcpu,u64 vmcb_pa);
+noir_svm_nested_vcpu_node_p nvc_svmn_insert_nested_vmcb(noir_svm_vcpu_p vcpu,memory_descriptor_p vmcb);
 u8 nvc_npt_get_host_pat_index(u8 type);
 noir_status nvc_svmc_initialize_cvm_module();
 void nvc_svmc_finalize_cvm_module();
\ No newline at end of file
@@ -20,6 +20,7 @@
 
 #define noir_nvt_vmxe			0
 #define noir_nvt_vmxon			1
+#define noir_nvt_shadowed		2
 
 // Constant for TSC offseting by Assembly Part.
 #define noir_vt_tsc_asm_offset		666		// To be fine tuned.
@@ -32,12 +33,26 @@
 #define noir_vt_syscall_hook		16		// Bit	4
 #define noir_vt_kva_shadow_presence	32		// Bit	5
 
+// Indices of VMCS fields cached on VM-Exit.
+#define noir_vt_cached_guest_rip			0
+#define noir_vt_cached_guest_rsp			1
+#define noir_vt_cached_guest_cr0			2
+#define noir_vt_cached_guest_cr3			3
+#define noir_vt_cached_guest_cr4			4
+#define noir_vt_cached_exit_qualification	5
+#define noir_vt_cached_instruction_length	6
+#define noir_vt_cached_field_limit			7
+
 typedef struct _noir_vt_hvm
 {
 	memory_descriptor msr_bitmap;
 	memory_descriptor io_bitmap_a;
 	memory_descriptor io_bitmap_b;
+	memory_descriptor vmread_bitmap;
+	memory_descriptor vmwrite_bitmap;
 	u32 hvm_cpuid_leaf_max;
+	u32 preemption_timer_rate;		// The VMX-Preemption Timer counts down by 1 every 2^rate TSC ticks.
+	bool shadow_ro_fields;
 }noir_vt_hvm,*noir_vt_hvm_p;
 
 typedef struct _noir_vt_msr_entry
@@ -61,9 +76,20 @@ typedef struct _noir_vt_nested_vcpu
 	memory_descriptor vmcs_c;
 	// Abstracted-to-CPU VMCS.
 	memory_descriptor vmcs_t;
+	// Shadow VMCS for hardware VMCS shadowing.
+	memory_descriptor vmcs_s;
 	u32 status;
 }noir_vt_nested_vcpu,*noir_vt_nested_vcpu_p;
 
+// Fields are read from VMCS on first use in a VM-Exit.
+// Dirty fields are written back before VM-Entry.
+typedef struct _noir_vt_vmcs_cache
+{
+	ulong_ptr value[noir_vt_cached_field_limit];
+	u32 valid;
+	u32 dirty;
+}noir_vt_vmcs_cache,*noir_vt_vmcs_cache_p;
+
 struct _noir_ept_manager;
 
 typedef struct _noir_vt_vcpu
@@ -77,6 +103,10 @@ typedef struct _noir_vt_vcpu
 	noir_vt_virtual_msr virtual_msr;
 	noir_vt_nested_vcpu nested_vcpu;
 	noir_mshv_vcpu mshvcpu;
+	noir_cpuid_cache cpuid_cache;
+	noir_vt_vmcs_cache vmcs_cache;
+	noir_exit_histogram_p exit_histogram;
+	noir_exit_trace_ring_p exit_trace;
 	u32 family_ext;		// Cached info of Extended Family.
 	u8 status;
 	u8 enabled_feature;
@@ -146,9 +176,15 @@ void nvc_vt_teardown_exit_handlers();
 void nvc_vt_resume_without_entry(noir_gpr_state_p state);
 void nvc_vt_exit_handler_a(void);
 void nvc_vt_set_mshv_handler(bool option);
+void nvc_vt_build_cpuid_cache(noir_vt_vcpu_p vcpu);
+void nvc_vt_flush_vmcs_cache(noir_vt_vcpu_p vcpu);
 void noir_vt_vmsuccess();
 void noir_vt_vmfail_invalid();
 void noir_vt_vmfail_valid();
 void noir_vt_vmfail(noir_vt_nested_vcpu_p nested_vcpu,u32 message);
 bool noir_vt_nested_vmread(void* vmcs,u32 encoding,ulong_ptr* data);
-bool noir_vt_nested_vmwrite(void* vmcs,u32 encoding,ulong_ptr data);
\ No newline at end of file
+bool noir_vt_nested_vmwrite(void* vmcs,u32 encoding,ulong_ptr data);
+void nvc_vt_build_vmcs_shadowing_bitmaps(noir_vt_hvm_p relative_hvm);
+void nvc_vt_load_shadow_vmcs(noir_vt_vcpu_p vcpu);
+void nvc_vt_unload_shadow_vmcs(noir_vt_vcpu_p vcpu);
+void nvc_vt_update_shadow_vmcs_field(noir_vt_vcpu_p vcpu,u32 encoding,ulong_ptr value);
\ No newline at end of file
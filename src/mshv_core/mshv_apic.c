@@ -0,0 +1,213 @@
+/*
+  NoirVisor - Hardware-Accelerated Hypervisor solution
+
+  Copyright 2018-2022, Zero Tang. All rights reserved.
+
+  This file is the Virtual APIC Enlightenments of MSHV Core.
+
+  This program is distributed in the hope that it will be useful, but 
+  without any warranty (no matter implied warranty or merchantability
+  or fitness for a particular purpose, etc.).
+
+  File Location: /mshv_core/mshv_apic.c
+*/
+
+#include <nvdef.h>
+#include <nvbdk.h>
+#include <noirhvm.h>
+#include <nv_intrin.h>
+#include "mshv_msr.h"
+#include "mshv_apic.h"
+
+// The Local APIC is not virtualized for the subverted host.
+// Synthetic APIC MSRs are forwarded to the physical Local APIC.
+bool static fastcall nvc_mshv_is_x2apic_mode()
+{
+	return (noir_rdmsr(noir_mshv_ia32_apic_base) & noir_mshv_apic_base_x2apic_mode)==noir_mshv_apic_base_x2apic_mode;
+}
+
+u32 static fastcall nvc_mshv_read_xapic(u32 offset)
+{
+	if(noir_mshv_xapic_page==null)return 0;
+	return *(u32v*)((ulong_ptr)noir_mshv_xapic_page+offset);
+}
+
+void static fastcall nvc_mshv_write_xapic(u32 offset,u32 val)
+{
+	if(noir_mshv_xapic_page)*(u32v*)((ulong_ptr)noir_mshv_xapic_page+offset)=val;
+}
+
+// This function must be called at passive level before subversion.
+// In xAPIC mode, Local APIC registers are accessed via MMIO.
+void fastcall nvc_mshv_initialize_apic_access()
+{
+	u64 apic_base=noir_rdmsr(noir_mshv_ia32_apic_base);
+	if((apic_base & noir_mshv_apic_base_x2apic_mode)!=noir_mshv_apic_base_x2apic_mode)
+		noir_mshv_xapic_page=noir_map_uncached_memory(page_mult(page_count(apic_base)),page_size);
+}
+
+void fastcall nvc_mshv_finalize_apic_access()
+{
+	if(noir_mshv_xapic_page)
+	{
+		noir_unmap_physical_memory(noir_mshv_xapic_page,page_size);
+		noir_mshv_xapic_page=null;
+	}
+}
+
+// Synthetic IPIs are sent in fixed delivery mode and physical destination mode.
+void fastcall nvc_mshv_send_fixed_ipi(u32 apic_id,u8 vector)
+{
+	if(nvc_mshv_is_x2apic_mode())
+		nvc_mshv_write_icr(((u64)apic_id<<32)|vector);
+	else
+		nvc_mshv_write_icr(((u64)apic_id<<56)|vector);
+}
+
+// NMIs are sent in physical destination mode. The vector field is ignored.
+void fastcall nvc_mshv_send_nmi(u32 apic_id)
+{
+	if(nvc_mshv_is_x2apic_mode())
+		nvc_mshv_write_icr(((u64)apic_id<<32)|noir_mshv_icr_delivery_nmi);
+	else
+		nvc_mshv_write_icr(((u64)apic_id<<56)|noir_mshv_icr_delivery_nmi);
+}
+
+// The layout of HV_X64_MSR_ICR is identical to the x2APIC ICR.
+// In xAPIC mode, the destination field is located in bits 56-63.
+u64 fastcall nvc_mshv_read_icr()
+{
+	if(nvc_mshv_is_x2apic_mode())return noir_rdmsr(noir_mshv_x2apic_icr);
+	return ((u64)nvc_mshv_read_xapic(noir_mshv_xapic_icr_high)<<32)|nvc_mshv_read_xapic(noir_mshv_xapic_icr_low);
+}
+
+void fastcall nvc_mshv_write_icr(u64 val)
+{
+	if(nvc_mshv_is_x2apic_mode())
+		noir_wrmsr(noir_mshv_x2apic_icr,val);
+	else
+	{
+		// The guest might be interrupted between writing the high and low halves of ICR.
+		// Preserve the high half so that the guest's IPI is not redirected.
+		const u32 icr_high=nvc_mshv_read_xapic(noir_mshv_xapic_icr_high);
+		nvc_mshv_write_xapic(noir_mshv_xapic_icr_high,(u32)(val>>32));
+		// Writing the low half sends the IPI.
+		nvc_mshv_write_xapic(noir_mshv_xapic_icr_low,(u32)val);
+		nvc_mshv_write_xapic(noir_mshv_xapic_icr_high,icr_high);
+	}
+}
+
+u64 fastcall nvc_mshv_read_tpr()
+{
+	if(nvc_mshv_is_x2apic_mode())return noir_rdmsr(noir_mshv_x2apic_tpr);
+	return nvc_mshv_read_xapic(noir_mshv_xapic_tpr);
+}
+
+void fastcall nvc_mshv_write_tpr(u64 val)
+{
+	if(nvc_mshv_is_x2apic_mode())
+		noir_wrmsr(noir_mshv_x2apic_tpr,val&0xFF);
+	else
+		nvc_mshv_write_xapic(noir_mshv_xapic_tpr,(u32)val&0xFF);
+}
+
+// Returns the highest vector in service of the physical Local APIC, or zero if there is none.
+u8 static fastcall nvc_mshv_get_physical_isrv()
+{
+	const bool x2apic=nvc_mshv_is_x2apic_mode();
+	for(u32 i=8;i>0;i--)
+	{
+		u32 isr=x2apic?(u32)noir_rdmsr(noir_mshv_x2apic_isr+i-1):nvc_mshv_read_xapic(noir_mshv_xapic_isr+(i-1)*noir_mshv_xapic_bitmap_stride);
+		u32 bit;
+		if(noir_bsr(&bit,isr))return (u8)(((i-1)<<5)+bit);
+	}
+	return 0;
+}
+
+// Returns the highest synthetic vector in service, or zero if there is none.
+u8 static fastcall nvc_mshv_get_synthetic_isrv(noir_mshv_vcpu_p vcpu)
+{
+	for(u32 i=8;i>0;i--)
+	{
+		u32 bit;
+		if(noir_bsr(&bit,vcpu->vapic.in_service[i-1]))return (u8)(((i-1)<<5)+bit);
+	}
+	return 0;
+}
+
+void static fastcall nvc_mshv_retire_synthetic_interrupt(noir_mshv_vcpu_p vcpu,u8 vector)
+{
+	noir_btr((u32*)&vcpu->vapic.in_service[vector>>5],vector&0x1F);
+}
+
+// The guest cannot tell a synthetic interrupt from a physical one when it signals EOI.
+// Complete the one with the highest vector in service.
+void fastcall nvc_mshv_write_eoi(noir_mshv_vcpu_p vcpu)
+{
+	const u8 synthetic=nvc_mshv_get_synthetic_isrv(vcpu);
+	if(synthetic && synthetic>=nvc_mshv_get_physical_isrv())
+		nvc_mshv_retire_synthetic_interrupt(vcpu,synthetic);
+	else if(nvc_mshv_is_x2apic_mode())
+		noir_wrmsr(noir_mshv_x2apic_eoi,0);
+	else
+		nvc_mshv_write_xapic(noir_mshv_xapic_eoi,0);
+}
+
+void fastcall nvc_mshv_remap_vp_assist_page(noir_mshv_vcpu_p vcpu)
+{
+	noir_mshv_msr_synic_page msr;
+	noir_mshv_vp_assist_page_p page;
+	msr.value=vcpu->vapic.vp_assist;
+	// Like the SynIC pages, the VP assist page is not overlaid.
+	page=msr.enable?(noir_mshv_vp_assist_page_p)noir_find_virt_by_phys(page_mult(msr.gpfn)):null;
+	if(vcpu->vapic.eoi_avoided)
+	{
+		// The old page is abandoned. Consider the avoided EOI to be completed.
+		nvc_mshv_retire_synthetic_interrupt(vcpu,nvc_mshv_get_synthetic_isrv(vcpu));
+		vcpu->vapic.eoi_avoided=false;
+	}
+	if(page)page->apic_assist=0;
+	vcpu->vapic.vp_assist_page=page;
+}
+
+// The guest clears the No-EOI-Required bit instead of signaling EOI.
+void fastcall nvc_mshv_complete_apic_assist(noir_mshv_vcpu_p vcpu)
+{
+	noir_mshv_vp_assist_page_p page=(noir_mshv_vp_assist_page_p)vcpu->vapic.vp_assist_page;
+	if(vcpu->vapic.eoi_avoided && page && !noir_bt((u32*)&page->apic_assist,hv_apic_assist_no_eoi_required))
+	{
+		nvc_mshv_retire_synthetic_interrupt(vcpu,nvc_mshv_get_synthetic_isrv(vcpu));
+		vcpu->vapic.eoi_avoided=false;
+	}
+}
+
+// This function is called as the synthetic interrupt is being injected.
+void fastcall nvc_mshv_assist_synthetic_interrupt(noir_mshv_vcpu_p vcpu,u8 vector,bool auto_eoi)
+{
+	noir_mshv_vp_assist_page_p page=(noir_mshv_vp_assist_page_p)vcpu->vapic.vp_assist_page;
+	// The guest does not signal EOI for SINTs configured with AutoEOI.
+	if(auto_eoi)return;
+	// The EOI of the guest is only observable via the VP assist page.
+	// Otherwise, it goes to the physical Local APIC and the vector would never be retired.
+	if(page)
+	{
+		noir_bts((u32*)&vcpu->vapic.in_service[vector>>5],vector&0x1F);
+		// Synthetic interrupts do not go through the physical Local APIC.
+		// Tell the guest not to signal EOI so that no physical interrupt is completed by mistake.
+		noir_locked_bts((long*)&page->apic_assist,hv_apic_assist_no_eoi_required);
+		vcpu->vapic.eoi_avoided=true;
+	}
+}
+
+// Synthetic interrupts are subject to the processor priority of the physical Local APIC.
+bool fastcall nvc_mshv_is_synthetic_interrupt_deliverable(noir_mshv_vcpu_p vcpu,u8 vector,bool auto_eoi)
+{
+	u8 priority=(u8)nvc_mshv_read_tpr();
+	const u8 physical=nvc_mshv_get_physical_isrv(),synthetic=nvc_mshv_get_synthetic_isrv(vcpu);
+	// Only one avoided EOI may be outstanding, or the guest's EOIs can't be told apart.
+	// AutoEOI vectors do not avoid EOI, so they are not subject to this restriction.
+	if(vcpu->vapic.eoi_avoided && !auto_eoi)return false;
+	if(physical>priority)priority=physical;
+	if(synthetic>priority)priority=synthetic;
+	return (vector>>4)>(priority>>4);
+}
\ No newline at end of file
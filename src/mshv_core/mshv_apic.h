@@ -0,0 +1,60 @@
+/*
+  NoirVisor - Hardware-Accelerated Hypervisor solution
+
+  Copyright 2018-2022, Zero Tang. All rights reserved.
+
+  This file includes definitions of Virtual APIC Enlightenments for MSHV-Core.
+
+  This program is distributed in the hope that it will be useful, but 
+  without any warranty (no matter implied warranty or merchantability
+  or fitness for a particular purpose, etc.).
+
+  File Location: /mshv_core/mshv_apic.h
+*/
+
+#include <nvdef.h>
+
+// Local APIC Base MSR
+#define noir_mshv_ia32_apic_base			0x1B
+#define noir_mshv_apic_base_x2apic_mode		0xC00	// Bits 10-11: x2APIC Enable and APIC Global Enable
+
+// Local APIC Registers in x2APIC Mode
+#define noir_mshv_x2apic_tpr				0x808
+#define noir_mshv_x2apic_eoi				0x80B
+#define noir_mshv_x2apic_isr				0x810
+#define noir_mshv_x2apic_icr				0x830
+
+// Local APIC Registers in xAPIC Mode
+#define noir_mshv_xapic_tpr					0x080
+#define noir_mshv_xapic_eoi					0x0B0
+#define noir_mshv_xapic_isr					0x100
+#define noir_mshv_xapic_icr_low				0x300
+#define noir_mshv_xapic_icr_high			0x310
+
+// Delivery Mode (Bits 8-10) of ICR
+#define noir_mshv_icr_delivery_nmi			0x400
+
+// Registers of 256-bit vector bitmaps are 16-byte aligned in xAPIC mode.
+#define noir_mshv_xapic_bitmap_stride		0x10
+
+// The VP Assist Page
+#define hv_apic_assist_no_eoi_required		0		// Bit 0 of the APIC Assist field.
+
+typedef struct _noir_mshv_vp_assist_page
+{
+	u32v apic_assist;
+	u32 reserved[1023];
+}noir_mshv_vp_assist_page,*noir_mshv_vp_assist_page_p;
+
+// Functions shared in MSHV-Core.
+void fastcall nvc_mshv_send_fixed_ipi(u32 apic_id,u8 vector);
+void fastcall nvc_mshv_send_nmi(u32 apic_id);
+u64 fastcall nvc_mshv_read_icr();
+void fastcall nvc_mshv_write_icr(u64 val);
+u64 fastcall nvc_mshv_read_tpr();
+void fastcall nvc_mshv_write_tpr(u64 val);
+void fastcall nvc_mshv_write_eoi(noir_mshv_vcpu_p vcpu);
+void fastcall nvc_mshv_remap_vp_assist_page(noir_mshv_vcpu_p vcpu);
+void fastcall nvc_mshv_complete_apic_assist(noir_mshv_vcpu_p vcpu);
+void fastcall nvc_mshv_assist_synthetic_interrupt(noir_mshv_vcpu_p vcpu,u8 vector,bool auto_eoi);
+bool fastcall nvc_mshv_is_synthetic_interrupt_deliverable(noir_mshv_vcpu_p vcpu,u8 vector,bool auto_eoi);
\ No newline at end of file
@@ -51,6 +51,19 @@ void static fastcall nvc_mshv_cpuid_fn40000003_handler(noir_cpuid_general_info_p
 	// Requirements of Minimal Hv#1 Interface
 	info->feat1.access_hypercall_msrs=true;
 	info->feat1.access_vp_index=true;
+	// Partition Reference Counter and Reference TSC Page
+	info->feat1.access_partition_ref_counter=true;
+	info->feat1.access_partition_ref_tsc=true;
+	// Synthetic Interrupt Controller
+	info->feat1.access_synic_msrs=true;
+	// Synthetic Timers are exposed only if the vCPU can be woken up at their deadlines.
+	if(noir_mshv_stimer_wakeup)
+	{
+		info->feat1.access_synthetic_timer_msrs=true;
+		info->feat3.direct_synthetic_timer=true;
+	}
+	// Synthetic APIC MSRs and VP Assist Page
+	info->feat1.access_apic_msrs=true;
 	// Support of Non-Privileged Instruction Execution Prevention (NPIEP)
 	info->feat3.npiep=true;
 }
@@ -61,6 +74,14 @@ void static fastcall nvc_mshv_cpuid_fn40000004_handler(noir_cpuid_general_info_p
 	noir_mshv_cpuid_implementation_recommendations_p info=(noir_mshv_cpuid_implementation_recommendations_p)param;
 	// We may recommend the guest nothing. Hence, clear it out.
 	noir_stosd((u32*)info,0,4);
+#if defined(_amd64)
+	// Hypercalls are only available to 64-bit guests.
+	info->recommendation1.local_tlb=true;
+	// Remote TLB flushes are recommended only if running vCPUs can be kicked to exit.
+	info->recommendation1.remote_tlb=noir_mshv_kick_nmi_handle!=null;
+	info->recommendation1.newer_exprocmask=true;
+	info->recommendation1.synth_clust_ipi=true;
+#endif
 }
 
 // Hypervisor Implementation Limits
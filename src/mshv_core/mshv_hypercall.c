@@ -0,0 +1,351 @@
+/*
+  NoirVisor - Hardware-Accelerated Hypervisor solution
+
+  Copyright 2018-2022, Zero Tang. All rights reserved.
+
+  This file is the Hypercall Dispatcher of MSHV Core.
+
+  This program is distributed in the hope that it will be useful, but 
+  without any warranty (no matter implied warranty or merchantability
+  or fitness for a particular purpose, etc.).
+
+  File Location: /mshv_core/mshv_hypercall.c
+*/
+
+#include <nvdef.h>
+#include <nvbdk.h>
+#include <noirhvm.h>
+#include <nv_intrin.h>
+#include "mshv_def.h"
+#include "mshv_hypercall.h"
+#include "mshv_apic.h"
+
+#if defined(_amd64)
+// The spin-wait notification is an advice. Nothing needs to be done at this moment.
+u16 static fastcall nvc_mshv_hypercall_notify_long_spin_wait(noir_mshv_vcpu_p vcpu,noir_mshv_hypercall_context_p context)
+{
+	return hv_status_success;
+}
+
+noir_mshv_vcpu_p static fastcall nvc_mshv_get_vcpu(u32 vp_index)
+{
+	if(vp_index>=hvm_p->cpu_count)return null;
+	if(hvm_p->selected_core==use_svm_core)return nvc_svm_get_mshv_vcpu(vp_index);
+	if(hvm_p->selected_core==use_vt_core)return nvc_vt_get_mshv_vcpu(vp_index);
+	return null;
+}
+
+// The NMI kicking a vCPU is claimed here, in the NMI handler of the guest.
+// Executing cpuid forces a VM-Exit, at the end of which the pending requests are applied.
+// If the NMI arrives while the processor is in host mode, cpuid does not exit, but the requests will be applied before the next VM-Entry anyway.
+u8 static nvc_mshv_kick_nmi_callback(void* context,u8 handled)
+{
+	noir_mshv_vcpu_p vcpu=nvc_mshv_get_vcpu(noir_get_current_processor());
+	if(vcpu && noir_locked_xchg((long*)&vcpu->kick_pending,0))
+	{
+		u32 a;
+		noir_cpuid(0,0,&a,null,null,null);
+		return true;
+	}
+	return handled;
+}
+
+// Virtual processors outside of the partition are ignored.
+u16 static fastcall nvc_mshv_enumerate_vp_bank(u64 bank,u32 base,noir_mshv_vp_set_routine routine,u64 argument)
+{
+	u32 bit;
+	while(noir_bsf64(&bit,bank))
+	{
+		noir_mshv_vcpu_p target=nvc_mshv_get_vcpu(base+bit);
+		bank&=bank-1;
+		if(target)
+		{
+			u16 status=routine(target,argument);
+			if(status!=hv_status_success)return status;
+		}
+	}
+	return hv_status_success;
+}
+
+u16 static fastcall nvc_mshv_enumerate_all_vps(noir_mshv_vp_set_routine routine,u64 argument)
+{
+	for(u32 i=0;i<hvm_p->cpu_count;i++)
+	{
+		u16 status=routine(nvc_mshv_get_vcpu(i),argument);
+		if(status!=hv_status_success)return status;
+	}
+	return hv_status_success;
+}
+
+// Sparse sets are divided into banks of 64 VPs. Only valid banks are present in the variable header.
+u16 static fastcall nvc_mshv_enumerate_vp_set(noir_mshv_hv_vp_set_p vp_set,u32 var_header_size,noir_mshv_vp_set_routine routine,u64 argument)
+{
+	if(vp_set->format==hv_generic_set_all)
+		return nvc_mshv_enumerate_all_vps(routine,argument);
+	else if(vp_set->format==hv_generic_set_sparse_4k)
+	{
+		u64p bank_contents=(u64p)(vp_set+1);
+		u64 valid_banks=vp_set->valid_bank_mask;
+		u32 bank_index,i=0;
+		// Validate the variable header before any VP is touched.
+		for(u64 mask=valid_banks;mask;mask&=mask-1)
+			if(++i>var_header_size)
+				return hv_status_invalid_hypercall_input;
+		i=0;
+		while(noir_bsf64(&bank_index,valid_banks))
+		{
+			u16 status=nvc_mshv_enumerate_vp_bank(bank_contents[i++],bank_index<<6,routine,argument);
+			if(status!=hv_status_success)return status;
+			valid_banks&=valid_banks-1;
+		}
+		return hv_status_success;
+	}
+	return hv_status_invalid_parameter;
+}
+
+// The flush is applied when the target vCPU enters the guest next time.
+u16 static fastcall nvc_mshv_mark_tlb_flush(noir_mshv_vcpu_p target,u64 argument)
+{
+	noir_locked_or((long*)&target->tlb_flush_pending,(long)argument);
+	return hv_status_success;
+}
+
+// Kick the target vCPU until it applies the flush. The flush of the calling vCPU is applied before it enters the guest.
+u16 static fastcall nvc_mshv_wait_tlb_flush(noir_mshv_vcpu_p target,u64 argument)
+{
+	noir_mshv_vcpu_p vcpu=(noir_mshv_vcpu_p)argument;
+	if(target==vcpu)return hv_status_success;
+	while(target->tlb_flush_pending)
+	{
+		// Exactly one NMI is sent for each kick, so that every kicking NMI is claimed by the callback.
+		if(noir_locked_cmpxchg((long*)&target->kick_pending,1,0)==0)nvc_mshv_send_nmi(target->apic_id);
+		// Two vCPUs may be waiting for each other. Defer the flushes requested to this vCPU so that the other one can proceed.
+		vcpu->tlb_flush_deferred|=(u32)noir_locked_xchg((long*)&vcpu->tlb_flush_pending,0);
+		noir_pause();
+	}
+	return hv_status_success;
+}
+
+// Address spaces are not tracked. The entire guest TLB context is flushed instead.
+// The hypercall is completed only after all target vCPUs have applied the flush.
+u16 static fastcall nvc_mshv_flush_virtual_address_space(noir_mshv_vcpu_p vcpu,noir_mshv_hypercall_context_p context,u64 flags,u64 processor_mask,noir_mshv_hv_vp_set_p vp_set)
+{
+	const u64 argument=(flags & hv_flush_non_global_mappings_only)?noir_mshv_tlb_flush_non_global:noir_mshv_tlb_flush_all;
+	u16 status;
+	if(flags & ~(u64)hv_flush_valid_flags)return hv_status_invalid_parameter;
+	if(flags & hv_flush_all_processors)
+		status=nvc_mshv_enumerate_all_vps(nvc_mshv_mark_tlb_flush,argument);
+	else if(vp_set)
+		status=nvc_mshv_enumerate_vp_set(vp_set,(u32)context->input.var_header_size,nvc_mshv_mark_tlb_flush,argument);
+	else
+		status=nvc_mshv_enumerate_vp_bank(processor_mask,0,nvc_mshv_mark_tlb_flush,argument);
+	// Without the NMI callback, kicking NMIs would not be claimed. The flushes are then applied at the next VM-Exit of the targets.
+	if(status!=hv_status_success || noir_mshv_kick_nmi_handle==null)return status;
+	if(flags & hv_flush_all_processors)
+		status=nvc_mshv_enumerate_all_vps(nvc_mshv_wait_tlb_flush,(u64)vcpu);
+	else if(vp_set)
+		status=nvc_mshv_enumerate_vp_set(vp_set,(u32)context->input.var_header_size,nvc_mshv_wait_tlb_flush,(u64)vcpu);
+	else
+		status=nvc_mshv_enumerate_vp_bank(processor_mask,0,nvc_mshv_wait_tlb_flush,(u64)vcpu);
+	if(vcpu->tlb_flush_deferred)
+	{
+		noir_locked_or((long*)&vcpu->tlb_flush_pending,(long)vcpu->tlb_flush_deferred);
+		vcpu->tlb_flush_deferred=0;
+	}
+	return status;
+}
+
+u16 static fastcall nvc_mshv_hypercall_flush_virtual_address_space(noir_mshv_vcpu_p vcpu,noir_mshv_hypercall_context_p context)
+{
+	noir_mshv_flush_virtual_address_space_input_p input=(noir_mshv_flush_virtual_address_space_input_p)context->input_header;
+	return nvc_mshv_flush_virtual_address_space(vcpu,context,input->flags,input->processor_mask,null);
+}
+
+// The GVA ranges are ignored. Flushing the whole context once per batch covers all of them.
+u16 static fastcall nvc_mshv_hypercall_flush_virtual_address_list(noir_mshv_vcpu_p vcpu,noir_mshv_hypercall_context_p context)
+{
+	noir_mshv_flush_virtual_address_space_input_p input=(noir_mshv_flush_virtual_address_space_input_p)context->input_header;
+	if(context->rep_index!=context->input.rep_start_index)return hv_status_success;
+	return nvc_mshv_flush_virtual_address_space(vcpu,context,input->flags,input->processor_mask,null);
+}
+
+u16 static fastcall nvc_mshv_hypercall_flush_virtual_address_space_ex(noir_mshv_vcpu_p vcpu,noir_mshv_hypercall_context_p context)
+{
+	noir_mshv_flush_virtual_address_space_ex_input_p input=(noir_mshv_flush_virtual_address_space_ex_input_p)context->input_header;
+	return nvc_mshv_flush_virtual_address_space(vcpu,context,input->flags,0,&input->processor_set);
+}
+
+u16 static fastcall nvc_mshv_hypercall_flush_virtual_address_list_ex(noir_mshv_vcpu_p vcpu,noir_mshv_hypercall_context_p context)
+{
+	noir_mshv_flush_virtual_address_space_ex_input_p input=(noir_mshv_flush_virtual_address_space_ex_input_p)context->input_header;
+	if(context->rep_index!=context->input.rep_start_index)return hv_status_success;
+	return nvc_mshv_flush_virtual_address_space(vcpu,context,input->flags,0,&input->processor_set);
+}
+
+u16 static fastcall nvc_mshv_send_ipi(noir_mshv_vcpu_p target,u64 argument)
+{
+	nvc_mshv_send_fixed_ipi(target->apic_id,(u8)argument);
+	return hv_status_success;
+}
+
+u16 static fastcall nvc_mshv_send_synthetic_cluster_ipi(noir_mshv_hypercall_context_p context,u32 vector,u8 target_vtl,u64 processor_mask,noir_mshv_hv_vp_set_p vp_set)
+{
+	// Vectors 0-15 are reserved by the architecture. Only VTL0 exists.
+	if(vector<0x10 || vector>0xFF || target_vtl)return hv_status_invalid_parameter;
+	if(vp_set)return nvc_mshv_enumerate_vp_set(vp_set,(u32)context->input.var_header_size,nvc_mshv_send_ipi,vector);
+	return nvc_mshv_enumerate_vp_bank(processor_mask,0,nvc_mshv_send_ipi,vector);
+}
+
+u16 static fastcall nvc_mshv_hypercall_send_synthetic_cluster_ipi(noir_mshv_vcpu_p vcpu,noir_mshv_hypercall_context_p context)
+{
+	noir_mshv_send_synthetic_cluster_ipi_input_p input=(noir_mshv_send_synthetic_cluster_ipi_input_p)context->input_header;
+	return nvc_mshv_send_synthetic_cluster_ipi(context,input->vector,input->target_vtl,input->processor_mask,null);
+}
+
+u16 static fastcall nvc_mshv_hypercall_send_synthetic_cluster_ipi_ex(noir_mshv_vcpu_p vcpu,noir_mshv_hypercall_context_p context)
+{
+	noir_mshv_send_synthetic_cluster_ipi_ex_input_p input=(noir_mshv_send_synthetic_cluster_ipi_ex_input_p)context->input_header;
+	return nvc_mshv_send_synthetic_cluster_ipi(context,input->vector,input->target_vtl,0,&input->processor_set);
+}
+
+noir_mshv_hypercall_entry nvc_mshv_hypercall_table[]=
+{
+	{hv_call_flush_virtual_address_space,0,24,0,0,nvc_mshv_hypercall_flush_virtual_address_space},
+	{hv_call_flush_virtual_address_list,noir_mshv_hypercall_rep,24,8,0,nvc_mshv_hypercall_flush_virtual_address_list},
+	{hv_call_notify_long_spin_wait,noir_mshv_hypercall_fast,8,0,0,nvc_mshv_hypercall_notify_long_spin_wait},
+	{hv_call_send_synthetic_cluster_ipi,noir_mshv_hypercall_fast,16,0,0,nvc_mshv_hypercall_send_synthetic_cluster_ipi},
+	{hv_call_flush_virtual_address_space_ex,0,32,0,0,nvc_mshv_hypercall_flush_virtual_address_space_ex},
+	{hv_call_flush_virtual_address_list_ex,noir_mshv_hypercall_rep,32,8,0,nvc_mshv_hypercall_flush_virtual_address_list_ex},
+	{hv_call_send_synthetic_cluster_ipi_ex,0,24,0,0,nvc_mshv_hypercall_send_synthetic_cluster_ipi_ex}
+};
+
+noir_mshv_hypercall_entry_p static nvc_mshv_lookup_hypercall(u16 call_code)
+{
+	for(u32 i=0;i<sizeof(nvc_mshv_hypercall_table)/sizeof(noir_mshv_hypercall_entry);i++)
+		if(nvc_mshv_hypercall_table[i].call_code==call_code)
+			return &nvc_mshv_hypercall_table[i];
+	return null;
+}
+
+u16 static nvc_mshv_validate_hypercall_input(noir_mshv_hypercall_entry_p entry,noir_mshv_hypercall_input_p input)
+{
+	if(input->reserved1 || input->reserved2 || input->reserved3)return hv_status_invalid_hypercall_input;
+	if(entry->properties & noir_mshv_hypercall_rep)
+	{
+		// Rep hypercalls must specify the reps to be processed.
+		if(input->rep_count==0 || input->rep_start_index>=input->rep_count)return hv_status_invalid_hypercall_input;
+	}
+	else
+	{
+		// Simple hypercalls must not specify the reps.
+		if(input->rep_count || input->rep_start_index)return hv_status_invalid_hypercall_input;
+	}
+	if(input->fast && !(entry->properties & noir_mshv_hypercall_fast))return hv_status_invalid_hypercall_input;
+	return hv_status_success;
+}
+
+// Parameter lists must be 8-byte aligned and must not span pages.
+// They must also reside in system memory.
+u8p static nvc_mshv_map_hypercall_parameters(u64 gpa,u32 size,u16 *status)
+{
+	u8p params;
+	if(size==0)return null;
+	if((gpa&7) || page_offset(gpa)+size>page_size)
+	{
+		*status=hv_status_invalid_alignment;
+		return null;
+	}
+	params=(u8p)noir_find_virt_by_phys(gpa);
+	if(params==null)*status=hv_status_invalid_parameter;
+	return params;
+}
+
+// Only the 64-bit calling convention is supported at this moment.
+// Return value indicates whether the hypercall is completed.
+// If not, the guest would re-execute the hypercall instruction to continue processing the reps.
+bool fastcall nvc_mshv_hypercall_handler(noir_mshv_vcpu_p vcpu,noir_gpr_state_p gpr_state)
+{
+	noir_mshv_hypercall_context context;
+	noir_mshv_hypercall_output output;
+	noir_mshv_hypercall_entry_p entry;
+	u16 status=hv_status_success;
+	context.input.value=gpr_state->rcx;
+	output.value=0;
+	entry=nvc_mshv_lookup_hypercall((u16)context.input.call_code);
+	if(entry==null)
+		status=hv_status_invalid_hypercall_code;
+	else
+		status=nvc_mshv_validate_hypercall_input(entry,&context.input);
+	if(status==hv_status_success)
+	{
+		const u32 header_size=entry->header_size+((u32)context.input.var_header_size<<3);
+		const u32 rep_count=(u32)context.input.rep_count;
+		u8p input_params,output_params=null;
+		if(context.input.fast)
+		{
+			// Register-based hypercalls carry at most 16 bytes of input and no output.
+			context.fast_params[0]=gpr_state->rdx;
+			context.fast_params[1]=gpr_state->r8;
+			if(header_size+rep_count*entry->rep_input_size>sizeof(context.fast_params) || entry->rep_output_size)
+				status=hv_status_invalid_hypercall_input;
+			input_params=(u8p)context.fast_params;
+		}
+		else
+		{
+			// Memory-based hypercalls carry the GPAs of input and output parameter lists.
+			input_params=nvc_mshv_map_hypercall_parameters(gpr_state->rdx,header_size+rep_count*entry->rep_input_size,&status);
+			output_params=nvc_mshv_map_hypercall_parameters(gpr_state->r8,rep_count*entry->rep_output_size,&status);
+		}
+		if(status==hv_status_success)
+		{
+			context.input_header=input_params;
+			if(entry->properties & noir_mshv_hypercall_rep)
+			{
+				// Process a batch of reps so that the guest may handle interrupts between batches.
+				u32 batch_limit=(u32)context.input.rep_start_index+noir_mshv_hypercall_rep_batch;
+				for(context.rep_index=(u32)context.input.rep_start_index;context.rep_index<rep_count;context.rep_index++)
+				{
+					if(context.rep_index>=batch_limit)
+					{
+						// Update the rep start index and let the guest re-execute the hypercall.
+						context.input.rep_start_index=context.rep_index;
+						gpr_state->rcx=context.input.value;
+						return false;
+					}
+					context.rep_input=input_params+header_size+context.rep_index*entry->rep_input_size;
+					context.rep_output=output_params?output_params+context.rep_index*entry->rep_output_size:null;
+					status=entry->routine(vcpu,&context);
+					if(status!=hv_status_success)break;
+				}
+				output.reps_completed=context.rep_index;
+			}
+			else
+			{
+				context.rep_index=0;
+				context.rep_input=context.rep_output=null;
+				status=entry->routine(vcpu,&context);
+			}
+		}
+	}
+	output.result=status;
+	gpr_state->rax=output.value;
+	return true;
+}
+#endif
+
+// This function must be called at passive level before subversion.
+void fastcall nvc_mshv_initialize_vcpu_kicker()
+{
+#if defined(_amd64)
+	noir_mshv_kick_nmi_handle=noir_register_nmi_callback(nvc_mshv_kick_nmi_callback,null);
+#endif
+}
+
+void fastcall nvc_mshv_finalize_vcpu_kicker()
+{
+	if(noir_mshv_kick_nmi_handle)
+	{
+		noir_unregister_nmi_callback(noir_mshv_kick_nmi_handle);
+		noir_mshv_kick_nmi_handle=null;
+	}
+}
\ No newline at end of file
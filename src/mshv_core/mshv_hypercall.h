@@ -0,0 +1,147 @@
+/*
+  NoirVisor - Hardware-Accelerated Hypervisor solution
+
+  Copyright 2018-2022, Zero Tang. All rights reserved.
+
+  This file includes definitions of Hypercalls for MSHV-Core.
+
+  This program is distributed in the hope that it will be useful, but 
+  without any warranty (no matter implied warranty or merchantability
+  or fitness for a particular purpose, etc.).
+
+  File Location: /mshv_core/mshv_hypercall.h
+*/
+
+#include <nvdef.h>
+
+// Microsoft Hypervisor Hypercall Code Definitions
+#define hv_call_switch_virtual_address_space	0x0001
+#define hv_call_flush_virtual_address_space		0x0002
+#define hv_call_flush_virtual_address_list		0x0003
+#define hv_call_notify_long_spin_wait			0x0008
+#define hv_call_send_synthetic_cluster_ipi		0x000B
+#define hv_call_flush_virtual_address_space_ex	0x0013
+#define hv_call_flush_virtual_address_list_ex	0x0014
+#define hv_call_send_synthetic_cluster_ipi_ex	0x0015
+#define hv_call_post_message					0x005C
+#define hv_call_signal_event					0x005D
+
+// Properties of Hypercalls
+#define noir_mshv_hypercall_rep				0x1		// This is a rep hypercall.
+#define noir_mshv_hypercall_fast			0x2		// Register-based calling is allowed.
+
+// Reps processed in one VM-Exit before the hypercall is continued.
+#define noir_mshv_hypercall_rep_batch		16
+
+typedef union _noir_mshv_hypercall_input
+{
+	struct
+	{
+		u64 call_code:16;			// Bits	0-15
+		u64 fast:1;					// Bit	16
+		u64 var_header_size:10;		// Bits	17-26
+		u64 reserved1:4;			// Bits	27-30
+		u64 is_nested:1;			// Bit	31
+		u64 rep_count:12;			// Bits	32-43
+		u64 reserved2:4;			// Bits	44-47
+		u64 rep_start_index:12;		// Bits	48-59
+		u64 reserved3:4;			// Bits	60-63
+	};
+	u64 value;
+}noir_mshv_hypercall_input,*noir_mshv_hypercall_input_p;
+
+typedef union _noir_mshv_hypercall_output
+{
+	struct
+	{
+		u64 result:16;				// Bits	0-15
+		u64 reserved1:16;			// Bits	16-31
+		u64 reps_completed:12;		// Bits	32-43
+		u64 reserved2:20;			// Bits	44-63
+	};
+	u64 value;
+}noir_mshv_hypercall_output,*noir_mshv_hypercall_output_p;
+
+// Flags of TLB-Flush Hypercalls
+#define hv_flush_all_processors					0x1
+#define hv_flush_all_virtual_address_spaces		0x2
+#define hv_flush_non_global_mappings_only		0x4
+#define hv_flush_use_extended_range_format		0x8
+#define hv_flush_valid_flags					0xF
+
+// Formats of Generic Sets
+#define hv_generic_set_sparse_4k				0
+#define hv_generic_set_all						1
+
+typedef struct _noir_mshv_hv_vp_set
+{
+	u64 format;
+	u64 valid_bank_mask;
+	// Contents of valid banks follow immediately in the variable-sized header.
+}noir_mshv_hv_vp_set,*noir_mshv_hv_vp_set_p;
+
+typedef struct _noir_mshv_flush_virtual_address_space_input
+{
+	u64 address_space;
+	u64 flags;
+	u64 processor_mask;
+}noir_mshv_flush_virtual_address_space_input,*noir_mshv_flush_virtual_address_space_input_p;
+
+typedef struct _noir_mshv_flush_virtual_address_space_ex_input
+{
+	u64 address_space;
+	u64 flags;
+	noir_mshv_hv_vp_set processor_set;
+}noir_mshv_flush_virtual_address_space_ex_input,*noir_mshv_flush_virtual_address_space_ex_input_p;
+
+typedef struct _noir_mshv_send_synthetic_cluster_ipi_input
+{
+	u32 vector;
+	u8 target_vtl;
+	u8 reserved[3];
+	u64 processor_mask;
+}noir_mshv_send_synthetic_cluster_ipi_input,*noir_mshv_send_synthetic_cluster_ipi_input_p;
+
+typedef struct _noir_mshv_send_synthetic_cluster_ipi_ex_input
+{
+	u32 vector;
+	u8 target_vtl;
+	u8 reserved[3];
+	noir_mshv_hv_vp_set processor_set;
+}noir_mshv_send_synthetic_cluster_ipi_ex_input,*noir_mshv_send_synthetic_cluster_ipi_ex_input_p;
+
+typedef struct _noir_mshv_hypercall_context
+{
+	noir_mshv_hypercall_input input;
+	// Fixed-size input header. Variable-size header follows immediately.
+	void* input_header;
+	// Input and output elements of the current rep.
+	void* rep_input;
+	void* rep_output;
+	u32 rep_index;
+	// Register-based input parameters are copied here.
+	u64 fast_params[2];
+}noir_mshv_hypercall_context,*noir_mshv_hypercall_context_p;
+
+typedef u16 (fastcall *noir_mshv_hypercall_routine)
+(
+ noir_mshv_vcpu_p vcpu,
+ noir_mshv_hypercall_context_p context
+);
+
+// Routine applied to each target vCPU of a processor set.
+typedef u16 (fastcall *noir_mshv_vp_set_routine)
+(
+ noir_mshv_vcpu_p target,
+ u64 argument
+);
+
+typedef struct _noir_mshv_hypercall_entry
+{
+	u16 call_code;
+	u16 properties;
+	u16 header_size;
+	u16 rep_input_size;
+	u16 rep_output_size;
+	noir_mshv_hypercall_routine routine;
+}noir_mshv_hypercall_entry,*noir_mshv_hypercall_entry_p;
\ No newline at end of file
@@ -17,12 +17,22 @@
 #include <noirhvm.h>
 #include <nv_intrin.h>
 #include "mshv_msr.h"
+#include "mshv_synic.h"
+#include "mshv_apic.h"
 
 // Return value will be included in rax register.
-// Accessing eax will clear higher 32 bits in rax.
-u8 nvc_mshv_hypercall_code64[6]=
+// The signature in eax tells the hypercall from NoirVisor's own calls.
+u8 nvc_mshv_hypercall_code64_vmx[9]=
 {
-	0xB8,0x02,0x00,0x00,0x00,	// mov eax,HV_STATUS_INVALID_HYPERCALL_CODE
+	0xB8,0x48,0x76,0x23,0x31,	// mov eax,noir_mshv_hypercall_signature
+	0x0F,0x01,0xC1,				// vmcall
+	0xC3						// ret
+};
+
+u8 nvc_mshv_hypercall_code64_svm[9]=
+{
+	0xB8,0x48,0x76,0x23,0x31,	// mov eax,noir_mshv_hypercall_signature
+	0x0F,0x01,0xD9,				// vmmcall
 	0xC3						// ret
 };
 
@@ -55,8 +65,9 @@ u64 static fastcall nvc_mshv_msr_r40000001_handler(noir_mshv_vcpu_p vcpu,bool wr
 				// However, we may just copy stuff onto it.
 				u64 pa=page_mult(msr.hypercall_gpfn);
 				void* va=noir_find_virt_by_phys(pa);
-				noir_movsb(va,nvc_mshv_hypercall_code64,sizeof(nvc_mshv_hypercall_code64));
-				noir_stosb((void*)((ulong_ptr)va+sizeof(nvc_mshv_hypercall_code64)),0,page_size-sizeof(nvc_mshv_hypercall_code64));
+				u8p code=hvm_p->selected_core==use_svm_core?nvc_mshv_hypercall_code64_svm:nvc_mshv_hypercall_code64_vmx;
+				noir_movsb(va,code,sizeof(nvc_mshv_hypercall_code64_vmx));
+				noir_stosb((void*)((ulong_ptr)va+sizeof(nvc_mshv_hypercall_code64_vmx)),0,page_size-sizeof(nvc_mshv_hypercall_code64_vmx));
 			}
 		}
 	}
@@ -68,17 +79,175 @@ u64 static fastcall nvc_mshv_msr_r40000002_handler(noir_mshv_vcpu_p vcpu,bool wr
 	return noir_get_current_processor();
 }
 
+u64 static fastcall nvc_mshv_msr_r40000020_handler(noir_mshv_vcpu_p vcpu,bool write,u64 val)
+{
+	// Partition reference counter is read-only.
+	return nvc_mshv_read_reference_time();
+}
+
+u64 static fastcall nvc_mshv_msr_r40000021_handler(noir_mshv_vcpu_p vcpu,bool write,u64 val)
+{
+	if(write)
+	{
+		noir_mshv_msr_reference_tsc msr;
+		msr.value=val;
+		msr.reserved=0;
+		noir_locked_xchg64(&noir_mshv_reference_tsc_ctrl,msr.value);
+		if(msr.enable)
+		{
+			// Like the hypercall page, the reference TSC page is not overlaid.
+			noir_mshv_reference_tsc_page_p page=(noir_mshv_reference_tsc_page_p)noir_find_virt_by_phys(page_mult(msr.gpfn));
+			// Invalidate the page before updating the scale and offset.
+			page->tsc_sequence=0;
+			noir_store_fence();
+			page->tsc_scale=noir_mshv_reference_tsc_scale;
+			page->tsc_offset=noir_mshv_reference_tsc_offset;
+			noir_store_fence();
+			// If TSC is not invariant, leave the sequence zero so that
+			// the guest falls back to the partition reference counter.
+			if(noir_mshv_invariant_tsc)page->tsc_sequence=1;
+		}
+	}
+	return noir_mshv_reference_tsc_ctrl;
+}
+
 u64 static fastcall nvc_mshv_msr_r40000040_handler(noir_mshv_vcpu_p vcpu,bool write,u64 val)
 {
 	if(write)
 	{
 		vcpu->npiep_config=val;
 		// Reconfigure the Interceptions.
-		if(hvm_p->selected_core==use_svm_core)nvc_svm_reconfigure_npiep_interceptions(vcpu->root_vcpu);
+		if(hvm_p->selected_core==use_svm_core)
+			nvc_svm_reconfigure_npiep_interceptions(vcpu->root_vcpu);
+		else if(hvm_p->selected_core==use_vt_core)
+			nvc_vt_reconfigure_npiep_interceptions(vcpu->root_vcpu);
 	}
 	return vcpu->npiep_config;
 }
 
+u64 static fastcall nvc_mshv_msr_r40000070_handler(noir_mshv_vcpu_p vcpu,bool write,u64 val)
+{
+	// EOI register is write-only.
+	if(write)nvc_mshv_write_eoi(vcpu);
+	return 0;
+}
+
+u64 static fastcall nvc_mshv_msr_r40000071_handler(noir_mshv_vcpu_p vcpu,bool write,u64 val)
+{
+	if(write)nvc_mshv_write_icr(val);
+	return nvc_mshv_read_icr();
+}
+
+u64 static fastcall nvc_mshv_msr_r40000072_handler(noir_mshv_vcpu_p vcpu,bool write,u64 val)
+{
+	if(write)nvc_mshv_write_tpr(val);
+	return nvc_mshv_read_tpr();
+}
+
+u64 static fastcall nvc_mshv_msr_r40000073_handler(noir_mshv_vcpu_p vcpu,bool write,u64 val)
+{
+	if(write)
+	{
+		noir_mshv_msr_synic_page assist;
+		assist.value=val;
+		assist.reserved=0;
+		vcpu->vapic.vp_assist=assist.value;
+		nvc_mshv_remap_vp_assist_page(vcpu);
+	}
+	return vcpu->vapic.vp_assist;
+}
+
+u64 static fastcall nvc_mshv_msr_r40000080_handler(noir_mshv_vcpu_p vcpu,bool write,u64 val)
+{
+	if(write)
+	{
+		noir_mshv_msr_scontrol scontrol;
+		scontrol.value=val;
+		scontrol.reserved=0;
+		vcpu->synic.scontrol=scontrol.value;
+	}
+	return vcpu->synic.scontrol;
+}
+
+u64 static fastcall nvc_mshv_msr_r40000081_handler(noir_mshv_vcpu_p vcpu,bool write,u64 val)
+{
+	// SynIC version is read-only.
+	return hv_synic_version;
+}
+
+u64 static fastcall nvc_mshv_msr_r40000082_handler(noir_mshv_vcpu_p vcpu,bool write,u64 val)
+{
+	if(write)
+	{
+		noir_mshv_msr_synic_page siefp;
+		siefp.value=val;
+		siefp.reserved=0;
+		vcpu->synic.siefp=siefp.value;
+		nvc_mshv_remap_synic_pages(vcpu);
+	}
+	return vcpu->synic.siefp;
+}
+
+u64 static fastcall nvc_mshv_msr_r40000083_handler(noir_mshv_vcpu_p vcpu,bool write,u64 val)
+{
+	if(write)
+	{
+		noir_mshv_msr_synic_page simp;
+		simp.value=val;
+		simp.reserved=0;
+		vcpu->synic.simp=simp.value;
+		nvc_mshv_remap_synic_pages(vcpu);
+	}
+	return vcpu->synic.simp;
+}
+
+u64 static fastcall nvc_mshv_msr_r40000084_handler(noir_mshv_vcpu_p vcpu,bool write,u64 val)
+{
+	// The guest has consumed a message slot. Undelivered messages
+	// are retried by the time the VM-Exit is about to be completed.
+	return 0;
+}
+
+u64 static fastcall nvc_mshv_msr_r40000090_handler(noir_mshv_vcpu_p vcpu,u32 sintx,bool write,u64 val)
+{
+	if(write)
+	{
+		noir_mshv_msr_sint sint;
+		sint.value=val;
+		sint.reserved1=sint.reserved2=0;
+		vcpu->synic.sint[sintx]=sint.value;
+	}
+	return vcpu->synic.sint[sintx];
+}
+
+u64 static fastcall nvc_mshv_msr_r400000b0_handler(noir_mshv_vcpu_p vcpu,u32 timer,bool write,u64 val)
+{
+	if(write)
+	{
+		noir_mshv_msr_stimer_config config;
+		config.value=val;
+		config.reserved1=config.reserved2=0;
+		vcpu->stimer[timer].config=config.value;
+		nvc_mshv_arm_synthetic_timer(vcpu,timer);
+	}
+	return vcpu->stimer[timer].config;
+}
+
+u64 static fastcall nvc_mshv_msr_r400000b1_handler(noir_mshv_vcpu_p vcpu,u32 timer,bool write,u64 val)
+{
+	if(write)
+	{
+		noir_mshv_msr_stimer_config config;
+		config.value=vcpu->stimer[timer].config;
+		vcpu->stimer[timer].count=val;
+		// Writing a non-zero count to an auto-enabled timer enables it.
+		if(config.auto_enable && val)config.enable=true;
+		vcpu->stimer[timer].config=config.value;
+		nvc_mshv_arm_synthetic_timer(vcpu,timer);
+	}
+	return vcpu->stimer[timer].count;
+}
+
 u64 fastcall nvc_mshv_rdmsr_handler(noir_mshv_vcpu_p vcpu,u32 index)
 {
 	switch(index)
@@ -89,27 +258,114 @@ u64 fastcall nvc_mshv_rdmsr_handler(noir_mshv_vcpu_p vcpu,u32 index)
 			return nvc_mshv_msr_r40000001_handler(vcpu,false,0);
 		case hv_x64_msr_vp_index:
 			return nvc_mshv_msr_r40000002_handler(vcpu,false,0);
+		case hv_x64_msr_time_ref_count:
+			return nvc_mshv_msr_r40000020_handler(vcpu,false,0);
+		case hv_x64_msr_reference_tsc:
+			return nvc_mshv_msr_r40000021_handler(vcpu,false,0);
 		case hv_x64_msr_npiep_config:
 			return nvc_mshv_msr_r40000040_handler(vcpu,false,0);
+		case hv_x64_msr_eoi:
+			return nvc_mshv_msr_r40000070_handler(vcpu,false,0);
+		case hv_x64_msr_icr:
+			return nvc_mshv_msr_r40000071_handler(vcpu,false,0);
+		case hv_x64_msr_tpr:
+			return nvc_mshv_msr_r40000072_handler(vcpu,false,0);
+		case hv_x64_msr_vp_assist_page:
+			return nvc_mshv_msr_r40000073_handler(vcpu,false,0);
+		case hv_x64_msr_scontrol:
+			return nvc_mshv_msr_r40000080_handler(vcpu,false,0);
+		case hv_x64_msr_sversion:
+			return nvc_mshv_msr_r40000081_handler(vcpu,false,0);
+		case hv_x64_msr_siefp:
+			return nvc_mshv_msr_r40000082_handler(vcpu,false,0);
+		case hv_x64_msr_simp:
+			return nvc_mshv_msr_r40000083_handler(vcpu,false,0);
+		case hv_x64_msr_eom:
+			return nvc_mshv_msr_r40000084_handler(vcpu,false,0);
+		default:
+		{
+			if(index>=hv_x64_msr_sint0 && index<=hv_x64_msr_sint15)
+				return nvc_mshv_msr_r40000090_handler(vcpu,index-hv_x64_msr_sint0,false,0);
+			// Config and Count MSRs of synthetic timers are interleaved.
+			if(index>=hv_x64_msr_stimer0_config && index<=hv_x64_msr_stimer3_count)
+			{
+				const u32 timer=(index-hv_x64_msr_stimer0_config)>>1;
+				if(index&1)return nvc_mshv_msr_r400000b1_handler(vcpu,timer,false,0);
+				return nvc_mshv_msr_r400000b0_handler(vcpu,timer,false,0);
+			}
+			break;
+		}
 	}
 	return 0;
 }
 
-void fastcall nvc_mshv_wrmsr_handler(noir_mshv_vcpu_p vcpu,u32 index,u64 val)
+// Returns false if the write is refused (e.g.: the MSR is read-only). The caller should inject #GP into the guest.
+bool fastcall nvc_mshv_wrmsr_handler(noir_mshv_vcpu_p vcpu,u32 index,u64 val)
 {
 	switch(index)
 	{
+		case hv_x64_msr_vp_index:
+		case hv_x64_msr_time_ref_count:
+		case hv_x64_msr_sversion:
+			return false;
 		case hv_x64_msr_guest_os_id:
 			nvc_mshv_msr_r40000000_handler(vcpu,true,val);
 			break;
 		case hv_x64_msr_hypercall:
 			nvc_mshv_msr_r40000001_handler(vcpu,true,val);
 			break;
-		case hv_x64_msr_vp_index:
-			nvc_mshv_msr_r40000002_handler(vcpu,true,val);
+		case hv_x64_msr_reference_tsc:
+		{
+			noir_mshv_msr_reference_tsc msr;
+			msr.value=val;
+			// The guest may specify a page that is not backed by system memory.
+			if(msr.enable && noir_find_virt_by_phys(page_mult(msr.gpfn))==null)return false;
+			nvc_mshv_msr_r40000021_handler(vcpu,true,val);
 			break;
+		}
 		case hv_x64_msr_npiep_config:
 			nvc_mshv_msr_r40000040_handler(vcpu,true,val);
 			break;
+		case hv_x64_msr_eoi:
+			nvc_mshv_msr_r40000070_handler(vcpu,true,val);
+			break;
+		case hv_x64_msr_icr:
+			nvc_mshv_msr_r40000071_handler(vcpu,true,val);
+			break;
+		case hv_x64_msr_tpr:
+			nvc_mshv_msr_r40000072_handler(vcpu,true,val);
+			break;
+		case hv_x64_msr_vp_assist_page:
+			nvc_mshv_msr_r40000073_handler(vcpu,true,val);
+			break;
+		case hv_x64_msr_scontrol:
+			nvc_mshv_msr_r40000080_handler(vcpu,true,val);
+			break;
+		case hv_x64_msr_siefp:
+			nvc_mshv_msr_r40000082_handler(vcpu,true,val);
+			break;
+		case hv_x64_msr_simp:
+			nvc_mshv_msr_r40000083_handler(vcpu,true,val);
+			break;
+		case hv_x64_msr_eom:
+			nvc_mshv_msr_r40000084_handler(vcpu,true,val);
+			break;
+		default:
+		{
+			if(index>=hv_x64_msr_sint0 && index<=hv_x64_msr_sint15)
+				nvc_mshv_msr_r40000090_handler(vcpu,index-hv_x64_msr_sint0,true,val);
+			else if(index>=hv_x64_msr_stimer0_config && index<=hv_x64_msr_stimer3_count)
+			{
+				const u32 timer=(index-hv_x64_msr_stimer0_config)>>1;
+				// Synthetic timers are not exposed if they cannot expire in time.
+				if(!noir_mshv_stimer_wakeup)return false;
+				if(index&1)
+					nvc_mshv_msr_r400000b1_handler(vcpu,timer,true,val);
+				else
+					nvc_mshv_msr_r400000b0_handler(vcpu,timer,true,val);
+			}
+			break;
+		}
 	}
+	return true;
 }
\ No newline at end of file
@@ -148,6 +148,83 @@ typedef union _noir_mshv_msr_hypercall
 	u64 value;
 }noir_mshv_msr_hypercall,*noir_mshv_msr_hypercall_p;
 
+typedef union _noir_mshv_msr_reference_tsc
+{
+	struct
+	{
+		u64 enable:1;			// Bit	0
+		u64 reserved:11;		// Bits	1-11
+		u64 gpfn:52;			// Bits	12-63
+	};
+	u64 value;
+}noir_mshv_msr_reference_tsc,*noir_mshv_msr_reference_tsc_p;
+
+// Reference time = ((TSC * tsc_scale) >> 64) + tsc_offset
+typedef struct _noir_mshv_reference_tsc_page
+{
+	u32v tsc_sequence;		// Zero indicates the page is invalid.
+	u32 reserved1;
+	u64v tsc_scale;
+	u64v tsc_offset;
+	u64 reserved2[509];
+}noir_mshv_reference_tsc_page,*noir_mshv_reference_tsc_page_p;
+
+typedef union _noir_mshv_msr_scontrol
+{
+	struct
+	{
+		u64 enable:1;			// Bit	0
+		u64 reserved:63;		// Bits	1-63
+	};
+	u64 value;
+}noir_mshv_msr_scontrol,*noir_mshv_msr_scontrol_p;
+
+// Layout of SIEFP, SIMP and VP Assist Page.
+typedef union _noir_mshv_msr_synic_page
+{
+	struct
+	{
+		u64 enable:1;			// Bit	0
+		u64 reserved:11;		// Bits	1-11
+		u64 gpfn:52;			// Bits	12-63
+	};
+	u64 value;
+}noir_mshv_msr_synic_page,*noir_mshv_msr_synic_page_p;
+
+typedef union _noir_mshv_msr_sint
+{
+	struct
+	{
+		u64 vector:8;			// Bits	0-7
+		u64 reserved1:8;		// Bits	8-15
+		u64 masked:1;			// Bit	16
+		u64 auto_eoi:1;			// Bit	17
+		u64 polling:1;			// Bit	18
+		u64 reserved2:45;		// Bits	19-63
+	};
+	u64 value;
+}noir_mshv_msr_sint,*noir_mshv_msr_sint_p;
+
+typedef union _noir_mshv_msr_stimer_config
+{
+	struct
+	{
+		u64 enable:1;			// Bit	0
+		u64 periodic:1;			// Bit	1
+		u64 lazy:1;				// Bit	2
+		u64 auto_enable:1;		// Bit	3
+		u64 apic_vector:8;		// Bits	4-11
+		u64 direct_mode:1;		// Bit	12
+		u64 reserved1:3;		// Bits	13-15
+		u64 sintx:4;			// Bits	16-19
+		u64 reserved2:44;		// Bits	20-63
+	};
+	u64 value;
+}noir_mshv_msr_stimer_config,*noir_mshv_msr_stimer_config_p;
+
+#define hv_synic_version		1
+#define hv_sint_default_value	0x10000		// Masked, with vector 0.
+
 typedef u32 hv_vp_index;
 #define hv_any_vp			((hv_vp_index)-1)
 #define hv_vp_index_self	((hv_vp_index)-2)
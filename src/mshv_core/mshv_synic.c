@@ -0,0 +1,269 @@
+/*
+  NoirVisor - Hardware-Accelerated Hypervisor solution
+
+  Copyright 2018-2022, Zero Tang. All rights reserved.
+
+  This file is the Synthetic Interrupt Controller of MSHV Core.
+
+  This program is distributed in the hope that it will be useful, but 
+  without any warranty (no matter implied warranty or merchantability
+  or fitness for a particular purpose, etc.).
+
+  File Location: /mshv_core/mshv_synic.c
+*/
+
+#include <nvdef.h>
+#include <nvbdk.h>
+#include <noirhvm.h>
+#include <nv_intrin.h>
+#include "mshv_msr.h"
+#include "mshv_synic.h"
+#include "mshv_apic.h"
+
+// Compute (10^7<<64)/frequency by long division.
+// The quotient is the 64.64 fixed-point scale from TSC ticks to 100ns units.
+u64 static nvc_mshv_compute_reference_scale(u64 frequency)
+{
+	u64 rem=hv_reference_time_frequency,quot=0;
+	for(u32 i=0;i<64;i++)
+	{
+		const bool carry=(rem>>63)!=0;
+		rem<<=1;
+		quot<<=1;
+		if(carry || rem>=frequency)
+		{
+			rem-=frequency;
+			quot|=1;
+		}
+	}
+	return quot;
+}
+
+// This function must be called at passive level before subversion.
+void fastcall nvc_mshv_calibrate_reference_time()
+{
+	u64 pc_freq,pc0,pc1,tsc0,tsc1;
+	u32 edx;
+	// Reference TSC page is reliable only if TSC is invariant.
+	noir_cpuid(noir_mshv_cpuid_ext_powermgr,0,null,null,null,&edx);
+	noir_mshv_invariant_tsc=noir_bt(&edx,noir_mshv_cpuid_invariant_tsc);
+	pc0=noir_query_performance_counter(&pc_freq);
+	tsc0=noir_rdtsc();
+	noir_sleep(50);
+	pc1=noir_query_performance_counter(null);
+	tsc1=noir_rdtsc();
+	noir_mshv_tsc_frequency=(tsc1-tsc0)*pc_freq/(pc1-pc0);
+	noir_mshv_reference_tsc_scale=nvc_mshv_compute_reference_scale(noir_mshv_tsc_frequency);
+	// Reference time starts counting from zero as NoirVisor is loaded.
+	noir_mshv_reference_tsc_offset=0-noir_umulh(noir_rdtsc(),noir_mshv_reference_tsc_scale);
+	nv_dprintf("TSC Frequency: %llu Hz\n",noir_mshv_tsc_frequency);
+}
+
+u64 fastcall nvc_mshv_read_reference_time()
+{
+	return noir_umulh(noir_rdtsc(),noir_mshv_reference_tsc_scale)+noir_mshv_reference_tsc_offset;
+}
+
+void fastcall nvc_mshv_initialize_synic(noir_mshv_vcpu_p vcpu)
+{
+	for(u32 i=0;i<noir_mshv_sint_count;i++)
+		vcpu->synic.sint[i]=hv_sint_default_value;
+}
+
+// This function must be called on the processor that the vCPU stands for.
+void fastcall nvc_mshv_capture_apic_id(noir_mshv_vcpu_p vcpu)
+{
+	u32 max_leaf,ebx,edx;
+	noir_cpuid(0,0,&max_leaf,null,null,null);
+	if(max_leaf>=noir_mshv_cpuid_x2apic_topology)
+	{
+		// The x2APIC ID is enumerated in CPUID Fn0000_000B EDX.
+		noir_cpuid(noir_mshv_cpuid_x2apic_topology,0,null,&ebx,null,&edx);
+		if(ebx)
+		{
+			vcpu->apic_id=edx;
+			return;
+		}
+	}
+	// Otherwise, the initial APIC ID is enumerated in CPUID Fn0000_0001 EBX[31:24].
+	noir_cpuid(noir_mshv_cpuid_std_proc_feature,0,null,&ebx,null,null);
+	vcpu->apic_id=ebx>>24;
+}
+
+void fastcall nvc_mshv_remap_synic_pages(noir_mshv_vcpu_p vcpu)
+{
+	noir_mshv_msr_synic_page siefp,simp;
+	siefp.value=vcpu->synic.siefp;
+	simp.value=vcpu->synic.simp;
+	// MSHV-TLFS tells us to overlay the page. We simply access the guest page.
+	vcpu->synic.siefp_page=siefp.enable?noir_find_virt_by_phys(page_mult(siefp.gpfn)):null;
+	vcpu->synic.simp_page=simp.enable?noir_find_virt_by_phys(page_mult(simp.gpfn)):null;
+}
+
+void fastcall nvc_mshv_arm_synthetic_timer(noir_mshv_vcpu_p vcpu,u32 index)
+{
+	noir_mshv_stimer_p stimer=&vcpu->stimer[index];
+	noir_mshv_msr_stimer_config config;
+	config.value=stimer->config;
+	// Zero count disables the timer.
+	if(config.enable && stimer->count==0)config.enable=false;
+	if(config.enable)
+	{
+		// Periodic timers count relatively. One-shot timers count absolutely.
+		stimer->deadline=config.periodic?nvc_mshv_read_reference_time()+stimer->count:stimer->count;
+		noir_bts((u32*)&vcpu->synic.armed_timers,index);
+	}
+	else if(!stimer->pending)
+		noir_btr((u32*)&vcpu->synic.armed_timers,index);
+	stimer->config=config.value;
+}
+
+void static fastcall nvc_mshv_assert_vector(noir_mshv_vcpu_p vcpu,u8 vector)
+{
+	// Vectors 0-15 are reserved by the architecture.
+	if(vector>=0x10)noir_bts((u32*)&vcpu->synic.pending_vectors[vector>>5],vector&0x1F);
+}
+
+bool static fastcall nvc_mshv_post_message(noir_mshv_vcpu_p vcpu,u32 sintx,u32 type,void* payload,u8 size)
+{
+	noir_mshv_msr_scontrol scontrol;
+	noir_mshv_msr_sint sint;
+	noir_mshv_message_p slot;
+	scontrol.value=vcpu->synic.scontrol;
+	sint.value=vcpu->synic.sint[sintx];
+	// Message cannot be delivered if SynIC or SIMP is disabled.
+	if(!scontrol.enable || vcpu->synic.simp_page==null)return false;
+	slot=(noir_mshv_message_p)((ulong_ptr)vcpu->synic.simp_page+sintx*hv_message_size);
+	if(slot->header.message_type!=hv_message_type_none)
+	{
+		// The slot is occupied. Ask the guest to write EOM after consuming it.
+		slot->header.message_flags.message_pending=true;
+		return false;
+	}
+	noir_movsb(slot->payload,payload,size);
+	slot->header.payload_size=size;
+	slot->header.message_flags.value=0;
+	slot->header.sender=0;
+	// Message type must be written in the last so that the guest sees a complete message.
+	noir_store_fence();
+	slot->header.message_type=type;
+	if(!sint.masked && !sint.polling)nvc_mshv_assert_vector(vcpu,(u8)sint.vector);
+	return true;
+}
+
+bool static fastcall nvc_mshv_deliver_timer_expiration(noir_mshv_vcpu_p vcpu,u32 index,u64 now)
+{
+	noir_mshv_stimer_p stimer=&vcpu->stimer[index];
+	noir_mshv_msr_stimer_config config;
+	noir_mshv_timer_message_payload payload;
+	config.value=stimer->config;
+	if(config.direct_mode)
+	{
+		// Direct-Mode timers bypass the message page.
+		nvc_mshv_assert_vector(vcpu,(u8)config.apic_vector);
+		return true;
+	}
+	payload.timer_index=index;
+	payload.reserved=0;
+	payload.expiration_time=stimer->expiration;
+	payload.delivery_time=now;
+	return nvc_mshv_post_message(vcpu,(u32)config.sintx,hv_message_type_timer_expired,&payload,sizeof(payload));
+}
+
+// Returns the highest pending vector, or zero if there is none.
+u8 static fastcall nvc_mshv_get_highest_pending_vector(noir_mshv_vcpu_p vcpu)
+{
+	for(u32 i=8;i>0;i--)
+	{
+		u32 bit;
+		if(noir_bsr(&bit,vcpu->synic.pending_vectors[i-1]))return (u8)(((i-1)<<5)+bit);
+	}
+	return 0;
+}
+
+// Returns whether the vector is asserted by a SINT configured with AutoEOI.
+bool static fastcall nvc_mshv_is_auto_eoi_vector(noir_mshv_vcpu_p vcpu,u8 vector)
+{
+	for(u32 i=0;i<noir_mshv_sint_count;i++)
+	{
+		noir_mshv_msr_sint sint;
+		sint.value=vcpu->synic.sint[i];
+		if(!sint.masked && sint.vector==vector && sint.auto_eoi)return true;
+	}
+	return false;
+}
+
+// Returns whether there are synthetic interrupts ready for injection.
+bool fastcall nvc_mshv_poll_synthetic_timers(noir_mshv_vcpu_p vcpu)
+{
+	u8 vector;
+	nvc_mshv_complete_apic_assist(vcpu);
+	if(vcpu->synic.armed_timers)
+	{
+		const u64 now=nvc_mshv_read_reference_time();
+		for(u32 i=0;i<noir_mshv_stimer_count;i++)
+		{
+			noir_mshv_stimer_p stimer=&vcpu->stimer[i];
+			noir_mshv_msr_stimer_config config;
+			if(!noir_bt((u32*)&vcpu->synic.armed_timers,i))continue;
+			config.value=stimer->config;
+			if(config.enable && !stimer->pending && now>=stimer->deadline)
+			{
+				stimer->expiration=stimer->deadline;
+				stimer->pending=true;
+				if(config.periodic)
+				{
+					// Skip the periods missed while the message is undelivered.
+					stimer->deadline+=stimer->count;
+					if(stimer->deadline<=now)stimer->deadline=now+stimer->count;
+				}
+				else
+				{
+					// One-shot timers are disabled upon expiration.
+					config.enable=false;
+					stimer->config=config.value;
+				}
+			}
+			// Retry the delivery until the message slot is available.
+			if(stimer->pending && nvc_mshv_deliver_timer_expiration(vcpu,i,now))stimer->pending=false;
+			if(!config.enable && !stimer->pending)noir_btr((u32*)&vcpu->synic.armed_timers,i);
+		}
+	}
+	vector=nvc_mshv_get_highest_pending_vector(vcpu);
+	return vector && nvc_mshv_is_synthetic_interrupt_deliverable(vcpu,vector,nvc_mshv_is_auto_eoi_vector(vcpu,vector));
+}
+
+// Returns the number of TSC ticks until the earliest synthetic timer expires, or maxu64 if no timers are armed.
+// The selected core should force a VM-Exit after that many ticks so that the expiration is delivered in time.
+u64 fastcall nvc_mshv_get_synthetic_timer_countdown(noir_mshv_vcpu_p vcpu)
+{
+	u64 deadline=maxu64,now;
+	if(vcpu->synic.armed_timers==0)return maxu64;
+	for(u32 i=0;i<noir_mshv_stimer_count;i++)
+	{
+		noir_mshv_stimer_p stimer=&vcpu->stimer[i];
+		noir_mshv_msr_stimer_config config;
+		config.value=stimer->config;
+		// Undelivered expirations are retried when the guest writes EOM.
+		if(config.enable && !stimer->pending && stimer->deadline<deadline)deadline=stimer->deadline;
+	}
+	if(deadline==maxu64)return maxu64;
+	now=nvc_mshv_read_reference_time();
+	if(deadline<=now)return 0;
+	// Limit the countdown to one second so that the conversion does not overflow.
+	deadline-=now;
+	if(deadline>hv_reference_time_frequency)deadline=hv_reference_time_frequency;
+	return deadline*noir_mshv_tsc_frequency/hv_reference_time_frequency;
+}
+
+// Returns the highest pending vector and moves it from pending state to in-service state.
+u8 fastcall nvc_mshv_acknowledge_synthetic_interrupt(noir_mshv_vcpu_p vcpu)
+{
+	const u8 vector=nvc_mshv_get_highest_pending_vector(vcpu);
+	if(vector)
+	{
+		noir_btr((u32*)&vcpu->synic.pending_vectors[vector>>5],vector&0x1F);
+		nvc_mshv_assist_synthetic_interrupt(vcpu,vector,nvc_mshv_is_auto_eoi_vector(vcpu,vector));
+	}
+	return vector;
+}
\ No newline at end of file
@@ -0,0 +1,71 @@
+/*
+  NoirVisor - Hardware-Accelerated Hypervisor solution
+
+  Copyright 2018-2022, Zero Tang. All rights reserved.
+
+  This file includes definitions of Synthetic Interrupt Controller for MSHV-Core.
+
+  This program is distributed in the hope that it will be useful, but 
+  without any warranty (no matter implied warranty or merchantability
+  or fitness for a particular purpose, etc.).
+
+  File Location: /mshv_core/mshv_synic.h
+*/
+
+#include <nvdef.h>
+
+// Microsoft Hypervisor Message Type Definitions
+#define hv_message_type_none				0x00000000
+#define hv_message_type_timer_expired		0x80000010
+
+#define hv_message_size						256
+#define hv_message_max_payload_qword		30
+
+// The reference time is counted in 100ns units.
+#define hv_reference_time_frequency			10000000
+
+// Invariant TSC is enumerated in CPUID Fn8000_0007 EDX[8] by both Intel and AMD.
+#define noir_mshv_cpuid_ext_powermgr		0x80000007
+#define noir_mshv_cpuid_invariant_tsc		8
+
+// APIC IDs are enumerated in CPUID Fn0000_0001 and Fn0000_000B.
+#define noir_mshv_cpuid_std_proc_feature	0x00000001
+#define noir_mshv_cpuid_x2apic_topology		0x0000000B
+
+typedef union _noir_mshv_message_flags
+{
+	struct
+	{
+		u8 message_pending:1;		// Bit	0
+		u8 reserved:7;				// Bits	1-7
+	};
+	u8 value;
+}noir_mshv_message_flags,*noir_mshv_message_flags_p;
+
+typedef struct _noir_mshv_message_header
+{
+	u32v message_type;
+	u8 payload_size;
+	noir_mshv_message_flags message_flags;
+	u8 reserved[2];
+	u64 sender;
+}noir_mshv_message_header,*noir_mshv_message_header_p;
+
+typedef struct _noir_mshv_message
+{
+	noir_mshv_message_header header;
+	u64 payload[hv_message_max_payload_qword];
+}noir_mshv_message,*noir_mshv_message_p;
+
+typedef struct _noir_mshv_timer_message_payload
+{
+	u32 timer_index;
+	u32 reserved;
+	u64 expiration_time;
+	u64 delivery_time;
+}noir_mshv_timer_message_payload,*noir_mshv_timer_message_payload_p;
+
+// Functions shared in MSHV-Core.
+u64 fastcall nvc_mshv_read_reference_time();
+void fastcall nvc_mshv_remap_synic_pages(noir_mshv_vcpu_p vcpu);
+void fastcall nvc_mshv_arm_synthetic_timer(noir_mshv_vcpu_p vcpu,u32 index);
\ No newline at end of file
@@ -22,6 +22,84 @@
 #include "svm_vmcb.h"
 #include "svm_def.h"
 #include "svm_npt.h"
+#include "svm_exit.h"
+
+// Stop requesting the interrupt window for the event queue.
+void nvc_svm_cancel_event_window(noir_svm_custom_vcpu_p cvcpu)
+{
+	if(cvcpu->special_state.event_window)
+	{
+		nvc_svm_avic_control avic_ctrl;
+		avic_ctrl.value=noir_svm_vmread64(cvcpu->vmcb.virt,avic_control);
+		avic_ctrl.virtual_irq=0;
+		avic_ctrl.ignore_virtual_tpr=0;
+		noir_svm_vmwrite64(cvcpu->vmcb.virt,avic_control,avic_ctrl.value);
+		noir_svm_vmcb_btr32(cvcpu->vmcb.virt,intercept_instruction1,nvc_svm_intercept_vector1_vint);
+		noir_svm_vmcb_btr32(cvcpu->vmcb.virt,vmcb_clean_bits,noir_svm_clean_interception);
+		noir_svm_vmcb_btr32(cvcpu->vmcb.virt,vmcb_clean_bits,noir_svm_clean_tpr);
+		cvcpu->special_state.event_window=0;
+	}
+}
+
+// Request a VM-Exit as soon as the guest is able to take external interrupts.
+// A virtual interrupt that ignores the TPR is held pending, and its delivery is intercepted.
+void static nvc_svm_request_event_window(noir_svm_custom_vcpu_p cvcpu)
+{
+	nvc_svm_avic_control avic_ctrl;
+	avic_ctrl.value=noir_svm_vmread64(cvcpu->vmcb.virt,avic_control);
+	// The virtual interrupt is already used by the User Hypervisor.
+	if(avic_ctrl.virtual_irq && !cvcpu->special_state.event_window)return;
+	avic_ctrl.virtual_irq=1;
+	avic_ctrl.ignore_virtual_tpr=1;
+	noir_svm_vmwrite64(cvcpu->vmcb.virt,avic_control,avic_ctrl.value);
+	noir_svm_vmcb_bts32(cvcpu->vmcb.virt,intercept_instruction1,nvc_svm_intercept_vector1_vint);
+	noir_svm_vmcb_btr32(cvcpu->vmcb.virt,vmcb_clean_bits,noir_svm_clean_interception);
+	noir_svm_vmcb_btr32(cvcpu->vmcb.virt,vmcb_clean_bits,noir_svm_clean_tpr);
+	cvcpu->special_state.event_window=1;
+}
+
+// Inject the pending event of highest priority if the guest is able to take it.
+// This function is called prior to every VMRUN of the vCPU.
+void nvc_svm_drain_event_queue(noir_svm_custom_vcpu_p cvcpu)
+{
+	noir_cvm_event_queue_p queue=&cvcpu->header.event_queue;
+	void* vmcb=cvcpu->vmcb.virt;
+	if(queue->count==0)return;
+	// Only one event can be injected per VMRUN.
+	// Do not overwrite an event being injected or interrupted in delivery.
+	if(noir_svm_vmcb_bt32(vmcb,event_injection,31) || noir_svm_vmcb_bt32(vmcb,exit_interrupt_info,31))return;
+	// The User Hypervisor is editing the queue. Try again at next VMRUN.
+	if(noir_locked_bts((long*)&queue->lock,0))return;
+	if(queue->count)
+	{
+		noir_cvm_event_injection_p event=&queue->events[queue->count-1];
+		bool shadowed=noir_svm_vmcb_bt32(vmcb,guest_interrupt,0);
+		bool injectable=true;
+		// External interrupts are blocked by RFLAGS.IF and interrupt shadow. NMIs are blocked by interrupt shadow.
+		// Exceptions and software interrupts are never blocked.
+		if(event->attributes.type==amd64_external_virtual_interrupt)
+			injectable=noir_svm_vmcb_bt32(vmcb,guest_rflags,amd64_rflags_if) && !shadowed;
+		else if(event->attributes.type==amd64_non_maskable_interrupt)
+			injectable=!shadowed;
+		if(injectable)
+		{
+			noir_cvm_event_injection evi=*event;
+			// The priority field is reserved in the event injection field.
+			evi.attributes.priority=0;
+			noir_svm_vmwrite32(vmcb,event_injection,evi.attributes.value);
+			noir_svm_vmwrite32(vmcb,event_error_code,evi.error_code);
+			queue->count--;
+		}
+		// Pending events other than the injected one require another VM-Entry.
+		// Request the interrupt window so that the guest will exit once it is able to take the next external interrupt.
+		// The window does not track the blocking of other events, which are retried at the next VMRUN.
+		if(queue->count && queue->events[queue->count-1].attributes.type==amd64_external_virtual_interrupt)
+			nvc_svm_request_event_window(cvcpu);
+		else
+			nvc_svm_cancel_event_window(cvcpu);
+	}
+	noir_locked_btr((long*)&queue->lock,0);
+}
 
 void nvc_svm_switch_to_host_vcpu(noir_gpr_state_p gpr_state,noir_svm_vcpu_p vcpu)
 {
@@ -43,6 +121,8 @@ void nvc_svm_switch_to_host_vcpu(noir_gpr_state_p gpr_state,noir_svm_vcpu_p vcpu
 	cvcpu->header.drs.dr1=noir_readdr1();
 	cvcpu->header.drs.dr2=noir_readdr2();
 	cvcpu->header.drs.dr3=noir_readdr3();
+	// The virtual interrupt requested for the event queue should not be seen as an injected event.
+	nvc_svm_cancel_event_window(cvcpu);
 	// Save the event injection field...
 	cvcpu->header.injected_event.attributes.value=noir_svm_vmread32(cvcpu->vmcb.virt,event_injection);
 	cvcpu->header.injected_event.error_code=noir_svm_vmread32(cvcpu->vmcb.virt,event_error_code);
@@ -61,7 +141,7 @@ void nvc_svm_switch_to_host_vcpu(noir_gpr_state_p gpr_state,noir_svm_vcpu_p vcpu
 	if(noir_bt(&hvm_p->relative_hvm->virt_cap.capabilities,amd64_cpuid_avic))
 	{
 		nvc_svm_avic_physical_apic_id_entry_p apic_physical=(nvc_svm_avic_physical_apic_id_entry_p)cvcpu->vm->avic_physical.virt;
-		apic_physical[cvcpu->proc_id].is_running=false;
+		apic_physical[cvcpu->vcpu_id].is_running=false;
 	}
 	// The rest of processor states are already saved in VMCB.
 	// Step 2: Load Host State.
@@ -85,9 +165,21 @@ void nvc_svm_switch_to_host_vcpu(noir_gpr_state_p gpr_state,noir_svm_vcpu_p vcpu
 void nvc_svm_switch_to_guest_vcpu(noir_gpr_state_p gpr_state,noir_svm_vcpu_p vcpu,noir_svm_custom_vcpu_p cvcpu)
 {
 	noir_svm_initial_stack_p loader_stack=(noir_svm_initial_stack_p)((ulong_ptr)vcpu->hv_stack+nvc_stack_size-sizeof(noir_svm_initial_stack));
-	// IMPORTANT: If vCPU is scheduled to a different processor, resetting the VMCB cache state is required.
+	u64 switch_tsc=noir_rdtsc();
+	// Account the time spent in the user hypervisor since the last exit.
+	if(cvcpu->timestamp.exit)
+	{
+		u64 user_time=switch_tsc-cvcpu->timestamp.exit;
+		cvcpu->header.statistics.tsc.user+=user_time;
+		cvcpu->header.statistics.exits[cvcpu->timestamp.index].tsc+=user_time;
+		cvcpu->timestamp.exit=0;
+	}
+	// IMPORTANT: The VMCB cache state is valid only on the processor owning the VMCB.
+	// If vCPU is scheduled to a different processor, resetting the VMCB cache state is required.
 	if(cvcpu->proc_id!=loader_stack->proc_id)
 	{
+		// It is not a migration if the VMCB has never been owned by any processor.
+		if(cvcpu->proc_id!=0xffffffff)cvcpu->header.statistics.affinity.migrations++;
 		cvcpu->proc_id=loader_stack->proc_id;
 		noir_svm_vmwrite32(cvcpu->vmcb.virt,vmcb_clean_bits,0);
 	}
@@ -261,13 +353,18 @@ void nvc_svm_switch_to_guest_vcpu(noir_gpr_state_p gpr_state,noir_svm_vcpu_p vcp
 		// Note that the AVIC Control field is cached. Invalidate it.
 		noir_svm_vmcb_btr32(cvcpu->vmcb.virt,vmcb_clean_bits,noir_svm_clean_tpr);
 	}
+	// Inject the queued events if the event injection field is not occupied.
+	nvc_svm_drain_event_queue(cvcpu);
 	// If AVIC is supported, set the Physical APIC ID Entry to be running.
 	if(noir_bt(&hvm_p->relative_hvm->virt_cap.capabilities,amd64_cpuid_avic))
 	{
 		nvc_svm_avic_physical_apic_id_entry_p apic_physical=(nvc_svm_avic_physical_apic_id_entry_p)cvcpu->vm->avic_physical.virt;
-		apic_physical[cvcpu->proc_id].is_running=true;
-		apic_physical[cvcpu->proc_id].host_physical_apic_id=cvcpu->proc_id;
+		apic_physical[cvcpu->vcpu_id].is_running=true;
+		apic_physical[cvcpu->vcpu_id].host_physical_apic_id=cvcpu->proc_id;
 	}
+	// Account the time spent in switching the world.
+	cvcpu->timestamp.entry=noir_rdtsc();
+	cvcpu->header.statistics.tsc.hypervisor+=cvcpu->timestamp.entry-switch_tsc;
 	// Step 3. Switch vCPU to Guest.
 	loader_stack->custom_vcpu=cvcpu;
 	loader_stack->guest_vmcb_pa=cvcpu->vmcb.phys;
@@ -369,6 +466,33 @@ void nvc_svm_dump_guest_vcpu_state(noir_svm_custom_vcpu_p vcpu)
 	vcpu->header.state_cache.synchronized=1;
 }
 
+// This function saves the optional sections of exit context from VMCB.
+void nvc_svm_save_exit_context(noir_svm_custom_vcpu_p vcpu,u32 sections)
+{
+	void* vmcb=vcpu->vmcb.virt;
+	if(noir_bt(&sections,noir_cvm_exit_section_vcpu_state))
+	{
+		vcpu->header.exit_context.vcpu_state.instruction_length=(noir_svm_vmread64(vmcb,next_rip)-noir_svm_vmread64(vmcb,guest_rip))&0xf;
+		vcpu->header.exit_context.vcpu_state.cpl=noir_svm_vmread8(vmcb,guest_cpl)&0x3;
+		vcpu->header.exit_context.vcpu_state.int_shadow=noir_svm_vmcb_bt32(vmcb,guest_interrupt,0);
+		vcpu->header.exit_context.vcpu_state.pe=noir_svm_vmcb_bt32(vmcb,guest_cr0,amd64_cr0_pe);
+		vcpu->header.exit_context.vcpu_state.lm=noir_svm_vmcb_bt32(vmcb,guest_efer,amd64_efer_lma);
+	}
+	if(noir_bt(&sections,noir_cvm_exit_section_code_segment))
+	{
+		vcpu->header.exit_context.cs.selector=noir_svm_vmread16(vmcb,guest_cs_selector);
+		vcpu->header.exit_context.cs.attrib=svm_attrib_inverse(noir_svm_vmread16(vmcb,guest_cs_attrib));
+		vcpu->header.exit_context.cs.limit=noir_svm_vmread32(vmcb,guest_cs_limit);
+		vcpu->header.exit_context.cs.base=noir_svm_vmread64(vmcb,guest_cs_base);
+	}
+	if(noir_bt(&sections,noir_cvm_exit_section_rip_rflags))
+	{
+		vcpu->header.exit_context.rflags=noir_svm_vmread64(vmcb,guest_rflags);
+		vcpu->header.exit_context.rip=noir_svm_vmread64(vmcb,guest_rip);
+	}
+	vcpu->header.exit_context.sections|=sections;
+}
+
 void nvc_svm_initialize_cvm_vmcb(noir_svm_custom_vcpu_p vcpu)
 {
 	void* vmcb=vcpu->vmcb.virt;
@@ -477,23 +601,253 @@ void nvc_svm_set_guest_vcpu_options(noir_svm_custom_vcpu_p vcpu)
 }
 
 #if !defined(_hv_type1)
-noir_status nvc_svmc_run_vcpu(noir_svm_custom_vcpu_p vcpu)
+// Pin the thread to a processor according to the affinity policy so that the cached VMCB state can be retained.
+// The thread is pinned even if it is already on the target processor. Otherwise, it may migrate during the run.
+bool static nvc_svmc_pin_vcpu(noir_svm_custom_vcpu_p vcpu,noir_thread_affinity_p prev_affinity)
 {
-	noir_status st=noir_success;
-	noir_acquire_reslock_shared(vcpu->vm->header.vcpu_list_lock);
+	u32 cur_proc=noir_get_current_processor(),target_proc;
+	switch(vcpu->header.affinity.policy)
+	{
+		case noir_cvm_affinity_soft:
+		{
+			// The VMCB is not owned yet. Let the vCPU start wherever the thread is.
+			if(vcpu->proc_id==0xffffffff)
+			{
+				vcpu->away_runs=0;
+				return false;
+			}
+			// The vCPU is running on the processor owning the VMCB.
+			if(vcpu->proc_id==cur_proc)
+				vcpu->away_runs=0;
+			else if(++vcpu->away_runs>vcpu->header.affinity.migration_cost)
+			{
+				// The thread is kept being scheduled away from the owning processor.
+				// The owning processor is likely busy. Migrating the vCPU is cheaper than pinning it.
+				vcpu->header.statistics.affinity.rehomes++;
+				vcpu->away_runs=0;
+				return false;
+			}
+			target_proc=vcpu->proc_id;
+			break;
+		}
+		case noir_cvm_affinity_hard:
+		{
+			target_proc=vcpu->header.affinity.processor;
+			break;
+		}
+		default:
+		{
+			return false;
+		}
+	}
+	if(target_proc>=noir_get_processor_count())return false;
+	noir_set_thread_affinity(target_proc,prev_affinity);
+	vcpu->header.statistics.affinity.pinned_runs++;
+	return true;
+}
+
+// Run the vCPU until it exits to the user hypervisor or its time slice expires.
+// If the run queue is specified, the vCPU is preempted by vCPUs of higher priority in the queue.
+void static nvc_svmc_run_vcpu_slice(noir_svm_custom_vcpu_p vcpu,noir_cvm_run_queue_p queue)
+{
+	u64 slice_start=noir_rdtsc();
+	u32 level=vcpu->header.scheduler.level;
 	// Abort execution if rescission is specified.
 	if(noir_locked_btr64(&vcpu->special_state,63))
+	{
 		vcpu->header.exit_context.intercept_code=cv_rescission;
-	else if(vcpu->header.scheduling_priority<noir_cvm_vcpu_priority_kernel)
+		return;
+	}
+	do
+	{
 		noir_svm_vmmcall(noir_svm_run_custom_vcpu,(ulong_ptr)vcpu);
-	else
+		if(vcpu->header.exit_context.intercept_code!=cv_scheduler_exit)break;
+		// Rescission is checked on every scheduler exit so that it will not be delayed for the whole slice.
+		if(noir_locked_btr64(&vcpu->special_state,63))
+		{
+			vcpu->header.exit_context.intercept_code=cv_rescission;
+			break;
+		}
+		// Preempt the vCPU if a vCPU of higher priority became ready on this processor.
+		// Reading the bitmap without the lock is fine: a stale value only delays preemption by a scheduler exit.
+		if(queue && (queue->ready_levels>>(level+1)))break;
+	}while(noir_rdtsc()-slice_start<vcpu->header.scheduler.time_slice);
+}
+
+// Return the vCPU that the entry of run queue belongs to.
+noir_svm_custom_vcpu_p static nvc_svmc_ready_list_to_vcpu(list_entry_p entry)
+{
+	return (noir_svm_custom_vcpu_p)((ulong_ptr)entry-(ulong_ptr)&((noir_svm_custom_vcpu_p)null)->header.scheduler.ready_list);
+}
+
+// Select the run queue for a vCPU that becomes ready.
+u32 static nvc_svmc_select_run_queue(noir_svm_custom_vcpu_p vcpu)
+{
+	u32 run_queues=vcpu->vm->header.run_queues;
+	// Hard affinity binds the vCPU to the specified processor.
+	if(vcpu->header.affinity.policy==noir_cvm_affinity_hard)
+		return vcpu->header.affinity.processor%run_queues;
+	// Soft affinity prefers the processor owning the cached VMCB state so that clean bits are retained.
+	if(vcpu->header.affinity.policy==noir_cvm_affinity_soft && vcpu->proc_id<run_queues)
+		return vcpu->proc_id;
+	return noir_get_current_processor()%run_queues;
+}
+
+// The caller must hold the lock of the run queue.
+void static nvc_svmc_enqueue_vcpu(noir_cvm_run_queue_p queue,u32 queue_index,noir_svm_custom_vcpu_p vcpu)
+{
+	u32 level=vcpu->header.scheduling_priority;
+	if(level>=noir_cvm_vcpu_priority_levels)level=noir_cvm_vcpu_priority_levels-1;
+	// Insert to the tail so that vCPUs of the same priority are rotated.
+	noir_insert_to_prev(&queue->head[level],&vcpu->header.scheduler.ready_list);
+	noir_bts(&queue->ready_levels,level);
+	queue->count++;
+	vcpu->header.scheduler.queue=queue_index;
+	vcpu->header.scheduler.level=level;
+	vcpu->header.scheduler.state=noir_cvm_vcpu_state_ready;
+}
+
+// The caller must hold the lock of the run queue.
+void static nvc_svmc_dequeue_vcpu(noir_cvm_run_queue_p queue,noir_svm_custom_vcpu_p vcpu)
+{
+	u32 level=vcpu->header.scheduler.level;
+	noir_remove_list_entry(&vcpu->header.scheduler.ready_list);
+	if(queue->head[level].next==&queue->head[level])noir_btr(&queue->ready_levels,level);
+	queue->count--;
+	vcpu->header.scheduler.queue=0xffffffff;
+}
+
+// Take the ready vCPU of highest priority from the run queue.
+noir_svm_custom_vcpu_p static nvc_svmc_pick_vcpu(noir_cvm_run_queue_p queue)
+{
+	noir_svm_custom_vcpu_p vcpu=null;
+	u32 level;
+	// Check the counter without the lock so that empty queues are skipped cheaply.
+	if(queue->count==0)return null;
+	noir_acquire_reslock_exclusive(queue->lock);
+	if(noir_bsr(&level,queue->ready_levels))
+	{
+		vcpu=nvc_svmc_ready_list_to_vcpu(queue->head[level].next);
+		nvc_svmc_dequeue_vcpu(queue,vcpu);
+		vcpu->header.scheduler.state=noir_cvm_vcpu_state_running;
+	}
+	noir_release_reslock(queue->lock);
+	return vcpu;
+}
+
+bool static nvc_svmc_run_queues_empty(noir_svm_custom_vm_p vm)
+{
+	for(u32 i=0;i<vm->header.run_queues;i++)
+		if(vm->header.run_queue[i].count)
+			return false;
+	return true;
+}
+
+noir_status nvc_svmc_schedule_vcpu(noir_svm_custom_vcpu_p vcpu)
+{
+	noir_status st=noir_vcpu_already_scheduled;
+	noir_svm_custom_vm_p vm=vcpu->vm;
+	u32 index;
+	noir_cvm_run_queue_p queue;
+	noir_acquire_reslock_shared(vm->header.vcpu_list_lock);
+	index=nvc_svmc_select_run_queue(vcpu);
+	queue=&vm->header.run_queue[index];
+	noir_acquire_reslock_exclusive(queue->lock);
+	// Swap the state atomically so that the vCPU cannot be queued twice, or be queued while it is running.
+	if(noir_locked_cmpxchg((long*)&vcpu->header.scheduler.state,noir_cvm_vcpu_state_ready,noir_cvm_vcpu_state_idle)==noir_cvm_vcpu_state_idle)
+	{
+		nvc_svmc_enqueue_vcpu(queue,index,vcpu);
+		st=noir_success;
+	}
+	noir_release_reslock(queue->lock);
+	noir_release_reslock(vm->header.vcpu_list_lock);
+	return st;
+}
+
+// Run the ready vCPUs of the VM until one of them exits to the user hypervisor.
+// Any number of threads can run the scheduler of the same VM. Each thread serves the run queue of its processor,
+// and steals from run queues of other processors if the local one is empty.
+// During a slice, the thread is pinned to the processor that runs the vCPU. Hard-pinned vCPUs are run on their
+// processors, even if they are stolen. The list lock is only held during a slice.
+noir_status nvc_svmc_run_scheduler(noir_svm_custom_vm_p vm,noir_svm_custom_vcpu_p *exited_vcpu,u32 *vcpu_id)
+{
+	noir_status st=noir_no_ready_vcpu;
+	*exited_vcpu=null;
+	while(1)
 	{
-		do
+		noir_thread_affinity prev_affinity;
+		noir_svm_custom_vcpu_p vcpu;
+		u32 local,run_proc;
+		noir_acquire_reslock_shared(vm->header.vcpu_list_lock);
+		local=noir_get_current_processor()%vm->header.run_queues;
+		vcpu=nvc_svmc_pick_vcpu(&vm->header.run_queue[local]);
+		// Steal from other run queues if the local queue is empty.
+		for(u32 i=1;vcpu==null && i<vm->header.run_queues;i++)
+			vcpu=nvc_svmc_pick_vcpu(&vm->header.run_queue[(local+i)%vm->header.run_queues]);
+		if(vcpu==null)
 		{
+			noir_release_reslock(vm->header.vcpu_list_lock);
+			// Another thread may have put a vCPU back after the queue was checked. Retry in this case.
+			if(nvc_svmc_run_queues_empty(vm))break;
+			// Back off so that the thread putting the vCPU back can release the lock of the run queue.
+			noir_pause();
+			continue;
+		}
+		run_proc=local;
+		if(vcpu->header.affinity.policy==noir_cvm_affinity_hard && vcpu->header.affinity.processor<vm->header.run_queues)
+			run_proc=vcpu->header.affinity.processor;
+		noir_set_thread_affinity(run_proc,&prev_affinity);
+		nvc_svmc_run_vcpu_slice(vcpu,&vm->header.run_queue[run_proc]);
+		if(vcpu->header.exit_context.intercept_code==cv_scheduler_exit)
+		{
+			// The time slice expired or the vCPU is preempted. Put it back to the tail of the run queue.
+			u32 index=nvc_svmc_select_run_queue(vcpu);
+			noir_cvm_run_queue_p queue=&vm->header.run_queue[index];
+			noir_acquire_reslock_exclusive(queue->lock);
+			nvc_svmc_enqueue_vcpu(queue,index,vcpu);
+			noir_release_reslock(queue->lock);
+		}
+		else
+		{
+			// The vCPU exits to the user hypervisor. It won't be run until it gets scheduled again.
+			vcpu->header.scheduler.state=noir_cvm_vcpu_state_idle;
+			*exited_vcpu=vcpu;
+			*vcpu_id=vcpu->vcpu_id;
+			st=noir_success;
+		}
+		noir_revert_thread_affinity(&prev_affinity);
+		noir_release_reslock(vm->header.vcpu_list_lock);
+		if(st==noir_success)break;
+	}
+	return st;
+}
+
+noir_status nvc_svmc_run_vcpu(noir_svm_custom_vcpu_p vcpu)
+{
+	noir_status st=noir_success;
+	noir_thread_affinity prev_affinity;
+	bool pinned=nvc_svmc_pin_vcpu(vcpu,&prev_affinity);
+	noir_acquire_reslock_shared(vcpu->vm->header.vcpu_list_lock);
+	// The vCPU cannot be run directly while the scheduler owns it.
+	if(noir_locked_cmpxchg((long*)&vcpu->header.scheduler.state,noir_cvm_vcpu_state_running,noir_cvm_vcpu_state_idle)!=noir_cvm_vcpu_state_idle)
+		st=noir_vcpu_already_scheduled;
+	else if(vcpu->header.scheduling_priority<noir_cvm_vcpu_priority_kernel)
+	{
+		// Abort execution if rescission is specified.
+		if(noir_locked_btr64(&vcpu->special_state,63))
+			vcpu->header.exit_context.intercept_code=cv_rescission;
+		else
 			noir_svm_vmmcall(noir_svm_run_custom_vcpu,(ulong_ptr)vcpu);
-		}while(vcpu->header.exit_context.intercept_code==cv_scheduler_exit);
 	}
+	else
+	{
+		// Scheduler exits are handled in kernel mode, but only within the time slice.
+		// The thread returns to the user hypervisor afterwards so that the host scheduler can preempt it.
+		nvc_svmc_run_vcpu_slice(vcpu,null);
+	}
+	if(st==noir_success)vcpu->header.scheduler.state=noir_cvm_vcpu_state_idle;
 	noir_release_reslock(vcpu->vm->header.vcpu_list_lock);
+	if(pinned)noir_revert_thread_affinity(&prev_affinity);
 	return st;
 }
 
@@ -516,24 +870,35 @@ noir_svm_custom_vcpu_p nvc_svmc_reference_vcpu(noir_svm_custom_vm_p vm,u32 vcpu_
 	return vm->vcpu[vcpu_id];
 }
 
-void nvc_svmc_release_vcpu(noir_svm_custom_vcpu_p vcpu)
+// The caller must hold the vCPU list lock with exclusive access, so that the vCPU is neither picked nor running.
+void static nvc_svmc_release_vcpu_worker(noir_svm_custom_vcpu_p vcpu)
 {
 	if(vcpu)
 	{
+		const u32 index=vcpu->header.scheduler.queue;
+		// Remove the vCPU from the run queue.
+		if(vcpu->vm && index!=0xffffffff)
+		{
+			noir_cvm_run_queue_p queue=&vcpu->vm->header.run_queue[index];
+			noir_acquire_reslock_exclusive(queue->lock);
+			// Check again with the lock held in that the vCPU may have been picked.
+			if(vcpu->header.scheduler.queue==index)nvc_svmc_dequeue_vcpu(queue,vcpu);
+			noir_release_reslock(queue->lock);
+		}
 		// Release VMCB.
 		if(vcpu->vmcb.virt)noir_free_contd_memory(vcpu->vmcb.virt);
 		// Release XSAVE State Area,
 		if(vcpu->header.xsave_area)noir_free_contd_memory(vcpu->header.xsave_area);
 		// Remove vCPU from VM.
-		if(vcpu->vm)vcpu->vm->vcpu[vcpu->proc_id]=null;
+		if(vcpu->vm)vcpu->vm->vcpu[vcpu->vcpu_id]=null;
 		// In addition, remove the vCPU from AVIC.
 		if(noir_bt(&hvm_p->relative_hvm->virt_cap.capabilities,amd64_cpuid_avic))
 		{
 			// Remove from AVIC Logical & Physical APIC ID Table.
 			nvc_svm_avic_physical_apic_id_entry_p avic_physical=(nvc_svm_avic_physical_apic_id_entry_p)vcpu->vm->avic_physical.virt;
 			nvc_svm_avic_logical_apic_id_entry_p avic_logical=(nvc_svm_avic_logical_apic_id_entry_p)vcpu->vm->avic_logical.virt;
-			avic_physical[vcpu->proc_id].value=0;
-			avic_logical[vcpu->proc_id].value=0;
+			avic_physical[vcpu->vcpu_id].value=0;
+			avic_logical[vcpu->vcpu_id].value=0;
 			// Release APIC Backing Page.
 			if(vcpu->apic_backing.virt)noir_free_contd_memory(vcpu->apic_backing.virt);
 		}
@@ -541,6 +906,16 @@ void nvc_svmc_release_vcpu(noir_svm_custom_vcpu_p vcpu)
 	}
 }
 
+void nvc_svmc_release_vcpu(noir_svm_custom_vcpu_p vcpu)
+{
+	noir_svm_custom_vm_p vm=vcpu?vcpu->vm:null;
+	// Scheduler threads hold the vCPU list lock with shared access during a slice.
+	// Acquiring it with exclusive access waits for the running vCPU to exit.
+	if(vm)noir_acquire_reslock_exclusive(vm->header.vcpu_list_lock);
+	nvc_svmc_release_vcpu_worker(vcpu);
+	if(vm)noir_release_reslock(vm->header.vcpu_list_lock);
+}
+
 noir_status nvc_svmc_create_vcpu(noir_svm_custom_vcpu_p* virtual_cpu,noir_svm_custom_vm_p virtual_machine,u32 vcpu_id)
 {
 	if(virtual_machine->vcpu[vcpu_id]==null)
@@ -576,7 +951,13 @@ noir_status nvc_svmc_create_vcpu(noir_svm_custom_vcpu_p* virtual_cpu,noir_svm_cu
 			virtual_machine->vcpu[vcpu_id]=vcpu;
 			// Mark the owner VM of vCPU.
 			vcpu->vm=virtual_machine;
-			vcpu->proc_id=vcpu_id;
+			vcpu->vcpu_id=vcpu_id;
+			// The VMCB is not owned by any processor yet.
+			vcpu->proc_id=0xffffffff;
+			// The vCPU is not scheduled yet.
+			noir_initialize_list_entry(&vcpu->header.scheduler.ready_list);
+			vcpu->header.scheduler.time_slice=noir_cvm_default_time_slice;
+			vcpu->header.scheduler.queue=0xffffffff;
 			// Initialize the VMCB via hypercall. It is supposed that only hypervisor can operate VMCB.
 			noir_svm_vmmcall(noir_svm_init_custom_vmcb,(ulong_ptr)vcpu);
 		}
@@ -675,7 +1056,7 @@ noir_status static nvc_svmc_create_1gb_page_map(noir_svm_custom_npt_manager_p np
 	noir_npt_pdpte_descriptor_p pdpte_p=noir_alloc_nonpg_memory(sizeof(noir_npt_pdpte_descriptor));
 	if(pdpte_p)
 	{
-		pdpte_p->virt=noir_alloc_contd_memory(page_size);
+		pdpte_p->virt=noir_alloc_pool_page(&npt_manager->pool,&pdpte_p->phys);
 		if(pdpte_p->virt==null)
 			noir_free_nonpg_memory(pdpte_p);
 		else
@@ -683,7 +1064,6 @@ noir_status static nvc_svmc_create_1gb_page_map(noir_svm_custom_npt_manager_p np
 			amd64_addr_translator gpa_t;
 			gpa_t.value=gpa;
 			// Setup PDPTE descriptor.
-			pdpte_p->phys=noir_get_physical_address(pdpte_p->virt);
 			pdpte_p->gpa_start=page_512gb_base(gpa);
 			// Do mapping - this level.
 			nvc_svmc_set_pdpte_entry(&pdpte_p->virt[gpa_t.pdpte_offset],hpa,map_attrib);
@@ -708,7 +1088,7 @@ noir_status static nvc_svmc_create_2mb_page_map(noir_svm_custom_npt_manager_p np
 	noir_npt_pde_descriptor_p pde_p=noir_alloc_nonpg_memory(sizeof(noir_npt_pde_descriptor));
 	if(pde_p)
 	{
-		pde_p->virt=noir_alloc_contd_memory(page_size);
+		pde_p->virt=noir_alloc_pool_page(&npt_manager->pool,&pde_p->phys);
 		if(pde_p->virt==null)
 			noir_free_nonpg_memory(pde_p);
 		else
@@ -717,7 +1097,6 @@ noir_status static nvc_svmc_create_2mb_page_map(noir_svm_custom_npt_manager_p np
 			amd64_addr_translator gpa_t;
 			gpa_t.value=gpa;
 			// Setup PDE descriptor
-			pde_p->phys=noir_get_physical_address(pde_p->virt);
 			pde_p->gpa_start=page_1gb_base(gpa);
 			// Do mapping
 			nvc_svmc_set_pde_entry(&pde_p->virt[gpa_t.pte_offset],hpa,map_attrib);
@@ -756,7 +1135,7 @@ noir_status static nvc_svmc_create_4kb_page_map(noir_svm_custom_npt_manager_p np
 	noir_npt_pte_descriptor_p pte_p=noir_alloc_nonpg_memory(sizeof(noir_npt_pte_descriptor));
 	if(pte_p)
 	{
-		pte_p->virt=noir_alloc_contd_memory(page_size);
+		pte_p->virt=noir_alloc_pool_page(&npt_manager->pool,&pte_p->phys);
 		if(pte_p->virt==null)
 			noir_free_nonpg_memory(pte_p);
 		else
@@ -765,7 +1144,6 @@ noir_status static nvc_svmc_create_4kb_page_map(noir_svm_custom_npt_manager_p np
 			amd64_addr_translator gpa_t;
 			gpa_t.value=gpa;
 			// Setup PTE descriptor
-			pte_p->phys=noir_get_physical_address(pte_p->virt);
 			pte_p->gpa_start=page_2mb_base(gpa);
 			// Do mapping
 			nvc_svmc_set_pte_entry(&pte_p->virt[gpa_t.pte_offset],0,map_attrib);
@@ -921,50 +1299,54 @@ void nvc_svmc_release_vm(noir_svm_custom_vm_p vm)
 		{
 			for(u32 i=0;i<255;i++)
 				if(vm->vcpu[i])
-					nvc_svmc_release_vcpu(vm->vcpu[i]);
+					nvc_svmc_release_vcpu_worker(vm->vcpu[i]);
 			noir_free_nonpg_memory(vm->vcpu);
 			vm->vcpu=null;
 		}
 		noir_release_reslock(vm->header.vcpu_list_lock);
-		// Release Nested Paging Structure.
-		if(vm->nptm.ncr3.virt)
-			noir_free_contd_memory(vm->nptm.ncr3.virt);
-		// Release PDPTE descriptors and paging structures...
+		// Release run queues. All vCPUs are removed from the queues as they are released.
+		if(vm->header.run_queue)
+		{
+			for(u32 i=0;i<vm->header.run_queues;i++)
+				if(vm->header.run_queue[i].lock)
+					noir_finalize_reslock(vm->header.run_queue[i].lock);
+			noir_free_nonpg_memory(vm->header.run_queue);
+		}
+		// Release PDPTE descriptors...
 		if(vm->nptm.pdpte.head)
 		{
 			noir_npt_pdpte_descriptor_p cur=vm->nptm.pdpte.head;
 			while(cur)
 			{
 				noir_npt_pdpte_descriptor_p next=cur->next;
-				if(cur->virt)noir_free_contd_memory(cur->virt);
 				noir_free_nonpg_memory(cur);
 				cur=next;
 			}
 		}
-		// Release PDE descriptors and paging structures...
+		// Release PDE descriptors...
 		if(vm->nptm.pde.head)
 		{
 			noir_npt_pde_descriptor_p cur=vm->nptm.pde.head;
 			while(cur)
 			{
 				noir_npt_pde_descriptor_p next=cur->next;
-				if(cur->virt)noir_free_contd_memory(cur->virt);
 				noir_free_nonpg_memory(cur);
 				cur=next;
 			}
 		}
-		// Release PTE descriptors and paging structures...
+		// Release PTE descriptors...
 		if(vm->nptm.pte.head)
 		{
 			noir_npt_pte_descriptor_p cur=vm->nptm.pte.head;
 			while(cur)
 			{
 				noir_npt_pte_descriptor_p next=cur->next;
-				if(cur->virt)noir_free_contd_memory(cur->virt);
 				noir_free_nonpg_memory(cur);
 				cur=next;
 			}
 		}
+		// Release Nested Paging Structure along with the pool.
+		noir_finalize_page_pool(&vm->nptm.pool);
 		// Release MSRPM & IOPM
 		if(vm->msrpm.virt)noir_free_contd_memory(vm->msrpm.virt);
 		if(vm->msrpm_full.virt)noir_free_contd_memory(vm->msrpm_full.virt);
@@ -1000,11 +1382,10 @@ noir_status nvc_svmc_create_vm(noir_svm_custom_vm_p* virtual_machine)
 			if(vm->asid==0xffffffff)
 				goto alloc_failure;
 			// Create a generic Page Map Level 4 (PML4) Table.
-			vm->nptm.ncr3.virt=noir_alloc_contd_memory(page_size);
-			if(vm->nptm.ncr3.virt)
-				vm->nptm.ncr3.phys=noir_get_physical_address(vm->nptm.ncr3.virt);
-			else
-				goto alloc_failure;
+			// CVMs may be scheduled on any processor. Their paging structures have no preference of node.
+			noir_initialize_page_pool(&vm->nptm.pool,noir_numa_any_node,null);
+			vm->nptm.ncr3.virt=noir_alloc_pool_page(&vm->nptm.pool,&vm->nptm.ncr3.phys);
+			if(vm->nptm.ncr3.virt==null)goto alloc_failure;
 			// Allocate IOPM.
 			vm->iopm.virt=noir_alloc_contd_memory(page_size*3);
 			if(vm->iopm.virt)
@@ -1026,6 +1407,17 @@ noir_status nvc_svmc_create_vm(noir_svm_custom_vm_p* virtual_machine)
 			// According to AVIC, 255 physical cores are permitted.
 			vm->vcpu=noir_alloc_nonpg_memory(sizeof(void*)*256);
 			if(vm->vcpu==null)goto alloc_failure;
+			// Allocate run queues. Each processor has its own run queue.
+			vm->header.run_queues=noir_get_processor_count();
+			vm->header.run_queue=noir_alloc_nonpg_memory(sizeof(noir_cvm_run_queue)*vm->header.run_queues);
+			if(vm->header.run_queue==null)goto alloc_failure;
+			for(u32 i=0;i<vm->header.run_queues;i++)
+			{
+				vm->header.run_queue[i].lock=noir_initialize_reslock();
+				if(vm->header.run_queue[i].lock==null)goto alloc_failure;
+				for(u32 j=0;j<noir_cvm_vcpu_priority_levels;j++)
+					noir_initialize_list_entry(&vm->header.run_queue[i].head[j]);
+			}
 			// Allocate AVIC-related pages if AVIC is supported.
 			if(noir_bt(&hvm_p->relative_hvm->virt_cap.capabilities,amd64_cpuid_avic))
 			{
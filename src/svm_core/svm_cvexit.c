@@ -265,6 +265,17 @@ void static fastcall nvc_svm_smi_cvexit_handler(noir_gpr_state_p gpr_state,noir_
 	cvcpu->header.exit_context.intercept_code=cv_scheduler_exit;
 }
 
+// Expected Intercept Code: 0x64
+void static fastcall nvc_svm_vintr_cvexit_handler(noir_gpr_state_p gpr_state,noir_svm_vcpu_p vcpu,noir_svm_custom_vcpu_p cvcpu)
+{
+	// The interrupt window requested for the event queue is open.
+	// The next pending event will be injected as the vCPU is resumed.
+	if(cvcpu->special_state.event_window)
+		nvc_svm_cancel_event_window(cvcpu);
+	else
+		nvc_svm_switch_to_host_vcpu(gpr_state,vcpu);
+}
+
 // Expected Intercept Code: 0x72
 void static fastcall nvc_svm_cpuid_cvexit_handler(noir_gpr_state_p gpr_state,noir_svm_vcpu_p vcpu,noir_svm_custom_vcpu_p cvcpu)
 {
@@ -357,6 +357,9 @@ typedef union _nvc_svm_avic_logical_apic_id_entry
 #define noir_svm_clean_avic				11
 #define noir_svm_clean_cet				12
 
+// All defined VMCB Clean Bits
+#define noir_svm_clean_bits_mask		0x1FFF
+
 // Exit Info - Decode Assists.
 typedef union _nvc_svm_cr_access_exit_info
 {
@@ -494,7 +494,6 @@ void static fastcall nvc_svm_sldt_handler(noir_gpr_state_p gpr_state,noir_svm_vc
 	}
 	else
 	{
-		ulong_ptr* gpr_array=(ulong_ptr*)gpr_state;
 		u16 ldtr=noir_svm_vmread16(vmcb,guest_ldtr_selector);
 		u8 operand_size=(u8)(decode_result>>30);
 		u8 register_index=(u8)(decode_result&0xf);
@@ -508,13 +507,7 @@ void static fastcall nvc_svm_sldt_handler(noir_gpr_state_p gpr_state,noir_svm_vc
 				noir_svm_vmwrite64(vmcb,guest_rsp,ldtr);
 		}
 		else
-		{
-			if(operand_size==2)
-				*(u32*)&gpr_array[register_index]=0;
-			else if(operand_size==3)
-				*(u64*)&gpr_array[register_index]=0;
-			*(u16*)&gpr_array[register_index]=ldtr;
-		}
+			noir_emu_write_gpr(gpr_state,register_index,(u8)(1<<operand_size),false,ldtr);
 	}
 	noir_svm_advance_rip(vmcb);
 }
@@ -559,7 +552,6 @@ void static fastcall nvc_svm_str_handler(noir_gpr_state_p gpr_state,noir_svm_vcp
 	}
 	else
 	{
-		ulong_ptr* gpr_array=(ulong_ptr*)gpr_state;
 		u16 tr=noir_svm_vmread16(vmcb,guest_tr_selector);
 		u8 operand_size=(u8)(decode_result>>30);
 		u8 register_index=(u8)(decode_result&0xf);
@@ -573,13 +565,7 @@ void static fastcall nvc_svm_str_handler(noir_gpr_state_p gpr_state,noir_svm_vcp
 				noir_svm_vmwrite64(vmcb,guest_rsp,tr);
 		}
 		else
-		{
-			if(operand_size==2)
-				*(u32*)&gpr_array[register_index]=0;
-			else if(operand_size==3)
-				*(u64*)&gpr_array[register_index]=0;
-			*(u16*)&gpr_array[register_index]=tr;
-		}
+			noir_emu_write_gpr(gpr_state,register_index,(u8)(1<<operand_size),false,tr);
 	}
 	noir_svm_advance_rip(vmcb);
 }
@@ -681,7 +667,9 @@ void static fastcall nvc_svm_cpuid_handler(noir_gpr_state_p gpr_state,noir_svm_v
 	u32 ia=(u32)gpr_state->rax;
 	u32 ic=(u32)gpr_state->rcx;
 	noir_cpuid_general_info info;
-	nvcp_svm_cpuid_handler(ia,ic,&info);
+	// Most leaves are precomputed on subversion. Invoke the handler only if the leaf is not cached.
+	if(!noir_query_cpuid_cache(&vcpu->cpuid_cache,ia,ic,noir_svm_vmread(vcpu->vmcb.virt,guest_cr4),&info))
+		nvcp_svm_cpuid_handler(ia,ic,&info);
 	*(u32*)&gpr_state->rax=info.eax;
 	*(u32*)&gpr_state->rbx=info.ebx;
 	*(u32*)&gpr_state->rcx=info.ecx;
@@ -771,7 +759,8 @@ void static fastcall nvc_svm_rdmsr_handler(noir_gpr_state_p gpr_state,noir_svm_v
 }
 
 // This is a branch of MSR-Exit. DO NOT ADVANCE RIP HERE!
-void static fastcall nvc_svm_wrmsr_handler(noir_gpr_state_p gpr_state,noir_svm_vcpu_p vcpu)
+// Returns false if #GP is injected, so that the faulting instruction is not skipped.
+bool static fastcall nvc_svm_wrmsr_handler(noir_gpr_state_p gpr_state,noir_svm_vcpu_p vcpu)
 {
 	void* vmcb=vcpu->vmcb.virt;
 	// The index of MSR is saved in ecx register (32-bit).
@@ -782,11 +771,12 @@ void static fastcall nvc_svm_wrmsr_handler(noir_gpr_state_p gpr_state,noir_svm_v
 	val.high=(u32)gpr_state->rdx;
 	if(noir_is_synthetic_msr(index))
 	{
-		if(hvm_p->options.cpuid_hv_presence)
-			nvc_mshv_wrmsr_handler(&vcpu->mshvcpu,index,val.value);
-		else
-			// Synthetic MSR is not allowed, inject #GP to Guest.
+		// Synthetic MSR is not allowed or is read-only, inject #GP to Guest.
+		if(!hvm_p->options.cpuid_hv_presence || !nvc_mshv_wrmsr_handler(&vcpu->mshvcpu,index,val.value))
+		{
 			noir_svm_inject_event(vmcb,amd64_general_protection,amd64_fault_trap_exception,true,true,0);
+			return false;
+		}
 	}
 	else
 	{
@@ -797,7 +787,10 @@ void static fastcall nvc_svm_wrmsr_handler(noir_gpr_state_p gpr_state,noir_svm_v
 				// If Nested Virtualization is disabled, attempts to set the SVME bit must be thrown exceptions.
 				bool svme=noir_bt(&val.low,amd64_efer_svme);
 				if(svme && !hvm_p->options.nested_virtualization)
+				{
 					noir_svm_inject_event(vmcb,amd64_general_protection,amd64_fault_trap_exception,true,true,0);
+					return false;
+				}
 				else
 				{
 					// Other bits can be ignored, but SVME should be always protected.
@@ -858,7 +851,10 @@ void static fastcall nvc_svm_wrmsr_handler(noir_gpr_state_p gpr_state,noir_svm_v
 			{
 				// Store the physical address of Host-Save Area to nested HVM structure.
 				if(page_4kb_offset(val.value))		// Unaligned address will trigger #GP exception.
+				{
 					noir_svm_inject_event(vmcb,amd64_general_protection,amd64_fault_trap_exception,true,true,0);
+					return false;
+				}
 				else
 				{
 					vcpu->nested_hvm.hsave_gpa=val.value;
@@ -884,6 +880,7 @@ void static fastcall nvc_svm_wrmsr_handler(noir_gpr_state_p gpr_state,noir_svm_v
 #endif
 		}
 	}
+	return true;
 }
 
 // Expected Intercept Code: 0x7C
@@ -894,10 +891,14 @@ void static fastcall nvc_svm_msr_handler(noir_gpr_state_p gpr_state,noir_svm_vcp
 	bool op_write=noir_svm_vmread8(vmcb,exit_info1);
 	// 
 	if(op_write)
-		nvc_svm_wrmsr_handler(gpr_state,vcpu);
+	{
+		if(nvc_svm_wrmsr_handler(gpr_state,vcpu))noir_svm_advance_rip(vmcb);
+	}
 	else
+	{
 		nvc_svm_rdmsr_handler(gpr_state,vcpu);
-	noir_svm_advance_rip(vmcb);
+		noir_svm_advance_rip(vmcb);
+	}
 }
 
 // Expected Intercept Code: 0x7F
@@ -921,36 +922,16 @@ void static fastcall nvc_svm_vmrun_handler(noir_gpr_state_p gpr_state,noir_svm_v
 		// Get the Nested VMCB.
 		const ulong_ptr nested_vmcb_pa=gpr_state->rax;
 		void* nested_vmcb_va=noir_find_virt_by_phys(nested_vmcb_pa);
-		noir_svm_nested_vcpu_node_p nvcpu=loader_stack->nested_vcpu;
 		// Search for cached VMCBs.
+		noir_svm_nested_vcpu_node_p nvcpu=nvc_svmn_search_nested_vmcb(vcpu,nested_vmcb_pa);
 		if(nvcpu)
-		{
-retry_search:
-			u32 lo=0,hi=noir_svm_cached_nested_vmcb;
-			// Use binary-search to look for cached VMCB.
-			while(hi>=lo)
-			{
-				u32 mid=(hi+lo)>>1;
-				if(vcpu->nested_hvm.nested_vmcb[mid].vmcb_c.phys>nested_vmcb_pa)
-					hi=mid-1;
-				else if(vcpu->nested_hvm.nested_vmcb[mid].vmcb_c.phys<nested_vmcb_pa)
-					lo=mid+1;
-				else
-				{
-					nvcpu=&vcpu->nested_hvm.nested_vmcb[mid];
-					nested_vmcb_va=nvcpu->vmcb_c.virt;
-					nvcpu->last_tsc=noir_rdtsc();
-					nvcpu->entry_counter++;
-				}
-			}
-		}
-		if(!nvcpu)
+			nested_vmcb_va=nvcpu->vmcb_c.virt;
+		else
 		{
 			memory_descriptor temp;
 			temp.virt=nested_vmcb_va;
 			temp.phys=nested_vmcb_pa;
-			nvc_svmn_insert_nested_vmcb(vcpu,&temp);
-			goto retry_search;
+			nvcpu=nvc_svmn_insert_nested_vmcb(vcpu,&temp);
 		}
 		// Some essential information for hypervisor-specific consistency check.
 		const u32 nested_asid=noir_svm_vmread32(nested_vmcb_va,guest_asid);
@@ -986,6 +967,18 @@ void static fastcall nvc_svm_vmmcall_handler(noir_gpr_state_p gpr_state,noir_svm
 	ulong_ptr gip=noir_svm_vmread(vcpu->vmcb.virt,guest_rip);
 	ulong_ptr gcr3=noir_svm_vmread(vcpu->vmcb.virt,guest_cr3);
 	unref_var(context);
+#if defined(_amd64)
+	// Hv#1 hypercalls are issued from the hypercall page with the signature in eax.
+	if(hvm_p->options.cpuid_hv_presence && (u32)gpr_state->rax==noir_mshv_hypercall_signature)
+	{
+		// Hypercalls from user mode are invalid instructions.
+		if(noir_svm_vmread8(vcpu->vmcb.virt,guest_cpl))
+			noir_svm_inject_event(vcpu->vmcb.virt,amd64_invalid_opcode,amd64_fault_trap_exception,false,true,0);
+		else if(nvc_mshv_hypercall_handler(&vcpu->mshvcpu,gpr_state))
+			noir_svm_advance_rip(vcpu->vmcb.virt);
+		return;
+	}
+#endif
 	switch(vmmcall_func)
 	{
 		case noir_svm_callexit:
@@ -1104,6 +1097,24 @@ void static fastcall nvc_svm_vmmcall_handler(noir_gpr_state_p gpr_state,noir_svm
 				noir_svm_inject_event(vcpu->vmcb.virt,amd64_invalid_opcode,amd64_fault_trap_exception,false,true,0);
 			break;
 		}
+		case noir_svm_fetch_exit_context:
+		{
+			// Validate the caller. Only Layered Hypervisor is authorized to invoke CVM hypercalls.
+			if(gip>=hvm_p->layered_hv_image.base && gip<hvm_p->layered_hv_image.base+hvm_p->layered_hv_image.size)
+			{
+#if defined(_hv_type1)
+				// FIXME: Translate GVAs in the structure.
+				noir_svm_custom_vcpu_p cvcpu=null;
+#else
+				noir_svm_custom_vcpu_p cvcpu=(noir_svm_custom_vcpu_p)context;
+#endif
+				// Only save the sections that were not saved at VM-Exit.
+				nvc_svm_save_exit_context(cvcpu,noir_cvm_exit_section_all&~cvcpu->header.exit_context.sections);
+			}
+			else
+				noir_svm_inject_event(vcpu->vmcb.virt,amd64_invalid_opcode,amd64_fault_trap_exception,false,true,0);
+			break;
+		}
 		case noir_svm_set_vcpu_options:
 		{
 			// Validate the caller. Only Layered Hypervisor is authorized to invoke CVM hypercalls.
@@ -1331,6 +1342,45 @@ void static fastcall nvc_svm_nested_pf_handler(noir_gpr_state_p gpr_state,noir_s
 	}
 }
 
+// If the guest cannot accept the interrupt right now, it will be retried in the next VM-Exit.
+void static fastcall nvc_svm_inject_synthetic_interrupt(noir_svm_vcpu_p vcpu)
+{
+	void* vmcb=vcpu->vmcb.virt;
+	nvc_svm_guest_interrupt gint;
+	// Do not overwrite an event being injected or interrupted in delivery.
+	if(noir_svm_vmcb_bt32(vmcb,event_injection,31) || noir_svm_vmcb_bt32(vmcb,exit_interrupt_info,31))return;
+	// The guest must be able to accept maskable interrupts.
+	if(!noir_svm_vmcb_bt32(vmcb,guest_rflags,amd64_rflags_if))return;
+	gint.value=noir_svm_vmread64(vmcb,guest_interrupt);
+	if(gint.interrupt_shadow)return;
+	if(noir_svm_vmcb_bt32(vmcb,avic_control,nvc_svm_avic_control_vgif_enabled))
+	{
+		if(!noir_svm_vmcb_bt32(vmcb,avic_control,nvc_svm_avic_control_vgif))return;
+	}
+	else if(vcpu->nested_hvm.svme && !vcpu->nested_hvm.gif)
+		return;
+	noir_svm_inject_event(vmcb,nvc_mshv_acknowledge_synthetic_interrupt(&vcpu->mshvcpu),amd64_external_virtual_interrupt,false,true,0);
+}
+
+// Apply the TLB flushes requested by the TLB-flush hypercalls.
+void static fastcall nvc_svm_apply_pending_tlb_flush(noir_svm_vcpu_p vcpu)
+{
+	const u32 pending=(u32)noir_locked_xchg((long*)&vcpu->mshvcpu.tlb_flush_pending,0);
+	if(pending)
+	{
+		void* vmcb=vcpu->vmcb.virt;
+		u8 control=noir_svm_vmread8(vmcb,tlb_control);
+		// Do not downgrade the flush decided by the exit handler.
+		if(pending & noir_mshv_tlb_flush_all)
+		{
+			if(control!=nvc_svm_tlb_control_flush_entire)control=nvc_svm_tlb_control_flush_guest;
+		}
+		else if(control==nvc_svm_tlb_control_do_nothing)
+			control=nvc_svm_tlb_control_flush_non_global;
+		noir_svm_vmwrite8(vmcb,tlb_control,control);
+	}
+}
+
 void fastcall nvc_svm_exit_handler(noir_gpr_state_p gpr_state,noir_svm_vcpu_p vcpu)
 {
 	// Get the linear address of VMCB.
@@ -1340,6 +1390,9 @@ void fastcall nvc_svm_exit_handler(noir_gpr_state_p gpr_state,noir_svm_vcpu_p vc
 	{
 		// Subverted Host is exiting...
 		const void* vmcb_va=vcpu->vmcb.virt;
+		// Take the timestamp only if exit profiling is enabled.
+		u64 exit_tsc=vcpu->exit_histogram?noir_rdtsc():0;
+		noir_exit_trace_record_p trace=null;
 		// Read the Intercept Code.
 		i64 intercept_code=noir_svm_vmread64(vmcb_va,exit_code);
 		// Determine the group and number of interception.
@@ -1347,6 +1400,9 @@ void fastcall nvc_svm_exit_handler(noir_gpr_state_p gpr_state,noir_svm_vcpu_p vc
 		u16 code_num=(u16)(intercept_code&0x3FF);
 		// rax is saved to VMCB, not GPR state.
 		gpr_state->rax=noir_svm_vmread(vmcb_va,guest_rax);
+		// Capture the exit if exit tracing is enabled.
+		if(vcpu->exit_trace)
+			trace=noir_begin_exit_trace(vcpu->exit_trace,intercept_code,noir_svm_vmread64(vmcb_va,exit_info1),noir_svm_vmread64(vmcb_va,exit_info2),noir_svm_vmread64(vmcb_va,guest_rip),gpr_state);
 		// Set VMCB Cache State as all to be cached.
 		if(vcpu->enabled_feature & noir_svm_vmcb_caching)
 			noir_svm_vmwrite32(vmcb_va,vmcb_clean_bits,0xffffffff);
@@ -1360,13 +1416,29 @@ void fastcall nvc_svm_exit_handler(noir_gpr_state_p gpr_state,noir_svm_vcpu_p vc
 			svm_exit_handlers[code_group][code_num](gpr_state,vcpu);
 		// Since rax register is operated, save to VMCB.
 		// If world is switched, do not write to VMCB.
-		if(loader_stack->guest_vmcb_pa==vcpu->vmcb.phys)noir_svm_vmwrite(vmcb_va,guest_rax,gpr_state->rax);
+		if(loader_stack->guest_vmcb_pa==vcpu->vmcb.phys)
+		{
+			noir_svm_vmwrite(vmcb_va,guest_rax,gpr_state->rax);
+			// Deliver the synthetic interrupts asserted by MSHV-Core.
+			if(hvm_p->options.cpuid_hv_presence && nvc_mshv_poll_synthetic_timers(&vcpu->mshvcpu))
+				nvc_svm_inject_synthetic_interrupt(vcpu);
+			if(hvm_p->options.cpuid_hv_presence)nvc_svm_apply_pending_tlb_flush(vcpu);
+		}
+		// Complete the capture with the decisions of the handler.
+		if(trace)noir_end_exit_trace(vcpu->exit_trace,trace,noir_svm_vmread64(vmcb_va,guest_rip),noir_svm_vmread64(vmcb_va,event_injection),gpr_state);
+		// Account the latency of this exit.
+		if(vcpu->exit_histogram)
+			noir_record_exit_latency(vcpu->exit_histogram,nvc_svm_histogram_slot(intercept_code,code_group,code_num),noir_rdtsc()-exit_tsc);
 	}
 	else if(gpr_state->rax==loader_stack->custom_vcpu->vmcb.phys)
 	{
 		// Customizable VM is exiting...
 		noir_svm_custom_vcpu_p cvcpu=loader_stack->custom_vcpu;
 		const void* vmcb_va=cvcpu->vmcb.virt;
+		// Account the time spent in the guest.
+		u64 exit_tsc=noir_rdtsc();
+		cvcpu->header.statistics.tsc.guest+=exit_tsc-cvcpu->timestamp.entry;
+		cvcpu->header.statistics.total_exits++;
 		// Read the Intercept Code.
 		i64 intercept_code=noir_svm_vmread64(vmcb_va,exit_code);
 		// Determine the group and number of interception.
@@ -1390,42 +1462,48 @@ void fastcall nvc_svm_exit_handler(noir_gpr_state_p gpr_state,noir_svm_vcpu_p vc
 		// Since rax register is operated, save to VMCB.
 		// If world is switched, do not write to VMCB.
 		if(loader_stack->guest_vmcb_pa==cvcpu->vmcb.phys)
+		{
 			noir_svm_vmwrite(vmcb_va,guest_rax,gpr_state->rax);
+			// Inject the queued events without returning to the User Hypervisor.
+			nvc_svm_drain_event_queue(cvcpu);
+			// The exit is handled by NoirVisor. Account the time spent in the hypervisor.
+			cvcpu->timestamp.entry=noir_rdtsc();
+			cvcpu->header.statistics.tsc.hypervisor+=cvcpu->timestamp.entry-exit_tsc;
+		}
 		else
 		{
+			u32 stat_index;
 			// VM-Exit to User Hypervisor occurs.
-			// If the exit is due to the scheduler, saving exit context is utterly meaningless.
-			if(cvcpu->header.exit_context.intercept_code!=cv_scheduler_exit)
+			if(cvcpu->header.exit_context.intercept_code==cv_scheduler_exit)
 			{
-				// Set General vCPU Exit Context.
-				cvcpu->header.exit_context.vcpu_state.instruction_length=(noir_svm_vmread64(vmcb_va,next_rip)-noir_svm_vmread64(vmcb_va,guest_rip))&0xf;
-				cvcpu->header.exit_context.vcpu_state.cpl=noir_svm_vmread8(vmcb_va,guest_cpl)&0x3;
-				cvcpu->header.exit_context.vcpu_state.int_shadow=noir_svm_vmcb_bt32(vmcb_va,guest_interrupt,0);
-				cvcpu->header.exit_context.vcpu_state.pe=noir_svm_vmcb_bt32(vmcb_va,guest_cr0,amd64_cr0_pe);
-				cvcpu->header.exit_context.vcpu_state.lm=noir_svm_vmcb_bt32(vmcb_va,guest_efer,amd64_efer_lma);
-				// Save Code Segment...
-				cvcpu->header.exit_context.cs.selector=noir_svm_vmread16(cvcpu->vmcb.virt,guest_cs_selector);
-				cvcpu->header.exit_context.cs.attrib=svm_attrib_inverse(noir_svm_vmread16(cvcpu->vmcb.virt,guest_cs_attrib));
-				cvcpu->header.exit_context.cs.limit=noir_svm_vmread32(cvcpu->vmcb.virt,guest_cs_limit);
-				cvcpu->header.exit_context.cs.base=noir_svm_vmread64(cvcpu->vmcb.virt,guest_cs_base);
-				// Save some GPRs...
-				cvcpu->header.exit_context.rflags=noir_svm_vmread64(cvcpu->vmcb.virt,guest_rflags);
-				cvcpu->header.exit_context.rip=noir_svm_vmread64(cvcpu->vmcb.virt,guest_rip);
-			}
-			else if(noir_locked_btr64(&cvcpu->special_state,63))		// User Hypervisor rescinded execution of vCPU.
-				cvcpu->header.exit_context.intercept_code=cv_rescission;
-			else if(cvcpu->header.vcpu_options.intercept_interrupt_window)
-			{
-				if(cvcpu->special_state.prev_virq && !noir_svm_vmcb_bt32(vmcb_va,avic_control,nvc_svm_avic_control_virq))
+				if(noir_locked_btr64(&cvcpu->special_state,63))		// User Hypervisor rescinded execution of vCPU.
+					cvcpu->header.exit_context.intercept_code=cv_rescission;
+				else if(cvcpu->header.vcpu_options.intercept_interrupt_window)
 				{
-					// User Hypervisor specifies intercepting the interrupt windows.
-					// If there was a previously injected IRQ and the interrupt was already taken, consider this an interrupt window.
-					// Notify the User Hypervisor of this information.
-					cvcpu->header.exit_context.intercept_code=cv_interrupt_window;
-					// Reset the status of previous vIRQ.
-					cvcpu->special_state.prev_virq=0;
+					if(cvcpu->special_state.prev_virq && !noir_svm_vmcb_bt32(vmcb_va,avic_control,nvc_svm_avic_control_virq))
+					{
+						// User Hypervisor specifies intercepting the interrupt windows.
+						// If there was a previously injected IRQ and the interrupt was already taken, consider this an interrupt window.
+						// Notify the User Hypervisor of this information.
+						cvcpu->header.exit_context.intercept_code=cv_interrupt_window;
+						// Reset the status of previous vIRQ.
+						cvcpu->special_state.prev_virq=0;
+					}
 				}
 			}
+			stat_index=noir_cvm_intercept_index(cvcpu->header.exit_context.intercept_code);
+			if(stat_index>=noir_cvm_intercept_index_limit)stat_index=cv_invalid_state;
+			// Save the optional sections of exit context requested for this intercept code.
+			// If the exit is due to the scheduler, nothing is requested by default.
+			cvcpu->header.exit_context.sections=0;
+			if(cvcpu->header.exit_sections[stat_index])
+				nvc_svm_save_exit_context(cvcpu,cvcpu->header.exit_sections[stat_index]);
+			// Account the exit by its final intercept code.
+			cvcpu->timestamp.exit=noir_rdtsc();
+			cvcpu->timestamp.index=stat_index;
+			cvcpu->header.statistics.exits[stat_index].count++;
+			cvcpu->header.statistics.exits[stat_index].tsc+=cvcpu->timestamp.exit-exit_tsc;
+			cvcpu->header.statistics.tsc.hypervisor+=cvcpu->timestamp.exit-exit_tsc;
 		}
 	}
 	else
@@ -1446,6 +1524,12 @@ void nvc_svm_set_mshv_handler(bool option)
 	nvcp_svm_cpuid_handler=option?nvc_svm_cpuid_hvp_handler:nvc_svm_cpuid_hvs_handler;
 }
 
+// This function must be called on the processor that the vCPU stands for, after the CPUID handler is set.
+void nvc_svm_build_cpuid_cache(noir_svm_vcpu_p vcpu)
+{
+	noir_build_cpuid_cache(&vcpu->cpuid_cache,nvcp_svm_cpuid_handler);
+}
+
 // Prior to calling this function, it is required to setup guest state fields.
 void nvc_svm_reconfigure_npiep_interceptions(noir_svm_vcpu_p vcpu)
 {
@@ -1472,4 +1556,10 @@ void nvc_svm_reconfigure_npiep_interceptions(noir_svm_vcpu_p vcpu)
 	noir_svm_vmwrite32(vmcb,intercept_instruction1,list1.value);
 	// Finally, invalidate VMCB Cache regarding interceptions.
 	noir_svm_vmcb_btr32(vmcb,vmcb_clean_bits,noir_svm_clean_interception);
+}
+
+// MSHV Core locates the target vCPUs of TLB-flush and IPI hypercalls via this function.
+noir_mshv_vcpu_p nvc_svm_get_mshv_vcpu(u32 vp_index)
+{
+	return &hvm_p->virtual_cpu[vp_index].mshvcpu;
 }
\ No newline at end of file
@@ -84,6 +84,9 @@
 #define noir_svm_maximum_code2		0x4
 #define noir_svm_maximum_negative	2
 
+// Slots of the exit histogram are laid out as group 1, group 2 and negative codes.
+#define nvc_svm_histogram_slot(c,g,n)	((c)<0?noir_svm_maximum_code1+noir_svm_maximum_code2+(u32)(-(c)-1):(g)?noir_svm_maximum_code1+(n):(n))
+
 #define amd64_external_virtual_interrupt	0
 #define amd64_non_maskable_interrupt		2
 #define amd64_fault_trap_exception			3
@@ -282,6 +285,7 @@ void static fastcall nvc_svm_sx_cvexit_handler(noir_gpr_state_p gpr_state,noir_s
 void static fastcall nvc_svm_extint_cvexit_handler(noir_gpr_state_p gpr_state,noir_svm_vcpu_p vcpu,noir_svm_custom_vcpu_p cvcpu);
 void static fastcall nvc_svm_nmi_cvexit_handler(noir_gpr_state_p gpr_state,noir_svm_vcpu_p vcpu,noir_svm_custom_vcpu_p cvcpu);
 void static fastcall nvc_svm_smi_cvexit_handler(noir_gpr_state_p gpr_state,noir_svm_vcpu_p vcpu,noir_svm_custom_vcpu_p cvcpu);
+void static fastcall nvc_svm_vintr_cvexit_handler(noir_gpr_state_p gpr_state,noir_svm_vcpu_p vcpu,noir_svm_custom_vcpu_p cvcpu);
 void static fastcall nvc_svm_cpuid_cvexit_handler(noir_gpr_state_p gpr_state,noir_svm_vcpu_p vcpu,noir_svm_custom_vcpu_p cvcpu);
 void static fastcall nvc_svm_invd_cvexit_handler(noir_gpr_state_p gpr_state,noir_svm_vcpu_p vcpu,noir_svm_custom_vcpu_p cvcpu);
 void static fastcall nvc_svm_hlt_cvexit_handler(noir_gpr_state_p gpr_state,noir_svm_vcpu_p vcpu,noir_svm_custom_vcpu_p cvcpu);
@@ -334,7 +338,7 @@ noir_svm_cvexit_handler_routine svm_cvexit_handler_group1[noir_svm_maximum_code1
 	nvc_svm_nmi_cvexit_handler,			// Physical Non-Maskable Interrupt
 	nvc_svm_smi_cvexit_handler,			// Physical System Management Interrupt
 	nvc_svm_default_cvexit_handler,		// Physical INIT Signal
-	nvc_svm_default_cvexit_handler,		// Virtual Interrupt
+	nvc_svm_vintr_cvexit_handler,		// Virtual Interrupt
 	nvc_svm_default_cvexit_handler,		// CR0 Selective Write
 	nvc_svm_default_cvexit_handler,		// sidt Instruction
 	nvc_svm_default_cvexit_handler,		// sgdt Instruction
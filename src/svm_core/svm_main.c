@@ -354,8 +354,12 @@ void static nvc_svm_subvert_processor(noir_svm_vcpu_p vcpu)
 		noir_wrmsr(amd64_hsave_pa,vcpu->hsave.phys);
 		nvc_svm_setup_virtual_msr(vcpu);
 		vcpu->mshvcpu.root_vcpu=(void*)vcpu;
+		nvc_mshv_initialize_synic(&vcpu->mshvcpu);
+		nvc_mshv_capture_apic_id(&vcpu->mshvcpu);
 		// Cache the Family-Model-Stepping Information for INIT Signal Emulation.
 		noir_cpuid(amd64_cpuid_std_proc_feature,0,&vcpu->cpuid_fms,null,null,null);
+		// Precompute the CPUID results so that CPUID exits won't execute the native cpuid instruction.
+		nvc_svm_build_cpuid_cache(vcpu);
 		vcpu->status=nvc_svm_subvert_processor_a(stack);
 		nv_dprintf("Processor %d Subversion Status: %d\n",vcpu->proc_id,vcpu->status);
 	}
@@ -382,7 +386,7 @@ void nvc_svm_cleanup(noir_hypervisor_p hvm_p)
 			if(vcpu->hvmcb.virt)
 				noir_free_contd_memory(vcpu->hvmcb.virt);
 			if(vcpu->hv_stack)
-				noir_free_nonpg_memory(vcpu->hv_stack);
+				noir_free_contd_memory(vcpu->hv_stack);
 			if(vcpu->cvm_state.xsave_area)
 				noir_free_contd_memory(vcpu->cvm_state.xsave_area);
 			if(vcpu->primary_nptm)
@@ -411,6 +415,73 @@ void nvc_svm_cleanup(noir_hypervisor_p hvm_p)
 #endif
 }
 
+// Prepare the structures of a vCPU. This function runs on the processor that the vCPU stands for.
+noir_status static nvc_svm_prepare_vcpu(noir_hypervisor_p hvm_p,u32 processor_id)
+{
+	noir_svm_vcpu_p vcpu=&hvm_p->virtual_cpu[processor_id];
+	// Place the structures on the node of the processor that accesses them on every exit.
+	const u32 node=noir_get_processor_node(processor_id);
+	if(hvm_p->exit_histograms)vcpu->exit_histogram=&hvm_p->exit_histograms[processor_id];
+	if(hvm_p->exit_traces)vcpu->exit_trace=&hvm_p->exit_traces[processor_id];
+	vcpu->vmcb.virt=noir_alloc_node_contd_memory(page_size,node,&hvm_p->numa_report);
+	if(vcpu->vmcb.virt)
+		vcpu->vmcb.phys=noir_get_physical_address(vcpu->vmcb.virt);
+	else
+		return noir_insufficient_resources;
+	vcpu->hsave.virt=noir_alloc_node_contd_memory(page_size,node,&hvm_p->numa_report);
+	if(vcpu->hsave.virt)
+		vcpu->hsave.phys=noir_get_physical_address(vcpu->hsave.virt);
+	else
+		return noir_insufficient_resources;
+	vcpu->hvmcb.virt=noir_alloc_node_contd_memory(page_size,node,&hvm_p->numa_report);
+	if(vcpu->hvmcb.virt)
+		vcpu->hvmcb.phys=noir_get_physical_address(vcpu->hvmcb.virt);
+	else
+		return noir_insufficient_resources;
+	vcpu->hv_stack=noir_alloc_node_contd_memory(nvc_stack_size,node,&hvm_p->numa_report);
+	if(vcpu->hv_stack==null)return noir_insufficient_resources;
+	vcpu->cvm_state.xsave_area=noir_alloc_node_contd_memory(hvm_p->xfeat.supported_size_max,node,&hvm_p->numa_report);
+	if(vcpu->cvm_state.xsave_area==null)return noir_insufficient_resources;
+	vcpu->relative_hvm=(noir_svm_hvm_p)hvm_p->reserved;
+	vcpu->primary_nptm=nvc_npt_build_identity_map(node);
+	if(vcpu->primary_nptm==null)return noir_insufficient_resources;
+#if !defined(_hv_type1)
+	// Only Type-II Hypervisor would hook into guest.
+	vcpu->secondary_nptm=nvc_npt_build_identity_map(node);
+	if(vcpu->secondary_nptm==null)return noir_insufficient_resources;
+	if(hvm_p->options.stealth_inline_hook)
+		nvc_npt_build_hook_mapping(vcpu);		// This feature does not have a good performance.
+#endif
+	if(hvm_p->options.nested_virtualization)
+	{
+		// Setup Nested Hypervisor
+		for(u32 j=0;j<noir_svm_cached_nested_vmcb;j++)
+		{
+			vcpu->nested_hvm.nested_vmcb[j].vmcb_t.virt=noir_alloc_node_contd_memory(page_size,node,&hvm_p->numa_report);
+			if(vcpu->nested_hvm.nested_vmcb[j].vmcb_t.virt==null)return noir_insufficient_resources;
+			vcpu->nested_hvm.nested_vmcb[j].vmcb_t.phys=noir_get_physical_address(vcpu->nested_hvm.nested_vmcb[j].vmcb_t.virt);
+			vcpu->nested_hvm.nested_vmcb[j].vmcb_c.phys=0xffffffffffffffff;		// Use -1 to indicate unused VMCB.
+		}
+		nvc_svmn_initialize_nested_vmcb_cache(vcpu);
+	}
+	if(nvc_npt_initialize_ci(vcpu->primary_nptm)==false)return noir_insufficient_resources;
+	if(hvm_p->options.stealth_msr_hook)vcpu->enabled_feature|=noir_svm_syscall_hook;
+	if(hvm_p->options.stealth_inline_hook)vcpu->enabled_feature|=noir_svm_npt_with_hooks;
+	if(hvm_p->options.kva_shadow_presence)
+	{
+		vcpu->enabled_feature|=noir_svm_kva_shadow_present;
+		nv_dprintf("Warning: KVA-Shadow is present! Stealth MSR-Hook on AMD Processors is untested in regards of KVA-Shadow!\n");
+	}
+	return noir_success;
+}
+
+void static nvc_svm_prepare_vcpu_thunk(void* context,u32 processor_id)
+{
+	noir_vcpu_setup_context_p setup=(noir_vcpu_setup_context_p)context;
+	noir_status st=nvc_svm_prepare_vcpu(setup->hvm,processor_id);
+	if(st!=noir_success)nvc_record_vcpu_setup_failure(setup,processor_id,st);
+}
+
 noir_status nvc_svm_subvert_system(noir_hypervisor_p hvm_p)
 {
 	hvm_p->cpu_count=noir_get_processor_count();
@@ -424,67 +495,31 @@ noir_status nvc_svm_subvert_system(noir_hypervisor_p hvm_p)
 	noir_cpuid(amd64_cpuid_std_pestate_enum,0,&hvm_p->xfeat.support_mask.low,&hvm_p->xfeat.enabled_size_max,&hvm_p->xfeat.supported_size_max,&hvm_p->xfeat.support_mask.high);
 	// Initialize vCPUs.
 	hvm_p->virtual_cpu=noir_alloc_nonpg_memory(hvm_p->cpu_count*sizeof(noir_svm_vcpu));
-	// Implementation of Generic Call might differ.
-	// In subversion routine, it might not be allowed to allocate memory.
-	// Thus allocate everything at this moment, even if it costs more on single processor core.
+	// Each processor prepares its own vCPU in parallel.
+	// Failures are collected here. Structures of all vCPUs are released if any vCPU fails.
 	if(hvm_p->virtual_cpu)
 	{
-		for(u32 i=0;i<hvm_p->cpu_count;i++)
+		noir_vcpu_setup_context setup;
+		nvc_initialize_vcpu_setup_context(&setup,hvm_p);
+		if(!nvc_npt_build_identity_template())nv_dprintf("Failed to build the template of identity map! NPTs will be built individually.\n");
+		noir_generic_passive_call(nvc_svm_prepare_vcpu_thunk,&setup);
+		nvc_npt_release_identity_template();
+		if(setup.failures)
 		{
-			noir_svm_vcpu_p vcpu=&hvm_p->virtual_cpu[i];
-			vcpu->vmcb.virt=noir_alloc_contd_memory(page_size);
-			if(vcpu->vmcb.virt)
-				vcpu->vmcb.phys=noir_get_physical_address(vcpu->vmcb.virt);
-			else
-				goto alloc_failure;
-			vcpu->hsave.virt=noir_alloc_contd_memory(page_size);
-			if(vcpu->hsave.virt)
-				vcpu->hsave.phys=noir_get_physical_address(vcpu->hsave.virt);
-			else
-				goto alloc_failure;
-			vcpu->hvmcb.virt=noir_alloc_contd_memory(page_size);
-			if(vcpu->hvmcb.virt)
-				vcpu->hvmcb.phys=noir_get_physical_address(vcpu->hvmcb.virt);
-			else
-				goto alloc_failure;
-			vcpu->hv_stack=noir_alloc_nonpg_memory(nvc_stack_size);
-			if(vcpu->hv_stack==null)goto alloc_failure;
-			vcpu->cvm_state.xsave_area=noir_alloc_contd_memory(hvm_p->xfeat.supported_size_max);
-			if(vcpu->cvm_state.xsave_area==null)goto alloc_failure;
-			vcpu->relative_hvm=(noir_svm_hvm_p)hvm_p->reserved;
-			vcpu->primary_nptm=nvc_npt_build_identity_map();
-			if(vcpu->primary_nptm==null)goto alloc_failure;
-#if !defined(_hv_type1)
-			// Only Type-II Hypervisor would hook into guest.
-			vcpu->secondary_nptm=nvc_npt_build_identity_map();
-			if(vcpu->secondary_nptm==null)goto alloc_failure;
-			if(hvm_p->options.stealth_inline_hook)
-				nvc_npt_build_hook_mapping(vcpu);		// This feature does not have a good performance.
-#endif
-			if(hvm_p->options.nested_virtualization)
-			{
-				// Setup Nested Hypervisor
-				for(u32 j=0;j<noir_svm_cached_nested_vmcb;j++)
-				{
-					vcpu->nested_hvm.nested_vmcb[j].vmcb_t.virt=noir_alloc_contd_memory(page_size);
-					if(vcpu->nested_hvm.nested_vmcb[j].vmcb_t.virt==null)goto alloc_failure;
-					vcpu->nested_hvm.nested_vmcb[j].vmcb_t.phys=noir_get_physical_address(vcpu->nested_hvm.nested_vmcb[j].vmcb_t.virt);
-					vcpu->nested_hvm.nested_vmcb[j].vmcb_c.phys=0xffffffffffffffff;		// Use -1 to indicate unused VMCB.
-				}
-			}
-			if(nvc_npt_initialize_ci(vcpu->primary_nptm)==false)goto alloc_failure;
-			if(hvm_p->options.stealth_msr_hook)vcpu->enabled_feature|=noir_svm_syscall_hook;
-			if(hvm_p->options.stealth_inline_hook)vcpu->enabled_feature|=noir_svm_npt_with_hooks;
-			if(hvm_p->options.kva_shadow_presence)
-			{
-				vcpu->enabled_feature|=noir_svm_kva_shadow_present;
-				nv_dprintf("Warning: KVA-Shadow is present! Stealth MSR-Hook on AMD Processors is untested in regards of KVA-Shadow!\n");
-			}
+			nv_dprintf("Failed to prepare %u vCPU(s)! Processor %u failed first with status 0x%X.\n",setup.failures,setup.failed_processor,setup.status);
+			goto alloc_failure;
 		}
 	}
+	nv_dprintf("NUMA Placement: %u node-requested, %u fallback, %u failed allocations.\n",hvm_p->numa_report.requested,hvm_p->numa_report.fallback,hvm_p->numa_report.failed);
 	hvm_p->host_pat.value=noir_rdmsr(amd64_pat);
 	hvm_p->relative_hvm->hvm_cpuid_leaf_max=nvc_mshv_build_cpuid_handlers();
 	if(hvm_p->relative_hvm->hvm_cpuid_leaf_max==0)goto alloc_failure;
+	if(hvm_p->options.cpuid_hv_presence)
+	{
+		nvc_mshv_calibrate_reference_time();
+		nvc_mshv_initialize_apic_access();
+		nvc_mshv_initialize_vcpu_kicker();
+	}
 	hvm_p->relative_hvm->msrpm.virt=noir_alloc_contd_memory(2*page_size);
 	if(hvm_p->relative_hvm->msrpm.virt)
 		hvm_p->relative_hvm->msrpm.phys=noir_get_physical_address(hvm_p->relative_hvm->msrpm.virt);
@@ -564,5 +599,7 @@ void nvc_svm_restore_system(noir_hypervisor_p hvm_p)
 		nvc_svm_cleanup(hvm_p);
 		nvc_svmc_finalize_cvm_module();
 		nvc_mshv_teardown_cpuid_handlers();
+		nvc_mshv_finalize_apic_access();
+		nvc_mshv_finalize_vcpu_kicker();
 	}
 }
\ No newline at end of file
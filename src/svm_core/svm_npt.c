@@ -33,10 +33,6 @@ void nvc_npt_cleanup(noir_npt_manager_p nptm)
 {
 	if(nptm)
 	{
-		if(nptm->ncr3.virt)
-			noir_free_contd_memory(nptm->ncr3.virt);
-		if(nptm->pdpt.virt)
-			noir_free_contd_memory(nptm->pdpt.virt);
 		if(nptm->pde.virt)
 			noir_free_2mb_page(nptm->pde.virt);
 		if(nptm->pte.head)
@@ -45,11 +41,12 @@ void nvc_npt_cleanup(noir_npt_manager_p nptm)
 			while(cur)
 			{
 				noir_npt_pte_descriptor_p next=cur->next;
-				noir_free_contd_memory(cur->virt);
 				noir_free_nonpg_memory(cur);
 				cur=next;
 			}
 		}
+		// Paging structures are returned along with the pool.
+		noir_finalize_page_pool(&nptm->pool);
 		noir_free_nonpg_memory(nptm);
 	}
 }
@@ -113,13 +110,12 @@ bool nvc_npt_update_pte(noir_npt_manager_p nptm,u64 hpa,u64 gpa,bool r,bool w,bo
 	pte_p=noir_alloc_nonpg_memory(sizeof(noir_npt_pte_descriptor));
 	if(pte_p)
 	{
-		pte_p->virt=noir_alloc_contd_memory(page_size);
+		pte_p->virt=noir_alloc_pool_page(&nptm->pool,&pte_p->phys);
 		if(pte_p->virt)
 		{
 			u64 index=(gat.pdpte_offset<<9)+gat.pde_offset;
 			amd64_npt_pde_p pde_p=(amd64_npt_pde_p)&nptm->pde.virt[index];
 			// PTE Descriptor
-			pte_p->phys=noir_get_physical_address(pte_p->virt);
 			pte_p->gpa_start=index<<9;
 			for(u32 i=0;i<512;i++)
 			{
@@ -258,6 +254,37 @@ void nvc_npt_build_hook_mapping(noir_svm_vcpu_p vcpu)
 }
 #endif
 
+void static nvc_npt_fill_identity_pdes(amd64_npt_large_pde_p pde)
+{
+	for(u32 k=0;k<512*512;k++)
+	{
+		pde[k].value=0;
+		pde[k].present=1;
+		pde[k].write=1;
+		pde[k].user=1;
+		pde[k].large_pde=1;
+		pde[k].page_base=k;
+	}
+}
+
+// The identity-mapped PDEs do not refer to any paging structures, so they are identical in all NPT managers.
+// Build them once in the template so that each NPT manager clones them with a bulk copy.
+bool nvc_npt_build_identity_template()
+{
+	noir_npt_pde_template=noir_alloc_2mb_page();
+	if(noir_npt_pde_template)nvc_npt_fill_identity_pdes(noir_npt_pde_template);
+	return noir_npt_pde_template!=null;
+}
+
+void nvc_npt_release_identity_template()
+{
+	if(noir_npt_pde_template)
+	{
+		noir_free_2mb_page(noir_npt_pde_template);
+		noir_npt_pde_template=null;
+	}
+}
+
 /*
   Introduction to Identity map:
 
@@ -274,45 +301,37 @@ void nvc_npt_build_hook_mapping(noir_svm_vcpu_p vcpu)
   4KB for 1 PDPTE page - all 512 entries are used for mapping 512*1GB=512GB physical memory.
   2MB for 512 PDE pages - all 262144 entries are used for mapping 512*512*2MB=512GB physical memory.
   We will allocate the PDEs on a single 2MB-aligned page.
+  The PDEs are cloned from the template if it is built. Only the PDPTEs have to be fixed up.
 */
-noir_npt_manager_p nvc_npt_build_identity_map()
+noir_npt_manager_p nvc_npt_build_identity_map(u32 node)
 {
 	bool alloc_success=false;
 	noir_npt_manager_p nptm=noir_alloc_nonpg_memory(sizeof(noir_npt_manager));
 	if(nptm)
 	{
-		nptm->ncr3.virt=noir_alloc_contd_memory(page_size);
-		if(nptm->ncr3.virt)
+		noir_initialize_page_pool(&nptm->pool,node,&hvm_p->numa_report);
+		// Reserve the pool in one go so that the paging structures are allocated in a contiguous chunk.
+		if(noir_reserve_pool_pages(&nptm->pool,noir_page_pool_chunk_pages))
 		{
-			nptm->pdpt.virt=noir_alloc_contd_memory(page_size);
-			if(nptm->pdpt.virt)
+			nptm->ncr3.virt=noir_alloc_pool_page(&nptm->pool,&nptm->ncr3.phys);
+			nptm->pdpt.virt=noir_alloc_pool_page(&nptm->pool,&nptm->pdpt.phys);
+			nptm->pde.virt=noir_alloc_node_2mb_page(node,&hvm_p->numa_report);
+			if(nptm->pde.virt)
 			{
-				nptm->pde.virt=noir_alloc_2mb_page();
-				if(nptm->pde.virt)
-				{
-					nptm->pde.phys=noir_get_physical_address(nptm->pde.virt);
-					alloc_success=true;
-				}
-				nptm->pdpt.phys=noir_get_physical_address(nptm->pdpt.virt);
+				nptm->pde.phys=noir_get_physical_address(nptm->pde.virt);
+				alloc_success=true;
 			}
-			nptm->ncr3.phys=noir_get_physical_address(nptm->ncr3.virt);
 		}
 	}
 	if(alloc_success)
 	{
+		// Build Page-Directory Entries (PDE)
+		if(noir_npt_pde_template)
+			noir_movsp(nptm->pde.virt,noir_npt_pde_template,page_2mb_size/sizeof(ulong_ptr));
+		else
+			nvc_npt_fill_identity_pdes(nptm->pde.virt);
 		for(u32 i=0;i<512;i++)
 		{
-			for(u32 j=0;j<512;j++)
-			{
-				const u32 k=(i<<9)+j;
-				// Build Page-Directory Entries (PDE)
-				nptm->pde.virt[k].value=0;
-				nptm->pde.virt[k].present=1;
-				nptm->pde.virt[k].write=1;
-				nptm->pde.virt[k].user=1;
-				nptm->pde.virt[k].large_pde=1;
-				nptm->pde.virt[k].page_base=k;
-			}
 			// Build Page-Directory Pointer Table Entries (PDPTE)
 			nptm->pdpt.virt[i].value=0;
 			nptm->pdpt.virt[i].present=1;
@@ -201,6 +201,7 @@ typedef struct _noir_npt_manager
 		noir_npt_pte_descriptor_p head;
 		noir_npt_pte_descriptor_p tail;
 	}pte;
+	noir_page_pool pool;	// Paging structures of 4KB pages are allocated from this pool.
 }noir_npt_manager,*noir_npt_manager_p;
 
 typedef union _amd64_npt_fault_code
@@ -224,9 +225,18 @@ typedef union _amd64_npt_fault_code
 	u64 value;
 }amd64_npt_fault_code,*amd64_npt_fault_code_p;
 
+// Template of identity-mapped PDEs. It only lives while NPT managers are being built.
+#if defined(_svm_npt)
+amd64_npt_large_pde_p noir_npt_pde_template=null;
+#else
+extern amd64_npt_large_pde_p noir_npt_pde_template;
+#endif
+
 bool nvc_npt_protect_critical_hypervisor(noir_hypervisor_p hvm);
 bool nvc_npt_initialize_ci(noir_npt_manager_p nptm);
-noir_npt_manager_p nvc_npt_build_identity_map();
+bool nvc_npt_build_identity_template();
+void nvc_npt_release_identity_template();
+noir_npt_manager_p nvc_npt_build_identity_map(u32 node);
 bool nvc_npt_update_pde(noir_npt_manager_p nptm,u64 hpa,bool r,bool w,bool x);
 void nvc_npt_build_hook_mapping(noir_svm_vcpu_p vcpu);
 void nvc_npt_cleanup(noir_npt_manager_p nptm);
@@ -25,46 +25,96 @@
 #include "svm_exit.h"
 #include "svm_def.h"
 
-i32 static cdecl nvc_svmn_compare_vmcb_node_callback(const void* a,const void* b)
+u32 static inline nvc_svmn_hash_vmcb(u64 vmcb_pa)
 {
-	noir_svm_nested_vcpu_node_p node1=(noir_svm_nested_vcpu_node_p)a;
-	noir_svm_nested_vcpu_node_p node2=(noir_svm_nested_vcpu_node_p)b;
-	if(node1->vmcb_c.phys>=node2->vmcb_c.phys+page_size)
-		return 1;
-	else if(node1->vmcb_c.phys<node2->vmcb_c.phys)
-		return -1;
-	return 0;
+	// Fibonacci hashing on the page frame number.
+	return (u32)(((vmcb_pa>>page_shift)*0x9E3779B97F4A7C15)>>(64-noir_svm_nested_vmcb_hash_bits));
 }
 
-void nvc_svmn_insert_nested_vmcb(noir_svm_vcpu_p vcpu,memory_descriptor_p vmcb)
+void static nvc_svmn_unlink_lru_node(noir_svm_nested_vcpu_p nested_hvm,noir_svm_nested_vcpu_node_p node)
 {
-	// Insert to cached nested VMCB list.
-	if(vcpu->nested_hvm.nested_vmcb[noir_svm_cached_nested_vmcb-1].vmcb_c.phys==0xffffffffffffffff)
+	if(node->lru_prev)
+		node->lru_prev->lru_next=node->lru_next;
+	else
+		nested_hvm->vmcb_lru.head=node->lru_next;
+	if(node->lru_next)
+		node->lru_next->lru_prev=node->lru_prev;
+	else
+		nested_hvm->vmcb_lru.tail=node->lru_prev;
+}
+
+void static nvc_svmn_push_lru_node(noir_svm_nested_vcpu_p nested_hvm,noir_svm_nested_vcpu_node_p node)
+{
+	node->lru_prev=null;
+	node->lru_next=nested_hvm->vmcb_lru.head;
+	if(nested_hvm->vmcb_lru.head)
+		nested_hvm->vmcb_lru.head->lru_prev=node;
+	else
+		nested_hvm->vmcb_lru.tail=node;
+	nested_hvm->vmcb_lru.head=node;
+}
+
+// This procedure is to be called after L2T VMCBs are allocated.
+void nvc_svmn_initialize_nested_vmcb_cache(noir_svm_vcpu_p vcpu)
+{
+	noir_svm_nested_vcpu_p nested_hvm=&vcpu->nested_hvm;
+	for(u32 i=0;i<noir_svm_nested_vmcb_hash_buckets;i++)
+		nested_hvm->vmcb_hash[i]=null;
+	nested_hvm->vmcb_lru.head=nested_hvm->vmcb_lru.tail=null;
+	// All entries are vacant at this moment. Their order in the list does not matter.
+	for(u32 i=0;i<noir_svm_cached_nested_vmcb;i++)
 	{
-		// There is vacancy, insert to the end.
-		vcpu->nested_hvm.nested_vmcb[noir_svm_cached_nested_vmcb-1].vmcb_c=*vmcb;
+		nested_hvm->nested_vmcb[i].hash_next=null;
+		nvc_svmn_push_lru_node(nested_hvm,&nested_hvm->nested_vmcb[i]);
 	}
-	else
+}
+
+noir_svm_nested_vcpu_node_p nvc_svmn_search_nested_vmcb(noir_svm_vcpu_p vcpu,u64 vmcb_pa)
+{
+	noir_svm_nested_vcpu_p nested_hvm=&vcpu->nested_hvm;
+	for(noir_svm_nested_vcpu_node_p node=nested_hvm->vmcb_hash[nvc_svmn_hash_vmcb(vmcb_pa)];node;node=node->hash_next)
 	{
-		// Possible optimization: use multi-dimensional comparison to select cache entry replacements.
-		u64 last_tsc=maxu64;
-		u32 last_index=0;
-		// Search for least-recent-used VMCB entry.
-		for(u32 i=0;i<noir_svm_cached_nested_vmcb;i++)
+		if(node->vmcb_c.phys==vmcb_pa)
 		{
-			if(vcpu->nested_hvm.nested_vmcb[i].last_tsc<last_tsc)
+			// Move the entry to the head of LRU list.
+			if(node!=nested_hvm->vmcb_lru.head)
 			{
-				last_tsc=vcpu->nested_hvm.nested_vmcb[i].last_tsc;
-				last_index=i;
+				nvc_svmn_unlink_lru_node(nested_hvm,node);
+				nvc_svmn_push_lru_node(nested_hvm,node);
 			}
+			node->last_tsc=noir_rdtsc();
+			node->entry_counter++;
+			return node;
 		}
-		// Replace the entry.
-		vcpu->nested_hvm.nested_vmcb[last_index].vmcb_c=*vmcb;
-		// Clear the cache.
-		noir_svm_vmwrite32(vcpu->nested_hvm.nested_vmcb[last_index].vmcb_t.virt,vmcb_clean_bits,0);
 	}
-	// Sort the list.
-	noir_qsort(&vcpu->nested_hvm.nested_vmcb,noir_svm_cached_nested_vmcb,sizeof(noir_svm_nested_vcpu_node),nvc_svmn_compare_vmcb_node_callback);
+	return null;
+}
+
+noir_svm_nested_vcpu_node_p nvc_svmn_insert_nested_vmcb(noir_svm_vcpu_p vcpu,memory_descriptor_p vmcb)
+{
+	noir_svm_nested_vcpu_p nested_hvm=&vcpu->nested_hvm;
+	// Either a vacant entry or the least-recently-used entry is at the tail.
+	noir_svm_nested_vcpu_node_p node=nested_hvm->vmcb_lru.tail;
+	if(node->vmcb_c.phys!=0xffffffffffffffff)
+	{
+		// Evict the entry from its hash bucket.
+		noir_svm_nested_vcpu_node_p *link=&nested_hvm->vmcb_hash[nvc_svmn_hash_vmcb(node->vmcb_c.phys)];
+		while(*link!=node)link=&(*link)->hash_next;
+		*link=node->hash_next;
+	}
+	// Replace the entry.
+	node->vmcb_c=*vmcb;
+	node->last_tsc=noir_rdtsc();
+	node->entry_counter=1;
+	// Clear the cache. All state groups must be synchronized at next VMRUN.
+	noir_svm_vmwrite32(node->vmcb_t.virt,vmcb_clean_bits,0);
+	node->dirty_groups=maxu32;
+	// Insert to the hash bucket and the head of LRU list.
+	node->hash_next=nested_hvm->vmcb_hash[nvc_svmn_hash_vmcb(vmcb->phys)];
+	nested_hvm->vmcb_hash[nvc_svmn_hash_vmcb(vmcb->phys)]=node;
+	nvc_svmn_unlink_lru_node(nested_hvm,node);
+	nvc_svmn_push_lru_node(nested_hvm,node);
+	return node;
 }
 
 void nvc_svmn_set_gif(noir_gpr_state_p gpr_state,noir_svm_vcpu_p vcpu,void* target_vmcb)
@@ -132,153 +182,163 @@ void nvc_svmn_clear_gif(noir_svm_vcpu_p vcpu)
 	noir_svm_vmcb_btr32(vmcb,vmcb_clean_bits,noir_svm_clean_tpr);
 }
 
-// This procedure is to be called on vmrun interception.
-void nvc_svmn_synchronize_to_l2t_vmcb(noir_svm_nested_vcpu_node_p nvcpu)
+// Copy the VMCB state groups specified by the bitmap from source VMCB to destination VMCB.
+// The layout of the bitmap is identical to VMCB clean bits.
+void static nvc_svmn_copy_vmcb_groups(void* dest,void* src,u32 groups)
 {
-	// Synchronize the L2C VMCB to L2T VMCB.
-	// First of all, synchronize all states not cached by clean bits.
-	noir_svm_vmwrite64(nvcpu->vmcb_t.virt,guest_rax,noir_svm_vmread64(nvcpu->vmcb_c.virt,guest_rax));
-	noir_svm_vmwrite64(nvcpu->vmcb_t.virt,guest_rsp,noir_svm_vmread64(nvcpu->vmcb_c.virt,guest_rsp));
-	noir_svm_vmwrite64(nvcpu->vmcb_t.virt,guest_rip,noir_svm_vmread64(nvcpu->vmcb_c.virt,guest_rip));
-	noir_svm_vmwrite64(nvcpu->vmcb_t.virt,guest_rflags,noir_svm_vmread64(nvcpu->vmcb_c.virt,guest_rflags));
-	noir_svm_vmwrite64(nvcpu->vmcb_t.virt,guest_interrupt,noir_svm_vmread64(nvcpu->vmcb_c.virt,guest_interrupt));
-	noir_svm_vmwrite64(nvcpu->vmcb_t.virt,event_injection,noir_svm_vmread64(nvcpu->vmcb_c.virt,event_injection));
-	noir_svm_vmwrite8(nvcpu->vmcb_t.virt,tlb_control,noir_svm_vmread8(nvcpu->vmcb_c.virt,tlb_control));
-	noir_svm_vmwrite8(nvcpu->vmcb_t.virt,guest_cpl,noir_svm_vmread8(nvcpu->vmcb_c.virt,guest_cpl));
-	// Then, traverse the clean bits to determine what fields in VMCBs are supposed be synchronized.
 	// Bit 0: Interception Vectors, TSC Offsetting, and Pause-Filter.
-	if(!noir_svm_vmcb_bt32(nvcpu->vmcb_t.virt,vmcb_clean_bits,noir_svm_clean_interception))
+	if(noir_bt(&groups,noir_svm_clean_interception))
 	{
-		noir_svm_vmwrite32(nvcpu->vmcb_t.virt,intercept_access_cr,noir_svm_vmread32(nvcpu->vmcb_c.virt,intercept_access_cr));
-		noir_svm_vmwrite32(nvcpu->vmcb_t.virt,intercept_access_dr,noir_svm_vmread32(nvcpu->vmcb_c.virt,intercept_access_dr));
-		noir_svm_vmwrite32(nvcpu->vmcb_t.virt,intercept_exceptions,noir_svm_vmread32(nvcpu->vmcb_c.virt,intercept_exceptions));
-		noir_svm_vmwrite32(nvcpu->vmcb_t.virt,intercept_instruction1,noir_svm_vmread32(nvcpu->vmcb_c.virt,intercept_instruction1));
-		noir_svm_vmwrite32(nvcpu->vmcb_t.virt,intercept_instruction2,noir_svm_vmread32(nvcpu->vmcb_c.virt,intercept_instruction2));
-		noir_svm_vmwrite32(nvcpu->vmcb_t.virt,intercept_instruction3,noir_svm_vmread32(nvcpu->vmcb_c.virt,intercept_instruction3));
-		noir_svm_vmwrite64(nvcpu->vmcb_t.virt,tsc_offset,noir_svm_vmread64(nvcpu->vmcb_c.virt,tsc_offset));
-		noir_svm_vmwrite16(nvcpu->vmcb_t.virt,pause_filter_count,noir_svm_vmread16(nvcpu->vmcb_c.virt,pause_filter_count));
-		noir_svm_vmwrite16(nvcpu->vmcb_t.virt,pause_filter_threshold,noir_svm_vmread16(nvcpu->vmcb_c.virt,pause_filter_threshold));
+		noir_svm_vmwrite32(dest,intercept_access_cr,noir_svm_vmread32(src,intercept_access_cr));
+		noir_svm_vmwrite32(dest,intercept_access_dr,noir_svm_vmread32(src,intercept_access_dr));
+		noir_svm_vmwrite32(dest,intercept_exceptions,noir_svm_vmread32(src,intercept_exceptions));
+		noir_svm_vmwrite32(dest,intercept_instruction1,noir_svm_vmread32(src,intercept_instruction1));
+		noir_svm_vmwrite32(dest,intercept_instruction2,noir_svm_vmread32(src,intercept_instruction2));
+		noir_svm_vmwrite32(dest,intercept_instruction3,noir_svm_vmread32(src,intercept_instruction3));
+		noir_svm_vmwrite64(dest,tsc_offset,noir_svm_vmread64(src,tsc_offset));
+		noir_svm_vmwrite16(dest,pause_filter_count,noir_svm_vmread16(src,pause_filter_count));
+		noir_svm_vmwrite16(dest,pause_filter_threshold,noir_svm_vmread16(src,pause_filter_threshold));
 	}
 	// Bit 1: IOPM and MSRPM
-	if(!noir_svm_vmcb_bt32(nvcpu->vmcb_t.virt,vmcb_clean_bits,noir_svm_clean_iomsrpm))
+	if(noir_bt(&groups,noir_svm_clean_iomsrpm))
 	{
-		noir_svm_vmwrite64(nvcpu->vmcb_t.virt,iopm_physical_address,noir_svm_vmread64(nvcpu->vmcb_c.virt,iopm_physical_address));
-		noir_svm_vmwrite64(nvcpu->vmcb_t.virt,msrpm_physical_address,noir_svm_vmread64(nvcpu->vmcb_c.virt,msrpm_physical_address));
+		noir_svm_vmwrite64(dest,iopm_physical_address,noir_svm_vmread64(src,iopm_physical_address));
+		noir_svm_vmwrite64(dest,msrpm_physical_address,noir_svm_vmread64(src,msrpm_physical_address));
 	}
-	// Bit 2: ASID
-	if(!noir_svm_vmcb_bt32(nvcpu->vmcb_t.virt,vmcb_clean_bits,noir_svm_clean_asid))
-		noir_svm_vmwrite32(nvcpu->vmcb_t.virt,guest_asid,noir_svm_vmread32(nvcpu->vmcb_c.virt,guest_asid)+1);
+	// Bit 2: ASID is translated by the caller.
 	// Bit 3: AVIC Control
-	if(!noir_svm_vmcb_bt32(nvcpu->vmcb_t.virt,vmcb_clean_bits,noir_svm_clean_tpr))
-		noir_svm_vmwrite64(nvcpu->vmcb_t.virt,avic_control,noir_svm_vmread64(nvcpu->vmcb_c.virt,avic_control));
+	if(noir_bt(&groups,noir_svm_clean_tpr))
+		noir_svm_vmwrite64(dest,avic_control,noir_svm_vmread64(src,avic_control));
 	// Bit 4: NPT
-	if(!noir_svm_vmcb_bt32(nvcpu->vmcb_t.virt,vmcb_clean_bits,noir_svm_clean_npt))
+	if(noir_bt(&groups,noir_svm_clean_npt))
 	{
-		noir_svm_vmwrite64(nvcpu->vmcb_t.virt,guest_pat,noir_svm_vmread64(nvcpu->vmcb_c.virt,guest_pat));
-		noir_svm_vmwrite64(nvcpu->vmcb_t.virt,npt_control,noir_svm_vmread64(nvcpu->vmcb_c.virt,npt_control));
-		noir_svm_vmwrite64(nvcpu->vmcb_t.virt,npt_cr3,noir_svm_vmread64(nvcpu->vmcb_c.virt,npt_cr3));
+		noir_svm_vmwrite64(dest,guest_pat,noir_svm_vmread64(src,guest_pat));
+		noir_svm_vmwrite64(dest,npt_control,noir_svm_vmread64(src,npt_control));
+		noir_svm_vmwrite64(dest,npt_cr3,noir_svm_vmread64(src,npt_cr3));
 	}
 	// Bit 5: Control Registers
-	if(!noir_svm_vmcb_bt32(nvcpu->vmcb_t.virt,vmcb_clean_bits,noir_svm_clean_control_reg))
+	if(noir_bt(&groups,noir_svm_clean_control_reg))
 	{
-		noir_svm_vmwrite64(nvcpu->vmcb_t.virt,guest_cr0,noir_svm_vmread64(nvcpu->vmcb_c.virt,guest_cr0));
-		noir_svm_vmwrite64(nvcpu->vmcb_t.virt,guest_cr3,noir_svm_vmread64(nvcpu->vmcb_c.virt,guest_cr3));
-		noir_svm_vmwrite64(nvcpu->vmcb_t.virt,guest_cr4,noir_svm_vmread64(nvcpu->vmcb_c.virt,guest_cr4));
-		noir_svm_vmwrite64(nvcpu->vmcb_t.virt,guest_efer,noir_svm_vmread64(nvcpu->vmcb_c.virt,guest_efer));
+		noir_svm_vmwrite64(dest,guest_cr0,noir_svm_vmread64(src,guest_cr0));
+		noir_svm_vmwrite64(dest,guest_cr3,noir_svm_vmread64(src,guest_cr3));
+		noir_svm_vmwrite64(dest,guest_cr4,noir_svm_vmread64(src,guest_cr4));
+		noir_svm_vmwrite64(dest,guest_efer,noir_svm_vmread64(src,guest_efer));
 	}
 	// Bit 6: Debug Registers
-	if(!noir_svm_vmcb_bt32(nvcpu->vmcb_t.virt,vmcb_clean_bits,noir_svm_clean_debug_reg))
+	if(noir_bt(&groups,noir_svm_clean_debug_reg))
 	{
-		noir_svm_vmwrite64(nvcpu->vmcb_t.virt,guest_dr6,noir_svm_vmread64(nvcpu->vmcb_c.virt,guest_dr6));
-		noir_svm_vmwrite64(nvcpu->vmcb_t.virt,guest_dr7,noir_svm_vmread64(nvcpu->vmcb_c.virt,guest_dr7));
+		noir_svm_vmwrite64(dest,guest_dr6,noir_svm_vmread64(src,guest_dr6));
+		noir_svm_vmwrite64(dest,guest_dr7,noir_svm_vmread64(src,guest_dr7));
 	}
 	// Bit 7: IDTR & GDTR
-	if(!noir_svm_vmcb_bt32(nvcpu->vmcb_t.virt,vmcb_clean_bits,noir_svm_clean_idt_gdt))
+	if(noir_bt(&groups,noir_svm_clean_idt_gdt))
 	{
-		noir_svm_vmwrite64(nvcpu->vmcb_t.virt,guest_idtr_base,noir_svm_vmread64(nvcpu->vmcb_c.virt,guest_idtr_base));
-		noir_svm_vmwrite64(nvcpu->vmcb_t.virt,guest_gdtr_base,noir_svm_vmread64(nvcpu->vmcb_c.virt,guest_gdtr_base));
-		noir_svm_vmwrite16(nvcpu->vmcb_t.virt,guest_idtr_limit,noir_svm_vmread16(nvcpu->vmcb_c.virt,guest_idtr_limit));
-		noir_svm_vmwrite16(nvcpu->vmcb_t.virt,guest_gdtr_limit,noir_svm_vmread16(nvcpu->vmcb_c.virt,guest_gdtr_limit));
+		noir_svm_vmwrite64(dest,guest_idtr_base,noir_svm_vmread64(src,guest_idtr_base));
+		noir_svm_vmwrite64(dest,guest_gdtr_base,noir_svm_vmread64(src,guest_gdtr_base));
+		noir_svm_vmwrite16(dest,guest_idtr_limit,noir_svm_vmread16(src,guest_idtr_limit));
+		noir_svm_vmwrite16(dest,guest_gdtr_limit,noir_svm_vmread16(src,guest_gdtr_limit));
 	}
 	// Bit 8: Segment Registers
-	if(!noir_svm_vmcb_bt32(nvcpu->vmcb_t.virt,vmcb_clean_bits,noir_svm_clean_segment_reg))
+	if(noir_bt(&groups,noir_svm_clean_segment_reg))
 	{
 		// Selectors
-		noir_svm_vmwrite16(nvcpu->vmcb_t.virt,guest_cs_selector,noir_svm_vmread16(nvcpu->vmcb_c.virt,guest_cs_selector));
-		noir_svm_vmwrite16(nvcpu->vmcb_t.virt,guest_ds_selector,noir_svm_vmread16(nvcpu->vmcb_c.virt,guest_ds_selector));
-		noir_svm_vmwrite16(nvcpu->vmcb_t.virt,guest_es_selector,noir_svm_vmread16(nvcpu->vmcb_c.virt,guest_es_selector));
-		noir_svm_vmwrite16(nvcpu->vmcb_t.virt,guest_ss_selector,noir_svm_vmread16(nvcpu->vmcb_c.virt,guest_ss_selector));
+		noir_svm_vmwrite16(dest,guest_cs_selector,noir_svm_vmread16(src,guest_cs_selector));
+		noir_svm_vmwrite16(dest,guest_ds_selector,noir_svm_vmread16(src,guest_ds_selector));
+		noir_svm_vmwrite16(dest,guest_es_selector,noir_svm_vmread16(src,guest_es_selector));
+		noir_svm_vmwrite16(dest,guest_ss_selector,noir_svm_vmread16(src,guest_ss_selector));
 		// Attributes
-		noir_svm_vmwrite16(nvcpu->vmcb_t.virt,guest_cs_attrib,noir_svm_vmread16(nvcpu->vmcb_c.virt,guest_cs_attrib));
-		noir_svm_vmwrite16(nvcpu->vmcb_t.virt,guest_ds_attrib,noir_svm_vmread16(nvcpu->vmcb_c.virt,guest_ds_attrib));
-		noir_svm_vmwrite16(nvcpu->vmcb_t.virt,guest_es_attrib,noir_svm_vmread16(nvcpu->vmcb_c.virt,guest_es_attrib));
-		noir_svm_vmwrite16(nvcpu->vmcb_t.virt,guest_ss_attrib,noir_svm_vmread16(nvcpu->vmcb_c.virt,guest_ss_attrib));
+		noir_svm_vmwrite16(dest,guest_cs_attrib,noir_svm_vmread16(src,guest_cs_attrib));
+		noir_svm_vmwrite16(dest,guest_ds_attrib,noir_svm_vmread16(src,guest_ds_attrib));
+		noir_svm_vmwrite16(dest,guest_es_attrib,noir_svm_vmread16(src,guest_es_attrib));
+		noir_svm_vmwrite16(dest,guest_ss_attrib,noir_svm_vmread16(src,guest_ss_attrib));
 		// Limits
-		noir_svm_vmwrite32(nvcpu->vmcb_t.virt,guest_cs_limit,noir_svm_vmread32(nvcpu->vmcb_c.virt,guest_cs_limit));
-		noir_svm_vmwrite32(nvcpu->vmcb_t.virt,guest_ds_limit,noir_svm_vmread32(nvcpu->vmcb_c.virt,guest_ds_limit));
-		noir_svm_vmwrite32(nvcpu->vmcb_t.virt,guest_es_limit,noir_svm_vmread32(nvcpu->vmcb_c.virt,guest_es_limit));
-		noir_svm_vmwrite32(nvcpu->vmcb_t.virt,guest_ss_limit,noir_svm_vmread32(nvcpu->vmcb_c.virt,guest_ss_limit));
+		noir_svm_vmwrite32(dest,guest_cs_limit,noir_svm_vmread32(src,guest_cs_limit));
+		noir_svm_vmwrite32(dest,guest_ds_limit,noir_svm_vmread32(src,guest_ds_limit));
+		noir_svm_vmwrite32(dest,guest_es_limit,noir_svm_vmread32(src,guest_es_limit));
+		noir_svm_vmwrite32(dest,guest_ss_limit,noir_svm_vmread32(src,guest_ss_limit));
 		// Bases
-		noir_svm_vmwrite64(nvcpu->vmcb_t.virt,guest_cs_base,noir_svm_vmread64(nvcpu->vmcb_c.virt,guest_cs_base));
-		noir_svm_vmwrite64(nvcpu->vmcb_t.virt,guest_ds_base,noir_svm_vmread64(nvcpu->vmcb_c.virt,guest_ds_base));
-		noir_svm_vmwrite64(nvcpu->vmcb_t.virt,guest_es_base,noir_svm_vmread64(nvcpu->vmcb_c.virt,guest_es_base));
-		noir_svm_vmwrite64(nvcpu->vmcb_t.virt,guest_ss_base,noir_svm_vmread64(nvcpu->vmcb_c.virt,guest_ss_base));
+		noir_svm_vmwrite64(dest,guest_cs_base,noir_svm_vmread64(src,guest_cs_base));
+		noir_svm_vmwrite64(dest,guest_ds_base,noir_svm_vmread64(src,guest_ds_base));
+		noir_svm_vmwrite64(dest,guest_es_base,noir_svm_vmread64(src,guest_es_base));
+		noir_svm_vmwrite64(dest,guest_ss_base,noir_svm_vmread64(src,guest_ss_base));
 	}
 	// Bit 9: CR2 Register
-	if(!noir_svm_vmcb_bt32(nvcpu->vmcb_t.virt,vmcb_clean_bits,noir_svm_clean_cr2))
-		noir_svm_vmwrite64(nvcpu->vmcb_t.virt,guest_cr2,noir_svm_vmread64(nvcpu->vmcb_c.virt,guest_cr2));
+	if(noir_bt(&groups,noir_svm_clean_cr2))
+		noir_svm_vmwrite64(dest,guest_cr2,noir_svm_vmread64(src,guest_cr2));
 	// Bit 10: Last-Branch Record
-	if(!noir_svm_vmcb_bt32(nvcpu->vmcb_t.virt,vmcb_clean_bits,noir_svm_clean_lbr))
+	if(noir_bt(&groups,noir_svm_clean_lbr))
 	{
-		noir_svm_vmwrite64(nvcpu->vmcb_t.virt,lbr_virtualization_control,noir_svm_vmread64(nvcpu->vmcb_c.virt,lbr_virtualization_control));
-		noir_svm_vmwrite64(nvcpu->vmcb_t.virt,guest_debug_ctrl,noir_svm_vmread64(nvcpu->vmcb_c.virt,guest_debug_ctrl));
-		noir_svm_vmwrite64(nvcpu->vmcb_t.virt,guest_last_branch_from,noir_svm_vmread64(nvcpu->vmcb_c.virt,guest_last_branch_from));
-		noir_svm_vmwrite64(nvcpu->vmcb_t.virt,guest_last_branch_to,noir_svm_vmread64(nvcpu->vmcb_c.virt,guest_last_branch_to));
-		noir_svm_vmwrite64(nvcpu->vmcb_t.virt,guest_last_exception_from,noir_svm_vmread64(nvcpu->vmcb_c.virt,guest_last_exception_from));
-		noir_svm_vmwrite64(nvcpu->vmcb_t.virt,guest_last_exception_to,noir_svm_vmread64(nvcpu->vmcb_c.virt,guest_last_exception_to));
+		noir_svm_vmwrite64(dest,lbr_virtualization_control,noir_svm_vmread64(src,lbr_virtualization_control));
+		noir_svm_vmwrite64(dest,guest_debug_ctrl,noir_svm_vmread64(src,guest_debug_ctrl));
+		noir_svm_vmwrite64(dest,guest_last_branch_from,noir_svm_vmread64(src,guest_last_branch_from));
+		noir_svm_vmwrite64(dest,guest_last_branch_to,noir_svm_vmread64(src,guest_last_branch_to));
+		noir_svm_vmwrite64(dest,guest_last_exception_from,noir_svm_vmread64(src,guest_last_exception_from));
+		noir_svm_vmwrite64(dest,guest_last_exception_to,noir_svm_vmread64(src,guest_last_exception_to));
 	}
 	// Bit 11: Advanced Virtual Interrupt Controller
-	if(!noir_svm_vmcb_bt32(nvcpu->vmcb_t.virt,vmcb_clean_bits,noir_svm_clean_avic))
+	if(noir_bt(&groups,noir_svm_clean_avic))
 	{
-		noir_svm_vmwrite64(nvcpu->vmcb_t.virt,avic_apic_bar,noir_svm_vmread64(nvcpu->vmcb_c.virt,avic_apic_bar));
-		noir_svm_vmwrite64(nvcpu->vmcb_t.virt,avic_backing_page_pointer,noir_svm_vmread64(nvcpu->vmcb_c.virt,avic_backing_page_pointer));
-		noir_svm_vmwrite64(nvcpu->vmcb_t.virt,avic_logical_table_pointer,noir_svm_vmread64(nvcpu->vmcb_c.virt,avic_logical_table_pointer));
-		noir_svm_vmwrite64(nvcpu->vmcb_t.virt,avic_physical_table_pointer,noir_svm_vmread64(nvcpu->vmcb_c.virt,avic_physical_table_pointer));
+		noir_svm_vmwrite64(dest,avic_apic_bar,noir_svm_vmread64(src,avic_apic_bar));
+		noir_svm_vmwrite64(dest,avic_backing_page_pointer,noir_svm_vmread64(src,avic_backing_page_pointer));
+		noir_svm_vmwrite64(dest,avic_logical_table_pointer,noir_svm_vmread64(src,avic_logical_table_pointer));
+		noir_svm_vmwrite64(dest,avic_physical_table_pointer,noir_svm_vmread64(src,avic_physical_table_pointer));
 	}
 	// Bit 12: Shadow Stacks
-	if(!noir_svm_vmcb_bt32(nvcpu->vmcb_t.virt,vmcb_clean_bits,noir_svm_clean_cet))
+	if(noir_bt(&groups,noir_svm_clean_cet))
 	{
-		noir_svm_vmwrite64(nvcpu->vmcb_t.virt,guest_s_cet,noir_svm_vmread64(nvcpu->vmcb_c.virt,guest_s_cet));
-		noir_svm_vmwrite64(nvcpu->vmcb_t.virt,guest_ssp,noir_svm_vmread64(nvcpu->vmcb_c.virt,guest_ssp));
-		noir_svm_vmwrite64(nvcpu->vmcb_t.virt,guest_isst,noir_svm_vmread64(nvcpu->vmcb_c.virt,guest_isst));
+		noir_svm_vmwrite64(dest,guest_s_cet,noir_svm_vmread64(src,guest_s_cet));
+		noir_svm_vmwrite64(dest,guest_ssp,noir_svm_vmread64(src,guest_ssp));
+		noir_svm_vmwrite64(dest,guest_isst,noir_svm_vmread64(src,guest_isst));
 	}
 }
 
+// This procedure is to be called on vmrun interception.
+void nvc_svmn_synchronize_to_l2t_vmcb(noir_svm_nested_vcpu_node_p nvcpu)
+{
+	// Synchronize the L2C VMCB to L2T VMCB.
+	// State groups not marked clean by the L1 hypervisor, or not yet synchronized by us, have to be copied.
+	u32 groups=(~noir_svm_vmread32(nvcpu->vmcb_c.virt,vmcb_clean_bits)|nvcpu->dirty_groups)&noir_svm_clean_bits_mask;
+	// First of all, synchronize all states not cached by clean bits.
+	noir_svm_vmwrite64(nvcpu->vmcb_t.virt,guest_rax,noir_svm_vmread64(nvcpu->vmcb_c.virt,guest_rax));
+	noir_svm_vmwrite64(nvcpu->vmcb_t.virt,guest_rsp,noir_svm_vmread64(nvcpu->vmcb_c.virt,guest_rsp));
+	noir_svm_vmwrite64(nvcpu->vmcb_t.virt,guest_rip,noir_svm_vmread64(nvcpu->vmcb_c.virt,guest_rip));
+	noir_svm_vmwrite64(nvcpu->vmcb_t.virt,guest_rflags,noir_svm_vmread64(nvcpu->vmcb_c.virt,guest_rflags));
+	noir_svm_vmwrite64(nvcpu->vmcb_t.virt,guest_interrupt,noir_svm_vmread64(nvcpu->vmcb_c.virt,guest_interrupt));
+	noir_svm_vmwrite64(nvcpu->vmcb_t.virt,event_injection,noir_svm_vmread64(nvcpu->vmcb_c.virt,event_injection));
+	noir_svm_vmwrite8(nvcpu->vmcb_t.virt,tlb_control,noir_svm_vmread8(nvcpu->vmcb_c.virt,tlb_control));
+	noir_svm_vmwrite8(nvcpu->vmcb_t.virt,guest_cpl,noir_svm_vmread8(nvcpu->vmcb_c.virt,guest_cpl));
+	// Then, synchronize the modified state groups.
+	nvc_svmn_copy_vmcb_groups(nvcpu->vmcb_t.virt,nvcpu->vmcb_c.virt,groups);
+	if(noir_bt(&groups,noir_svm_clean_asid))
+		noir_svm_vmwrite32(nvcpu->vmcb_t.virt,guest_asid,noir_svm_vmread32(nvcpu->vmcb_c.virt,guest_asid)+1);
+	// State groups not copied are still valid in the processor's VMCB state cache.
+	noir_svm_vmwrite32(nvcpu->vmcb_t.virt,vmcb_clean_bits,~groups&noir_svm_clean_bits_mask);
+	nvcpu->dirty_groups=0;
+}
+
 // This procedure is to be called on VM-Exit of nested vCPU.
 void nvc_svmn_synchronize_to_l2c_vmcb(noir_svm_nested_vcpu_node_p nvcpu)
 {
 	// Synchronize the L2T VMCB to L2C VMCB.
-	noir_svm_nested_vcpu_node nvcpu_temp;
-	u32 prev_clean_bits=noir_svm_vmread32(nvcpu->vmcb_c.virt,vmcb_clean_bits);
-	// Use a temporary, field-interexchanged variable to save effort.
-	nvcpu_temp.vmcb_t.virt=nvcpu->vmcb_c.virt;
-	nvcpu_temp.vmcb_c.virt=nvcpu->vmcb_t.virt;
-	// Most fields are mandatory to be synchronized.
-	noir_svm_vmwrite32(nvcpu->vmcb_c.virt,vmcb_clean_bits,noir_svm_nesting_vmcb_clean_bits);
-	// Use the same synchronization function to reduce code size.
-	nvc_svmn_synchronize_to_l2t_vmcb(&nvcpu_temp);
-	// Restore VMCB clean bits.
-	noir_svm_vmwrite32(nvcpu->vmcb_c.virt,vmcb_clean_bits,prev_clean_bits);
-	// Restore ASID.
-	noir_svm_vmwrite32(nvcpu->vmcb_c.virt,guest_asid,noir_svm_vmread32(nvcpu->vmcb_c.virt,guest_asid)-2);
+	// Only the state groups that the processor could change during the execution of L2 guest are copied back.
+	// VMCB clean bits in L2C VMCB are owned by the L1 hypervisor and are left untouched.
+	const u32 groups=~noir_svm_nesting_vmcb_clean_bits&noir_svm_clean_bits_mask;
+	noir_svm_vmwrite64(nvcpu->vmcb_c.virt,guest_rax,noir_svm_vmread64(nvcpu->vmcb_t.virt,guest_rax));
+	noir_svm_vmwrite64(nvcpu->vmcb_c.virt,guest_rsp,noir_svm_vmread64(nvcpu->vmcb_t.virt,guest_rsp));
+	noir_svm_vmwrite64(nvcpu->vmcb_c.virt,guest_rip,noir_svm_vmread64(nvcpu->vmcb_t.virt,guest_rip));
+	noir_svm_vmwrite64(nvcpu->vmcb_c.virt,guest_rflags,noir_svm_vmread64(nvcpu->vmcb_t.virt,guest_rflags));
+	noir_svm_vmwrite64(nvcpu->vmcb_c.virt,guest_interrupt,noir_svm_vmread64(nvcpu->vmcb_t.virt,guest_interrupt));
+	noir_svm_vmwrite64(nvcpu->vmcb_c.virt,event_injection,noir_svm_vmread64(nvcpu->vmcb_t.virt,event_injection));
+	noir_svm_vmwrite8(nvcpu->vmcb_c.virt,guest_cpl,noir_svm_vmread8(nvcpu->vmcb_t.virt,guest_cpl));
+	nvc_svmn_copy_vmcb_groups(nvcpu->vmcb_c.virt,nvcpu->vmcb_t.virt,groups);
 	// In addition to guest state, copy exit information.
-	noir_svm_vmwrite64(nvcpu->vmcb_c.virt,exit_code,noir_svm_vmread64(nvcpu->vmcb_c.virt,exit_code));
-	noir_svm_vmwrite64(nvcpu->vmcb_c.virt,exit_info1,noir_svm_vmread64(nvcpu->vmcb_c.virt,exit_info1));
-	noir_svm_vmwrite64(nvcpu->vmcb_c.virt,exit_info2,noir_svm_vmread64(nvcpu->vmcb_c.virt,exit_info2));
-	noir_svm_vmwrite64(nvcpu->vmcb_c.virt,exit_interrupt_info,noir_svm_vmread64(nvcpu->vmcb_c.virt,exit_interrupt_info));
+	noir_svm_vmwrite64(nvcpu->vmcb_c.virt,exit_code,noir_svm_vmread64(nvcpu->vmcb_t.virt,exit_code));
+	noir_svm_vmwrite64(nvcpu->vmcb_c.virt,exit_info1,noir_svm_vmread64(nvcpu->vmcb_t.virt,exit_info1));
+	noir_svm_vmwrite64(nvcpu->vmcb_c.virt,exit_info2,noir_svm_vmread64(nvcpu->vmcb_t.virt,exit_info2));
+	noir_svm_vmwrite64(nvcpu->vmcb_c.virt,exit_interrupt_info,noir_svm_vmread64(nvcpu->vmcb_t.virt,exit_interrupt_info));
 	for(u8 i=0;i<15;i++)
 		noir_svm_vmwrite8(nvcpu->vmcb_c.virt,guest_instruction_bytes+i,noir_svm_vmread8(nvcpu->vmcb_t.virt,guest_instruction_bytes+i));
 	noir_svm_vmwrite8(nvcpu->vmcb_c.virt,number_of_bytes_fetched,noir_svm_vmread8(nvcpu->vmcb_t.virt,number_of_bytes_fetched));
 	// Do not forget to save the next RIP.
 	noir_svm_vmwrite64(nvcpu->vmcb_c.virt,next_rip,noir_svm_vmread64(nvcpu->vmcb_t.virt,next_rip));
-}
\ No newline at end of file
+}
@@ -48,9 +48,8 @@ bool nvc_ept_insert_pte(noir_ept_manager_p eptm,noir_hook_page_p nhp)
 			u32 i=0;
 			cur_d=noir_alloc_nonpg_memory(sizeof(noir_ept_pte_descriptor));
 			if(cur_d==null)return false;
-			cur_d->virt=noir_alloc_contd_memory(page_size);
+			cur_d->virt=noir_alloc_pool_page(&eptm->pool,&cur_d->phys);
 			if(cur_d->virt==null)return false;
-			cur_d->phys=noir_get_physical_address(cur_d->virt);
 			cur_d->gpa_start=(addr.pdpte_offset<<18)+(addr.pde_offset<<9);
 			// Setup identity map.
 			for(;i<512;i++)
@@ -95,10 +94,6 @@ void nvc_ept_cleanup(noir_ept_manager_p eptm)
 {
 	if(eptm)
 	{
-		if(eptm->eptp.virt)
-			noir_free_contd_memory(eptm->eptp.virt);
-		if(eptm->pdpt.virt)
-			noir_free_contd_memory(eptm->pdpt.virt);
 		if(eptm->pde.virt)
 			noir_free_2mb_page(eptm->pde.virt);
 		if(eptm->pte.head)
@@ -107,11 +102,12 @@ void nvc_ept_cleanup(noir_ept_manager_p eptm)
 			do
 			{
 				noir_ept_pte_descriptor_p next=cur->next;
-				noir_free_contd_memory(cur->virt);
 				noir_free_nonpg_memory(cur);
 				cur=next;
 			}while(cur);
 		}
+		// Paging structures are returned along with the pool.
+		noir_finalize_page_pool(&eptm->pool);
 		if(eptm->blank_page.virt)
 			noir_free_contd_memory(eptm->blank_page.virt);
 		noir_free_nonpg_memory(eptm);
@@ -202,13 +198,12 @@ bool nvc_ept_update_pte_memory_type(noir_ept_manager_p eptm,u64 hpa,u8 memory_ty
 	pte_p=noir_alloc_nonpg_memory(sizeof(noir_ept_pte_descriptor));
 	if(pte_p)
 	{
-		pte_p->virt=noir_alloc_contd_memory(page_size);
+		pte_p->virt=noir_alloc_pool_page(&eptm->pool,&pte_p->phys);
 		if(pte_p->virt)
 		{
 			u64 index=(trans.pdpte_offset<<9)+trans.pde_offset;
 			ia32_ept_pde_p pde_p=(ia32_ept_pde_p)&eptm->pde.virt[index];
 			// PTE Descriptor
-			pte_p->phys=noir_get_physical_address(pte_p->virt);
 			pte_p->gpa_start=index<<9;
 			for(u32 i=0;i<512;i++)
 			{
@@ -265,13 +260,12 @@ bool nvc_ept_update_pte(noir_ept_manager_p eptm,u64 hpa,u64 gpa,bool r,bool w,bo
 	pte_p=noir_alloc_nonpg_memory(sizeof(noir_ept_pte_descriptor));
 	if(pte_p)
 	{
-		pte_p->virt=noir_alloc_contd_memory(page_size);
+		pte_p->virt=noir_alloc_pool_page(&eptm->pool,&pte_p->phys);
 		if(pte_p->virt)
 		{
 			u64 index=(hat.pdpte_offset<<9)+hat.pde_offset;
 			ia32_ept_pde_p pde_p=(ia32_ept_pde_p)&eptm->pde.virt[index];
 			// PTE Descriptor
-			pte_p->phys=noir_get_physical_address(pte_p->virt);
 			pte_p->gpa_start=index<<9;
 			for(u32 i=0;i<512;i++)
 			{
@@ -345,6 +339,94 @@ void static nvc_ept_update_per_var_mtrr(noir_ept_manager_p eptm,u32 mtrr_msr_ind
 	}
 }
 
+// Apply the fixed-range MTRRs to the first MiB of memory.
+void static nvc_ept_update_fixed_mtrr(noir_ept_manager_p eptm)
+{
+	u8* type;
+	// Read Fixed Range MTRRs.
+	// All Fixed Range MTRRs span the first MiB of system memory.
+	u64 fix64k_00000=noir_rdmsr(ia32_mtrr_fix64k_00000);
+	u64 fix16k_80000=noir_rdmsr(ia32_mtrr_fix16k_80000);
+	u64 fix16k_a0000=noir_rdmsr(ia32_mtrr_fix16k_a0000);
+	u64 fix4k_c0000=noir_rdmsr(ia32_mtrr_fix4k_c0000);
+	u64 fix4k_c8000=noir_rdmsr(ia32_mtrr_fix4k_c8000);
+	u64 fix4k_d0000=noir_rdmsr(ia32_mtrr_fix4k_d0000);
+	u64 fix4k_d8000=noir_rdmsr(ia32_mtrr_fix4k_d8000);
+	u64 fix4k_e0000=noir_rdmsr(ia32_mtrr_fix4k_e0000);
+	u64 fix4k_e8000=noir_rdmsr(ia32_mtrr_fix4k_e8000);
+	u64 fix4k_f0000=noir_rdmsr(ia32_mtrr_fix4k_f0000);
+	u64 fix4k_f8000=noir_rdmsr(ia32_mtrr_fix4k_f8000);
+	// MTRR Fixed64K 00000
+	// This register specifies eight 64KiB ranges, 512KiB in total.
+	type=(u8*)&fix64k_00000;
+	for(u32 i=0;i<8;i++)
+		for(u32 j=0;j<16;j++)	// 64KiB is actually 16 pages.
+			eptm->pte.head->virt[(i<<4)+j].memory_type=type[i];
+			// if(nvc_ept_update_pte_memory_type(eptm,(i<<16)+(j<<12),type[i])==false)return false;
+	// MTRR Fixed16K_80000
+	// This register specifies eight 16KiB ranges, 128KiB in total.
+	type=(u8*)&fix16k_80000;
+	for(u32 i=0;i<8;i++)
+		for(u32 j=0;j<4;j++)	// 16KiB is actually 4 pages.
+			eptm->pte.head->virt[0x80+(i<<2)+j].memory_type=type[i];
+			// if(nvc_ept_update_pte_memory_type(eptm,0x80000+(i<<14)+(j<<12),type[i])==false)return false;
+	// MTRR Fixed16K_a0000
+	// This register specifies eight 16KiB ranges, 128KiB in total.
+	type=(u8*)&fix16k_a0000;
+	for(u32 i=0;i<8;i++)
+		for(u32 j=0;j<4;j++)	// 16KiB is actually 4 pages.
+			eptm->pte.head->virt[0xa0+(i<<2)+j].memory_type=type[i];
+			// if(nvc_ept_update_pte_memory_type(eptm,0xa0000+(i<<14)+(j<<12),type[i])==false)return false;
+	// MTRR Fixed4K_c0000
+	// This register specifies eight 4KiB ranges, 32KiB in total
+	type=(u8*)&fix4k_c0000;
+	for(u32 i=0;i<8;i++)
+		eptm->pte.head->virt[0xc0+i].memory_type=type[i];
+		// if(nvc_ept_update_pte_memory_type(eptm,0xc0000+(i<<12),type[i])==false)return false;
+	// MTRR Fixed4K_c8000
+	// This register specifies eight 4KiB ranges, 32KiB in total
+	type=(u8*)&fix4k_c8000;
+	for(u32 i=0;i<8;i++)
+		eptm->pte.head->virt[0xc8+i].memory_type=type[i];
+		// if(nvc_ept_update_pte_memory_type(eptm,0xc8000+(i<<12),type[i])==false)return false;
+	// MTRR Fixed4K_d0000
+	// This register specifies eight 4KiB ranges, 32KiB in total
+	type=(u8*)&fix4k_d0000;
+	for(u32 i=0;i<8;i++)
+		eptm->pte.head->virt[0xd0+i].memory_type=type[i];
+		// if(nvc_ept_update_pte_memory_type(eptm,0xd0000+(i<<12),type[i])==false)return false;
+	// MTRR Fixed4K_d8000
+	// This register specifies eight 4KiB ranges, 32KiB in total
+	type=(u8*)&fix4k_d8000;
+	for(u32 i=0;i<8;i++)
+		eptm->pte.head->virt[0xd8+i].memory_type=type[i];
+		// if(nvc_ept_update_pte_memory_type(eptm,0xd8000+(i<<12),type[i])==false)return false;
+	// MTRR Fixed4K_e0000
+	// This register specifies eight 4KiB ranges, 32KiB in total
+	type=(u8*)&fix4k_e0000;
+	for(u32 i=0;i<8;i++)
+		eptm->pte.head->virt[0xe0+i].memory_type=type[i];
+		// if(nvc_ept_update_pte_memory_type(eptm,0xe0000+(i<<12),type[i])==false)return false;
+	// MTRR Fixed4K_e8000
+	// This register specifies eight 4KiB ranges, 32KiB in total
+	type=(u8*)&fix4k_e8000;
+	for(u32 i=0;i<8;i++)
+		eptm->pte.head->virt[0xe8+i].memory_type=type[i];
+		// if(nvc_ept_update_pte_memory_type(eptm,0xe8000+(i<<12),type[i])==false)return false;
+	// MTRR Fixed4K_f0000
+	// This register specifies eight 4KiB ranges, 32KiB in total
+	type=(u8*)&fix4k_f0000;
+	for(u32 i=0;i<8;i++)
+		eptm->pte.head->virt[0xf0+i].memory_type=type[i];
+		// if(nvc_ept_update_pte_memory_type(eptm,0xf0000+(i<<12),type[i])==false)return false;
+	// MTRR Fixed4K_f8000
+	// This register specifies eight 4KiB ranges, 32KiB in total
+	type=(u8*)&fix4k_f8000;
+	for(u32 i=0;i<8;i++)
+		eptm->pte.head->virt[0xf8+i].memory_type=type[i];
+		// if(nvc_ept_update_pte_memory_type(eptm,0xf8000+(i<<12),type[i])==false)return false;
+}
+
 // This procedure is to be invoked on a per-processor basis.
 void nvc_ept_update_by_mtrr(noir_ept_manager_p eptm)
 {
@@ -381,93 +463,152 @@ void nvc_ept_update_by_mtrr(noir_ept_manager_p eptm)
 	if(mtrr_cap.support_smrr)
 		nvc_ept_update_per_var_mtrr(eptm,ia32_smrr_phys_base);
 	// Traverse fixed-range MTRRs.
-	if(eptm->def_type.fix_enabled)
+	if(eptm->def_type.fix_enabled)nvc_ept_update_fixed_mtrr(eptm);
+	// return true;
+}
+
+void static nvc_ept_take_mtrr_snapshot(noir_ept_mtrr_snapshot_p snapshot)
+{
+	ia32_mtrr_cap_msr mtrr_cap;
+	u32 i;
+	mtrr_cap.value=noir_rdmsr(ia32_mtrr_cap);
+	for(i=0;i<mtrr_cap.variable_count && i<noir_ept_mtrr_var_limit;i++)
 	{
-		u8* type;
-		// Read Fixed Range MTRRs.
-		// All Fixed Range MTRRs span the first MiB of system memory.
-		u64 fix64k_00000=noir_rdmsr(ia32_mtrr_fix64k_00000);
-		u64 fix16k_80000=noir_rdmsr(ia32_mtrr_fix16k_80000);
-		u64 fix16k_a0000=noir_rdmsr(ia32_mtrr_fix16k_a0000);
-		u64 fix4k_c0000=noir_rdmsr(ia32_mtrr_fix4k_c0000);
-		u64 fix4k_c8000=noir_rdmsr(ia32_mtrr_fix4k_c8000);
-		u64 fix4k_d0000=noir_rdmsr(ia32_mtrr_fix4k_d0000);
-		u64 fix4k_d8000=noir_rdmsr(ia32_mtrr_fix4k_d8000);
-		u64 fix4k_e0000=noir_rdmsr(ia32_mtrr_fix4k_e0000);
-		u64 fix4k_e8000=noir_rdmsr(ia32_mtrr_fix4k_e8000);
-		u64 fix4k_f0000=noir_rdmsr(ia32_mtrr_fix4k_f0000);
-		u64 fix4k_f8000=noir_rdmsr(ia32_mtrr_fix4k_f8000);
-		// MTRR Fixed64K 00000
-		// This register specifies eight 64KiB ranges, 512KiB in total.
-		type=(u8*)&fix64k_00000;
-		for(u32 i=0;i<8;i++)
-			for(u32 j=0;j<16;j++)	// 64KiB is actually 16 pages.
-				eptm->pte.head->virt[(i<<4)+j].memory_type=type[i];
-				// if(nvc_ept_update_pte_memory_type(eptm,(i<<16)+(j<<12),type[i])==false)return false;
-		// MTRR Fixed16K_80000
-		// This register specifies eight 16KiB ranges, 128KiB in total.
-		type=(u8*)&fix16k_80000;
-		for(u32 i=0;i<8;i++)
-			for(u32 j=0;j<4;j++)	// 16KiB is actually 4 pages.
-				eptm->pte.head->virt[0x80+(i<<2)+j].memory_type=type[i];
-				// if(nvc_ept_update_pte_memory_type(eptm,0x80000+(i<<14)+(j<<12),type[i])==false)return false;
-		// MTRR Fixed16K_a0000
-		// This register specifies eight 16KiB ranges, 128KiB in total.
-		type=(u8*)&fix16k_a0000;
-		for(u32 i=0;i<8;i++)
-			for(u32 j=0;j<4;j++)	// 16KiB is actually 4 pages.
-				eptm->pte.head->virt[0xa0+(i<<2)+j].memory_type=type[i];
-				// if(nvc_ept_update_pte_memory_type(eptm,0xa0000+(i<<14)+(j<<12),type[i])==false)return false;
-		// MTRR Fixed4K_c0000
-		// This register specifies eight 4KiB ranges, 32KiB in total
-		type=(u8*)&fix4k_c0000;
-		for(u32 i=0;i<8;i++)
-			eptm->pte.head->virt[0xc0+i].memory_type=type[i];
-			// if(nvc_ept_update_pte_memory_type(eptm,0xc0000+(i<<12),type[i])==false)return false;
-		// MTRR Fixed4K_c8000
-		// This register specifies eight 4KiB ranges, 32KiB in total
-		type=(u8*)&fix4k_c8000;
-		for(u32 i=0;i<8;i++)
-			eptm->pte.head->virt[0xc8+i].memory_type=type[i];
-			// if(nvc_ept_update_pte_memory_type(eptm,0xc8000+(i<<12),type[i])==false)return false;
-		// MTRR Fixed4K_d0000
-		// This register specifies eight 4KiB ranges, 32KiB in total
-		type=(u8*)&fix4k_d0000;
-		for(u32 i=0;i<8;i++)
-			eptm->pte.head->virt[0xd0+i].memory_type=type[i];
-			// if(nvc_ept_update_pte_memory_type(eptm,0xd0000+(i<<12),type[i])==false)return false;
-		// MTRR Fixed4K_d8000
-		// This register specifies eight 4KiB ranges, 32KiB in total
-		type=(u8*)&fix4k_d8000;
-		for(u32 i=0;i<8;i++)
-			eptm->pte.head->virt[0xd8+i].memory_type=type[i];
-			// if(nvc_ept_update_pte_memory_type(eptm,0xd8000+(i<<12),type[i])==false)return false;
-		// MTRR Fixed4K_e0000
-		// This register specifies eight 4KiB ranges, 32KiB in total
-		type=(u8*)&fix4k_e0000;
-		for(u32 i=0;i<8;i++)
-			eptm->pte.head->virt[0xe0+i].memory_type=type[i];
-			// if(nvc_ept_update_pte_memory_type(eptm,0xe0000+(i<<12),type[i])==false)return false;
-		// MTRR Fixed4K_e8000
-		// This register specifies eight 4KiB ranges, 32KiB in total
-		type=(u8*)&fix4k_e8000;
-		for(u32 i=0;i<8;i++)
-			eptm->pte.head->virt[0xe8+i].memory_type=type[i];
-			// if(nvc_ept_update_pte_memory_type(eptm,0xe8000+(i<<12),type[i])==false)return false;
-		// MTRR Fixed4K_f0000
-		// This register specifies eight 4KiB ranges, 32KiB in total
-		type=(u8*)&fix4k_f0000;
-		for(u32 i=0;i<8;i++)
-			eptm->pte.head->virt[0xf0+i].memory_type=type[i];
-			// if(nvc_ept_update_pte_memory_type(eptm,0xf0000+(i<<12),type[i])==false)return false;
-		// MTRR Fixed4K_f8000
-		// This register specifies eight 4KiB ranges, 32KiB in total
-		type=(u8*)&fix4k_f8000;
-		for(u32 i=0;i<8;i++)
-			eptm->pte.head->virt[0xf8+i].memory_type=type[i];
-			// if(nvc_ept_update_pte_memory_type(eptm,0xf8000+(i<<12),type[i])==false)return false;
+		snapshot->base[i].value=noir_rdmsr(ia32_mtrr_phys_base0+(i<<1));
+		snapshot->mask[i].value=noir_rdmsr(ia32_mtrr_phys_mask0+(i<<1));
+	}
+	// SMRR is treated as the last variable-range MTRR.
+	if(mtrr_cap.support_smrr)
+	{
+		snapshot->base[i].value=noir_rdmsr(ia32_smrr_phys_base);
+		snapshot->mask[i].value=noir_rdmsr(ia32_smrr_phys_mask);
+		i++;
+	}
+	snapshot->count=i;
+}
+
+// Resolve the memory type of a 2MiB frame from scratch with the snapshot of variable-range MTRRs.
+// Overlapped ranges take the memory type with the smallest value, as is described above.
+u8 static nvc_ept_resolve_frame_memory_type(noir_ept_manager_p eptm,noir_ept_mtrr_snapshot_p snapshot,u64 frame,bool *matched)
+{
+	u8 type=(u8)eptm->def_type.type;
+	*matched=false;
+	for(u32 i=0;i<snapshot->count;i++)
+	{
+		if(snapshot->mask[i].valid)
+		{
+			const u64 mask_phys=snapshot->mask[i].phys_mask<<page_shift;
+			const u64 mask_base=(snapshot->base[i].phys_base&snapshot->mask[i].phys_mask)<<page_shift;
+			if((frame&mask_phys)==mask_base)
+			{
+				if(*matched==false || snapshot->base[i].type<type)type=(u8)snapshot->base[i].type;
+				*matched=true;
+			}
+		}
+	}
+	return type;
+}
+
+void static nvc_ept_apply_frame_memory_type(noir_ept_manager_p eptm,u64 frame,u8 type,bool matched)
+{
+	u32 index=(u32)(frame>>page_2mb_shift);
+	if(eptm->pde.virt[index].large_pde)
+	{
+		eptm->pde.virt[index].memory_type=type;
+		eptm->pde.virt[index].ignored0=matched;
+	}
+	else
+	{
+		// The 2MiB frame is described by PTEs.
+		for(noir_ept_pte_descriptor_p cur=eptm->pte.head;cur;cur=cur->next)
+		{
+			if(cur->gpa_start==frame)
+			{
+				for(u32 i=0;i<512;i++)
+				{
+					cur->virt[i].memory_type=type;
+					cur->virt[i].ignored1=matched;
+				}
+				break;
+			}
+		}
+	}
+}
+
+// Recompute the memory types of the 2MiB frames covered by the specified variable-range MTRR.
+// Return true if the first 2MiB frame is recomputed.
+bool static nvc_ept_update_var_mtrr_frames(noir_ept_manager_p eptm,noir_ept_mtrr_snapshot_p snapshot,ia32_mtrr_phys_base_msr phys_base,ia32_mtrr_phys_mask_msr phys_mask)
+{
+	bool first_frame=false;
+	if(phys_mask.valid)
+	{
+		const u64 mask_phys=phys_mask.phys_mask<<page_shift;
+		const u64 mask_base=(phys_base.phys_base&phys_mask.phys_mask)<<page_shift;
+		u64 start=0,limit=1i64<<page_512gb_shift;
+		u32 size_bit;
+		// If the mask is contiguous, only the frames inside the range have to be checked.
+		// Otherwise, check all frames as nvc_ept_update_per_var_mtrr does.
+		if(noir_bsf64(&size_bit,mask_phys) && (mask_phys>>size_bit)+1==1i64<<(eptm->phys_addr_size-size_bit))
+		{
+			start=mask_base&~(page_2mb_size-1);
+			if(start>=limit)return false;
+			if(start+(1i64<<size_bit)<limit)limit=start+(1i64<<size_bit);
+		}
+		for(u64 frame=start;frame<limit;frame+=page_2mb_size)
+		{
+			if((frame&mask_phys)==mask_base)
+			{
+				bool matched;
+				u8 type=nvc_ept_resolve_frame_memory_type(eptm,snapshot,frame,&matched);
+				nvc_ept_apply_frame_memory_type(eptm,frame,type,matched);
+				if(frame==0)first_frame=true;
+			}
+		}
+	}
+	return first_frame;
+}
+
+// This procedure is to be invoked on a per-processor basis after the MTRR is written.
+// Only the ranges covered by the old and new values of the written MTRR are updated.
+void nvc_ept_update_by_mtrr_write(noir_ept_manager_p eptm,u32 index,u64 old_value,u64 new_value)
+{
+	if(index==ia32_mtrr_def_type)
+	{
+		// The default memory type affects all memory.
+		nvc_ept_update_by_mtrr(eptm);
+	}
+	else if(index>=ia32_mtrr_fix64k_00000 && index<=ia32_mtrr_fix4k_f8000)
+	{
+		// Fixed-range MTRRs only span the first MiB of memory.
+		if(eptm->def_type.fix_enabled)nvc_ept_update_fixed_mtrr(eptm);
+	}
+	else
+	{
+		noir_ept_mtrr_snapshot snapshot;
+		ia32_mtrr_phys_base_msr old_base,new_base;
+		ia32_mtrr_phys_mask_msr old_mask,new_mask;
+		u32 base_index=index&0xfffffffe;
+		bool first_frame;
+		// The other half of the pair is not changed by this write.
+		if(index & 1)
+		{
+			old_base.value=new_base.value=noir_rdmsr(base_index);
+			old_mask.value=old_value;
+			new_mask.value=new_value;
+		}
+		else
+		{
+			old_mask.value=new_mask.value=noir_rdmsr(base_index+1);
+			old_base.value=old_value;
+			new_base.value=new_value;
+		}
+		nvc_ept_take_mtrr_snapshot(&snapshot);
+		// Frames leaving the range and frames entering the range are both affected.
+		first_frame=nvc_ept_update_var_mtrr_frames(eptm,&snapshot,old_base,old_mask);
+		first_frame|=nvc_ept_update_var_mtrr_frames(eptm,&snapshot,new_base,new_mask);
+		// Fixed-range MTRRs take precedence over variable-range MTRRs in the first MiB.
+		if(first_frame && eptm->def_type.fix_enabled)nvc_ept_update_fixed_mtrr(eptm);
 	}
-	// return true;
 }
 
 bool nvc_ept_initialize_ci(noir_ept_manager_p eptm)
@@ -530,6 +671,37 @@ bool nvc_ept_protect_hypervisor(noir_hypervisor_p hvm,noir_ept_manager_p eptm)
 	return false;
 }
 
+void static nvc_ept_fill_identity_pdes(ia32_ept_large_pde_p pde)
+{
+	for(u32 k=0;k<512*512;k++)
+	{
+		pde[k].value=0;
+		pde[k].page_offset=k;
+		pde[k].read=1;
+		pde[k].write=1;
+		pde[k].execute=1;
+		pde[k].large_pde=1;
+	}
+}
+
+// The identity-mapped PDEs do not refer to any paging structures, so they are identical in all EPT managers.
+// Build them once in the template so that each EPT manager clones them with a bulk copy.
+bool nvc_ept_build_identity_template()
+{
+	noir_ept_pde_template=noir_alloc_2mb_page();
+	if(noir_ept_pde_template)nvc_ept_fill_identity_pdes(noir_ept_pde_template);
+	return noir_ept_pde_template!=null;
+}
+
+void nvc_ept_release_identity_template()
+{
+	if(noir_ept_pde_template)
+	{
+		noir_free_2mb_page(noir_ept_pde_template);
+		noir_ept_pde_template=null;
+	}
+}
+
 /*
   Introduction to Identity map:
 
@@ -546,34 +718,30 @@ bool nvc_ept_protect_hypervisor(noir_hypervisor_p hvm,noir_ept_manager_p eptm)
   4KB for 1 PDPTE page - all 512 entries are used for mapping 512*1GB=512GB physical memory.
   2MB for 512 PDE pages - all 262144 entries are used for mapping 512*512*2MB=512GB physical memory.
   We will allocate the PDEs on a single 2MB-aligned page.
+  The PDEs are cloned from the template if it is built. Only the PDPTEs have to be fixed up.
 */
-noir_ept_manager_p nvc_ept_build_identity_map()
+noir_ept_manager_p nvc_ept_build_identity_map(u32 node)
 {
 	bool alloc_success=false;
 	noir_ept_manager_p eptm=noir_alloc_nonpg_memory(sizeof(noir_ept_manager));
 	if(eptm)
 	{
-		eptm->eptp.virt=noir_alloc_contd_memory(page_size);
-		if(eptm->eptp.virt)
+		noir_initialize_page_pool(&eptm->pool,node,&hvm_p->numa_report);
+		// Reserve the pool in one go so that the paging structures are allocated in a contiguous chunk.
+		if(noir_reserve_pool_pages(&eptm->pool,noir_page_pool_chunk_pages))
 		{
-			eptm->pdpt.virt=noir_alloc_contd_memory(page_size);
-			if(eptm->pdpt.virt)
+			eptm->eptp.virt=noir_alloc_pool_page(&eptm->pool,null);
+			eptm->pdpt.virt=noir_alloc_pool_page(&eptm->pool,&eptm->pdpt.phys);
+			eptm->pde.virt=noir_alloc_node_2mb_page(node,&hvm_p->numa_report);
+			if(eptm->pde.virt)
 			{
-				eptm->pde.virt=noir_alloc_2mb_page();
-				if(eptm->pde.virt)
+				eptm->pde.phys=noir_get_physical_address(eptm->pde.virt);
+				eptm->pte.head=noir_alloc_nonpg_memory(sizeof(noir_ept_pte_descriptor));
+				if(eptm->pte.head)
 				{
-					eptm->pde.phys=noir_get_physical_address(eptm->pde.virt);
-					eptm->pte.head=noir_alloc_nonpg_memory(sizeof(noir_ept_pte_descriptor));
-					if(eptm->pte.head)
-					{
-						eptm->pte.head->virt=noir_alloc_contd_memory(page_size);
-						if(eptm->pte.head->virt)
-						{
-							eptm->pte.head->phys=noir_get_physical_address(eptm->pte.head->virt);
-							alloc_success=true;
-						}
-						eptm->pte.tail=eptm->pte.head;
-					}
+					eptm->pte.head->virt=noir_alloc_pool_page(&eptm->pool,&eptm->pte.head->phys);
+					if(eptm->eptp.virt && eptm->pdpt.virt && eptm->pte.head->virt)alloc_success=true;
+					eptm->pte.tail=eptm->pte.head;
 				}
 			}
 		}
@@ -585,19 +753,13 @@ noir_ept_manager_p nvc_ept_build_identity_map()
 		noir_cpuid(ia32_cpuid_ext_pcap_prm_eid,0,&a,null,null,null);
 		eptm->phys_addr_size=a&0xff;
 		eptm->virt_addr_size=(a<<8)&0xff;
+		// Build Page-Directory Entries (PDEs)
+		if(noir_ept_pde_template)
+			noir_movsp(eptm->pde.virt,noir_ept_pde_template,page_2mb_size/sizeof(ulong_ptr));
+		else
+			nvc_ept_fill_identity_pdes(eptm->pde.virt);
 		for(u32 i=0;i<512;i++)
 		{
-			for(u32 j=0;j<512;j++)
-			{
-				const u32 k=(i<<9)+j;
-				// Build Page-Directory Entries (PDEs)
-				eptm->pde.virt[k].value=0;
-				eptm->pde.virt[k].page_offset=k;
-				eptm->pde.virt[k].read=1;
-				eptm->pde.virt[k].write=1;
-				eptm->pde.virt[k].execute=1;
-				eptm->pde.virt[k].large_pde=1;
-			}
 			// Build Page-Directory-Pointer-Table Entries (PDPTEs)
 			eptm->pdpt.virt[i].value=0;
 			eptm->pdpt.virt[i].pde_offset=(eptm->pde.phys>>page_shift)+i;
@@ -624,7 +786,6 @@ noir_ept_manager_p nvc_ept_build_identity_map()
 		if(nvc_ept_initialize_ci(eptm)==false)
 			goto alloc_failure;
 		// Build Page Map Level-4 Entry (PML4E)
-		eptm->pdpt.phys=noir_get_physical_address(eptm->pdpt.virt);
 		eptm->eptp.virt->value=0;
 		eptm->eptp.virt->pdpte_offset=eptm->pdpt.phys>>page_shift;
 		eptm->eptp.virt->read=1;
@@ -207,6 +207,16 @@ typedef struct _noir_ept_pte_descriptor
 	u64 gpa_start;
 }noir_ept_pte_descriptor,*noir_ept_pte_descriptor_p;
 
+// Maximum number of variable-range MTRRs to be snapshotted, excluding SMRR.
+#define noir_ept_mtrr_var_limit		0x20
+
+typedef struct _noir_ept_mtrr_snapshot
+{
+	ia32_mtrr_phys_base_msr base[noir_ept_mtrr_var_limit+1];
+	ia32_mtrr_phys_mask_msr mask[noir_ept_mtrr_var_limit+1];
+	u32 count;
+}noir_ept_mtrr_snapshot,*noir_ept_mtrr_snapshot_p;
+
 typedef struct _noir_ept_manager
 {
 	struct
@@ -229,6 +239,7 @@ typedef struct _noir_ept_manager
 		noir_ept_pte_descriptor_p head;
 		noir_ept_pte_descriptor_p tail;
 	}pte;
+	noir_page_pool pool;	// Paging structures of 4KB pages are allocated from this pool.
 	memory_descriptor blank_page;
 	ia32_mtrr_def_type_msr def_type;
 	u8 phys_addr_size;
@@ -261,7 +272,17 @@ typedef union _ia32_ept_violation_qualification
 	ulong_ptr value;
 }ia32_ept_violation_qualification,*ia32_ept_violation_qualification_p;
 
+// Template of identity-mapped PDEs. It only lives while EPT managers are being built.
+#if defined(_vt_ept)
+ia32_ept_large_pde_p noir_ept_pde_template=null;
+#else
+extern ia32_ept_large_pde_p noir_ept_pde_template;
+#endif
+
 bool nvc_ept_protect_hypervisor(noir_hypervisor_p hvm,noir_ept_manager_p eptm);
-noir_ept_manager_p nvc_ept_build_identity_map();
+bool nvc_ept_build_identity_template();
+void nvc_ept_release_identity_template();
+noir_ept_manager_p nvc_ept_build_identity_map(u32 node);
 void nvc_ept_cleanup(noir_ept_manager_p eptm);
-void nvc_ept_update_by_mtrr(noir_ept_manager_p eptm);
\ No newline at end of file
+void nvc_ept_update_by_mtrr(noir_ept_manager_p eptm);
+void nvc_ept_update_by_mtrr_write(noir_ept_manager_p eptm,u32 index,u64 old_value,u64 new_value);
\ No newline at end of file
@@ -111,13 +111,13 @@ void static fastcall nvc_vt_exception_nmi_handler(noir_gpr_state_p gpr_state,noi
 				ia32_page_fault_error_code err_code;
 				noir_vt_vmread(vmexit_interruption_error_code,&err_code.value);
 				// Processor does not update CR2 on #PF Exit, but the faulting address is saved in Exit Qualification.
-				noir_vt_vmread(vmexit_qualification,&gcr2);
+				gcr2=noir_vt_cached_vmread(vcpu,noir_vt_cached_exit_qualification);
 				if(gcr2==(ulong_ptr)noir_system_call)
 				{
 					// ulong_ptr gcr4;
 					u64 gcr3k=noir_get_current_process_cr3();
 					// Switch to KVA-unshadowed CR3 of the process.
-					noir_vt_vmwrite(guest_cr3,gcr3k);
+					noir_vt_cached_vmwrite(vcpu,noir_vt_cached_guest_cr3,gcr3k);
 					// noir_vt_vmread(guest_cr4,&gcr4);
 					// Flush Guest TLB because the Guest CR3 is changed.
 					if(vcpu->enabled_feature & noir_vt_vpid_tagged_tlb)
@@ -161,19 +161,19 @@ void static fastcall nvc_vt_init_handler(noir_gpr_state_p gpr_state,noir_vt_vcpu
 	ia32_vmx_entry_controls entry_ctrl;
 	ulong_ptr cr0;
 	// General-Purpose Registers
-	noir_vt_vmwrite(guest_rip,0xFFF0);
-	noir_vt_vmwrite(guest_rsp,0);
+	noir_vt_cached_vmwrite(vcpu,noir_vt_cached_guest_rip,0xFFF0);
+	noir_vt_cached_vmwrite(vcpu,noir_vt_cached_guest_rsp,0);
 	noir_vt_vmwrite(guest_rflags,2);
 	noir_stosp(gpr_state,0,sizeof(void*)*2);
 	gpr_state->rdx=vcpu->family_ext;
 	// Control Registers
-	noir_vt_vmread(guest_cr0,&cr0);
+	cr0=noir_vt_cached_vmread(vcpu,noir_vt_cached_guest_cr0);
 	cr0&=0x60000000;		// Bits CD & NW of CR0 are unchanged during INIT.
 	cr0|=0x00000010;		// Bit ET of CR0 is always set.
-	noir_vt_vmwrite(guest_cr0,cr0);
+	noir_vt_cached_vmwrite(vcpu,noir_vt_cached_guest_cr0,cr0);
 	noir_vt_vmwrite(cr0_read_shadow,0x60000010);
-	noir_vt_vmwrite(guest_cr3,0);
-	noir_vt_vmwrite(guest_cr4,ia32_cr4_vmxe_bit);
+	noir_vt_cached_vmwrite(vcpu,noir_vt_cached_guest_cr3,0);
+	noir_vt_cached_vmwrite(vcpu,noir_vt_cached_guest_cr4,ia32_cr4_vmxe_bit);
 	noir_vt_vmwrite(cr4_read_shadow,0);
 	noir_writecr2(0);
 	noir_vt_vmwrite(guest_msr_ia32_efer,0);
@@ -261,11 +261,11 @@ void static fastcall nvc_vt_sipi_handler(noir_gpr_state_p gpr_state,noir_vt_vcpu
 {
 	// The SIPI Vector is stored in Exit-Qualification.
 	ulong_ptr vector;
-	noir_vt_vmread(vmexit_qualification,&vector);
+	vector=noir_vt_cached_vmread(vcpu,noir_vt_cached_exit_qualification);
 	// According to vector, set control-flow fields of vCPU.
 	noir_vt_vmwrite(guest_cs_selector,vector<<8);
 	noir_vt_vmwrite(guest_cs_base,vector<<12);
-	noir_vt_vmwrite(guest_rip,0);
+	noir_vt_cached_vmwrite(vcpu,noir_vt_cached_guest_rip,0);
 	// Startup-IPI is received, resume to active state.
 	noir_vt_vmwrite(guest_activity_state,guest_is_active);
 }
@@ -325,15 +325,20 @@ void static fastcall nvc_vt_cpuid_handler(noir_gpr_state_p gpr_state,noir_vt_vcp
 {
 	u32 ia=(u32)gpr_state->rax;
 	u32 ic=(u32)gpr_state->rcx;
+	ulong_ptr gcr4=0;
 	noir_cpuid_general_info info;
-	// Invoke handlers.
-	nvcp_vt_cpuid_handler(ia,ic,&info);
+	// Only the leaves reflecting CR4 require the guest CR4. Save the vmread for other leaves.
+	if(ia==ia32_cpuid_std_proc_feature || ia==ia32_cpuid_std_struct_extid)
+		gcr4=noir_vt_cached_vmread(vcpu,noir_vt_cached_guest_cr4);
+	// Most leaves are precomputed on subversion. Invoke handlers only if the leaf is not cached.
+	if(!noir_query_cpuid_cache(&vcpu->cpuid_cache,ia,ic,gcr4,&info))
+		nvcp_vt_cpuid_handler(ia,ic,&info);
 	*(u32*)&gpr_state->rax=info.eax;
 	*(u32*)&gpr_state->rbx=info.ebx;
 	*(u32*)&gpr_state->rcx=info.ecx;
 	*(u32*)&gpr_state->rdx=info.edx;
 	// Finally, advance the instruction pointer.
-	noir_vt_advance_rip();
+	noir_vt_advance_rip(vcpu);
 }
 
 // Expected Exit Reason: 11
@@ -342,7 +347,7 @@ void static fastcall nvc_vt_cpuid_handler(noir_gpr_state_p gpr_state,noir_vt_vcp
 void static fastcall nvc_vt_getsec_handler(noir_gpr_state_p gpr_state,noir_vt_vcpu_p vcpu)
 {
 	nv_dprintf("SMX Virtualization is not supported!\n");
-	noir_vt_advance_rip();
+	noir_vt_advance_rip(vcpu);
 }
 
 // Expected Exit Reason: 13
@@ -352,7 +357,7 @@ void static fastcall nvc_vt_invd_handler(noir_gpr_state_p gpr_state,noir_vt_vcpu
 	// In Hyper-V, it invoked wbinvd at invd exit.
 	nv_dprintf("The invd instruction is executed!\n");
 	noir_wbinvd();
-	noir_vt_advance_rip();
+	noir_vt_advance_rip(vcpu);
 }
 
 // Expected Exit Reason: 18
@@ -362,8 +367,23 @@ void static fastcall nvc_vt_vmcall_handler(noir_gpr_state_p gpr_state,noir_vt_vc
 	ulong_ptr gip,gcr3;
 	bool valid_call=false;
 	u32 index=(u32)gpr_state->rcx;
-	noir_vt_vmread(guest_rip,&gip);
-	noir_vt_vmread(guest_cr3,&gcr3);
+	gip=noir_vt_cached_vmread(vcpu,noir_vt_cached_guest_rip);
+	gcr3=noir_vt_cached_vmread(vcpu,noir_vt_cached_guest_cr3);
+#if defined(_amd64)
+	// Hv#1 hypercalls are issued from the hypercall page with the signature in eax.
+	if(hvm_p->options.cpuid_hv_presence && (u32)gpr_state->rax==noir_mshv_hypercall_signature)
+	{
+		vmx_segment_access_right ss_attrib;
+		// Hypercalls from user mode are invalid instructions.
+		// According to Intel SDM, SS.DPL must be the CPL.
+		noir_vt_vmread(guest_ss_access_rights,&ss_attrib.value);
+		if(ss_attrib.dpl)
+			noir_vt_inject_event(ia32_invalid_opcode,ia32_hardware_exception,false,0,0);
+		else if(nvc_mshv_hypercall_handler(&vcpu->mshvcpu,gpr_state))
+			noir_vt_advance_rip(vcpu);
+		return;
+	}
+#endif
 	switch(index)
 	{
 		case noir_vt_callexit:
@@ -374,9 +394,9 @@ void static fastcall nvc_vt_vmcall_handler(noir_gpr_state_p gpr_state,noir_vt_vc
 				noir_gpr_state_p saved_state=(noir_gpr_state_p)vcpu->hv_stack;
 				ulong_ptr gsp,gflags;
 				u32 inslen=3;		// By default, vmcall uses 3 bytes.
-				noir_vt_vmread(guest_rsp,&gsp);
+				gsp=noir_vt_cached_vmread(vcpu,noir_vt_cached_guest_rsp);
 				noir_vt_vmread(guest_rflags,&gflags);
-				noir_vt_vmread(vmexit_instruction_length,&inslen);
+				inslen=(u32)noir_vt_cached_vmread(vcpu,noir_vt_cached_instruction_length);
 				// We may allocate space from unused HV-Stack
 				noir_movsp(saved_state,gpr_state,sizeof(void*)*2);
 				saved_state->rax=gip+inslen;
@@ -446,7 +466,7 @@ void static fastcall nvc_vt_vmcall_handler(noir_gpr_state_p gpr_state,noir_vt_vc
 		}
 	}
 	if(valid_call)
-		noir_vt_advance_rip();
+		noir_vt_advance_rip(vcpu);
 	else
 	{
 		// If vmcall is not inside the NoirVisor's image,
@@ -462,7 +482,7 @@ void static fastcall nvc_vt_vmcall_handler(noir_gpr_state_p gpr_state,noir_vt_vc
 				noir_vt_vmfail_invalid();		// At this moment, valid VMCS is not loaded.
 			else
 				noir_vt_vmfail_valid();			// At this moment, valid VMCS is loaded.
-			noir_vt_advance_rip();
+			noir_vt_advance_rip(vcpu);
 		}
 		else
 		{
@@ -518,6 +538,8 @@ void static fastcall nvc_vt_vmclear_handler(noir_gpr_state_p gpr_state,noir_vt_v
 			else
 			{
 				noir_vt_nested_vmcs_header_p header=noir_find_virt_by_phys(vmcs_pa);
+				// Contents in the shadow VMCS must be written to memory.
+				if(vmcs_pa==nested_vcpu->vmcs_c.phys)nvc_vt_unload_shadow_vmcs(vcpu);
 				header->clean_fields.active=0;
 				header->clean_fields.launched=0;
 				if(vmcs_pa==nested_vcpu->vmcs_c.phys)
@@ -528,7 +550,7 @@ void static fastcall nvc_vt_vmclear_handler(noir_gpr_state_p gpr_state,noir_vt_v
 				noir_vt_vmsuccess();
 			}
 		}
-		noir_vt_advance_rip();
+		noir_vt_advance_rip(vcpu);
 		return;
 	}
 	noir_vt_inject_event(ia32_invalid_opcode,ia32_hardware_exception,false,0,0);
@@ -556,16 +578,21 @@ void static fastcall nvc_vt_vmptrld_handler(noir_gpr_state_p gpr_state,noir_vt_v
 				u32 true_revision_id=(u32)vcpu->virtual_msr.vmx_msr[0];
 				if(header->revision_id!=true_revision_id)
 					noir_vt_vmfail(nested_vcpu,vmptrld_with_incorrect_revid);
-				else
+				else if(vmcs_pa!=nested_vcpu->vmcs_c.phys)
 				{
+					// Synchronize the previous VMCS before switching.
+					nvc_vt_unload_shadow_vmcs(vcpu);
 					header->clean_fields.active=1;
 					nested_vcpu->vmcs_c.phys=vmcs_pa;
 					nested_vcpu->vmcs_c.virt=(void*)header;
+					nvc_vt_load_shadow_vmcs(vcpu);
 					noir_vt_vmsuccess();
 				}
+				else
+					noir_vt_vmsuccess();
 			}
 		}
-		noir_vt_advance_rip();
+		noir_vt_advance_rip(vcpu);
 		return;
 	}
 	noir_vt_inject_event(ia32_invalid_opcode,ia32_hardware_exception,false,0,0);
@@ -580,7 +607,75 @@ void static fastcall nvc_vt_vmptrst_handler(noir_gpr_state_p gpr_state,noir_vt_v
 	{
 		ulong_ptr pointer=nvc_vt_parse_vmx_pointer(gpr_state);
 		*(u64*)pointer=nested_vcpu->vmcs_c.phys;
-		noir_vt_advance_rip();
+		noir_vt_advance_rip(vcpu);
+		return;
+	}
+	noir_vt_inject_event(ia32_invalid_opcode,ia32_hardware_exception,false,0,0);
+}
+
+// Expected Exit Reason: 23
+// This is VM-Exit of obligation.
+// With VMCS shadowing, only the fields not shadowed by the processor reach here.
+void static fastcall nvc_vt_vmread_handler(noir_gpr_state_p gpr_state,noir_vt_vcpu_p vcpu)
+{
+	noir_vt_nested_vcpu_p nested_vcpu=&vcpu->nested_vcpu;
+	if(noir_bt(&nested_vcpu->status,noir_nvt_vmxon))
+	{
+		if(nested_vcpu->vmcs_c.phys==maxu64)
+			noir_vt_vmfail_invalid();
+		else
+		{
+			ia32_vmexit_instruction_information info;
+			ulong_ptr* gpr=(ulong_ptr*)gpr_state;
+			ulong_ptr value=0;
+			noir_vt_vmread(vmexit_instruction_information,(u32*)&info);
+			if(noir_vt_nested_vmread(nested_vcpu->vmcs_c.virt,(u32)gpr[info.f6.reg2],&value))
+			{
+				if(info.f6.use_register)
+					gpr[info.f6.reg1]=value;
+				else
+					*(ulong_ptr*)nvc_vt_parse_vmx_pointer(gpr_state)=value;
+			}
+		}
+		noir_vt_advance_rip(vcpu);
+		return;
+	}
+	noir_vt_inject_event(ia32_invalid_opcode,ia32_hardware_exception,false,0,0);
+}
+
+// Expected Exit Reason: 25
+// This is VM-Exit of obligation.
+// With VMCS shadowing, only the fields not shadowed by the processor reach here.
+void static fastcall nvc_vt_vmwrite_handler(noir_gpr_state_p gpr_state,noir_vt_vcpu_p vcpu)
+{
+	noir_vt_nested_vcpu_p nested_vcpu=&vcpu->nested_vcpu;
+	if(noir_bt(&nested_vcpu->status,noir_nvt_vmxon))
+	{
+		if(nested_vcpu->vmcs_c.phys==maxu64)
+			noir_vt_vmfail_invalid();
+		else
+		{
+			ia32_vmexit_instruction_information info;
+			ia32_vmx_vmcs_encoding encoding;
+			ulong_ptr* gpr=(ulong_ptr*)gpr_state;
+			ulong_ptr value;
+			noir_vt_vmread(vmexit_instruction_information,(u32*)&info);
+			encoding.value=(u32)gpr[info.f6.reg2];
+			if(info.f6.use_register)
+				value=gpr[info.f6.reg1];
+			else
+				value=*(ulong_ptr*)nvc_vt_parse_vmx_pointer(gpr_state);
+			// Read-only fields are writable only if the virtual VMX capability says so.
+			if(encoding.type==1 && !noir_bt((u32*)&vcpu->virtual_msr.vmx_msr[ia32_vmx_misc-ia32_vmx_basic],29))
+				noir_vt_vmfail(nested_vcpu,vmwrite_to_read_only_field);
+			else
+			{
+				noir_vt_nested_vmwrite(nested_vcpu->vmcs_c.virt,encoding.value,value);
+				// Read-only fields are not shadowed for writes, but may be shadowed for reads.
+				nvc_vt_update_shadow_vmcs_field(vcpu,encoding.value,value);
+			}
+		}
+		noir_vt_advance_rip(vcpu);
 		return;
 	}
 	noir_vt_inject_event(ia32_invalid_opcode,ia32_hardware_exception,false,0,0);
@@ -594,9 +689,11 @@ void static fastcall nvc_vt_vmxoff_handler(noir_gpr_state_p gpr_state,noir_vt_vc
 	// Check if VMXON has been executed. Plus, revoke vmxon.
 	if(noir_btr(&nested_vcpu->status,noir_nvt_vmxon))
 	{
+		// The current VMCS is no longer used.
+		nvc_vt_unload_shadow_vmcs(vcpu);
 		// Mark as success operation.
 		noir_vt_vmsuccess();
-		noir_vt_advance_rip();
+		noir_vt_advance_rip(vcpu);
 	}
 	else
 	{
@@ -656,7 +753,7 @@ void static fastcall nvc_vt_vmxon_handler(noir_gpr_state_p gpr_state,noir_vt_vcp
 		}
 		// We don't have to check whether vCPU is under VMX Non-Root Operation.
 		// There will be another handler regarding the VM-Exit.
-		noir_vt_advance_rip();
+		noir_vt_advance_rip(vcpu);
 	}
 	else
 	{
@@ -673,7 +770,7 @@ void static fastcall nvc_vt_cr_access_handler(noir_gpr_state_p gpr_state,noir_vt
 	// On default NoirVisor's setting of VMCS, this handler only traps writes to CR0 and CR4.
 	ia32_cr_access_qualification info;
 	bool advance_ip=true;
-	noir_vt_vmread(vmexit_qualification,(ulong_ptr*)&info);
+	info.value=noir_vt_cached_vmread(vcpu,noir_vt_cached_exit_qualification);
 	switch(info.access_type)
 	{
 		case 0:
@@ -700,26 +797,26 @@ void static fastcall nvc_vt_cr_access_handler(noir_gpr_state_p gpr_state,noir_vt
 					else
 					{
 						ulong_ptr gcr0,cr0x;
-						noir_vt_vmread(guest_cr0,&gcr0);
+						gcr0=noir_vt_cached_vmread(vcpu,noir_vt_cached_guest_cr0);
 						// Use exclusive-or to check if CR0.CD bit is being changed.
 						cr0x=gcr0^data;
 						if(noir_bt((u32*)&cr0x,ia32_cr0_cd))
 						{
 							// The CR0.CD bit is being changed.
-							if(noir_bt((u32*)&gcr0,ia32_cr0_cd)==0)
+							// If caching is being re-enabled after MTRR writes, flush EPT TLB once for all of them.
+							// Memory types in EPT entries were already updated upon each write.
+							if(noir_bt((u32*)&gcr0,ia32_cr0_cd) && vcpu->mtrr_dirty)
 							{
 								invept_descriptor ied;
-								// Reset EPT entries.
-								nvc_ept_update_by_mtrr(vcpu->ept_manager);
-								// Flush EPT TLB due to the update.
 								ied.eptp=vcpu->ept_manager->eptp.phys.value;
 								ied.reserved=0;
 								noir_vt_invept(ept_single_invd,&ied);
+								vcpu->mtrr_dirty=0;
 							}
 						}
 						// Reflect the write to both host and guest.
 						noir_vt_vmwrite(host_cr0,data);
-						noir_vt_vmwrite(guest_cr0,data);
+						noir_vt_cached_vmwrite(vcpu,noir_vt_cached_guest_cr0,data);
 						noir_vt_vmwrite(cr0_read_shadow,data);
 					}
 					break;
@@ -727,8 +824,8 @@ void static fastcall nvc_vt_cr_access_handler(noir_gpr_state_p gpr_state,noir_vt
 				case 4:
 				{
 					ulong_ptr data=((ulong_ptr*)gpr_state)[info.gpr_num];
-					ulong_ptr cr4_rs,gcr4;
-					noir_vt_vmread(guest_cr4,&gcr4);
+					ulong_ptr cr4_rs,gcr4,old_cr4;
+					gcr4=old_cr4=noir_vt_cached_vmread(vcpu,noir_vt_cached_guest_cr4);
 					noir_vt_vmread(cr4_read_shadow,&cr4_rs);
 					cr4_rs=data;
 					gcr4=data|ia32_cr4_vmxe_bit;	// Always set CR4.VMXE for the valid Guest State.
@@ -754,8 +851,11 @@ void static fastcall nvc_vt_cr_access_handler(noir_gpr_state_p gpr_state,noir_vt
 						}
 					}
 					// Finally, write to Guest CR4 field and CR4 Read-Shadow field.
-					noir_vt_vmwrite(guest_cr4,gcr4);
+					noir_vt_cached_vmwrite(vcpu,noir_vt_cached_guest_cr4,gcr4);
 					noir_vt_vmwrite(cr4_read_shadow,cr4_rs);
+					// Check if UMIP is to be switched.
+					if(noir_bt((u32*)&old_cr4,ia32_cr4_umip)!=noir_bt((u32*)&gcr4,ia32_cr4_umip))
+						nvc_vt_reconfigure_npiep_interceptions(vcpu);
 					break;
 				}
 				default:
@@ -787,15 +887,15 @@ void static fastcall nvc_vt_cr_access_handler(noir_gpr_state_p gpr_state,noir_vt
 			if(noir_bt((u32*)&msw,0))
 			{
 				ulong_ptr gcr0;
-				noir_vt_vmread(guest_cr0,&gcr0);
+				gcr0=noir_vt_cached_vmread(vcpu,noir_vt_cached_guest_cr0);
 				gcr0|=msw;
 				gcr0&=~msw;
-				noir_vt_vmwrite(guest_cr0,gcr0);
+				noir_vt_cached_vmwrite(vcpu,noir_vt_cached_guest_cr0,gcr0);
 			}
 			break;
 		}
 	}
-	if(advance_ip)noir_vt_advance_rip();
+	if(advance_ip)noir_vt_advance_rip(vcpu);
 }
 
 // Expected Exit Reason: 31
@@ -866,7 +966,8 @@ void static fastcall nvc_vt_rdmsr_handler(noir_gpr_state_p gpr_state,noir_vt_vcp
 #endif
 			default:
 			{
-				nv_dprintf("Unexpected rdmsr is intercepted! Index=0x%X\n",index);
+				// Do not print synchronously in the VM-Exit handler. Guests may probe unknown MSRs frequently.
+				nv_async_tracef(1,"Unexpected rdmsr is intercepted! Index=0x%llX\n",(u64)index);
 				break;
 			}
 		}
@@ -874,7 +975,7 @@ void static fastcall nvc_vt_rdmsr_handler(noir_gpr_state_p gpr_state,noir_vt_vcp
 	// Put into GPRs. Clear high 32-bits of each register.
 	gpr_state->rax=(ulong_ptr)val.low;
 	gpr_state->rdx=(ulong_ptr)val.high;
-	if(advance)noir_vt_advance_rip();
+	if(advance)noir_vt_advance_rip(vcpu);
 }
 
 // Expected Exit Reason: 32
@@ -887,10 +988,13 @@ void static fastcall nvc_vt_wrmsr_handler(noir_gpr_state_p gpr_state,noir_vt_vcp
 	// Expected Case: Microsoft Synthetic MSR
 	if(noir_is_synthetic_msr(index))
 	{
-		if(hvm_p->options.cpuid_hv_presence)
-			nvc_mshv_wrmsr_handler(&vcpu->mshvcpu,index,val.value);
-		else
+		// Writes to synthetic MSRs go to #GP if they are not exposed or they are read-only.
+		// The faulting instruction must not be skipped.
+		if(!hvm_p->options.cpuid_hv_presence || !nvc_mshv_wrmsr_handler(&vcpu->mshvcpu,index,val.value))
+		{
 			noir_vt_inject_event(ia32_general_protection,ia32_hardware_exception,true,0,0);
+			return;
+		}
 	}
 	else
 	{
@@ -945,20 +1049,20 @@ void static fastcall nvc_vt_wrmsr_handler(noir_gpr_state_p gpr_state,noir_vt_vcp
 			case ia32_mtrr_def_type:
 			{
 				ulong_ptr gcr0;
+				u64 old_value=noir_rdmsr(index);
 				// Writes to MTRRs are intercepted.
 				// Pass the value to the real MTRR.
 				noir_wrmsr(index,val.value);
-				// If CR0.CD is cleared, we should re-emulate MTRRs.
-				// Otherwise, simply mark the MTRR is dirty.
-				// Re-emulation would be done when CR0.CD is reset.
-				noir_vt_vmread(guest_cr0,&gcr0);
+				// Only the ranges covered by the old and new values are re-emulated.
+				nvc_ept_update_by_mtrr_write(vcpu->ept_manager,index,old_value,val.value);
+				// If CR0.CD is set, the guest is likely to write more MTRRs.
+				// Simply mark the MTRR is dirty and flush EPT TLB when CR0.CD is reset.
+				gcr0=noir_vt_cached_vmread(vcpu,noir_vt_cached_guest_cr0);
 				if(noir_bt((u32*)&gcr0,ia32_cr0_cd))
 					vcpu->mtrr_dirty=1;
 				else
 				{
 					invept_descriptor ied;
-					// Reset EPT entries.
-					nvc_ept_update_by_mtrr(vcpu->ept_manager);
 					// Flush EPT TLB due to the update.
 					ied.eptp=vcpu->ept_manager->eptp.phys.value;
 					ied.reserved=0;
@@ -987,13 +1091,13 @@ void static fastcall nvc_vt_wrmsr_handler(noir_gpr_state_p gpr_state,noir_vt_vcp
 #endif
 			default:
 			{
-				nv_dprintf("Unexpected wrmsr is intercepted! Index=0x%X\t Value=0x%08X`%08X\n",index,val.low,val.high);
+				nv_async_tracef(2,"Unexpected wrmsr is intercepted! Index=0x%llX\t Value=0x%016llX\n",(u64)index,val.value);
 				break;
 			}
 		}
 		noir_wrmsr(index,val.value);
 	}
-	noir_vt_advance_rip();
+	noir_vt_advance_rip(vcpu);
 }
 
 // Expected Exit Reason: 33
@@ -1024,13 +1128,13 @@ void static fastcall nvc_vt_access_gdtr_idtr_handler(noir_gpr_state_p gpr_state,
 	noir_vt_vmread(guest_cs_access_rights,&cs_attrib.value);
 	noir_vt_vmread(vmexit_instruction_information,&exit_info.value);
 	// Forge the pointer.
-	noir_vt_vmread(vmexit_qualification,&displacement);
+	displacement=(long_ptr)noir_vt_cached_vmread(vcpu,noir_vt_cached_exit_qualification);
 	if(!exit_info.f2.base_invalid)
 	{
 		ulong_ptr base;
 		// Note: The rsp register is saved in VMCS.
 		if(exit_info.f2.base==4)
-			noir_vt_vmread(guest_rsp,&base);
+			base=noir_vt_cached_vmread(vcpu,noir_vt_cached_guest_rsp);
 		else
 			base=gpr_array[exit_info.f2.base];
 		pointer+=base;
@@ -1039,7 +1143,7 @@ void static fastcall nvc_vt_access_gdtr_idtr_handler(noir_gpr_state_p gpr_state,
 	if(!exit_info.f2.index_invalid)
 		pointer+=gpr_array[exit_info.f2.index]<<gpr_array[exit_info.f2.scaling];
 	// Apply the segment base.
-	noir_vt_vmread(guest_cr0,&gcr0);
+	gcr0=noir_vt_cached_vmread(vcpu,noir_vt_cached_guest_cr0);
 #if defined(_hv_type1)
 	if(gcr0 & noir_cr0_pe)
 #endif
@@ -1120,7 +1224,7 @@ void static fastcall nvc_vt_access_gdtr_idtr_handler(noir_gpr_state_p gpr_state,
 			*(u32*)(pointer+2)=(u32)base;
 		*(u16*)pointer=limit;
 	}
-	noir_vt_advance_rip();
+	noir_vt_advance_rip(vcpu);
 }
 
 // Expected Exit Reason: 47
@@ -1133,15 +1237,15 @@ void static fastcall nvc_vt_access_ldtr_tr_handler(noir_gpr_state_p gpr_state,no
 	vmx_segment_access_right cs_attrib;
 	noir_vt_vmread(guest_cs_access_rights,&cs_attrib.value);
 	noir_vt_vmread(vmexit_instruction_information,&exit_info.value);
-	noir_vt_vmread(vmexit_qualification,&displacement);
-	noir_vt_vmread(guest_cr0,&gcr0);
+	displacement=(long_ptr)noir_vt_cached_vmread(vcpu,noir_vt_cached_exit_qualification);
+	gcr0=noir_vt_cached_vmread(vcpu,noir_vt_cached_guest_cr0);
 	noir_vt_vmread(guest_gdtr_base,&gdt_base);
 	// Accessing LDTR and TR does not necessarily reference memory.
 	if(!exit_info.f3.use_register)
 	{
 		;
 	}
-	noir_vt_advance_rip();
+	noir_vt_advance_rip(vcpu);
 }
 
 // Expected Exit Reason: 48
@@ -1203,7 +1307,7 @@ void static fastcall nvc_vt_ept_violation_handler(noir_gpr_state_p gpr_state,noi
 			break;
 		}
 	}
-	if(advance)noir_vt_advance_rip();
+	if(advance)noir_vt_advance_rip(vcpu);
 }
 
 // Expected Exit Reason: 49
@@ -1217,6 +1321,14 @@ void static fastcall nvc_vt_ept_misconfig_handler(noir_gpr_state_p gpr_state,noi
 	noir_int3();
 }
 
+// Expected Exit Reason: 7, 52
+// Interrupt-Window and VMX-Preemption Timer exits are requested to deliver synthetic interrupts.
+// Synthetic interrupts are delivered at the end of every VM-Exit, so there is nothing to do here.
+void static fastcall nvc_vt_synthetic_interrupt_handler(noir_gpr_state_p gpr_state,noir_vt_vcpu_p vcpu)
+{
+	;
+}
+
 // Expected Exit Reason: 55
 // This is VM-Exit of obligation.
 void static fastcall nvc_vt_xsetbv_handler(noir_gpr_state_p gpr_state,noir_vt_vcpu_p vcpu)
@@ -1252,7 +1364,7 @@ void static fastcall nvc_vt_xsetbv_handler(noir_gpr_state_p gpr_state,noir_vt_vc
 	if(gp_exception)
 	{
 		u32 len;
-		noir_vt_vmread(vmexit_instruction_length,&len);
+		len=(u32)noir_vt_cached_vmread(vcpu,noir_vt_cached_instruction_length);
 		// Exception induced by xsetbv has error code zero pushed onto stack.
 		noir_vt_inject_event(ia32_general_protection,ia32_hardware_exception,true,len,0);
 	}
@@ -1260,7 +1372,83 @@ void static fastcall nvc_vt_xsetbv_handler(noir_gpr_state_p gpr_state,noir_vt_vc
 	{
 		// Everything is fine.
 		noir_xsetbv(index,value);
-		noir_vt_advance_rip();
+		noir_vt_advance_rip(vcpu);
+	}
+}
+
+// Write the dirty fields in the VMCS cache back to the current VMCS.
+void nvc_vt_flush_vmcs_cache(noir_vt_vcpu_p vcpu)
+{
+	noir_vt_vmcs_cache_p cache=&vcpu->vmcs_cache;
+	for(u32 dirty=cache->dirty,i;noir_bsf(&i,dirty);noir_btr(&dirty,i))
+		noir_vt_vmwrite(vt_cached_field_encoding[i],cache->value[i]);
+	cache->dirty=0;
+}
+
+// Returns false if the guest cannot accept the interrupt right now.
+bool static fastcall nvc_vt_inject_synthetic_interrupt(noir_vt_vcpu_p vcpu)
+{
+	ia32_vmentry_interruption_information_field entry_info,idt_vectoring;
+	ia32_vmx_interruptibility_state interruptibility;
+	ulong_ptr gflags;
+	// Do not overwrite an event being injected or interrupted in delivery.
+	noir_vt_vmread(vmentry_interruption_information_field,&entry_info.value);
+	noir_vt_vmread(idt_vectoring_information,&idt_vectoring.value);
+	if(entry_info.valid || idt_vectoring.valid)return false;
+	// The guest must be able to accept maskable interrupts.
+	noir_vt_vmread(guest_rflags,&gflags);
+	if(!noir_bt((u32*)&gflags,ia32_rflags_if))return false;
+	noir_vt_vmread(guest_interruptibility_state,&interruptibility.value);
+	if(interruptibility.blocking_by_sti || interruptibility.blocking_by_mov_ss)return false;
+	noir_vt_inject_event(nvc_mshv_acknowledge_synthetic_interrupt(&vcpu->mshvcpu),ia32_external_interrupt,false,0,0);
+	return true;
+}
+
+// Deliver the synthetic interrupts asserted by MSHV-Core, and request the VM-Exits to deliver them in time.
+void static fastcall nvc_vt_schedule_synthetic_interrupts(noir_vt_vcpu_p vcpu)
+{
+	ia32_vmx_priproc_controls proc_ctrl;
+	bool window=false;
+	if(nvc_mshv_poll_synthetic_timers(&vcpu->mshvcpu))window=!nvc_vt_inject_synthetic_interrupt(vcpu);
+	// If the guest cannot accept the interrupt right now, exit as soon as it can.
+	noir_vt_vmread(primary_processor_based_vm_execution_controls,&proc_ctrl.value);
+	if(proc_ctrl.interrupt_window_exiting!=window)
+	{
+		proc_ctrl.interrupt_window_exiting=window;
+		noir_vt_vmwrite(primary_processor_based_vm_execution_controls,proc_ctrl.value);
+	}
+	// Exit at the deadline of the earliest synthetic timer.
+	if(noir_mshv_stimer_wakeup)
+	{
+		const u64 countdown=nvc_mshv_get_synthetic_timer_countdown(&vcpu->mshvcpu);
+		const bool armed=countdown!=maxu64;
+		ia32_vmx_pinbased_controls pin_ctrl;
+		noir_vt_vmread(pin_based_vm_execution_controls,&pin_ctrl.value);
+		if(pin_ctrl.activate_vmx_preemption_timer!=armed)
+		{
+			pin_ctrl.activate_vmx_preemption_timer=armed;
+			noir_vt_vmwrite(pin_based_vm_execution_controls,pin_ctrl.value);
+		}
+		if(armed)
+		{
+			const u64 ticks=countdown>>vcpu->relative_hvm->preemption_timer_rate;
+			noir_vt_vmwrite(vmx_preemption_timer_value,ticks>0xffffffff?0xffffffff:(u32)ticks);
+		}
+	}
+}
+
+// Apply the TLB flushes requested by the TLB-flush hypercalls.
+// Without VPID, the TLB is flushed on every VM-Entry and VM-Exit anyway.
+void static fastcall nvc_vt_apply_pending_tlb_flush(noir_vt_vcpu_p vcpu)
+{
+	const u32 pending=(u32)noir_locked_xchg((long*)&vcpu->mshvcpu.tlb_flush_pending,0);
+	if(pending && (vcpu->enabled_feature & noir_vt_vpid_tagged_tlb))
+	{
+		invvpid_descriptor ivd;
+		noir_vt_vmread(virtual_processor_identifier,&ivd.vpid);
+		ivd.reserved[0]=ivd.reserved[1]=ivd.reserved[2]=0;
+		ivd.linear_address=0;
+		noir_vt_invvpid((pending & noir_mshv_tlb_flush_all)?vpid_single_invd:vpid_sicrgb_invd,&ivd);
 	}
 }
 
@@ -1273,13 +1461,42 @@ void fastcall nvc_vt_exit_handler(noir_gpr_state_p gpr_state,noir_vt_vcpu_p vcpu
 	// Confirm which vCPU is exiting so that the correct handler is to be invoked...
 	if(likely(vmcs_phys==vcpu->vmcs.phys))
 	{
+		// Take the timestamp only if exit profiling is enabled.
+		u64 exit_tsc=vcpu->exit_histogram?noir_rdtsc():0;
+		noir_exit_trace_record_p trace=null;
 		u32 exit_reason;
+		// Fields cached in previous VM-Exit are stale.
+		vcpu->vmcs_cache.valid=0;
 		noir_vt_vmread(vmexit_reason,&exit_reason);
 		exit_reason&=0xFFFF;
+		// Capture the exit if exit tracing is enabled.
+		if(vcpu->exit_trace)
+		{
+			ulong_ptr qualification=noir_vt_cached_vmread(vcpu,noir_vt_cached_exit_qualification);
+			ulong_ptr rip=noir_vt_cached_vmread(vcpu,noir_vt_cached_guest_rip);
+			ulong_ptr linear_address;
+			noir_vt_vmread(guest_linear_address,&linear_address);
+			trace=noir_begin_exit_trace(vcpu->exit_trace,exit_reason,qualification,linear_address,rip,gpr_state);
+		}
 		if(exit_reason<vmx_maximum_exit_reason)
 			vt_exit_handlers[exit_reason](gpr_state,vcpu);
 		else
 			nvc_vt_default_handler(gpr_state,vcpu);
+		if(hvm_p->options.cpuid_hv_presence)nvc_vt_schedule_synthetic_interrupts(vcpu);
+		if(hvm_p->options.cpuid_hv_presence)nvc_vt_apply_pending_tlb_flush(vcpu);
+		// Complete the capture with the decisions of the handler.
+		if(trace)
+		{
+			ulong_ptr rip=noir_vt_cached_vmread(vcpu,noir_vt_cached_guest_rip);
+			u32 event;
+			noir_vt_vmread(vmentry_interruption_information_field,&event);
+			noir_end_exit_trace(vcpu->exit_trace,trace,rip,event,gpr_state);
+		}
+		// Write the modified fields back to VMCS before VM-Entry.
+		nvc_vt_flush_vmcs_cache(vcpu);
+		// Account the latency of this exit. Unknown exit reasons share the last slot.
+		if(vcpu->exit_histogram)
+			noir_record_exit_latency(vcpu->exit_histogram,exit_reason<vmx_maximum_exit_reason?exit_reason:vmx_maximum_exit_reason,noir_rdtsc()-exit_tsc);
 	}
 	else if(vmcs_phys==loader_stack->custom_vcpu->vmcs.phys)
 	{
@@ -1322,7 +1539,7 @@ void nvc_vt_reconfigure_npiep_interceptions(noir_vt_vcpu_p vcpu)
 {
 	ulong_ptr gcr4;
 	ia32_vmx_2ndproc_controls proc_ctrl2;
-	noir_vt_vmread(guest_cr4,&gcr4);
+	gcr4=noir_vt_cached_vmread(vcpu,noir_vt_cached_guest_cr4);
 	noir_vt_vmread(secondary_processor_based_vm_execution_controls,&proc_ctrl2.value);
 	// If the UMIP is to be enabled, disable descriptor-table exiting.
 	// If no NPIEP preventions are set, disable descriptor-table exiting.
@@ -1334,7 +1551,19 @@ void nvc_vt_reconfigure_npiep_interceptions(noir_vt_vcpu_p vcpu)
 	noir_vt_vmwrite(secondary_processor_based_vm_execution_controls,proc_ctrl2.value);
 }
 
+// MSHV Core locates the target vCPUs of TLB-flush and IPI hypercalls via this function.
+noir_mshv_vcpu_p nvc_vt_get_mshv_vcpu(u32 vp_index)
+{
+	return &hvm_p->virtual_cpu[vp_index].mshvcpu;
+}
+
 void nvc_vt_set_mshv_handler(bool option)
 {
 	nvcp_vt_cpuid_handler=option?nvc_vt_cpuid_hvp_handler:nvc_vt_cpuid_hvs_handler;
+}
+
+// This function must be called on the processor that the vCPU stands for, after the CPUID handler is set.
+void nvc_vt_build_cpuid_cache(noir_vt_vcpu_p vcpu)
+{
+	noir_build_cpuid_cache(&vcpu->cpuid_cache,nvcp_vt_cpuid_handler);
 }
\ No newline at end of file
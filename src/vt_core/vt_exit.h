@@ -350,6 +350,8 @@ void static fastcall nvc_vt_vmcall_handler(noir_gpr_state_p gpr_state,noir_vt_vc
 void static fastcall nvc_vt_vmclear_handler(noir_gpr_state_p gpr_state,noir_vt_vcpu_p vcpu);
 void static fastcall nvc_vt_vmptrld_handler(noir_gpr_state_p gpr_state,noir_vt_vcpu_p vcpu);
 void static fastcall nvc_vt_vmptrst_handler(noir_gpr_state_p gpr_state,noir_vt_vcpu_p vcpu);
+void static fastcall nvc_vt_vmread_handler(noir_gpr_state_p gpr_state,noir_vt_vcpu_p vcpu);
+void static fastcall nvc_vt_vmwrite_handler(noir_gpr_state_p gpr_state,noir_vt_vcpu_p vcpu);
 void static fastcall nvc_vt_vmxoff_handler(noir_gpr_state_p gpr_state,noir_vt_vcpu_p vcpu);
 void static fastcall nvc_vt_vmxon_handler(noir_gpr_state_p gpr_state,noir_vt_vcpu_p vcpu);
 void static fastcall nvc_vt_cr_access_handler(noir_gpr_state_p gpr_state,noir_vt_vcpu_p vcpu);
@@ -359,6 +361,7 @@ void static fastcall nvc_vt_invalid_guest_state(noir_gpr_state_p gpr_state,noir_
 void static fastcall nvc_vt_invalid_msr_loading(noir_gpr_state_p gpr_state,noir_vt_vcpu_p vcpu);
 void static fastcall nvc_vt_ept_violation_handler(noir_gpr_state_p gpr_state,noir_vt_vcpu_p vcpu);
 void static fastcall nvc_vt_ept_misconfig_handler(noir_gpr_state_p gpr_state,noir_vt_vcpu_p vcpu);
+void static fastcall nvc_vt_synthetic_interrupt_handler(noir_gpr_state_p gpr_state,noir_vt_vcpu_p vcpu);
 void static fastcall nvc_vt_xsetbv_handler(noir_gpr_state_p gpr_state,noir_vt_vcpu_p vcpu);
 
 noir_vt_exit_handler_routine vt_exit_handlers[vmx_maximum_exit_reason]=
@@ -370,7 +373,7 @@ noir_vt_exit_handler_routine vt_exit_handlers[vmx_maximum_exit_reason]=
 	nvc_vt_sipi_handler,			// Start-up IPI
 	nvc_vt_default_handler,			// I/O SMI
 	nvc_vt_default_handler,			// Other SMI
-	nvc_vt_default_handler,			// Interrupt Window
+	nvc_vt_synthetic_interrupt_handler,	// Interrupt Window
 	nvc_vt_default_handler,			// NMI Window
 	nvc_vt_task_switch_handler,		// Task Switch
 	nvc_vt_cpuid_handler,			// CPUID Instruction
@@ -386,9 +389,9 @@ noir_vt_exit_handler_routine vt_exit_handlers[vmx_maximum_exit_reason]=
 	nvc_vt_default_handler,			// VMLAUNCH Instruction
 	nvc_vt_vmptrld_handler,			// VMPTRLD Instruction
 	nvc_vt_vmptrst_handler,			// VMPTRST Instruction
-	nvc_vt_default_handler,			// VMREAD Instruction
+	nvc_vt_vmread_handler,			// VMREAD Instruction
 	nvc_vt_default_handler,			// VMRESUME Instruction
-	nvc_vt_default_handler,			// VMWRITE Instruction
+	nvc_vt_vmwrite_handler,			// VMWRITE Instruction
 	nvc_vt_vmxoff_handler,			// VMXOFF Instruction
 	nvc_vt_vmxon_handler,			// VMXON Instruction
 	nvc_vt_cr_access_handler,		// Control-Register Access
@@ -415,7 +418,7 @@ noir_vt_exit_handler_routine vt_exit_handlers[vmx_maximum_exit_reason]=
 	nvc_vt_ept_misconfig_handler,	// EPT Misconfiguration
 	nvc_vt_default_handler,			// INVEPT Instruction
 	nvc_vt_default_handler,			// RDTSCP Instruction
-	nvc_vt_default_handler,			// VMX-Preemption Timer Expiry
+	nvc_vt_synthetic_interrupt_handler,	// VMX-Preemption Timer Expiry
 	nvc_vt_default_handler,			// INVVPID Instruction
 	nvc_vt_default_handler,			// WBINVD/WBNOINVD Instruction
 	nvc_vt_xsetbv_handler,			// XSETBV Instruction
@@ -456,7 +459,38 @@ void inline noir_vt_set_single_stepping(ulong_ptr gflags)
 }
 
 
-void inline noir_vt_advance_rip()
+// Encodings of the VMCS fields in the cache, in the order of indices.
+const u32 vt_cached_field_encoding[noir_vt_cached_field_limit]=
+{
+	guest_rip,
+	guest_rsp,
+	guest_cr0,
+	guest_cr3,
+	guest_cr4,
+	vmexit_qualification,
+	vmexit_instruction_length
+};
+
+ulong_ptr inline noir_vt_cached_vmread(noir_vt_vcpu_p vcpu,u32 index)
+{
+	noir_vt_vmcs_cache_p cache=&vcpu->vmcs_cache;
+	if(!noir_bt(&cache->valid,index))
+	{
+		noir_vt_vmread(vt_cached_field_encoding[index],&cache->value[index]);
+		noir_bts(&cache->valid,index);
+	}
+	return cache->value[index];
+}
+
+void inline noir_vt_cached_vmwrite(noir_vt_vcpu_p vcpu,u32 index,ulong_ptr value)
+{
+	noir_vt_vmcs_cache_p cache=&vcpu->vmcs_cache;
+	cache->value[index]=value;
+	noir_bts(&cache->valid,index);
+	noir_bts(&cache->dirty,index);
+}
+
+void inline noir_vt_advance_rip(noir_vt_vcpu_p vcpu)
 {
 	ulong_ptr gip,gflags;
 	u32 len;
@@ -465,9 +499,9 @@ void inline noir_vt_advance_rip()
 	if(vst==0 && noir_bt(&gflags,ia32_rflags_tf))
 		noir_vt_set_single_stepping(gflags);
 	// Regular stuff...
-	noir_vt_vmread(guest_rip,&gip);
-	noir_vt_vmread(vmexit_instruction_length,&len);
-	noir_vt_vmwrite(guest_rip,gip+len);
+	gip=noir_vt_cached_vmread(vcpu,noir_vt_cached_guest_rip);
+	len=(u32)noir_vt_cached_vmread(vcpu,noir_vt_cached_instruction_length);
+	noir_vt_cached_vmwrite(vcpu,noir_vt_cached_guest_rip,gip+len);
 }
 
 void inline noir_vt_inject_event(u8 vector,u8 type,bool deliver,u32 length,u32 err_code)
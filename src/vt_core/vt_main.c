@@ -65,6 +65,18 @@ bool nvc_is_vmcs_shadowing_supported()
 	return false;
 }
 
+bool static nvc_is_preemption_timer_supported()
+{
+	ia32_vmx_basic_msr vt_basic;
+	ia32_vmx_pinbased_ctrl_msr pin_ctrl_msr;
+	vt_basic.value=noir_rdmsr(ia32_vmx_basic);
+	if(vt_basic.use_true_msr)
+		pin_ctrl_msr.value=noir_rdmsr(ia32_vmx_true_pinbased_ctrl);
+	else
+		pin_ctrl_msr.value=noir_rdmsr(ia32_vmx_pinbased_ctrl);
+	return pin_ctrl_msr.allowed1_settings.activate_vmx_preemption_timer;
+}
+
 bool nvc_is_ept_supported()
 {
 	ia32_vmx_ept_vpid_cap_msr ev_cap;
@@ -126,8 +138,10 @@ void static nvc_vt_cleanup(noir_hypervisor_p hvm)
 					noir_free_contd_memory(vcpu->msr_auto.virt);
 				if(vcpu->nested_vcpu.vmcs_t.virt)
 					noir_free_contd_memory(vcpu->nested_vcpu.vmcs_t.virt);
+				if(vcpu->nested_vcpu.vmcs_s.virt)
+					noir_free_contd_memory(vcpu->nested_vcpu.vmcs_s.virt);
 				if(vcpu->hv_stack)
-					noir_free_nonpg_memory(vcpu->hv_stack);
+					noir_free_contd_memory(vcpu->hv_stack);
 				nvc_ept_cleanup(vcpu->ept_manager);
 			}
 			noir_free_nonpg_memory(hvm->virtual_cpu);
@@ -137,6 +151,8 @@ void static nvc_vt_cleanup(noir_hypervisor_p hvm)
 			if(rhvm->msr_bitmap.virt)noir_free_contd_memory(rhvm->msr_bitmap.virt);
 			if(rhvm->io_bitmap_a.virt)noir_free_contd_memory(rhvm->io_bitmap_a.virt);
 			if(rhvm->io_bitmap_b.virt)noir_free_contd_memory(rhvm->io_bitmap_b.virt);
+			if(rhvm->vmread_bitmap.virt)noir_free_contd_memory(rhvm->vmread_bitmap.virt);
+			if(rhvm->vmwrite_bitmap.virt)noir_free_contd_memory(rhvm->vmwrite_bitmap.virt);
 		}
 	}
 }
@@ -636,11 +652,18 @@ u8 nvc_vt_subvert_processor_i(noir_vt_vcpu_p vcpu,void* reserved,ulong_ptr gsp,u
 
 void static nvc_vt_subvert_processor(noir_vt_vcpu_p vcpu)
 {
-	u8 vst=nvc_vt_enable(&vcpu->vmxon.phys);
+	u8 vst;
+	// Precompute the CPUID results so that CPUID exits won't execute the native cpuid instruction.
+	nvc_vt_build_cpuid_cache(vcpu);
+	nvc_mshv_capture_apic_id(&vcpu->mshvcpu);
+	vst=nvc_vt_enable(&vcpu->vmxon.phys);
 	if(vst==vmx_success)
 	{
 		vcpu->status=noir_virt_trans;
 		vst=noir_vt_vmclear(&vcpu->vmcs.phys);
+		// Shadow VMCS must be initialized by vmclear before its first use.
+		if(vst==vmx_success && vcpu->nested_vcpu.vmcs_s.virt)
+			vst=noir_vt_vmclear(&vcpu->nested_vcpu.vmcs_s.phys);
 		if(vst==vmx_success)
 		{
 			vst=noir_vt_vmptrld(&vcpu->vmcs.phys);
@@ -695,17 +718,83 @@ void static nvc_vt_subvert_processor_thunk(void* context,u32 processor_id)
 	*(u32*)vcpu[processor_id].vmxon.virt=(u32)vt_basic.revision_id;
 	*(u32*)vcpu[processor_id].vmcs.virt=(u32)vt_basic.revision_id;
 	*(u32*)vcpu[processor_id].nested_vcpu.vmcs_t.virt=(u32)vt_basic.revision_id;
+	// Bit 31 of Revision ID indicates a shadow VMCS.
+	if(vcpu[processor_id].nested_vcpu.vmcs_s.virt)
+		*(u32*)vcpu[processor_id].nested_vcpu.vmcs_s.virt=(u32)vt_basic.revision_id|0x80000000;
 	nv_dprintf("Processor %d entered subversion routine!\n",processor_id);
 	nvc_vt_subvert_processor(&vcpu[processor_id]);
 }
 
+// Prepare the structures of a vCPU. This function runs on the processor that the vCPU stands for.
+noir_status static nvc_vt_prepare_vcpu(noir_hypervisor_p hvm,u32 processor_id)
+{
+	noir_vt_vcpu_p vcpu=&hvm->virtual_cpu[processor_id];
+	// Place the structures on the node of the processor that accesses them on every exit.
+	const u32 node=noir_get_processor_node(processor_id);
+	if(hvm->exit_histograms)vcpu->exit_histogram=&hvm->exit_histograms[processor_id];
+	if(hvm->exit_traces)vcpu->exit_trace=&hvm->exit_traces[processor_id];
+	vcpu->vmcs.virt=noir_alloc_node_contd_memory(page_size,node,&hvm->numa_report);
+	if(vcpu->vmcs.virt)
+		vcpu->vmcs.phys=noir_get_physical_address(vcpu->vmcs.virt);
+	else
+		return noir_insufficient_resources;
+	vcpu->vmxon.virt=noir_alloc_node_contd_memory(page_size,node,&hvm->numa_report);
+	if(vcpu->vmxon.virt)
+		vcpu->vmxon.phys=noir_get_physical_address(vcpu->vmxon.virt);
+	else
+		return noir_insufficient_resources;
+	vcpu->msr_auto.virt=noir_alloc_node_contd_memory(page_size,node,&hvm->numa_report);
+	if(vcpu->msr_auto.virt)
+		vcpu->msr_auto.phys=noir_get_physical_address(vcpu->msr_auto.virt);
+	else
+		return noir_insufficient_resources;
+	vcpu->nested_vcpu.vmcs_t.virt=noir_alloc_node_contd_memory(page_size,node,&hvm->numa_report);
+	if(vcpu->nested_vcpu.vmcs_t.virt)
+		vcpu->nested_vcpu.vmcs_t.phys=noir_get_physical_address(vcpu->nested_vcpu.vmcs_t.virt);
+	else
+		return noir_insufficient_resources;
+	if(hvm_p->options.nested_virtualization && nvc_is_vmcs_shadowing_supported())
+	{
+		vcpu->nested_vcpu.vmcs_s.virt=noir_alloc_node_contd_memory(page_size,node,&hvm->numa_report);
+		if(vcpu->nested_vcpu.vmcs_s.virt)
+			vcpu->nested_vcpu.vmcs_s.phys=noir_get_physical_address(vcpu->nested_vcpu.vmcs_s.virt);
+		else
+			return noir_insufficient_resources;
+	}
+	vcpu->hv_stack=noir_alloc_node_contd_memory(nvc_stack_size,node,&hvm->numa_report);
+	if(vcpu->hv_stack==null)
+		return noir_insufficient_resources;
+	vcpu->ept_manager=(void*)nvc_ept_build_identity_map(node);
+	if(vcpu->ept_manager==null)
+		return noir_insufficient_resources;
+	if(hvm_p->options.stealth_msr_hook)
+	{
+		if(hvm_p->options.kva_shadow_presence)
+		{
+			nv_dprintf("KVA Shadow is present in the system!\n");
+			vcpu->enabled_feature|=noir_vt_kva_shadow_presence;
+		}
+		vcpu->enabled_feature|=noir_vt_syscall_hook;
+	}
+	vcpu->relative_hvm=(noir_vt_hvm_p)hvm->reserved;
+	vcpu->mshvcpu.root_vcpu=(void*)vcpu;
+	nvc_mshv_initialize_synic(&vcpu->mshvcpu);
+	return noir_success;
+}
+
+void static nvc_vt_prepare_vcpu_thunk(void* context,u32 processor_id)
+{
+	noir_vcpu_setup_context_p setup=(noir_vcpu_setup_context_p)context;
+	noir_status st=nvc_vt_prepare_vcpu(setup->hvm,processor_id);
+	if(st!=noir_success)nvc_record_vcpu_setup_failure(setup,processor_id,st);
+}
+
 /*
-  In NoirVisor, allocations of VMXON region and VMCS, etc. are performed in Single CPU.
-  It is not Multi-CPU designed in two reasons:
-  Performance consumption is not so significant.
-  In Windows, this routine is expected to be executed in Passive IRQL. However, in the per-CPU
-  routine, it is executed in DPC-Level (KeInsertQueueDpc) or IPI-Level (KeIpiGenericCall), where
-  memory allocations are significantly restricted (DPC-Level) or even prohibited (IPI-Level).
+  In NoirVisor, allocations of VMXON region and VMCS, etc. are performed by each processor in parallel.
+  They are not performed in the generic call because the per-CPU routine is executed in DPC-Level
+  (KeInsertQueueDpc) or IPI-Level (KeIpiGenericCall), where memory allocations are significantly
+  restricted (DPC-Level) or even prohibited (IPI-Level). Instead, a passive-level thread is pinned
+  to each processor. Structures of all vCPUs are released if any of the processors fails.
 */
 noir_status nvc_vt_subvert_system(noir_hypervisor_p hvm)
 {
@@ -714,53 +803,32 @@ noir_status nvc_vt_subvert_system(noir_hypervisor_p hvm)
 	hvm->virtual_cpu=noir_alloc_nonpg_memory(hvm->cpu_count*sizeof(noir_vt_vcpu));
 	if(hvm->virtual_cpu)
 	{
-		for(u32 i=0;i<hvm->cpu_count;i++)
+		noir_vcpu_setup_context setup;
+		nvc_initialize_vcpu_setup_context(&setup,hvm);
+		if(!nvc_ept_build_identity_template())nv_dprintf("Failed to build the template of identity map! EPTs will be built individually.\n");
+		noir_generic_passive_call(nvc_vt_prepare_vcpu_thunk,&setup);
+		nvc_ept_release_identity_template();
+		if(setup.failures)
 		{
-			noir_vt_vcpu_p vcpu=&hvm->virtual_cpu[i];
-			vcpu->vmcs.virt=noir_alloc_contd_memory(page_size);
-			if(vcpu->vmcs.virt)
-				vcpu->vmcs.phys=noir_get_physical_address(vcpu->vmcs.virt);
-			else
-				goto alloc_failure;
-			vcpu->vmxon.virt=noir_alloc_contd_memory(page_size);
-			if(vcpu->vmxon.virt)
-				vcpu->vmxon.phys=noir_get_physical_address(vcpu->vmxon.virt);
-			else
-				goto alloc_failure;
-			vcpu->msr_auto.virt=noir_alloc_contd_memory(page_size);
-			if(vcpu->msr_auto.virt)
-				vcpu->msr_auto.phys=noir_get_physical_address(vcpu->msr_auto.virt);
-			else
-				goto alloc_failure;
-			vcpu->nested_vcpu.vmcs_t.virt=noir_alloc_contd_memory(page_size);
-			if(vcpu->nested_vcpu.vmcs_t.virt)
-				vcpu->nested_vcpu.vmcs_t.phys=noir_get_physical_address(vcpu->nested_vcpu.vmcs_t.virt);
-			else
-				goto alloc_failure;
-			vcpu->hv_stack=noir_alloc_nonpg_memory(nvc_stack_size);
-			if(vcpu->hv_stack==null)
-				goto alloc_failure;
-			vcpu->ept_manager=(void*)nvc_ept_build_identity_map();
-			if(vcpu->ept_manager==null)
-				goto alloc_failure;
-			if(hvm_p->options.stealth_msr_hook)
-			{
-				if(hvm_p->options.kva_shadow_presence)
-				{
-					nv_dprintf("KVA Shadow is present in the system!\n");
-					vcpu->enabled_feature|=noir_vt_kva_shadow_presence;
-				}
-				vcpu->enabled_feature|=noir_vt_syscall_hook;
-			}
-			vcpu->relative_hvm=(noir_vt_hvm_p)hvm->reserved;
-			vcpu->mshvcpu.root_vcpu=(void*)vcpu;
+			nv_dprintf("Failed to prepare %u vCPU(s)! Processor %u failed first with status 0x%X.\n",setup.failures,setup.failed_processor,setup.status);
+			goto alloc_failure;
 		}
 	}
+	nv_dprintf("NUMA Placement: %u node-requested, %u fallback, %u failed allocations.\n",hvm->numa_report.requested,hvm->numa_report.fallback,hvm->numa_report.failed);
 	hvm->relative_hvm->msr_bitmap.virt=noir_alloc_contd_memory(page_size);
 	if(hvm->relative_hvm->msr_bitmap.virt)
 		hvm->relative_hvm->msr_bitmap.phys=noir_get_physical_address(hvm->relative_hvm->msr_bitmap.virt);
 	else
 		goto alloc_failure;
+	if(hvm_p->options.nested_virtualization && nvc_is_vmcs_shadowing_supported())
+	{
+		hvm->relative_hvm->vmread_bitmap.virt=noir_alloc_contd_memory(page_size);
+		hvm->relative_hvm->vmwrite_bitmap.virt=noir_alloc_contd_memory(page_size);
+		if(hvm->relative_hvm->vmread_bitmap.virt==null || hvm->relative_hvm->vmwrite_bitmap.virt==null)goto alloc_failure;
+		hvm->relative_hvm->vmread_bitmap.phys=noir_get_physical_address(hvm->relative_hvm->vmread_bitmap.virt);
+		hvm->relative_hvm->vmwrite_bitmap.phys=noir_get_physical_address(hvm->relative_hvm->vmwrite_bitmap.virt);
+		nvc_vt_build_vmcs_shadowing_bitmaps(hvm->relative_hvm);
+	}
 	// At this time, we don't need to virtualize I/O instructions. So leave them blank.
 	/*hvm->relative_hvm->io_bitmap_a.virt=noir_alloc_contd_memory(page_size);
 	hvm->relative_hvm->io_bitmap_b.virt=noir_alloc_contd_memory(page_size);
@@ -774,6 +842,20 @@ noir_status nvc_vt_subvert_system(noir_hypervisor_p hvm)
 	nvc_vt_set_mshv_handler(hvm_p->options.cpuid_hv_presence);
 	hvm->relative_hvm->hvm_cpuid_leaf_max=nvc_mshv_build_cpuid_handlers();
 	if(hvm->relative_hvm->hvm_cpuid_leaf_max==0)goto alloc_failure;
+	if(hvm_p->options.cpuid_hv_presence)
+	{
+		nvc_mshv_calibrate_reference_time();
+		nvc_mshv_initialize_apic_access();
+		nvc_mshv_initialize_vcpu_kicker();
+		// Synthetic timers rely on the VMX-Preemption Timer to exit at their deadlines.
+		noir_mshv_stimer_wakeup=nvc_is_preemption_timer_supported();
+		if(noir_mshv_stimer_wakeup)
+		{
+			ia32_vmx_misc_msr misc_msr;
+			misc_msr.value=noir_rdmsr(ia32_vmx_misc);
+			hvm->relative_hvm->preemption_timer_rate=(u32)misc_msr.tsc_preemption_scale;
+		}
+	}
 	if(hvm->virtual_cpu==null)goto alloc_failure;
 	nvc_vt_setup_msr_hook(hvm);
 	for(u32 i=0;i<hvm->cpu_count;i++)
@@ -814,5 +896,7 @@ void nvc_vt_restore_system(noir_hypervisor_p hvm)
 		noir_generic_call(nvc_vt_restore_processor_thunk,hvm->virtual_cpu);
 		nvc_vt_cleanup(hvm);
 		nvc_mshv_teardown_cpuid_handlers();
+		nvc_mshv_finalize_apic_access();
+		nvc_mshv_finalize_vcpu_kicker();
 	}
 }
\ No newline at end of file
@@ -50,6 +50,7 @@ void nvc_vt_build_nested_vmx_msr(noir_vt_vcpu_p vcpu)
 	// Process the Secondary Processor-Based VM-Execution Control MSR.
 	secproc_msr.value=noir_rdmsr(ia32_vmx_2ndproc_ctrl);
 	secproc_msr.allowed1_settings.enable_ept=0;	// We cannot emulate Intel EPT.
+	secproc_msr.allowed1_settings.vmcs_shadowing=0;	// Shadow VMCS of L1 hypervisor is not emulated.
 	vmsr->vmx_msr[ia32_vmx_2ndproc_ctrl-ia32_vmx_basic]=secproc_msr.value;
 	// Process the VM-Exit Control MSR
 	exit_msr.value=noir_rdmsr(ia32_vmx_exit_ctrl);
@@ -148,7 +149,7 @@ void noir_vt_vmfail_valid()
 	noir_vt_vmwrite(guest_rflags,gflags);
 }
 
-bool noir_vt_nested_vmread(void* vmcs,u32 encoding,ulong_ptr* data)
+bool static nvc_vt_software_vmread(void* vmcs,u32 encoding,ulong_ptr* data)
 {
 	ia32_vmx_vmcs_encoding translator;
 	u8 w,t;
@@ -193,16 +194,13 @@ bool noir_vt_nested_vmread(void* vmcs,u32 encoding,ulong_ptr* data)
 				break;
 			}
 		}
-		noir_vt_vmsuccess();
 		return true;
 	}
 invalid_field:
-	noir_vt_vmfail_valid();
-	noir_vt_nested_vmwrite(vmcs,vm_instruction_error,vmrw_unsupported_field);
 	return false;
 }
 
-bool noir_vt_nested_vmwrite(void* vmcs,u32 encoding,ulong_ptr data)
+bool static nvc_vt_software_vmwrite(void* vmcs,u32 encoding,ulong_ptr data)
 {
 	ia32_vmx_vmcs_encoding translator;
 	u8 w,t;
@@ -247,13 +245,33 @@ bool noir_vt_nested_vmwrite(void* vmcs,u32 encoding,ulong_ptr data)
 				break;
 			}
 		}
-		noir_vt_vmsuccess();
 		return true;
 	}
 invalid_field:
+	return false;
+}
+
+bool noir_vt_nested_vmread(void* vmcs,u32 encoding,ulong_ptr* data)
+{
+	if(nvc_vt_software_vmread(vmcs,encoding,data))
+	{
+		noir_vt_vmsuccess();
+		return true;
+	}
+	noir_vt_vmfail_valid();
+	nvc_vt_software_vmwrite(vmcs,vm_instruction_error,vmrw_unsupported_field);
+	return false;
+}
+
+bool noir_vt_nested_vmwrite(void* vmcs,u32 encoding,ulong_ptr data)
+{
+	if(nvc_vt_software_vmwrite(vmcs,encoding,data))
+	{
+		noir_vt_vmsuccess();
+		return true;
+	}
 	noir_vt_vmfail_valid();
-	// This won't cause a dead recursive call.
-	noir_vt_nested_vmwrite(vmcs,vm_instruction_error,vmrw_unsupported_field);
+	nvc_vt_software_vmwrite(vmcs,vm_instruction_error,vmrw_unsupported_field);
 	return false;
 }
 
@@ -263,9 +281,202 @@ void noir_vt_vmfail(noir_vt_nested_vcpu_p nested_vcpu,u32 message)
 	{
 		noir_vt_nested_vmcs_header_p header=(noir_vt_nested_vmcs_header_p)nested_vcpu->vmcs_c.virt;
 		unref_var(header);
-		noir_vt_nested_vmwrite(nested_vcpu->vmcs_c.virt,vm_instruction_error,message);
+		nvc_vt_software_vmwrite(nested_vcpu->vmcs_c.virt,vm_instruction_error,message);
 		noir_vt_vmfail_valid();
 		return;
 	}
 	noir_vt_vmfail_invalid();
-}
\ No newline at end of file
+}
+
+/*
+  VMCS Shadowing:
+
+  Fields listed below are frequently accessed by L1 hypervisors.
+  While the shadow VMCS is linked, accesses to these fields are
+  served by the processor without VM-Exits. Accesses to the rest
+  of fields are intercepted and served by the software VMCS.
+
+  The contents of software VMCS are copied to the shadow VMCS upon
+  vmptrld, and are copied back when the VMCS is no longer current.
+  64-bit fields are not shadowed because accesses to their high
+  32 bits would be served by the stale software VMCS.
+*/
+const u32 static noir_vt_shadowed_rw_fields[]=
+{
+	// Guest-State Fields
+	guest_es_selector,
+	guest_cs_selector,
+	guest_ss_selector,
+	guest_ds_selector,
+	guest_fs_selector,
+	guest_gs_selector,
+	guest_ldtr_selector,
+	guest_tr_selector,
+	guest_es_limit,
+	guest_cs_limit,
+	guest_ss_limit,
+	guest_ds_limit,
+	guest_fs_limit,
+	guest_gs_limit,
+	guest_ldtr_limit,
+	guest_tr_limit,
+	guest_gdtr_limit,
+	guest_idtr_limit,
+	guest_es_access_rights,
+	guest_cs_access_rights,
+	guest_ss_access_rights,
+	guest_ds_access_rights,
+	guest_fs_access_rights,
+	guest_gs_access_rights,
+	guest_ldtr_access_rights,
+	guest_tr_access_rights,
+	guest_interruptibility_state,
+	guest_activity_state,
+	guest_cr0,
+	guest_cr3,
+	guest_cr4,
+	guest_es_base,
+	guest_cs_base,
+	guest_ss_base,
+	guest_ds_base,
+	guest_fs_base,
+	guest_gs_base,
+	guest_ldtr_base,
+	guest_tr_base,
+	guest_gdtr_base,
+	guest_idtr_base,
+	guest_dr7,
+	guest_rsp,
+	guest_rip,
+	guest_rflags,
+	guest_pending_debug_exceptions,
+	// Control Fields
+	vmentry_interruption_information_field,
+	vmentry_exception_error_code,
+	vmentry_instruction_length,
+	tpr_threshold,
+	cr0_read_shadow,
+	cr4_read_shadow
+};
+
+// Read-only fields can only be shadowed for reads.
+// VM-Instruction Error is excluded because it is updated by vmfail.
+const u32 static noir_vt_shadowed_ro_fields[]=
+{
+	vmexit_reason,
+	vmexit_interruption_information,
+	vmexit_interruption_error_code,
+	idt_vectoring_information,
+	idt_vectoring_error_code,
+	vmexit_instruction_length,
+	vmexit_instruction_information,
+	vmexit_qualification,
+	guest_linear_address
+};
+
+void static nvc_vt_clear_vmcs_bitmap(u8* bitmap,u32 encoding)
+{
+	// Bits 0-14 of the encoding select the bit in the bitmap.
+	encoding&=0x7fff;
+	bitmap[encoding>>3]&=~(1<<(encoding&7));
+}
+
+// Build the VMREAD/VMWRITE bitmaps shared by all processors.
+void nvc_vt_build_vmcs_shadowing_bitmaps(noir_vt_hvm_p relative_hvm)
+{
+	u8* read_bitmap=(u8*)relative_hvm->vmread_bitmap.virt;
+	u8* write_bitmap=(u8*)relative_hvm->vmwrite_bitmap.virt;
+	ia32_vmx_misc_msr misc_msr;
+	misc_msr.value=noir_rdmsr(ia32_vmx_misc);
+	// Intercept all fields at default.
+	noir_stosb(read_bitmap,0xff,page_size);
+	noir_stosb(write_bitmap,0xff,page_size);
+	for(u32 i=0;i<sizeof(noir_vt_shadowed_rw_fields)/sizeof(u32);i++)
+	{
+		nvc_vt_clear_vmcs_bitmap(read_bitmap,noir_vt_shadowed_rw_fields[i]);
+		nvc_vt_clear_vmcs_bitmap(write_bitmap,noir_vt_shadowed_rw_fields[i]);
+	}
+	// Read-only fields can be filled into the shadow VMCS only if vmwrite is allowed to any field.
+	relative_hvm->shadow_ro_fields=(bool)misc_msr.allow_any_writing_to_vmcs;
+	if(relative_hvm->shadow_ro_fields)
+		for(u32 i=0;i<sizeof(noir_vt_shadowed_ro_fields)/sizeof(u32);i++)
+			nvc_vt_clear_vmcs_bitmap(read_bitmap,noir_vt_shadowed_ro_fields[i]);
+}
+
+// This procedure is to be called when a nested VMCS becomes current.
+void nvc_vt_load_shadow_vmcs(noir_vt_vcpu_p vcpu)
+{
+	noir_vt_nested_vcpu_p nested_vcpu=&vcpu->nested_vcpu;
+	if((vcpu->enabled_feature & noir_vt_vmcs_shadowing) && nested_vcpu->vmcs_s.virt)
+	{
+		ia32_vmx_2ndproc_controls proc_ctrl2;
+		// Link the shadow VMCS and enable VMCS shadowing.
+		noir_vt_vmwrite64(vmcs_link_pointer,nested_vcpu->vmcs_s.phys);
+		noir_vt_vmwrite64(vmread_bitmap_address,vcpu->relative_hvm->vmread_bitmap.phys);
+		noir_vt_vmwrite64(vmwrite_bitmap_address,vcpu->relative_hvm->vmwrite_bitmap.phys);
+		noir_vt_vmread(secondary_processor_based_vm_execution_controls,&proc_ctrl2.value);
+		proc_ctrl2.vmcs_shadowing=1;
+		noir_vt_vmwrite(secondary_processor_based_vm_execution_controls,proc_ctrl2.value);
+		// Make the shadow VMCS current in order to fill its fields.
+		noir_vt_vmptrld(&nested_vcpu->vmcs_s.phys);
+		for(u32 i=0;i<sizeof(noir_vt_shadowed_rw_fields)/sizeof(u32);i++)
+		{
+			ulong_ptr value=0;
+			nvc_vt_software_vmread(nested_vcpu->vmcs_c.virt,noir_vt_shadowed_rw_fields[i],&value);
+			noir_vt_vmwrite(noir_vt_shadowed_rw_fields[i],value);
+		}
+		if(vcpu->relative_hvm->shadow_ro_fields)
+		{
+			for(u32 i=0;i<sizeof(noir_vt_shadowed_ro_fields)/sizeof(u32);i++)
+			{
+				ulong_ptr value=0;
+				nvc_vt_software_vmread(nested_vcpu->vmcs_c.virt,noir_vt_shadowed_ro_fields[i],&value);
+				noir_vt_vmwrite(noir_vt_shadowed_ro_fields[i],value);
+			}
+		}
+		// Switch back to the VMCS of this processor.
+		noir_vt_vmptrld(&vcpu->vmcs.phys);
+		noir_bts(&nested_vcpu->status,noir_nvt_shadowed);
+	}
+}
+
+// This procedure is to be called when the L1 hypervisor writes a field via intercepted vmwrite.
+// If the field is read from the shadow VMCS without VM-Exit, the shadow VMCS must be updated as well.
+void nvc_vt_update_shadow_vmcs_field(noir_vt_vcpu_p vcpu,u32 encoding,ulong_ptr value)
+{
+	noir_vt_nested_vcpu_p nested_vcpu=&vcpu->nested_vcpu;
+	if(noir_bt(&nested_vcpu->status,noir_nvt_shadowed) && encoding<0x8000)
+	{
+		u8* read_bitmap=(u8*)vcpu->relative_hvm->vmread_bitmap.virt;
+		if(!(read_bitmap[encoding>>3] & (1<<(encoding&7))))
+		{
+			noir_vt_vmptrld(&nested_vcpu->vmcs_s.phys);
+			noir_vt_vmwrite(encoding,value);
+			noir_vt_vmptrld(&vcpu->vmcs.phys);
+		}
+	}
+}
+
+// This procedure is to be called when the nested VMCS is no longer current.
+void nvc_vt_unload_shadow_vmcs(noir_vt_vcpu_p vcpu)
+{
+	noir_vt_nested_vcpu_p nested_vcpu=&vcpu->nested_vcpu;
+	if(noir_btr(&nested_vcpu->status,noir_nvt_shadowed))
+	{
+		ia32_vmx_2ndproc_controls proc_ctrl2;
+		// Unlink the shadow VMCS and disable VMCS shadowing.
+		noir_vt_vmwrite64(vmcs_link_pointer,maxu64);
+		noir_vt_vmread(secondary_processor_based_vm_execution_controls,&proc_ctrl2.value);
+		proc_ctrl2.vmcs_shadowing=0;
+		noir_vt_vmwrite(secondary_processor_based_vm_execution_controls,proc_ctrl2.value);
+		// Write the fields modified by L1 hypervisor back to the software VMCS.
+		noir_vt_vmptrld(&nested_vcpu->vmcs_s.phys);
+		for(u32 i=0;i<sizeof(noir_vt_shadowed_rw_fields)/sizeof(u32);i++)
+		{
+			ulong_ptr value=0;
+			noir_vt_vmread(noir_vt_shadowed_rw_fields[i],&value);
+			nvc_vt_software_vmwrite(nested_vcpu->vmcs_c.virt,noir_vt_shadowed_rw_fields[i],value);
+		}
+		noir_vt_vmptrld(&vcpu->vmcs.phys);
+	}
+}
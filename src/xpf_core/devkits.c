@@ -117,4 +117,417 @@ u32 noir_find_set_bit(void* bitmap,u32 limit)
 		}
 	}
 	return result;
+}
+
+// Classify the caching method of the CPUID leaf.
+u8 static noir_classify_cpuid_leaf(u32 leaf)
+{
+	switch(leaf)
+	{
+		// Deterministic Cache Parameters, Structured Extended Features, Extended Topology and Cache Topology.
+		case 0x4:
+		case 0x7:
+		case 0xB:
+		case 0x1F:
+		case 0x8000001D:
+			return noir_cpuid_cache_indexed;
+		// Extended State Enumeration depends on the XCR0 and IA32_XSS of the guest.
+		// Other leaves enumerated by subleaves are rarely queried. Don't bother caching them.
+		case 0xD:
+		case 0xF:
+		case 0x10:
+		case 0x12:
+		case 0x14:
+		case 0x17:
+		case 0x18:
+		case 0x1A:
+		case 0x1B:
+		case 0x1D:
+		case 0x1E:
+		case 0x20:
+		case 0x80000020:
+		case 0x80000026:
+			return noir_cpuid_cache_native;
+	}
+	return noir_cpuid_cache_plain;
+}
+
+// Check if the subleaf is the last one that the leaf enumerates.
+bool static noir_is_last_cpuid_subleaf(u32 leaf,u32 subleaf,noir_cpuid_general_info_p first,noir_cpuid_general_info_p info)
+{
+	switch(leaf)
+	{
+		case 0x4:
+		case 0x8000001D:
+			return (info->eax&0x1f)==0;		// Null cache type.
+		case 0x7:
+			return subleaf>=first->eax;		// Maximum subleaf is reported in subleaf 0.
+		case 0xB:
+		case 0x1F:
+			return (info->ecx&0xff00)==0;	// Invalid level type.
+	}
+	return true;
+}
+
+void static noir_build_cpuid_cache_class(noir_cpuid_cache_p cache,u32 class_index,u32 base,noir_cpuid_handler handler)
+{
+	noir_cpuid_general_info info;
+	u32 leaves;
+	handler(base,0,&info);
+	leaves=info.eax-base+1;
+	// The maximum leaf might be garbage if the class is not supported.
+	if(info.eax<base)leaves=0;
+	if(leaves>noir_cpuid_cache_leaf_limit)leaves=noir_cpuid_cache_leaf_limit;
+	for(u32 i=0;i<leaves;i++)
+	{
+		noir_cpuid_cache_leaf_p leaf=&cache->leaf[class_index][i];
+		leaf->type=noir_classify_cpuid_leaf(base+i);
+		if(leaf->type==noir_cpuid_cache_plain)
+			handler(base+i,0,&cache->info[class_index][i]);
+		else if(leaf->type==noir_cpuid_cache_indexed)
+		{
+			noir_cpuid_general_info_p first=&cache->subleaf[cache->subleaves];
+			leaf->first=(u8)cache->subleaves;
+			// The terminating subleaf is cached as well, in that enumeration loops will query it.
+			for(u32 j=0;;j++)
+			{
+				noir_cpuid_general_info_p cur=&cache->subleaf[cache->subleaves];
+				// Run out of the subleaf table. Leave the leaf uncached.
+				if(cache->subleaves>=noir_cpuid_cache_subleaf_limit)
+				{
+					leaf->type=noir_cpuid_cache_native;
+					cache->subleaves=leaf->first;
+					break;
+				}
+				handler(base+i,j,cur);
+				cache->subleaves++;
+				if(noir_is_last_cpuid_subleaf(base+i,j,first,cur))break;
+			}
+			leaf->count=(u8)(cache->subleaves-leaf->first);
+		}
+	}
+	cache->leaves[class_index]=leaves;
+}
+
+// Build the CPUID cache with the CPUID handler of the hypervisor.
+// Results are processor-specific (e.g: APIC ID), so the cache must be built on the processor that it serves.
+void noir_build_cpuid_cache(noir_cpuid_cache_p cache,noir_cpuid_handler handler)
+{
+	noir_stosb((void*)cache,0,sizeof(noir_cpuid_cache));
+	noir_build_cpuid_cache_class(cache,0,0,handler);
+	noir_build_cpuid_cache_class(cache,1,0x80000000,handler);
+}
+
+// Query the CPUID cache. Return false if the result is not cached.
+// Bits that reflect the CR4 of the guest are patched on query, so the CR4 of the guest must be specified.
+bool noir_query_cpuid_cache(noir_cpuid_cache_p cache,u32 leaf,u32 subleaf,ulong_ptr cr4,noir_cpuid_general_info_p info)
+{
+	u32 leaf_class=noir_cpuid_class(leaf);
+	u32 leaf_func=noir_cpuid_index(leaf);
+	u32 class_index;
+	noir_cpuid_cache_leaf_p entry;
+	if(leaf_class==std_leaf_index)
+		class_index=0;
+	else if(leaf_class==ext_leaf_index)
+		class_index=1;
+	else
+		return false;
+	if(leaf_func>=cache->leaves[class_index])return false;
+	entry=&cache->leaf[class_index][leaf_func];
+	if(entry->type==noir_cpuid_cache_plain)
+		*info=cache->info[class_index][leaf_func];
+	else if(entry->type==noir_cpuid_cache_indexed && subleaf<entry->count)
+		*info=cache->subleaf[entry->first+subleaf];
+	else
+		return false;
+	// OSXSAVE (Bit 27 of ECX in leaf 1) reflects CR4.OSXSAVE (Bit 18).
+	if(leaf==1)
+	{
+		if(noir_bt((u32*)&cr4,18))
+			noir_bts(&info->ecx,27);
+		else
+			noir_btr(&info->ecx,27);
+	}
+	// OSPKE (Bit 4 of ECX in leaf 7 subleaf 0) reflects CR4.PKE (Bit 22).
+	else if(leaf==7 && subleaf==0)
+	{
+		if(noir_bt((u32*)&cr4,22))
+			noir_bts(&info->ecx,4);
+		else
+			noir_btr(&info->ecx,4);
+	}
+	return true;
+}
+
+// Record the latency of an exit. This function must be called on the processor that the histogram serves.
+void noir_record_exit_latency(noir_exit_histogram_p histogram,u32 slot,u64 ticks)
+{
+	noir_exit_histogram_slot_p entry;
+	u32 bucket=0;
+	if(unlikely(histogram->reset_pending))
+	{
+		noir_stosb((void*)histogram->slot,0,sizeof(histogram->slot));
+		noir_locked_btr((long*)&histogram->reset_pending,0);
+	}
+	if(slot>=noir_exit_histogram_slots)return;
+	entry=&histogram->slot[slot];
+#if defined(_amd64)
+	if(ticks>1)noir_bsr64(&bucket,ticks);
+#else
+	// 64-bit bit scan is unavailable. Scan the high half at first.
+	if(ticks>>32)
+	{
+		noir_bsr(&bucket,(u32)(ticks>>32));
+		bucket+=32;
+	}
+	else if(ticks>1)
+		noir_bsr(&bucket,(u32)ticks);
+#endif
+	// Exits taking 2^32 ticks or longer (e.g: host preemption) are counted in the last bucket.
+	if(bucket>=noir_exit_histogram_buckets)bucket=noir_exit_histogram_buckets-1;
+	entry->count++;
+	entry->total+=ticks;
+	if(ticks>entry->maximum)entry->maximum=ticks;
+	entry->bucket[bucket]++;
+}
+
+// Request a reset of the histogram. It can be called on any processor.
+void noir_reset_exit_histogram(noir_exit_histogram_p histogram)
+{
+	noir_locked_bts((long*)&histogram->reset_pending,0);
+}
+
+// Accumulate the source histogram into the target histogram.
+// A source histogram pending for reset is considered empty.
+void noir_merge_exit_histogram(noir_exit_histogram_p target,noir_exit_histogram_p source)
+{
+	if(source->reset_pending)return;
+	for(u32 i=0;i<noir_exit_histogram_slots;i++)
+	{
+		noir_exit_histogram_slot_p dst=&target->slot[i];
+		noir_exit_histogram_slot_p src=&source->slot[i];
+		if(src->count==0)continue;
+		dst->count+=src->count;
+		dst->total+=src->total;
+		if(src->maximum>dst->maximum)dst->maximum=src->maximum;
+		for(u32 j=0;j<noir_exit_histogram_buckets;j++)
+			dst->bucket[j]+=src->bucket[j];
+	}
+}
+
+// Start capturing an exit. This function must be called on the processor that the ring serves.
+noir_exit_trace_record_p noir_begin_exit_trace(noir_exit_trace_ring_p ring,i64 exit_code,u64 exit_info1,u64 exit_info2,u64 rip,noir_gpr_state_p gpr_state)
+{
+	noir_exit_trace_record_p record=&ring->records[ring->head&(noir_exit_trace_ring_size-1)];
+	// Invalidate the record so that readers would not take a partially written record.
+	noir_locked_xchg64((i64*)&record->sequence,0);
+	record->timestamp=noir_rdtsc();
+	record->exit_code=exit_code;
+	record->exit_info[0]=exit_info1;
+	record->exit_info[1]=exit_info2;
+	record->rip[0]=rip;
+	record->gpr[0]=*gpr_state;
+	return record;
+}
+
+// Complete capturing an exit with the decisions made by the handler.
+void noir_end_exit_trace(noir_exit_trace_ring_p ring,noir_exit_trace_record_p record,u64 rip,u64 event,noir_gpr_state_p gpr_state)
+{
+	record->rip[1]=rip;
+	record->event=event;
+	record->gpr[1]=*gpr_state;
+	// Publish the record.
+	noir_locked_xchg64((i64*)&record->sequence,++ring->head);
+}
+
+u32 static stdcall noir_passive_call_worker(void* context)
+{
+	noir_passive_call_thread_p pct=(noir_passive_call_thread_p)context;
+	// Run the worker on the designated processor.
+	noir_thread_affinity prev_affinity;
+	noir_set_thread_affinity(pct->processor_id,&prev_affinity);
+	pct->worker(pct->context,pct->processor_id);
+	noir_revert_thread_affinity(&prev_affinity);
+	noir_exit_thread(0);
+	return 0;
+}
+
+// Run the worker on all processors in parallel and wait until all of them return.
+// Unlike the generic call, workers run at passive level. They may allocate memory and wait.
+void noir_generic_passive_call(noir_broadcast_worker worker,void* context)
+{
+	const u32 num=noir_get_processor_count();
+	noir_passive_call_thread_p threads=noir_alloc_nonpg_memory(num*sizeof(noir_passive_call_thread));
+	if(threads)
+	{
+		for(u32 i=0;i<num;i++)
+		{
+			threads[i].worker=worker;
+			threads[i].context=context;
+			threads[i].processor_id=i;
+			threads[i].thread=noir_create_thread(noir_passive_call_worker,&threads[i]);
+		}
+	}
+	for(u32 i=0;i<num;i++)
+	{
+		if(threads && threads[i].thread)
+			noir_join_thread(threads[i].thread);
+		else
+		{
+			// The thread is not created. Run the worker on this thread instead.
+			noir_thread_affinity prev_affinity;
+			noir_set_thread_affinity(i,&prev_affinity);
+			worker(context,i);
+			noir_revert_thread_affinity(&prev_affinity);
+		}
+	}
+	if(threads)noir_free_nonpg_memory(threads);
+}
+
+// Allocate contiguous memory from the preferred node. Fall back to any node if the system refuses the node.
+void* noir_alloc_node_contd_memory(size_t length,u32 node,noir_numa_alloc_report_p report)
+{
+	void* p;
+	if(node!=noir_numa_any_node)
+	{
+		p=noir_alloc_contd_memory_on_node(length,node);
+		if(p)
+		{
+			if(report)noir_locked_inc((long*)&report->requested);
+			return p;
+		}
+	}
+	p=noir_alloc_contd_memory(length);
+	if(report && node!=noir_numa_any_node)
+	{
+		if(p)
+			noir_locked_inc((long*)&report->fallback);
+		else
+			noir_locked_inc((long*)&report->failed);
+	}
+	return p;
+}
+
+// Allocate a 2MB page from the preferred node. Fall back to any node if the system refuses the node.
+void* noir_alloc_node_2mb_page(u32 node,noir_numa_alloc_report_p report)
+{
+	void* p;
+	if(node!=noir_numa_any_node)
+	{
+		p=noir_alloc_2mb_page_on_node(node);
+		if(p)
+		{
+			if(report)noir_locked_inc((long*)&report->requested);
+			return p;
+		}
+	}
+	p=noir_alloc_2mb_page();
+	if(report && node!=noir_numa_any_node)
+	{
+		if(p)
+			noir_locked_inc((long*)&report->fallback);
+		else
+			noir_locked_inc((long*)&report->failed);
+	}
+	return p;
+}
+
+// Initialize the pool before it is used. Use noir_numa_any_node if the pool has no preference of node.
+void noir_initialize_page_pool(noir_page_pool_p pool,u32 node,noir_numa_alloc_report_p report)
+{
+	pool->node=node;
+	pool->report=report;
+}
+
+// Refill the pool until the specified number of pages are free.
+// This function calls the memory allocator of the host system. Do not call it in the host context.
+bool noir_reserve_pool_pages(noir_page_pool_p pool,u32 count)
+{
+	while(pool->free_pages<count)
+	{
+		noir_page_pool_chunk_p chunk=noir_alloc_nonpg_memory(sizeof(noir_page_pool_chunk));
+		if(chunk==null)return false;
+		// Try smaller chunks if contiguous memory is fragmented.
+		for(chunk->pages=noir_page_pool_chunk_pages;chunk->pages;chunk->pages>>=1)
+		{
+			chunk->virt=noir_alloc_node_contd_memory(page_mult(chunk->pages),pool->node,pool->report);
+			if(chunk->virt)break;
+		}
+		if(chunk->virt==null)
+		{
+			noir_free_nonpg_memory(chunk);
+			return false;
+		}
+		chunk->phys=noir_get_physical_address(chunk->virt);
+		chunk->next=pool->chunks;
+		pool->chunks=chunk;
+		pool->total_pages+=chunk->pages;
+		// Contiguous memory is zeroed by the allocator. Push the pages in reverse order so that they are handed out in ascending order.
+		for(u32 i=chunk->pages;i>0;i--)
+		{
+			noir_page_pool_entry_p entry=(noir_page_pool_entry_p)((ulong_ptr)chunk->virt+page_mult(i-1));
+			entry->phys=chunk->phys+page_mult(i-1);
+			entry->next=pool->free_list;
+			pool->free_list=entry;
+		}
+		pool->free_pages+=chunk->pages;
+	}
+	return true;
+}
+
+// Allocate a zeroed page from the pool. The pool is refilled if it is exhausted.
+// In the host context, reserve enough pages in advance so that the pool is never refilled.
+void* noir_alloc_pool_page(noir_page_pool_p pool,u64p phys)
+{
+	noir_page_pool_entry_p entry=pool->free_list;
+	if(entry==null)
+	{
+		if(!noir_reserve_pool_pages(pool,1))return null;
+		entry=pool->free_list;
+	}
+	pool->free_list=entry->next;
+	pool->free_pages--;
+	if(phys)*phys=entry->phys;
+	// Clear the header so that the whole page is zeroed.
+	entry->next=null;
+	entry->phys=0;
+	return (void*)entry;
+}
+
+// Return a page to the pool. The page is zeroed here so that the free list remains pre-zeroed.
+void noir_free_pool_page(noir_page_pool_p pool,void* virtual_address)
+{
+	noir_page_pool_entry_p entry=(noir_page_pool_entry_p)virtual_address;
+	noir_page_pool_chunk_p chunk=pool->chunks;
+	while(chunk)
+	{
+		const ulong_ptr offset=(ulong_ptr)virtual_address-(ulong_ptr)chunk->virt;
+		if((ulong_ptr)virtual_address>=(ulong_ptr)chunk->virt && offset<page_mult(chunk->pages))
+		{
+			noir_stosb(virtual_address,0,page_size);
+			entry->phys=chunk->phys+offset;
+			entry->next=pool->free_list;
+			pool->free_list=entry;
+			pool->free_pages++;
+			return;
+		}
+		chunk=chunk->next;
+	}
+	nv_dprintf("Page 0x%p does not belong to the pool!\n",virtual_address);
+}
+
+// Release all memory of the pool. Pages allocated from the pool are no longer valid.
+void noir_finalize_page_pool(noir_page_pool_p pool)
+{
+	noir_page_pool_chunk_p chunk=pool->chunks;
+	while(chunk)
+	{
+		noir_page_pool_chunk_p next=chunk->next;
+		noir_free_contd_memory(chunk->virt);
+		noir_free_nonpg_memory(chunk);
+		chunk=next;
+	}
+	pool->chunks=null;
+	pool->free_list=null;
+	pool->free_pages=pool->total_pages=0;
 }
\ No newline at end of file
@@ -123,12 +123,47 @@ bool noir_is_under_hvm()
 }
 
 #if !defined(_hv_type1)
+// Default optional sections of exit context to be saved for each intercept code.
+// Exits that can be handled by intercept code alone do not require optional sections.
+u8 static noir_cvm_default_exit_sections[noir_cvm_intercept_index_limit]=
+{
+	noir_cvm_exit_section_all,		// Invalid State
+	0,								// Shutdown Condition
+	noir_cvm_exit_section_all,		// Memory Access
+	0,								// INIT Signal
+	0,								// hlt Instruction
+	noir_cvm_exit_section_all,		// I/O Instruction
+	noir_cvm_exit_section_all,		// cpuid Instruction
+	noir_cvm_exit_section_all,		// rdmsr Instruction
+	noir_cvm_exit_section_all,		// wrmsr Instruction
+	noir_cvm_exit_section_all,		// Control-Register Access
+	noir_cvm_exit_section_all,		// Debug-Register Access
+	noir_cvm_exit_section_all,		// Hypercall
+	noir_cvm_exit_section_all,		// Exception
+	0,								// Rescission
+	0,								// Interrupt Window
+	0,								// Scheduler Exit
+	0								// Scheduler Pause
+};
+
+// The size of exit context to be copied is determined by the last valid optional section.
+u32 static nvc_get_exit_context_copy_size(u32 sections)
+{
+	if(noir_bt(&sections,noir_cvm_exit_section_rip_rflags))
+		return sizeof(noir_cvm_exit_context);
+	else if(noir_bt(&sections,noir_cvm_exit_section_code_segment))
+		return (u32)(ulong_ptr)&((noir_cvm_exit_context_p)0)->rip;
+	else if(noir_bt(&sections,noir_cvm_exit_section_vcpu_state))
+		return (u32)(ulong_ptr)&((noir_cvm_exit_context_p)0)->cs;
+	return (u32)(ulong_ptr)&((noir_cvm_exit_context_p)0)->vcpu_state;
+}
+
 noir_status nvc_set_guest_vcpu_options(noir_cvm_virtual_cpu_p vcpu,noir_cvm_vcpu_option_type option_type,u32 data)
 {
 	noir_status st=noir_hypervision_absent;
 	if(hvm_p)
 	{
-		bool valid=true;
+		bool valid=true,vmcb_related=true;
 		switch(option_type)
 		{
 			case noir_cvm_guest_vcpu_options:
@@ -146,13 +181,49 @@ noir_status nvc_set_guest_vcpu_options(noir_cvm_virtual_cpu_p vcpu,noir_cvm_vcpu
 				vcpu->scheduling_priority=data;
 				break;
 			}
+			case noir_cvm_exit_context_sections:
+			{
+				noir_cvm_exit_section_option option;
+				option.value=data;
+				if(option.index<noir_cvm_intercept_index_limit)
+					vcpu->exit_sections[option.index]=(u8)(option.sections&noir_cvm_exit_section_all);
+				else
+					valid=false;
+				// Exit context is not relevant to the VMCB/VMCS.
+				vmcb_related=false;
+				break;
+			}
+			case noir_cvm_vcpu_time_slice:
+			{
+				// The time slice is specified in units of 1024 TSC ticks. Zero selects the default.
+				vcpu->scheduler.time_slice=data?(u64)data<<10:noir_cvm_default_time_slice;
+				// Time slice is handled by the scheduler, not the VMCB/VMCS.
+				vmcb_related=false;
+				break;
+			}
+			case noir_cvm_vcpu_affinity_policy:
+			{
+				noir_cvm_vcpu_affinity affinity;
+				affinity.value=data;
+				if(affinity.policy>noir_cvm_affinity_hard || (affinity.policy==noir_cvm_affinity_hard && affinity.processor>=noir_get_processor_count()))
+					valid=false;
+				else
+					vcpu->affinity=affinity;
+				// Affinity is handled by the scheduler, not the VMCB/VMCS.
+				vmcb_related=false;
+				break;
+			}
 			default:
 			{
 				valid=false;
 				break;
 			}
 		}
-		if(valid)
+		if(!valid)
+			st=noir_invalid_parameter;
+		else if(!vmcb_related)
+			st=noir_success;
+		else
 		{
 			if(hvm_p->selected_core==use_svm_core)
 			{
@@ -477,9 +548,112 @@ noir_status nvc_view_vcpu_registers(noir_cvm_virtual_cpu_p vcpu,noir_cvm_registe
 noir_status nvc_set_event_injection(noir_cvm_virtual_cpu_p vcpu,noir_cvm_event_injection injected_event)
 {
 	vcpu->injected_event=injected_event;
+	if(injected_event.attributes.valid)vcpu->statistics.injected_events++;
 	return noir_success;
 }
 
+// Exceptions are of highest priority, followed by NMIs and software interrupts.
+// External interrupts are of lowest priority, and the one with higher vector is preferred like the local APIC does.
+u32 static nvc_get_event_priority(noir_cvm_event_injection_p event)
+{
+	switch(event->attributes.type)
+	{
+		case 0:return event->attributes.vector;
+		case 2:return 0x200;
+		case 3:return 0x300;
+		default:return 0x100;
+	}
+}
+
+noir_status nvc_queue_event_injection(noir_cvm_virtual_cpu_p vcpu,noir_cvm_event_injection injected_event)
+{
+	noir_status st=noir_invalid_parameter;
+	if(injected_event.attributes.valid)
+	{
+		noir_cvm_event_queue_p queue=&vcpu->event_queue;
+		u32 priority=nvc_get_event_priority(&injected_event);
+		// The hypervisor never spins on this lock, so it is held very shortly.
+		while(noir_locked_bts((long*)&queue->lock,0))noir_pause();
+		if(queue->count<noir_cvm_event_queue_size)
+		{
+			// Events of the same priority are injected in the order they are queued.
+			// Hence the new event is inserted below the events of the same priority.
+			u32 i=queue->count;
+			for(;i && nvc_get_event_priority(&queue->events[i-1])>=priority;i--)
+				queue->events[i]=queue->events[i-1];
+			queue->events[i]=injected_event;
+			queue->count++;
+			vcpu->statistics.injected_events++;
+			st=noir_success;
+		}
+		else
+			st=noir_insufficient_resources;
+		noir_locked_btr((long*)&queue->lock,0);
+	}
+	return st;
+}
+
+void static nvc_accumulate_vcpu_statistics(noir_cvm_vcpu_statistics_p total,noir_cvm_vcpu_statistics_p stats)
+{
+	for(u32 i=0;i<noir_cvm_intercept_index_limit;i++)
+	{
+		total->exits[i].count+=stats->exits[i].count;
+		total->exits[i].tsc+=stats->exits[i].tsc;
+	}
+	total->total_exits+=stats->total_exits;
+	total->injected_events+=stats->injected_events;
+	total->tsc.guest+=stats->tsc.guest;
+	total->tsc.hypervisor+=stats->tsc.hypervisor;
+	total->tsc.user+=stats->tsc.user;
+	total->affinity.migrations+=stats->affinity.migrations;
+	total->affinity.pinned_runs+=stats->affinity.pinned_runs;
+	total->affinity.rehomes+=stats->affinity.rehomes;
+}
+
+// The statistics are sampled while the vCPU may be running.
+// Counters might be off by the exit being processed at the moment.
+noir_status nvc_query_vcpu_statistics(noir_cvm_virtual_cpu_p vcpu,void* buffer,u32 buffer_size)
+{
+	noir_status st=noir_buffer_too_small;
+	if(buffer_size>=sizeof(noir_cvm_vcpu_statistics))
+	{
+		noir_copy_memory(buffer,&vcpu->statistics,sizeof(noir_cvm_vcpu_statistics));
+		st=noir_success;
+	}
+	return st;
+}
+
+noir_status nvc_query_vm_statistics(noir_cvm_virtual_machine_p vm,void* buffer,u32 buffer_size)
+{
+	noir_status st=noir_hypervision_absent;
+	if(hvm_p)
+	{
+		st=noir_buffer_too_small;
+		if(buffer_size>=sizeof(noir_cvm_vcpu_statistics))
+		{
+			noir_cvm_vcpu_statistics_p total=(noir_cvm_vcpu_statistics_p)buffer;
+			noir_stosb((void*)total,0,sizeof(noir_cvm_vcpu_statistics));
+			st=noir_success;
+			// Sum up the statistics of all vCPUs in the VM.
+			noir_acquire_reslock_shared(vm->vcpu_list_lock);
+			if(hvm_p->selected_core==use_svm_core)
+			{
+				for(u32 i=0;i<255;i++)
+				{
+					noir_cvm_virtual_cpu_p vcpu=nvc_svmc_reference_vcpu(vm,i);
+					if(vcpu)nvc_accumulate_vcpu_statistics(total,&vcpu->statistics);
+				}
+			}
+			else if(hvm_p->selected_core==use_vt_core)
+				st=noir_not_implemented;
+			else
+				st=noir_unknown_processor;
+			noir_release_reslock(vm->vcpu_list_lock);
+		}
+	}
+	return st;
+}
+
 bool nvc_validate_vcpu_state(noir_cvm_virtual_cpu_p vcpu)
 {
 	// Check Extended CRs.
@@ -522,7 +696,78 @@ noir_status nvc_run_vcpu(noir_cvm_virtual_cpu_p vcpu,void* exit_context)
 			else
 				st=noir_unknown_processor;
 		}
+		else
+		{
+			// No optional sections are saved for the invalid state.
+			vcpu->exit_context.sections=0;
+		}
+		// Optional sections that are not saved are not copied.
+		if(st==noir_success)noir_copy_memory(exit_context,&vcpu->exit_context,nvc_get_exit_context_copy_size(vcpu->exit_context.sections));
+	}
+	return st;
+}
+
+// Fetch the optional sections of exit context that were not saved at VM-Exit.
+// The vCPU must not be queued or running. Otherwise, the VMCB and the exit context may be torn.
+noir_status nvc_fetch_exit_context(noir_cvm_virtual_cpu_p vcpu,void* exit_context)
+{
+	noir_status st=noir_hypervision_absent;
+	if(hvm_p)
+	{
+		// Claim the vCPU so that it cannot be run or scheduled while the exit context is being fetched.
+		if(noir_locked_cmpxchg((long*)&vcpu->scheduler.state,noir_cvm_vcpu_state_running,noir_cvm_vcpu_state_idle)!=noir_cvm_vcpu_state_idle)
+			return noir_vcpu_already_scheduled;
+		st=noir_success;
+		if(hvm_p->selected_core==use_svm_core)
+		{
+			if((vcpu->exit_context.sections&noir_cvm_exit_section_all)!=noir_cvm_exit_section_all)
+				noir_svm_vmmcall(noir_cvm_fetch_exit_context,(ulong_ptr)vcpu);
+		}
+		else if(hvm_p->selected_core==use_vt_core)
+			st=noir_not_implemented;
+		else
+			st=noir_unknown_processor;
 		if(st==noir_success)noir_copy_memory(exit_context,&vcpu->exit_context,sizeof(noir_cvm_exit_context));
+		vcpu->scheduler.state=noir_cvm_vcpu_state_idle;
+	}
+	return st;
+}
+
+// Put the vCPU into the run queue so that it will be run by the scheduler.
+noir_status nvc_schedule_vcpu(noir_cvm_virtual_cpu_p vcpu)
+{
+	noir_status st=noir_hypervision_absent;
+	if(hvm_p)
+	{
+		// The state is checked before the vCPU is queued, in that the scheduler won't return to this thread.
+		// The user hypervisor may inspect the exit context for the reason of rejection.
+		if(!nvc_validate_vcpu_state(vcpu))
+			st=noir_invalid_parameter;
+		else if(hvm_p->selected_core==use_svm_core)
+			st=nvc_svmc_schedule_vcpu(vcpu);
+		else if(hvm_p->selected_core==use_vt_core)
+			st=noir_not_implemented;
+		else
+			st=noir_unknown_processor;
+	}
+	return st;
+}
+
+// Run the scheduled vCPUs of the VM until one of them exits to the user hypervisor.
+noir_status nvc_run_scheduler(noir_cvm_virtual_machine_p vm,u32 *vcpu_id,void* exit_context)
+{
+	noir_status st=noir_hypervision_absent;
+	if(hvm_p)
+	{
+		noir_cvm_virtual_cpu_p vcpu=null;
+		if(hvm_p->selected_core==use_svm_core)
+			st=nvc_svmc_run_scheduler(vm,&vcpu,vcpu_id);
+		else if(hvm_p->selected_core==use_vt_core)
+			st=noir_not_implemented;
+		else
+			st=noir_unknown_processor;
+		// Optional sections that are not saved are not copied.
+		if(st==noir_success)noir_copy_memory(exit_context,&vcpu->exit_context,nvc_get_exit_context_copy_size(vcpu->exit_context.sections));
 	}
 	return st;
 }
@@ -584,6 +829,8 @@ noir_status nvc_create_vcpu(noir_cvm_virtual_machine_p vm,noir_cvm_virtual_cpu_p
 			st=nvc_svmc_create_vcpu(vcpu,vm,vcpu_id);
 		else
 			st=noir_unknown_processor;
+		// Initialize the optional sections of exit context to be saved.
+		if(st==noir_success && *vcpu)noir_copy_memory((*vcpu)->exit_sections,noir_cvm_default_exit_sections,sizeof(noir_cvm_default_exit_sections));
 	}
 	return st;
 }
@@ -702,6 +949,80 @@ void nvc_print_vm_list()
 }
 #endif
 
+// Query the histogram of exit latencies of the specified processor.
+// Histograms are read without synchronization, so counters being updated at the moment may be slightly inconsistent.
+noir_status nvc_query_exit_histogram(u32 processor,noir_exit_histogram_p histogram,u32 size)
+{
+	if(hvm_p==null)return noir_hypervision_absent;
+	if(hvm_p->exit_histograms==null)return noir_not_implemented;
+	if(size<sizeof(noir_exit_histogram))return noir_buffer_too_small;
+	noir_stosb((void*)histogram,0,sizeof(noir_exit_histogram));
+	if(processor==noir_exit_histogram_all_processors)
+	{
+		for(u32 i=0;i<hvm_p->cpu_count;i++)
+			noir_merge_exit_histogram(histogram,&hvm_p->exit_histograms[i]);
+	}
+	else if(processor<hvm_p->cpu_count)
+		noir_merge_exit_histogram(histogram,&hvm_p->exit_histograms[processor]);
+	else
+		return noir_invalid_parameter;
+	return noir_success;
+}
+
+// Reset the histograms of exit latencies of all processors.
+noir_status nvc_reset_exit_histograms()
+{
+	if(hvm_p==null)return noir_hypervision_absent;
+	if(hvm_p->exit_histograms==null)return noir_not_implemented;
+	for(u32 i=0;i<hvm_p->cpu_count;i++)
+		noir_reset_exit_histogram(&hvm_p->exit_histograms[i]);
+	return noir_success;
+}
+
+// Copy the exit trace ring of the specified processor.
+// Records are ordered by their sequence numbers. Records with zero sequence number should be discarded.
+noir_status nvc_query_exit_trace(u32 processor,noir_exit_trace_ring_p ring,u32 size)
+{
+	noir_exit_trace_ring_p source;
+	if(hvm_p==null)return noir_hypervision_absent;
+	if(hvm_p->exit_traces==null)return noir_not_implemented;
+	if(size<sizeof(noir_exit_trace_ring))return noir_buffer_too_small;
+	if(processor>=hvm_p->cpu_count)return noir_invalid_parameter;
+	source=&hvm_p->exit_traces[processor];
+	ring->head=source->head;
+	ring->reserved=0;
+	// The processor keeps writing the ring during the copy. Copy records one by one in the way of a sequence lock.
+	for(u32 i=0;i<noir_exit_trace_ring_size;i++)
+	{
+		noir_exit_trace_record_p src=&source->records[i],dst=&ring->records[i];
+		const u64 sequence=*(u64vp)&src->sequence;
+		noir_load_fence();
+		noir_copy_memory(dst,src,sizeof(noir_exit_trace_record));
+		noir_load_fence();
+		// The record is torn if it is rewritten during the copy.
+		dst->sequence=(sequence && sequence==*(u64vp)&src->sequence)?sequence:0;
+	}
+	return noir_success;
+}
+
+void nvc_initialize_vcpu_setup_context(noir_vcpu_setup_context_p setup,noir_hypervisor_p hvm)
+{
+	setup->hvm=hvm;
+	setup->failures=0;
+	setup->failed_processor=noir_vcpu_setup_no_failure;
+	setup->status=noir_success;
+	setup->reserved=0;
+}
+
+// This function may be called by multiple processors simultaneously.
+void nvc_record_vcpu_setup_failure(noir_vcpu_setup_context_p setup,u32 processor_id,u32 status)
+{
+	// Only the first failure is recorded in details.
+	if(noir_locked_cmpxchg((long*)&setup->failed_processor,(long)processor_id,(long)noir_vcpu_setup_no_failure)==(long)noir_vcpu_setup_no_failure)
+		setup->status=status;
+	noir_locked_inc((long*)&setup->failures);
+}
+
 noir_status nvc_build_hypervisor()
 {
 	hvm_p=noir_alloc_nonpg_memory(sizeof(noir_hypervisor));
@@ -711,6 +1032,16 @@ noir_status nvc_build_hypervisor()
 		hvm_p->cpu_manuf=nvc_confirm_cpu_manufacturer(hvm_p->vendor_string);
 		hvm_p->options.value=noir_query_enabled_features_in_system();
 		nvc_store_image_info(&hvm_p->hv_image.base,&hvm_p->hv_image.size);
+		if(hvm_p->options.exit_profiling)
+		{
+			hvm_p->exit_histograms=noir_alloc_nonpg_memory(noir_get_processor_count()*sizeof(noir_exit_histogram));
+			if(hvm_p->exit_histograms==null)nv_dprintf("Failed to allocate exit histograms! Exit profiling is disabled!\n");
+		}
+		if(hvm_p->options.exit_tracing)
+		{
+			hvm_p->exit_traces=noir_alloc_nonpg_memory(noir_get_processor_count()*sizeof(noir_exit_trace_ring));
+			if(hvm_p->exit_traces==null)nv_dprintf("Failed to allocate exit trace rings! Exit tracing is disabled!\n");
+		}
 		switch(hvm_p->cpu_manuf)
 		{
 			case intel_processor:
@@ -794,6 +1125,8 @@ svm_restoration:
 end_restoration:
 			nv_dprintf("Restoration Complete...\n");
 		}
+		if(hvm_p->exit_histograms)noir_free_nonpg_memory(hvm_p->exit_histograms);
+		if(hvm_p->exit_traces)noir_free_nonpg_memory(hvm_p->exit_traces);
 		noir_free_nonpg_memory(hvm_p);
 	}
 }
\ No newline at end of file
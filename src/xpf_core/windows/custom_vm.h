@@ -279,11 +279,17 @@ NOIR_STATUS nvc_set_mapping(IN PVOID VirtualMachine,IN PNOIR_ADDRESS_MAPPING Map
 NOIR_STATUS nvc_create_vcpu(IN PVOID VirtualMachine,OUT PVOID *VirtualProcessor,IN ULONG32 VpIndex);
 NOIR_STATUS nvc_release_vcpu(IN PVOID VirtualProcessor);
 NOIR_STATUS nvc_run_vcpu(IN PVOID VirtualProcessor,OUT PVOID ExitContext);
+NOIR_STATUS nvc_fetch_exit_context(IN PVOID VirtualProcessor,OUT PVOID ExitContext);
 NOIR_STATUS nvc_rescind_vcpu(IN PVOID VirtualProcessor);
+NOIR_STATUS nvc_schedule_vcpu(IN PVOID VirtualProcessor);
+NOIR_STATUS nvc_run_scheduler(IN PVOID VirtualMachine,OUT PULONG32 VpIndex,OUT PVOID ExitContext);
 NOIR_STATUS nvc_view_vcpu_registers(IN PVOID VirtualProcessor,IN NOIR_CVM_REGISTER_TYPE RegisterType,OUT PVOID Buffer,IN ULONG32 BufferSize);
 NOIR_STATUS nvc_edit_vcpu_registers(IN PVOID VirtualProcessor,IN NOIR_CVM_REGISTER_TYPE RegisterType,IN PVOID Buffer,IN ULONG32 BufferSize);
 NOIR_STATUS nvc_set_event_injection(IN PVOID VirtualProcessor,IN ULONG64 InjectedEvent);
+NOIR_STATUS nvc_queue_event_injection(IN PVOID VirtualProcessor,IN ULONG64 InjectedEvent);
 NOIR_STATUS nvc_set_guest_vcpu_options(IN PVOID VirtualProcessor,IN ULONG32 OptionType,IN ULONG32 Options);
+NOIR_STATUS nvc_query_vcpu_statistics(IN PVOID VirtualProcessor,OUT PVOID Buffer,IN ULONG32 BufferSize);
+NOIR_STATUS nvc_query_vm_statistics(IN PVOID VirtualMachine,OUT PVOID Buffer,IN ULONG32 BufferSize);
 PVOID nvc_reference_vcpu(IN PVOID VirtualMachine,IN ULONG32 VpIndex);
 HANDLE nvc_get_vm_pid(IN PVOID VirtualMachine);
 
@@ -94,9 +94,10 @@ void __cdecl nv_panicf(const char* format,...)
 	va_end(arg_list);
 }
 
-// Asynchronous Debug-Printer Implementation...
+// Asynchronous Binary Tracer Implementation...
 // In the context of VM-Exit, debug-printing is not permitted.
-// FIXME: Some debug log messages are missing.
+// Producers only save the format-ID and raw arguments to the ring of the current processor.
+// Formatting is deferred to a low-priority consumer thread.
 
 PVOID NoirAllocateLoggerBuffer(IN ULONG Size)
 {
@@ -110,71 +111,86 @@ void NoirFreeLoggerBuffer(IN PVOID Buffer)
 	ExFreePoolWithTag(Buffer,'gLvN');
 }
 
-void NoirAsyncDebugLogThreadWorker(IN PVOID StartContext)
+void static NoirDecodeTraceRecord(IN ULONG32 ProcessorId,IN PNOIR_TRACE_RECORD Record)
 {
-	PNOIR_ASYNC_DEBUG_LOG_MONITOR LogMonitor=(PNOIR_ASYNC_DEBUG_LOG_MONITOR)StartContext;
 	PSTR Level[4]={"Error","Warning","Trace","Info"};
-	KAFFINITY Affinity=(KAFFINITY)(1<<LogMonitor->ProcessorId);
+	PULONG64 Args=Record->Arguments;
+	CHAR Log[512];
+	PSTR LogBuffer;
+	SIZE_T LogSize;
+	RtlStringCbPrintfExA(Log,sizeof(Log),&LogBuffer,&LogSize,STRSAFE_FILL_BEHIND_NULL,"[NoirVisor - Async Log | Core %03u | %s]\t | TSC=%llu | ",ProcessorId,Level[Record->Level&3],Record->Timestamp);
+	// Arguments beyond the argument count are zero and are ignored by the format string.
+	RtlStringCbPrintfA(LogBuffer,LogSize,Record->Format,Args[0],Args[1],Args[2],Args[3],Args[4],Args[5]);
+	DbgPrintEx(DPFLTR_IHVDRIVER_ID,Record->Level,Log);
+}
+
+void static NoirDrainTraceRing(IN ULONG32 ProcessorId,IN PNOIR_TRACE_RING Ring)
+{
+	LONG64 Tail=Ring->Tail,Dropped,Rejected;
+	while(Tail!=Ring->Head)
+	{
+		PNOIR_TRACE_RECORD Record=&Ring->Records[Tail&(NOIR_TRACE_RING_SIZE-1)];
+		// Stop at the record which is reserved but not yet published.
+		if(InterlockedCompareExchange64(&Record->Sequence,0,0)!=Tail+1)break;
+		NoirDecodeTraceRecord(ProcessorId,Record);
+		// Release the slot to the producer.
+		InterlockedExchange64(&Ring->Tail,++Tail);
+	}
+	Dropped=InterlockedCompareExchange64(&Ring->Dropped,0,0);
+	if(Dropped!=Ring->Reported)
+	{
+		DbgPrintEx(DPFLTR_IHVDRIVER_ID,DPFLTR_ERROR_LEVEL,"[NoirVisor - Async Log | Core %03u | Panic] There are %llu trace records dropped!\n",ProcessorId,Dropped-Ring->Reported);
+		Ring->Reported=Dropped;
+	}
+	Rejected=InterlockedCompareExchange64(&Ring->Rejected,0,0);
+	if(Rejected!=Ring->ReportedRejected)
+	{
+		DbgPrintEx(DPFLTR_IHVDRIVER_ID,DPFLTR_ERROR_LEVEL,"[NoirVisor - Async Log | Core %03u | Panic] There are %llu trace records rejected due to non-64-bit arguments!\n",ProcessorId,Rejected-Ring->ReportedRejected);
+		Ring->ReportedRejected=Rejected;
+	}
+}
+
+void NoirAsyncTraceThreadWorker(IN PVOID StartContext)
+{
+	PNOIR_ASYNC_TRACE_MONITOR Monitor=(PNOIR_ASYNC_TRACE_MONITOR)StartContext;
 	LARGE_INTEGER Delay;
 	Delay.QuadPart=NOIR_DEBUG_PRINT_DELAY*(-10000);
-	KeSetSystemAffinityThread(Affinity);
-	NoirDebugPrint("Asynchronous Logger Thread is listening on Processor Core %03u!\n",LogMonitor->ProcessorId);
-	while(InterlockedCompareExchange(&LogMonitor->TerminationSignal,1,1)==0)
+	KeSetPriorityThread(KeGetCurrentThread(),LOW_PRIORITY+1);
+	NoirDebugPrint("Asynchronous Tracer Thread is listening on %u Processor Cores!\n",Monitor->NumberOfRings);
+	while(InterlockedCompareExchange(&Monitor->TerminationSignal,1,1)==0)
 	{
-		ULONG i=0;
-		// Turn off interrupts to prevent the worker thread from being scheduled out.
-		_disable();
-		// Traverse the log records then print them.
-		while(i<LogMonitor->RecordCount)
-		{
-			PNOIR_DEBUG_LOG_RECORD LogRecord=LogMonitor->LogInfo;
-			UCHAR Log[512];
-			LARGE_INTEGER Time;
-			TIME_FIELDS TimeFields;
-			ExSystemTimeToLocalTime(&LogRecord->LogTime,&Time);
-			RtlTimeToTimeFields(&Time,&TimeFields);
-			RtlStringCchPrintfA(Log,sizeof(Log),"[NoirVisor - Async Log | Core %03u | %s]\t | %04u-%02u-%02u %02u:%02u:%02u.%03u | %s",
-				LogMonitor->ProcessorId,Level[LogRecord->Level],TimeFields.Year,TimeFields.Month,TimeFields.Day,
-				TimeFields.Hour,TimeFields.Minute,TimeFields.Second,TimeFields.Milliseconds,LogRecord->Message);
-			DbgPrintEx(DPFLTR_IHVDRIVER_ID,LogRecord->Level,Log);
-			if(++i==NOIR_DEBUG_LOG_RECORD_LIMIT)break;
-		}
-		if(LogMonitor->RecordCount>=NOIR_DEBUG_LOG_RECORD_LIMIT)
-		{
-			ULONG DroppedCount=LogMonitor->RecordCount-NOIR_DEBUG_LOG_RECORD_LIMIT+1;
-			DbgPrintEx(DPFLTR_IHVDRIVER_ID,DPFLTR_ERROR_LEVEL,"[NoirVisor - Async Log | Core %03u | Panic] There are %u debug log record dropped!\n",LogMonitor->ProcessorId,DroppedCount);
-		}
-		LogMonitor->RecordCount=0;
-		// Turn on interrupts to sleep properly.
-		_enable();
+		// The rings are lock-free, so there is no need to disable interrupts.
+		for(ULONG32 i=0;i<Monitor->NumberOfRings;i++)
+			NoirDrainTraceRing(i,&Monitor->Rings[i]);
 		// Sleep.
 		KeDelayExecutionThread(KernelMode,TRUE,&Delay);
 	}
-	KeRevertToUserAffinityThread();
+	// Flush the remaining records before termination.
+	for(ULONG32 i=0;i<Monitor->NumberOfRings;i++)
+		NoirDrainTraceRing(i,&Monitor->Rings[i]);
 	PsTerminateSystemThread(STATUS_SUCCESS);
 }
 
 void NoirFinalizeAsyncDebugPrinter()
 {
-	if(NoirAsyncDebugLogger)
+	if(NoirAsyncTracer.ThreadHandle)
 	{
-		ULONG NumberOfProcessors=KeQueryActiveProcessorCount(NULL);
-		// Join the threads so freeing the buffer does not encounter race conditions.
-		for(ULONG32 i=0;i<NumberOfProcessors;i++)
-		{
-			if(NoirAsyncDebugLogger[i].ThreadHandle)
-			{
-				// Signal the monitor thread to be ready for termination.
-				InterlockedIncrement(&NoirAsyncDebugLogger[i].TerminationSignal);
-				// Wake the thread from timer-sleeping.
-				ZwAlertThread(NoirAsyncDebugLogger[i].ThreadHandle);
-				// Join the thread.
-				ZwWaitForSingleObject(NoirAsyncDebugLogger[i].ThreadHandle,FALSE,NULL);
-				ZwClose(NoirAsyncDebugLogger[i].ThreadHandle);
-			}
-			if(NoirAsyncDebugLogger[i].LogInfo)NoirFreeLoggerBuffer(NoirAsyncDebugLogger[i].LogInfo);
-		}
-		NoirFreeLoggerBuffer(NoirAsyncDebugLogger);
+		// Signal the tracer thread to be ready for termination.
+		InterlockedIncrement(&NoirAsyncTracer.TerminationSignal);
+		// Wake the thread from timer-sleeping.
+		ZwAlertThread(NoirAsyncTracer.ThreadHandle);
+		// Join the thread so freeing the buffer does not encounter race conditions.
+		ZwWaitForSingleObject(NoirAsyncTracer.ThreadHandle,FALSE,NULL);
+		ZwClose(NoirAsyncTracer.ThreadHandle);
+		NoirAsyncTracer.ThreadHandle=NULL;
+	}
+	if(NoirAsyncTracer.Rings)
+	{
+		for(ULONG32 i=0;i<NoirAsyncTracer.NumberOfRings;i++)
+			if(NoirAsyncTracer.Rings[i].Records)
+				NoirFreeLoggerBuffer(NoirAsyncTracer.Rings[i].Records);
+		NoirFreeLoggerBuffer(NoirAsyncTracer.Rings);
+		NoirAsyncTracer.Rings=NULL;
 	}
 }
 
@@ -182,51 +198,100 @@ NTSTATUS NoirInitializeAsyncDebugPrinter()
 {
 	NTSTATUS st=STATUS_INSUFFICIENT_RESOURCES;
 	ULONG NumberOfProcessors=KeQueryActiveProcessorCount(NULL);
-	NoirAsyncDebugLogger=NoirAllocateLoggerBuffer(sizeof(NOIR_ASYNC_DEBUG_LOG_MONITOR)*NumberOfProcessors);
-	if(NoirAsyncDebugLogger)
+	PNOIR_TRACE_RING Rings=NoirAllocateLoggerBuffer(sizeof(NOIR_TRACE_RING)*NumberOfProcessors);
+	if(Rings)
 	{
 		OBJECT_ATTRIBUTES oa;
 		InitializeObjectAttributes(&oa,NULL,OBJ_KERNEL_HANDLE,NULL,NULL);
+		NoirAsyncTracer.NumberOfRings=NumberOfProcessors;
+		NoirAsyncTracer.TerminationSignal=0;
 		for(ULONG32 i=0;i<NumberOfProcessors;i++)
 		{
-			NoirAsyncDebugLogger[i].LogInfo=NoirAllocateLoggerBuffer(sizeof(NOIR_DEBUG_LOG_RECORD)*NOIR_DEBUG_LOG_RECORD_LIMIT);
-			if(NoirAsyncDebugLogger[i].LogInfo==NULL)
+			Rings[i].Records=NoirAllocateLoggerBuffer(sizeof(NOIR_TRACE_RECORD)*NOIR_TRACE_RING_SIZE);
+			if(Rings[i].Records==NULL)
 			{
-				st=STATUS_INSUFFICIENT_RESOURCES;
+				NoirAsyncTracer.Rings=Rings;
 				NoirFinalizeAsyncDebugPrinter();
-				return st;
-			}
-			NoirAsyncDebugLogger[i].ProcessorId=i;
-			NoirAsyncDebugLogger[i].RecordCount=0;
-			NoirAsyncDebugLogger[i].TerminationSignal=0;
-			st=PsCreateSystemThread(&NoirAsyncDebugLogger[i].ThreadHandle,SYNCHRONIZE,&oa,NULL,NULL,NoirAsyncDebugLogThreadWorker,&NoirAsyncDebugLogger[i]);
-			if(NT_ERROR(st))
-			{
-				NoirFinalizeAsyncDebugPrinter();
-				return st;
+				return STATUS_INSUFFICIENT_RESOURCES;
 			}
 		}
+		// Publish the rings only if all of them are allocated.
+		NoirAsyncTracer.Rings=Rings;
+		st=PsCreateSystemThread(&NoirAsyncTracer.ThreadHandle,SYNCHRONIZE,&oa,NULL,NULL,NoirAsyncTraceThreadWorker,&NoirAsyncTracer);
+		if(NT_ERROR(st))
+		{
+			NoirAsyncTracer.ThreadHandle=NULL;
+			NoirFinalizeAsyncDebugPrinter();
+		}
 	}
 	return st;
 }
 
-void __cdecl NoirAsyncDebugVPrint(ULONG FilterLevel,const char* Format,va_list ArgList)
+// Every conversion in the format string must consume a 64-bit argument, so the
+// producer can read the arguments without knowing their types.
+BOOLEAN static NoirValidateTraceFormat(IN PCSTR Format,IN ULONG32 ArgumentCount)
 {
-	ULONG ProcNum=KeGetCurrentProcessorNumber();
-	ULONG Index=NoirAsyncDebugLogger[ProcNum].RecordCount++;
-	PNOIR_DEBUG_LOG_RECORD LogRecord=&NoirAsyncDebugLogger[ProcNum].LogInfo[Index%NOIR_DEBUG_LOG_RECORD_LIMIT];
-	// Record the debug logging messages.
-	KeQuerySystemTime(&LogRecord->LogTime);
-	LogRecord->Level=FilterLevel;
-	// Format the logging message string.
-	RtlStringCchVPrintfA(LogRecord->Message,sizeof(LogRecord->Message),Format,ArgList);
+	ULONG32 Conversions=0;
+	for(PCSTR p=Format;*p;p++)
+	{
+		if(*p!='%')continue;
+		if(*++p=='%')continue;
+		// Skip flags, width and precision. Variable width (*) would consume an int argument.
+		while(*p=='-' || *p=='+' || *p==' ' || *p=='#' || *p=='.' || (*p>='0' && *p<='9'))p++;
+		if(p[0]=='l' && p[1]=='l')
+			p+=2;
+		else if(p[0]=='I' && p[1]=='6' && p[2]=='4')
+			p+=3;
+		else
+			return FALSE;
+		if(*p!='d' && *p!='i' && *p!='u' && *p!='x' && *p!='X' && *p!='o')return FALSE;
+		Conversions++;
+	}
+	return Conversions==ArgumentCount;
 }
 
-void __cdecl nv_async_dprintf(const char* format,...)
+void __cdecl NoirAsyncTraceV(ULONG FilterLevel,ULONG32 ArgumentCount,const char* Format,va_list ArgList)
+{
+	PNOIR_TRACE_RING Ring;
+	PNOIR_TRACE_RECORD Record;
+	LONG64 Head;
+	if(NoirAsyncTracer.Rings==NULL)return;
+	Ring=&NoirAsyncTracer.Rings[KeGetCurrentProcessorNumber()];
+	// Reading a narrower argument as 64-bit is wrong on 32-bit platforms. Reject the record.
+	if(ArgumentCount>NOIR_TRACE_ARGUMENT_LIMIT || !NoirValidateTraceFormat(Format,ArgumentCount))
+	{
+		InterlockedIncrement64(&Ring->Rejected);
+		return;
+	}
+	// Reserve a record. A VM-Exit may interrupt the producer on the same processor, so the reservation must be atomic.
+	do
+	{
+		Head=Ring->Head;
+		if(Head-Ring->Tail>=NOIR_TRACE_RING_SIZE)
+		{
+			// The ring is full. Count the record as dropped.
+			InterlockedIncrement64(&Ring->Dropped);
+			return;
+		}
+	}while(InterlockedCompareExchange64(&Ring->Head,Head+1,Head)!=Head);
+	Record=&Ring->Records[Head&(NOIR_TRACE_RING_SIZE-1)];
+	Record->Timestamp=__rdtsc();
+	Record->Format=Format;
+	Record->Level=FilterLevel;
+	Record->ArgumentCount=ArgumentCount;
+	for(ULONG32 i=0;i<NOIR_TRACE_ARGUMENT_LIMIT;i++)
+		Record->Arguments[i]=i<ArgumentCount?va_arg(ArgList,ULONG64):0;
+	// Publish the record to the consumer.
+	InterlockedExchange64(&Record->Sequence,Head+1);
+}
+
+// Every argument must be passed as a 64-bit integer and formatted with %ll or %I64 conversions.
+// Pointers should be casted to u64. Strings are not supported because the formatting is deferred.
+void __cdecl nv_async_tracef(ULONG32 argc,const char* format,...)
 {
 	va_list arg_list;
 	va_start(arg_list,format);
-	NoirAsyncDebugVPrint(DPFLTR_INFO_LEVEL,format,arg_list);
+	NoirAsyncTraceV(DPFLTR_INFO_LEVEL,argc,format,arg_list);
 	va_end(arg_list);
 }
 
@@ -241,6 +306,51 @@ ULONG32 noir_get_current_processor()
 	return KeGetCurrentProcessorNumber();
 }
 
+// The previous affinity is saved to the buffer specified by the caller.
+// The caller must make sure that the processor index is less than the number of processors.
+void noir_set_thread_affinity(IN ULONG32 ProcessorNumber,OUT PVOID PreviousAffinity)
+{
+#if defined(_WINNT5)
+	// Processor groups are absent. The affinity is reverted to the user affinity.
+	UNREFERENCED_PARAMETER(PreviousAffinity);
+	KeSetSystemAffinityThread(AFFINITY_MASK(ProcessorNumber));
+#else
+	PROCESSOR_NUMBER ProcNum;
+	GROUP_AFFINITY Affinity;
+	RtlZeroMemory(&Affinity,sizeof(Affinity));
+	// The processor index is system-wide. Translate it into the group-relative number.
+	KeGetProcessorNumberFromIndex(ProcessorNumber,&ProcNum);
+	Affinity.Group=ProcNum.Group;
+	Affinity.Mask=AFFINITY_MASK(ProcNum.Number);
+	KeSetSystemGroupAffinityThread(&Affinity,(PGROUP_AFFINITY)PreviousAffinity);
+#endif
+}
+
+void noir_revert_thread_affinity(IN PVOID PreviousAffinity)
+{
+#if defined(_WINNT5)
+	UNREFERENCED_PARAMETER(PreviousAffinity);
+	KeRevertToUserAffinityThread();
+#else
+	KeRevertToUserGroupAffinityThread((PGROUP_AFFINITY)PreviousAffinity);
+#endif
+}
+
+ULONG32 noir_get_processor_node(IN ULONG32 ProcessorNumber)
+{
+#if defined(_WINNT5)
+	return 0;
+#else
+	// Query the topology so that the thread is not migrated to the specified processor.
+	PROCESSOR_NUMBER ProcNum;
+	SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX Info;
+	ULONG Length=sizeof(Info);
+	NTSTATUS st=KeGetProcessorNumberFromIndex(ProcessorNumber,&ProcNum);
+	if(NT_SUCCESS(st))st=KeQueryLogicalProcessorRelationship(&ProcNum,RelationNumaNode,&Info,&Length);
+	return NT_SUCCESS(st)?Info.NumaNode.NodeNumber:0;
+#endif
+}
+
 void static NoirDpcRT(IN PKDPC Dpc,IN PVOID DeferedContext OPTIONAL,IN PVOID SystemArgument1 OPTIONAL,IN PVOID SystemArgument2 OPTIONAL)
 {
 	noir_broadcast_worker worker=(noir_broadcast_worker)SystemArgument1;
@@ -385,10 +495,7 @@ void NoirFreePagedMemory(IN PVOID VirtualAddress)
 
 void* noir_alloc_contd_memory(size_t length)
 {
-	// PHYSICAL_ADDRESS L={0};
 	PHYSICAL_ADDRESS H={0xFFFFFFFFFFFFFFFF};
-	// PHYSICAL_ADDRESS B={0};
-	// PVOID p=MmAllocateContiguousMemorySpecifyCacheNode(length,L,H,B,MmCached,MM_ANY_NODE_OK);
 	PVOID p=MmAllocateContiguousMemory(length,H);
 	if(p)
 	{
@@ -398,6 +505,27 @@ void* noir_alloc_contd_memory(size_t length)
 	return p;
 }
 
+// Note that the node is preferred rather than mandatory.
+// Windows may still satisfy the allocation from other nodes under memory pressure.
+void* noir_alloc_contd_memory_on_node(size_t length,ULONG32 node)
+{
+#if defined(_WINNT5)
+	// NUMA-aware allocation is unavailable on NT5.
+	return NULL;
+#else
+	PHYSICAL_ADDRESS L={0};
+	PHYSICAL_ADDRESS H={0xFFFFFFFFFFFFFFFF};
+	PHYSICAL_ADDRESS B={0};
+	PVOID p=MmAllocateContiguousMemorySpecifyCacheNode(length,L,H,B,MmCached,(NODE_REQUIREMENT)node);
+	if(p)
+	{
+		RtlZeroMemory(p,length);
+		InterlockedIncrement(&NoirAllocatedContiguousMemoryCount);
+	}
+	return p;
+#endif
+}
+
 void* noir_alloc_nonpg_memory(size_t length)
 {
 	PVOID p=ExAllocatePoolWithTag(NonPagedPool,length,'pNvN');
@@ -488,6 +616,14 @@ void* noir_map_physical_memory(ULONG64 physical_address,size_t length)
 	return MmMapIoSpace(pa,length,MmCached);
 }
 
+// Memory-mapped devices (e.g.: Local APIC) must be mapped as uncached.
+void* noir_map_uncached_memory(ULONG64 physical_address,size_t length)
+{
+	PHYSICAL_ADDRESS pa;
+	pa.QuadPart=physical_address;
+	return MmMapIoSpace(pa,length,MmNonCached);
+}
+
 void noir_unmap_physical_memory(void* virtual_address,size_t length)
 {
 	MmUnmapIoSpace(virtual_address,length);
@@ -535,13 +671,36 @@ void* noir_alloc_2mb_page()
 	PHYSICAL_ADDRESS H={0xFFFFFFFFFFFFFFFF};
 	PHYSICAL_ADDRESS B={0x200000};
 	PVOID p=MmAllocateContiguousMemorySpecifyCache(0x200000,L,H,B,MmCached);
-	if(p)RtlZeroMemory(p,0x200000);
+	if(p)
+	{
+		RtlZeroMemory(p,0x200000);
+		InterlockedIncrement(&NoirAllocatedContiguousMemoryCount);
+	}
+	return p;
+}
+
+void* noir_alloc_2mb_page_on_node(ULONG32 node)
+{
+#if defined(_WINNT5)
+	return NULL;
+#else
+	PHYSICAL_ADDRESS L={0};
+	PHYSICAL_ADDRESS H={0xFFFFFFFFFFFFFFFF};
+	PHYSICAL_ADDRESS B={0x200000};
+	PVOID p=MmAllocateContiguousMemorySpecifyCacheNode(0x200000,L,H,B,MmCached,(NODE_REQUIREMENT)node);
+	if(p)
+	{
+		RtlZeroMemory(p,0x200000);
+		InterlockedIncrement(&NoirAllocatedContiguousMemoryCount);
+	}
 	return p;
+#endif
 }
 
 void noir_free_2mb_page(void* virtual_address)
 {
 	MmFreeContiguousMemorySpecifyCache(virtual_address,0x200000,MmCached);
+	InterlockedDecrement(&NoirAllocatedContiguousMemoryCount);
 }
 
 ULONG64 noir_get_current_process_cr3()
@@ -656,4 +815,25 @@ void noir_release_reslock(IN PERESOURCE Resource)
 void noir_qsort(IN PVOID base,IN ULONG num,IN ULONG width,IN noir_sorting_comparator comparator)
 {
 	qsort(base,num,width,comparator);
+}
+
+// Non-Maskable Interrupt
+// The callback is invoked in the NMI handler of the system. Its prototype is identical to NMI_CALLBACK.
+PVOID noir_register_nmi_callback(IN PNMI_CALLBACK Callback,IN PVOID Context)
+{
+	return KeRegisterNmiCallback(Callback,Context);
+}
+
+void noir_unregister_nmi_callback(IN PVOID Handle)
+{
+	KeDeregisterNmiCallback(Handle);
+}
+
+// Timing
+ULONG64 noir_query_performance_counter(OUT PULONG64 Frequency OPTIONAL)
+{
+	LARGE_INTEGER Freq;
+	LARGE_INTEGER Counter=KeQueryPerformanceCounter(&Freq);
+	if(Frequency)*Frequency=Freq.QuadPart;
+	return Counter.QuadPart;
 }
\ No newline at end of file
@@ -15,7 +15,8 @@
 #include <ntifs.h>
 #include <windef.h>
 
-#define NOIR_DEBUG_LOG_RECORD_LIMIT		160
+#define NOIR_TRACE_RING_SIZE			1024	// Number of records per processor. Must be power of 2.
+#define NOIR_TRACE_ARGUMENT_LIMIT		6
 #define NOIR_DEBUG_PRINT_DELAY			2000
 
 typedef union _MEMORY_WORKING_SET_EX_BLOCK
@@ -63,21 +64,38 @@ typedef struct _NOIR_GPR_STATE
 	ULONG64 Rip;
 }NOIR_GPR_STATE,*PNOIR_GPR_STATE;
 
-typedef struct _NOIR_DEBUG_LOG_RECORD
+// The address of the format string serves as the format-ID.
+// Arguments are saved without formatting. They are decoded by the consumer.
+typedef struct _NOIR_TRACE_RECORD
 {
-	LARGE_INTEGER LogTime;
+	LONG64 volatile Sequence;		// Set to index+1 when the record is published.
+	ULONG64 Timestamp;
+	PCSTR Format;
 	ULONG32 Level;
-	CHAR Message[436];
-}NOIR_DEBUG_LOG_RECORD,*PNOIR_DEBUG_LOG_RECORD;
+	ULONG32 ArgumentCount;
+	ULONG64 Arguments[NOIR_TRACE_ARGUMENT_LIMIT];
+}NOIR_TRACE_RECORD,*PNOIR_TRACE_RECORD;
 
-typedef struct _NOIR_ASYNC_DEBUG_LOG_MONITOR
+// Each processor produces records to its own ring.
+// Records are only consumed by the logger thread.
+typedef struct _NOIR_TRACE_RING
 {
-	ULONG32 ProcessorId;
-	ULONG32 RecordCount;
+	LONG64 volatile Head;
+	LONG64 volatile Tail;
+	LONG64 volatile Dropped;
+	LONG64 volatile Rejected;		// Records whose format string does not take 64-bit arguments only.
+	LONG64 Reported;				// Number of dropped records already reported by the consumer.
+	LONG64 ReportedRejected;
+	PNOIR_TRACE_RECORD Records;
+}NOIR_TRACE_RING,*PNOIR_TRACE_RING;
+
+typedef struct _NOIR_ASYNC_TRACE_MONITOR
+{
+	ULONG32 NumberOfRings;
 	LONG32 volatile TerminationSignal;
 	HANDLE ThreadHandle;
-	PNOIR_DEBUG_LOG_RECORD LogInfo;
-}NOIR_ASYNC_DEBUG_LOG_MONITOR,*PNOIR_ASYNC_DEBUG_LOG_MONITOR;
+	PNOIR_TRACE_RING Rings;
+}NOIR_ASYNC_TRACE_MONITOR,*PNOIR_ASYNC_TRACE_MONITOR;
 
 typedef void(*noir_broadcast_worker)(void* context,ULONG ProcessorNumber);
 typedef LONG(__cdecl *noir_sorting_comparator)(const void* a,const void*b);
@@ -91,7 +109,7 @@ BYTE NoirGetInstructionLength32(PBYTE Code,SIZE_T CodeLength);
 BYTE NoirGetInstructionLength64(PBYTE Code,SIZE_T CodeLength);
 NTSTATUS NoirGetPageInformation(IN PVOID PageAddress,OUT PMEMORY_WORKING_SET_EX_BLOCK Information);
 
-PNOIR_ASYNC_DEBUG_LOG_MONITOR NoirAsyncDebugLogger=NULL;
+NOIR_ASYNC_TRACE_MONITOR NoirAsyncTracer={0};
 
 // Simple Memory Introspection Counters
 LONG volatile NoirAllocatedNonPagedPools=0;
@@ -186,6 +186,8 @@ NTSTATUS NoirQueryEnabledFeaturesInSystem(OUT PULONG64 Features)
 	ULONG32 StealthMsrHook=0;		// Disable Stealth MSR Hook at default.
 	ULONG32 StealthInlineHook=0;	// Disable Stealth Inline Hook at default.
 	ULONG32 NestedVirtualization=0;	// Disable Nested Virtualization at default
+	ULONG32 ExitProfiling=0;		// Disable Exit Profiling at default.
+	ULONG32 ExitTracing=0;			// Disable Exit Tracing at default.
 	BOOLEAN KvaShadowPresence=0;
 	// Initialize.
 	NTSTATUS st=STATUS_INSUFFICIENT_RESOURCES;
@@ -221,6 +223,16 @@ NTSTATUS NoirQueryEnabledFeaturesInSystem(OUT PULONG64 Features)
 			st=ZwQueryValueKey(hKey,&uniKvName,KeyValuePartialInformation,KvPartInf,PAGE_SIZE,&RetLen);
 			if(NT_SUCCESS(st))NestedVirtualization=*(PULONG32)KvPartInf->Data;
 			NoirDebugPrint("Nested Virtualization is %s!\n",NestedVirtualization?"enabled":"disabled");
+			// Detect if Exit Profiling is enabled.
+			RtlInitUnicodeString(&uniKvName,L"ExitProfiling");
+			st=ZwQueryValueKey(hKey,&uniKvName,KeyValuePartialInformation,KvPartInf,PAGE_SIZE,&RetLen);
+			if(NT_SUCCESS(st))ExitProfiling=*(PULONG32)KvPartInf->Data;
+			NoirDebugPrint("Exit Profiling is %s!\n",ExitProfiling?"enabled":"disabled");
+			// Detect if Exit Tracing is enabled.
+			RtlInitUnicodeString(&uniKvName,L"ExitTracing");
+			st=ZwQueryValueKey(hKey,&uniKvName,KeyValuePartialInformation,KvPartInf,PAGE_SIZE,&RetLen);
+			if(NT_SUCCESS(st))ExitTracing=*(PULONG32)KvPartInf->Data;
+			NoirDebugPrint("Exit Tracing is %s!\n",ExitTracing?"enabled":"disabled");
 			KvaShadowPresence=NoirDetectKvaShadow();
 			// Close the registry key handle.
 			ZwClose(hKey);
@@ -233,6 +245,8 @@ NTSTATUS NoirQueryEnabledFeaturesInSystem(OUT PULONG64 Features)
 	*Features|=(StealthInlineHook!=0)<<NOIR_HVM_FEATURE_STEALTH_INLINE_HOOK_BIT;
 	*Features|=(NestedVirtualization!=0)<<NOIR_HVM_FEATURE_NESTED_VIRTUALIZATION_BIT;
 	*Features|=KvaShadowPresence<<NOIR_HVM_FEATURE_KVA_SHADOW_PRESENCE_BIT;
+	*Features|=(ExitProfiling!=0)<<NOIR_HVM_FEATURE_EXIT_PROFILING_BIT;
+	*Features|=(ExitTracing!=0)<<NOIR_HVM_FEATURE_EXIT_TRACING_BIT;
 	return st;
 }
 
@@ -338,6 +352,21 @@ BOOLEAN NoirIsVirtualizationEnabled()
 	return noir_is_virtualization_enabled();
 }
 
+ULONG NoirQueryExitHistogram(IN ULONG ProcessorNumber,OUT PVOID Buffer,IN ULONG BufferSize)
+{
+	return nvc_query_exit_histogram(ProcessorNumber,Buffer,BufferSize);
+}
+
+ULONG NoirResetExitHistograms()
+{
+	return nvc_reset_exit_histograms();
+}
+
+ULONG NoirQueryExitTrace(IN ULONG ProcessorNumber,OUT PVOID Buffer,IN ULONG BufferSize)
+{
+	return nvc_query_exit_trace(ProcessorNumber,Buffer,BufferSize);
+}
+
 void NoirSaveImageInfo(IN PDRIVER_OBJECT DriverObject)
 {
 	if(DriverObject)
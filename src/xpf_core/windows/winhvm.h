@@ -30,12 +30,16 @@
 #define NOIR_HVM_FEATURE_CPUID_PRESENCE			0x04
 #define NOIR_HVM_FEATURE_NESTED_VIRTUALIZATION	0x10
 #define NOIR_HVM_FEATURE_KVA_SHADOW_PRESENCE	0x20
+#define NOIR_HVM_FEATURE_EXIT_PROFILING			0x40
+#define NOIR_HVM_FEATURE_EXIT_TRACING			0x80
 
 #define NOIR_HVM_FEATURE_STEALTH_MSR_HOOK_BIT		0
 #define NOIR_HVM_FEATURE_STEALTH_INLINE_HOOK_BIT	1
 #define NOIR_HVM_FEATURE_CPUID_PRESENCE_BIT			2
 #define NOIR_HVM_FEATURE_NESTED_VIRTUALIZATION_BIT	4
 #define NOIR_HVM_FEATURE_KVA_SHADOW_PRESENCE_BIT	5
+#define NOIR_HVM_FEATURE_EXIT_PROFILING_BIT			6
+#define NOIR_HVM_FEATURE_EXIT_TRACING_BIT			7
 
 typedef union _HV_MSR_PROPRIETARY_GUEST_OS_ID
 {
@@ -126,6 +130,9 @@ void noir_get_vendor_string(char* vendor_string);
 void noir_get_processor_name(char* processor_name);
 ULONG noir_get_virtualization_supportability();
 BOOLEAN noir_is_virtualization_enabled();
+ULONG nvc_query_exit_histogram(ULONG processor,PVOID buffer,ULONG size);
+ULONG nvc_reset_exit_histograms();
+ULONG nvc_query_exit_trace(ULONG processor,PVOID buffer,ULONG size);
 BOOLEAN noir_initialize_ci(PVOID section,ULONG size,BOOLEAN soft_ci,BOOLEAN hard_ci);
 void noir_finalize_ci();
 